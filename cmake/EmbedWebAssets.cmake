@@ -0,0 +1,47 @@
+# Generates a C++ source file that contains the web assets of welle-cli,
+# see src/welle-cli/webassets.h
+#
+# Usage: cmake -DINPUT_DIR=<dir> -DFILES="index.html index.js"
+#              [-DGZIP_DIR=<dir containing the .gz variants>]
+#              -DOUTPUT=<file.cpp> -P EmbedWebAssets.cmake
+
+separate_arguments(FILES)
+
+# Convert a file into a comma-separated list of bytes, 16 per line
+function(file_to_array filename result)
+    file(READ ${filename} hex HEX)
+    string(REGEX REPLACE "([0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f])" "\\1\n    " hex "${hex}")
+    string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," hex "${hex}")
+    set(${result} "    ${hex}" PARENT_SCOPE)
+endfunction()
+
+set(content "// Generated by cmake/EmbedWebAssets.cmake, do not edit\n\n")
+set(content "${content}#include \"welle-cli/webassets.h\"\n\n")
+set(table "")
+
+set(index 0)
+foreach(f ${FILES})
+    file_to_array(${INPUT_DIR}/${f} bytes)
+    set(content "${content}static const uint8_t asset_${index}[] = {\n${bytes}\n};\n\n")
+
+    if(GZIP_DIR AND EXISTS ${GZIP_DIR}/${f}.gz)
+        file_to_array(${GZIP_DIR}/${f}.gz gzbytes)
+        set(content "${content}static const uint8_t asset_${index}_gz[] = {\n${gzbytes}\n};\n\n")
+        set(table "${table}    { \"${f}\", asset_${index}, sizeof(asset_${index}), asset_${index}_gz, sizeof(asset_${index}_gz) },\n")
+    else()
+        set(table "${table}    { \"${f}\", asset_${index}, sizeof(asset_${index}), nullptr, 0 },\n")
+    endif()
+
+    math(EXPR index "${index} + 1")
+endforeach()
+
+set(content "${content}const WebAsset web_assets[] = {\n${table}    { nullptr, nullptr, 0, nullptr, 0 }\n};\n")
+
+# Only touch the output if it changed, to avoid needless rebuilds
+if(EXISTS ${OUTPUT})
+    file(READ ${OUTPUT} previous)
+endif()
+
+if(NOT "${previous}" STREQUAL "${content}")
+    file(WRITE ${OUTPUT} "${content}")
+endif()
@@ -0,0 +1,14 @@
+# - Try to find Opus
+# Once done this will define
+#
+# OPUS_FOUND - system has libopus
+# OPUS_INCLUDE_DIRS - the libopus include directory
+# OPUS_LIBRARIES - The libopus libraries
+
+find_path(OPUS_INCLUDE_DIRS opus/opus.h)
+find_library(OPUS_LIBRARIES opus)
+
+include(FindPackageHandleStandardArgs)
+find_package_handle_standard_args(Opus DEFAULT_MSG OPUS_INCLUDE_DIRS OPUS_LIBRARIES)
+
+mark_as_advanced(OPUS_INCLUDE_DIRS OPUS_LIBRARIES)
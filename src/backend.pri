@@ -86,6 +86,9 @@ INCLUDEPATH += \
     $$PWD/libs/fec
 
 HEADERS += \
+    $$PWD/backend/audio-frame.h \
+    $$PWD/backend/audio-postprocessor.h \
+    $$PWD/backend/band-scanner.h \
     $$PWD/backend/dab-audio.h \
     $$PWD/backend/dab_decoder.h \
     $$PWD/backend/dabplus_decoder.h \
@@ -97,7 +100,12 @@ HEADERS += \
     $$PWD/backend/mot_manager.h \
     $$PWD/backend/pad_decoder.h \
     $$PWD/backend/eep-protection.h \
+    $$PWD/backend/ensemble.h \
+    $$PWD/backend/ensemble-cache.h \
     $$PWD/backend/energy_dispersal.h \
+    $$PWD/backend/eti.h \
+    $$PWD/backend/eti-reader.h \
+    $$PWD/backend/eti-writer.h \
     $$PWD/backend/fib-processor.h \
     $$PWD/backend/fic-handler.h \
     $$PWD/backend/msc-handler.h \
@@ -106,7 +114,9 @@ HEADERS += \
     $$PWD/backend/ofdm-processor.h \
     $$PWD/backend/phasereference.h \
     $$PWD/backend/phasetable.h \
+    $$PWD/backend/spectrum-service.h \
     $$PWD/backend/tii-decoder.h \
+    $$PWD/backend/time-deinterleaver.h \
     $$PWD/backend/protTables.h \
     $$PWD/backend/protection.h \
     $$PWD/backend/radio-controller.h \
@@ -121,6 +131,7 @@ HEADERS += \
     $$PWD/various/wavfile.h \
     $$PWD/various/Socket.h \
     $$PWD/various/MathHelper.h \
+    $$PWD/various/metrics.h \
     $$PWD/various/fft.h \
     $$PWD/various/ringbuffer.h \
     $$PWD/various/Xtan2.h \
@@ -142,6 +153,9 @@ HEADERS += \
     $$PWD/input/rtl_tcp.h
 	
 SOURCES += \
+    $$PWD/backend/audio-frame.cpp \
+    $$PWD/backend/audio-postprocessor.cpp \
+    $$PWD/backend/band-scanner.cpp \
     $$PWD/backend/dab-audio.cpp \
     $$PWD/backend/dab_decoder.cpp \
     $$PWD/backend/dabplus_decoder.cpp \
@@ -150,6 +164,11 @@ SOURCES += \
     $$PWD/backend/mot_manager.cpp \
     $$PWD/backend/pad_decoder.cpp \
     $$PWD/backend/eep-protection.cpp \
+    $$PWD/backend/ensemble.cpp \
+    $$PWD/backend/ensemble-cache.cpp \
+    $$PWD/backend/eti.cpp \
+    $$PWD/backend/eti-reader.cpp \
+    $$PWD/backend/eti-writer.cpp \
     $$PWD/backend/fib-processor.cpp \
     $$PWD/backend/fic-handler.cpp \
     $$PWD/backend/msc-handler.cpp \
@@ -158,8 +177,11 @@ SOURCES += \
     $$PWD/backend/ofdm-processor.cpp \
     $$PWD/backend/phasereference.cpp \
     $$PWD/backend/phasetable.cpp \
+    $$PWD/backend/spectrum-service.cpp \
     $$PWD/backend/tii-decoder.cpp \
+    $$PWD/backend/time-deinterleaver.cpp \
     $$PWD/backend/protTables.cpp \
+    $$PWD/backend/protection.cpp \
     $$PWD/backend/radio-receiver.cpp \
     $$PWD/backend/tools.cpp \
     $$PWD/backend/uep-protection.cpp \
@@ -167,6 +189,7 @@ SOURCES += \
     $$PWD/various/Xtan2.cpp \
     $$PWD/various/channels.cpp \
     $$PWD/various/fft.cpp \
+    $$PWD/various/metrics.cpp \
     $$PWD/various/wavfile.c \
     $$PWD/various/Socket.cpp \
     $$PWD/libs/fec/encode_rs_char.c \
@@ -0,0 +1,191 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include "audio-frame.h"
+
+using namespace std;
+
+AudioFramePool::AudioFramePool() :
+    free_list(make_shared<free_list_t>())
+{
+    // So that releasing a frame never allocates
+    free_list->frames.reserve(max_pooled);
+    free_list->blocks.reserve(max_pooled);
+}
+
+AudioFramePool::free_list_t::~free_list_t()
+{
+    for (void *block : blocks) {
+        ::operator delete(block);
+    }
+}
+
+shared_ptr<audio_frame_t> AudioFramePool::acquire()
+{
+    unique_ptr<audio_frame_t> frame;
+    {
+        lock_guard<mutex> lock(free_list->mutex);
+        if (not free_list->frames.empty()) {
+            frame = move(free_list->frames.back());
+            free_list->frames.pop_back();
+        }
+    }
+
+    if (not frame) {
+        frame = make_unique<audio_frame_t>();
+    }
+
+    // The control block and the holder are allocated together, in a
+    // block that is recycled like the frame. The returned pointer shares
+    // the ownership of the holder.
+    auto holder = allocate_shared<Holder>(
+            BlockAllocator<Holder>(free_list), free_list, move(frame));
+    audio_frame_t *f = holder->frame.get();
+    return shared_ptr<audio_frame_t>(holder, f);
+}
+
+AudioFramePool::Holder::Holder(shared_ptr<free_list_t> free_list,
+        unique_ptr<audio_frame_t>&& frame) :
+    free_list(move(free_list)),
+    frame(move(frame))
+{
+}
+
+AudioFramePool::Holder::~Holder()
+{
+    lock_guard<mutex> lock(free_list->mutex);
+    if (free_list->frames.size() < max_pooled) {
+        free_list->frames.push_back(move(frame));
+    }
+}
+
+void *AudioFramePool::allocate_block(free_list_t& fl, size_t size)
+{
+    {
+        lock_guard<mutex> lock(fl.mutex);
+        if (fl.block_size == 0) {
+            fl.block_size = size;
+        }
+
+        if (size == fl.block_size and not fl.blocks.empty()) {
+            void *block = fl.blocks.back();
+            fl.blocks.pop_back();
+            return block;
+        }
+    }
+    return ::operator new(size);
+}
+
+void AudioFramePool::deallocate_block(free_list_t& fl, void *block, size_t size)
+{
+    {
+        lock_guard<mutex> lock(fl.mutex);
+        if (size == fl.block_size and fl.blocks.size() < max_pooled) {
+            fl.blocks.push_back(block);
+            return;
+        }
+    }
+    ::operator delete(block);
+}
+
+static inline int16_t float_to_s16(float s)
+{
+    s *= 32768.0f;
+    s = min(max(s, -32768.0f), 32767.0f);
+    return (int16_t)lrintf(s);
+}
+
+template<int channels, bool float32>
+static inline int read_sample(const uint8_t *data, size_t i)
+{
+    if (float32) {
+        float f;
+        memcpy(&f, data + i * sizeof(float), sizeof(float));
+        return float_to_s16(f);
+    }
+    else {
+        return (int16_t)(data[2*i+1] << 8 | data[2*i]);
+    }
+}
+
+// One pass over the samples for conversion, up-mix and metering. The
+// format is a template parameter so that the loop has no branches and
+// can be vectorised by the compiler. The levels are computed on int to
+// avoid overflows with -32768.
+template<int channels, bool float32>
+static void convert_pcm_loop(const uint8_t *data, size_t num_frames,
+        audio_frame_t& frame)
+{
+    int16_t *out = frame.samples.data();
+
+    int peak_L = 0;
+    int peak_R = 0;
+    int64_t energy_L = 0;
+    int64_t energy_R = 0;
+
+    for (size_t i = 0; i < num_frames; i++) {
+        const int L = read_sample<channels, float32>(data, i * channels);
+        const int R = channels == 2 ? read_sample<channels, float32>(data, i * channels + 1) : L;
+
+        out[2*i] = L;
+        out[2*i+1] = R;
+
+        peak_L = max(peak_L, abs(L));
+        peak_R = max(peak_R, abs(R));
+        energy_L += L * L;
+        energy_R += R * R;
+    }
+
+    frame.peak_L = min(peak_L, 32767);
+    frame.peak_R = min(peak_R, 32767);
+    frame.rms_L = num_frames ? sqrtf((float)energy_L / num_frames) : 0.0f;
+    frame.rms_R = num_frames ? sqrtf((float)energy_R / num_frames) : 0.0f;
+}
+
+void convert_pcm(const uint8_t *data, size_t len, int channels, bool float32,
+        audio_frame_t& frame)
+{
+    const size_t bytes_per_sample = float32 ? sizeof(float) : sizeof(int16_t);
+    const size_t num_samples = len / bytes_per_sample;
+    const size_t num_frames = channels == 2 ? num_samples / 2 : num_samples;
+
+    // Does not reallocate once the vector has reached its usual size
+    frame.samples.resize(num_frames * audio_frame_t::channels);
+
+    if (channels == 2) {
+        if (float32) {
+            convert_pcm_loop<2, true>(data, num_frames, frame);
+        }
+        else {
+            convert_pcm_loop<2, false>(data, num_frames, frame);
+        }
+    }
+    else {
+        if (float32) {
+            convert_pcm_loop<1, true>(data, num_frames, frame);
+        }
+        else {
+            convert_pcm_loop<1, false>(data, num_frames, frame);
+        }
+    }
+}
@@ -0,0 +1,152 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/* A block of decoded audio, as delivered to the ProgrammeHandlerInterface.
+ * The samples are always interleaved stereo int16, mono programmes are
+ * up-mixed by the decoder. The levels are measured while converting, so
+ * that consumers do not need to scan the samples again.
+ *
+ * Frames are handed out by an AudioFramePool and shared read-only; they
+ * are reused once the last reference to them is dropped. A consumer that
+ * needs the samples beyond the callback may keep the pointer, but should
+ * not hold on to many of them. */
+struct audio_frame_t {
+    static constexpr int channels = 2;
+
+    int sample_rate = 0;
+    std::vector<int16_t> samples;
+
+    // Peak absolute sample value and RMS, both in the range 0 to 32767
+    int16_t peak_L = 0;
+    int16_t peak_R = 0;
+    float rms_L = 0.0f;
+    float rms_R = 0.0f;
+
+    // Only set if the AudioPostProcessor measures the loudness: EBU R128
+    // momentary and short-term loudness in LUFS, measured before the
+    // normalisation, and the gain applied by the normalisation.
+    float loudness_momentary = -std::numeric_limits<float>::infinity();
+    float loudness_short_term = -std::numeric_limits<float>::infinity();
+    float gain_dB = 0.0f;
+
+    size_t num_frames(void) const { return samples.size() / channels; }
+
+    void resetLevels(void) {
+        peak_L = peak_R = 0;
+        rms_L = rms_R = 0.0f;
+        loudness_momentary = -std::numeric_limits<float>::infinity();
+        loudness_short_term = -std::numeric_limits<float>::infinity();
+        gain_dB = 0.0f;
+    }
+};
+
+using audio_frame_ptr = std::shared_ptr<const audio_frame_t>;
+
+class AudioFramePool {
+    public:
+        AudioFramePool();
+
+        /* Returns a frame that is not referenced anywhere else, with an
+         * undefined content. When the last reference to it is dropped, in
+         * whatever thread, the frame goes back to the pool. New frames are
+         * only allocated if all pooled ones are in use. The frames may
+         * outlive the pool. */
+        std::shared_ptr<audio_frame_t> acquire(void);
+
+    private:
+        // The free list is shared with the frames handed out. Its mutex
+        // orders the last reads of a consumer before the writes of the
+        // decoder that reuses the frame. Besides the frames, it keeps the
+        // memory of the shared_ptr control blocks, which all have the
+        // same size.
+        struct free_list_t {
+            std::mutex mutex;
+            std::vector<std::unique_ptr<audio_frame_t> > frames;
+            size_t block_size = 0;
+            std::vector<void*> blocks;
+
+            ~free_list_t();
+        };
+
+        // Owns a frame while it is handed out, and gives it back to the
+        // free list when the last reference to it is dropped
+        struct Holder {
+            std::shared_ptr<free_list_t> free_list;
+            std::unique_ptr<audio_frame_t> frame;
+
+            Holder(std::shared_ptr<free_list_t> free_list,
+                    std::unique_ptr<audio_frame_t>&& frame);
+            ~Holder();
+        };
+
+        // Used by allocate_shared to take the control blocks from the
+        // free list
+        template<typename T>
+        struct BlockAllocator {
+            using value_type = T;
+
+            std::shared_ptr<free_list_t> free_list;
+
+            explicit BlockAllocator(const std::shared_ptr<free_list_t>& fl) :
+                free_list(fl) {}
+            template<typename U>
+            BlockAllocator(const BlockAllocator<U>& other) :
+                free_list(other.free_list) {}
+
+            T *allocate(size_t n) {
+                return static_cast<T*>(allocate_block(*free_list, n * sizeof(T)));
+            }
+
+            void deallocate(T *p, size_t n) {
+                deallocate_block(*free_list, p, n * sizeof(T));
+            }
+
+            template<typename U>
+            bool operator==(const BlockAllocator<U>& other) const {
+                return free_list == other.free_list;
+            }
+            template<typename U>
+            bool operator!=(const BlockAllocator<U>& other) const {
+                return free_list != other.free_list;
+            }
+        };
+
+        static void *allocate_block(free_list_t& fl, size_t size);
+        static void deallocate_block(free_list_t& fl, void *block, size_t size);
+
+        // More frames than this are not kept in the free list
+        static constexpr size_t max_pooled = 8;
+        std::shared_ptr<free_list_t> free_list;
+};
+
+/* Convert the decoder output in data (len bytes, little-endian int16 or
+ * native float32 samples, mono or stereo interleaved) into the frame,
+ * up-mixing to stereo and measuring the levels in the same pass. */
+void convert_pcm(const uint8_t *data, size_t len, int channels, bool float32,
+        audio_frame_t& frame);
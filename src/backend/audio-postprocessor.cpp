@@ -0,0 +1,379 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include "audio-postprocessor.h"
+
+using namespace std;
+
+bool audio_postprocessing_t::operator==(const audio_postprocessing_t& other) const
+{
+    return output_rate == other.output_rate and
+        measure_loudness == other.measure_loudness and
+        normalise == other.normalise and
+        target_lufs == other.target_lufs;
+}
+
+// Modified Bessel function of the first kind, order 0, for the Kaiser window
+static double bessel_i0(double x)
+{
+    double sum = 1.0;
+    double term = 1.0;
+    for (int k = 1; k < 50; k++) {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+        if (term < sum * 1e-12) {
+            break;
+        }
+    }
+    return sum;
+}
+
+static int gcd(int a, int b)
+{
+    while (b != 0) {
+        const int t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+bool Resampler::supportsOutputRate(int output_rate)
+{
+    if (output_rate <= 0) {
+        return false;
+    }
+
+    for (int input_rate : {16000, 24000, 32000, 48000}) {
+        if (output_rate / gcd(input_rate, output_rate) > max_interpolation) {
+            return false;
+        }
+    }
+    return true;
+}
+
+Resampler::Resampler(int input_rate, int output_rate)
+{
+    const int g = gcd(input_rate, output_rate);
+    interpolation = output_rate / g;
+    decimation = input_rate / g;
+
+    if (interpolation > max_interpolation) {
+        throw invalid_argument("Cannot resample from " + to_string(input_rate) +
+                " to " + to_string(output_rate) + " Hz");
+    }
+
+    // Low-pass prototype at the interpolated rate, cutting slightly below
+    // the lower of the two Nyquist frequencies. Windowed sinc, Kaiser
+    // window with beta = 8.
+    const int num_taps = interpolation * taps_per_phase;
+    const double cutoff = 0.5 * 0.95 / max(interpolation, decimation);
+    const double centre = (num_taps - 1) / 2.0;
+    const double beta = 8.0;
+
+    vector<double> h(num_taps);
+    for (int i = 0; i < num_taps; i++) {
+        const double t = i - centre;
+        const double sinc = t == 0.0 ? 1.0 :
+            sin(2 * M_PI * cutoff * t) / (2 * M_PI * cutoff * t);
+        const double r = t / centre;
+        const double window = bessel_i0(beta * sqrt(max(0.0, 1.0 - r * r))) / bessel_i0(beta);
+        h[i] = 2 * cutoff * sinc * window;
+    }
+
+    coefs.resize(num_taps);
+    for (int p = 0; p < interpolation; p++) {
+        // Normalise every phase to unit DC gain, which also compensates
+        // for the zeros inserted by the interpolation.
+        double sum = 0.0;
+        for (int k = 0; k < taps_per_phase; k++) {
+            sum += h[p + k * interpolation];
+        }
+
+        for (int k = 0; k < taps_per_phase; k++) {
+            coefs[p * taps_per_phase + (taps_per_phase - 1 - k)] =
+                h[p + k * interpolation] / sum;
+        }
+    }
+
+    for (auto& b : buffers) {
+        b.assign(taps_per_phase - 1, 0.0f);
+    }
+    position = (taps_per_phase - 1) * interpolation;
+}
+
+void Resampler::process(const float *in, size_t num_frames, vector<float>& out)
+{
+    const size_t history = taps_per_phase - 1;
+
+    for (int ch = 0; ch < 2; ch++) {
+        buffers[ch].resize(history + num_frames);
+        for (size_t i = 0; i < num_frames; i++) {
+            buffers[ch][history + i] = in[2 * i + ch];
+        }
+    }
+
+    const size_t end = (history + num_frames) * interpolation;
+    for (; position < end; position += decimation) {
+        const size_t index = position / interpolation;
+        const float *c = &coefs[(position % interpolation) * taps_per_phase];
+
+        float y[2];
+        for (int ch = 0; ch < 2; ch++) {
+            const float *x = &buffers[ch][index - history];
+
+            // Independent accumulators, so that the compiler can use
+            // vector instructions without changing the rounding.
+            float acc[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+            for (int k = 0; k < taps_per_phase; k += 4) {
+                acc[0] += c[k] * x[k];
+                acc[1] += c[k+1] * x[k+1];
+                acc[2] += c[k+2] * x[k+2];
+                acc[3] += c[k+3] * x[k+3];
+            }
+            y[ch] = (acc[0] + acc[1]) + (acc[2] + acc[3]);
+        }
+        out.push_back(y[0]);
+        out.push_back(y[1]);
+    }
+
+    // Keep the history for the next call
+    for (auto& b : buffers) {
+        copy(b.end() - history, b.end(), b.begin());
+        b.resize(history);
+    }
+    position -= num_frames * interpolation;
+}
+
+static constexpr size_t subblocks_short_term = 30; // 3s
+static constexpr size_t blocks_gated = 300; // 30s
+
+static float energy_to_lufs(double energy)
+{
+    if (energy <= 0.0) {
+        return -numeric_limits<float>::infinity();
+    }
+    return -0.691 + 10.0 * log10(energy);
+}
+
+LoudnessMeter::LoudnessMeter(int sample_rate) :
+    subblock_length(sample_rate / 10),
+    subblocks(subblocks_short_term),
+    blocks(blocks_gated)
+{
+    // K-weighting filter coefficients from BS.1770, recomputed for the
+    // sample rate as done in libebur128.
+    double f0 = 1681.974450955533;
+    const double G = 3.999843853973347;
+    double Q = 0.7071752369554196;
+
+    double K = tan(M_PI * f0 / sample_rate);
+    const double Vh = pow(10.0, G / 20.0);
+    const double Vb = pow(Vh, 0.4996667741545416);
+    double a0 = 1.0 + K / Q + K * K;
+
+    Biquad shelf;
+    shelf.b0 = (Vh + Vb * K / Q + K * K) / a0;
+    shelf.b1 = 2.0 * (K * K - Vh) / a0;
+    shelf.b2 = (Vh - Vb * K / Q + K * K) / a0;
+    shelf.a1 = 2.0 * (K * K - 1.0) / a0;
+    shelf.a2 = (1.0 - K / Q + K * K) / a0;
+
+    f0 = 38.13547087602444;
+    Q = 0.5003270373238773;
+    K = tan(M_PI * f0 / sample_rate);
+    a0 = 1.0 + K / Q + K * K;
+
+    Biquad hp;
+    hp.b0 = 1.0;
+    hp.b1 = -2.0;
+    hp.b2 = 1.0;
+    hp.a1 = 2.0 * (K * K - 1.0) / a0;
+    hp.a2 = (1.0 - K / Q + K * K) / a0;
+
+    for (int ch = 0; ch < 2; ch++) {
+        shelving[ch] = shelf;
+        highpass[ch] = hp;
+    }
+}
+
+void LoudnessMeter::process(const float *in, size_t num_frames)
+{
+    for (size_t i = 0; i < num_frames; i++) {
+        for (int ch = 0; ch < 2; ch++) {
+            const double y = highpass[ch].process(shelving[ch].process(in[2 * i + ch]));
+            subblock_energy += y * y;
+        }
+
+        if (++subblock_fill == subblock_length) {
+            subblocks[num_subblocks % subblocks.size()] = subblock_energy / subblock_length;
+            num_subblocks++;
+            subblock_fill = 0;
+            subblock_energy = 0.0;
+
+            if (num_subblocks >= 4) {
+                blocks[num_blocks % blocks.size()] = meanOfLastSubblocks(4);
+                num_blocks++;
+            }
+        }
+    }
+}
+
+double LoudnessMeter::meanOfLastSubblocks(size_t n) const
+{
+    double sum = 0.0;
+    for (size_t i = 1; i <= n; i++) {
+        sum += subblocks[(num_subblocks - i) % subblocks.size()];
+    }
+    return sum / n;
+}
+
+float LoudnessMeter::momentary() const
+{
+    if (num_subblocks < 4) {
+        return -numeric_limits<float>::infinity();
+    }
+    return energy_to_lufs(meanOfLastSubblocks(4));
+}
+
+float LoudnessMeter::shortTerm() const
+{
+    if (num_subblocks < subblocks_short_term) {
+        return -numeric_limits<float>::infinity();
+    }
+    return energy_to_lufs(meanOfLastSubblocks(subblocks_short_term));
+}
+
+float LoudnessMeter::gated() const
+{
+    const size_t n = min(num_blocks, blocks.size());
+
+    // Absolute gate at -70 LUFS, then relative gate 10 LU below the
+    // loudness of the blocks above the absolute gate.
+    const double absolute_gate = pow(10.0, (-70.0 + 0.691) / 10.0);
+
+    double sum = 0.0;
+    size_t count = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (blocks[i] > absolute_gate) {
+            sum += blocks[i];
+            count++;
+        }
+    }
+    if (count == 0) {
+        return -numeric_limits<float>::infinity();
+    }
+
+    const double relative_gate = sum / count * pow(10.0, -10.0 / 10.0);
+    sum = 0.0;
+    count = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (blocks[i] > absolute_gate and blocks[i] > relative_gate) {
+            sum += blocks[i];
+            count++;
+        }
+    }
+    return energy_to_lufs(sum / count);
+}
+
+// The normaliser changes the gain by at most this much per second, and
+// never more than max_gain_dB in either direction.
+static constexpr float gain_slew_dB_per_s = 2.0f;
+static constexpr float max_gain_dB = 20.0f;
+
+AudioPostProcessor::AudioPostProcessor(const audio_postprocessing_t& settings) :
+    settings(settings)
+{
+}
+
+void AudioPostProcessor::process(const audio_frame_t& in, audio_frame_t& out)
+{
+    if (in.sample_rate != input_rate) {
+        input_rate = in.sample_rate;
+        resampler.reset();
+        meter.reset();
+
+        if (settings.output_rate != 0 and settings.output_rate != input_rate) {
+            resampler = make_unique<Resampler>(input_rate, settings.output_rate);
+        }
+
+        if (settings.measure_loudness or settings.normalise) {
+            meter = make_unique<LoudnessMeter>(input_rate);
+        }
+    }
+
+    const size_t num_frames = in.num_frames();
+
+    samples.resize(in.samples.size());
+    for (size_t i = 0; i < in.samples.size(); i++) {
+        samples[i] = in.samples[i] * (1.0f / 32768.0f);
+    }
+
+    out.loudness_momentary = -numeric_limits<float>::infinity();
+    out.loudness_short_term = -numeric_limits<float>::infinity();
+    out.gain_dB = 0.0f;
+
+    if (meter) {
+        meter->process(samples.data(), num_frames);
+        out.loudness_momentary = meter->momentary();
+        out.loudness_short_term = meter->shortTerm();
+    }
+
+    if (settings.normalise and num_frames > 0) {
+        const float loudness = meter->gated();
+        const float previous_gain_dB = gain_dB;
+
+        if (isfinite(loudness)) {
+            const float desired = min(max(settings.target_lufs - loudness,
+                        -max_gain_dB), max_gain_dB);
+            const float max_step = gain_slew_dB_per_s * num_frames / input_rate;
+            gain_dB += min(max(desired - gain_dB, -max_step), max_step);
+        }
+
+        // Ramp over the frame to avoid steps
+        const float g0 = pow(10.0f, previous_gain_dB / 20.0f);
+        const float g1 = pow(10.0f, gain_dB / 20.0f);
+        const float dg = (g1 - g0) / num_frames;
+        for (size_t i = 0; i < num_frames; i++) {
+            const float g = g0 + dg * i;
+            samples[2 * i] *= g;
+            samples[2 * i + 1] *= g;
+        }
+        out.gain_dB = gain_dB;
+    }
+
+    const vector<float> *result = &samples;
+    if (resampler) {
+        resampled.clear();
+        resampler->process(samples.data(), num_frames, resampled);
+        result = &resampled;
+    }
+
+    out.sample_rate = resampler ? settings.output_rate : in.sample_rate;
+
+    // Convert back, also measuring the peak and RMS levels of the output
+    convert_pcm(reinterpret_cast<const uint8_t*>(result->data()),
+            result->size() * sizeof(float), audio_frame_t::channels, true, out);
+}
@@ -0,0 +1,156 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "audio-frame.h"
+
+/* Settings of the optional stage between the audio decoder and the
+ * ProgrammeHandlerInterface. It runs once per programme, all outputs of
+ * the programme get the processed audio. */
+struct audio_postprocessing_t {
+    // Resample to this rate. 0 keeps the rate of the decoder.
+    int output_rate = 0;
+
+    // Measure the loudness according to EBU R128
+    bool measure_loudness = false;
+
+    // Slowly adapt the gain so that the loudness approaches target_lufs.
+    // Implies measure_loudness.
+    bool normalise = false;
+    float target_lufs = -23.0f;
+
+    bool enabled(void) const {
+        return output_rate != 0 or measure_loudness or normalise; }
+
+    bool operator==(const audio_postprocessing_t& other) const;
+    bool operator!=(const audio_postprocessing_t& other) const {
+        return not (*this == other); }
+};
+
+/* Polyphase FIR resampler for the rational ratio between the two rates.
+ * Works on interleaved stereo floats. */
+class Resampler {
+    public:
+        Resampler(int input_rate, int output_rate);
+
+        // The polyphase table has taps_per_phase coefficients for each of
+        // the output_rate / gcd(input_rate, output_rate) phases. Returns
+        // false for output rates that would need more than max_interpolation
+        // phases for one of the rates a DAB or DAB+ decoder produces.
+        static bool supportsOutputRate(int output_rate);
+
+        static constexpr int max_interpolation = 480;
+
+        // Resample num_frames frames from in and append them to out
+        void process(const float *in, size_t num_frames, std::vector<float>& out);
+
+    private:
+        static constexpr int taps_per_phase = 32;
+
+        int interpolation;
+        int decimation;
+
+        // For every phase, taps_per_phase coefficients in reverse order,
+        // so that they are applied to consecutive input samples.
+        std::vector<float> coefs;
+
+        // Per channel, the last taps_per_phase-1 input samples followed
+        // by the current input.
+        std::vector<float> buffers[2];
+
+        // Position of the next output sample, in samples at the
+        // interpolated rate relative to the start of the buffers.
+        size_t position;
+};
+
+/* Loudness meter according to ITU-R BS.1770-4 and EBU R128, for
+ * interleaved stereo floats. All values are in LUFS, and are -inf
+ * until enough audio was measured, or for silence. */
+class LoudnessMeter {
+    public:
+        explicit LoudnessMeter(int sample_rate);
+
+        void process(const float *in, size_t num_frames);
+
+        // Over the last 400ms
+        float momentary(void) const;
+
+        // Over the last 3s
+        float shortTerm(void) const;
+
+        // Gated like the integrated loudness, but over the last 30s only,
+        // so that it follows changes of programme.
+        float gated(void) const;
+
+    private:
+        struct Biquad {
+            double b0 = 1, b1 = 0, b2 = 0, a1 = 0, a2 = 0;
+            double z1 = 0, z2 = 0;
+
+            double process(double x) {
+                const double y = b0 * x + z1;
+                z1 = b1 * x - a1 * y + z2;
+                z2 = b2 * x - a2 * y;
+                return y;
+            }
+        };
+
+        // K-weighting filters, per channel
+        Biquad shelving[2];
+        Biquad highpass[2];
+
+        // Energies of the last 100ms sub-blocks, and of the 400ms blocks
+        // that overlap by 75%, as ring buffers
+        size_t subblock_length;
+        size_t subblock_fill = 0;
+        double subblock_energy = 0.0;
+        std::vector<double> subblocks;
+        size_t num_subblocks = 0;
+        std::vector<double> blocks;
+        size_t num_blocks = 0;
+
+        double meanOfLastSubblocks(size_t n) const;
+};
+
+class AudioPostProcessor {
+    public:
+        explicit AudioPostProcessor(const audio_postprocessing_t& settings);
+
+        const audio_postprocessing_t& getSettings(void) const { return settings; }
+
+        // Process the frame in into out. out must be a different frame.
+        void process(const audio_frame_t& in, audio_frame_t& out);
+
+    private:
+        audio_postprocessing_t settings;
+
+        int input_rate = 0;
+        std::unique_ptr<Resampler> resampler;
+        std::unique_ptr<LoudnessMeter> meter;
+        float gain_dB = 0.0f;
+
+        std::vector<float> samples;
+        std::vector<float> resampled;
+};
@@ -0,0 +1,331 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <thread>
+#include "band-scanner.h"
+#include "spectrum-service.h"
+#include "various/channels.h"
+
+using namespace std;
+
+static chrono::milliseconds elapsed_since(chrono::steady_clock::time_point t)
+{
+    return chrono::duration_cast<chrono::milliseconds>(
+            chrono::steady_clock::now() - t);
+}
+
+static float to_dB(double ratio)
+{
+    return ratio > 0 ? 10.0 * log10(ratio) : -100.0f;
+}
+
+BandScanner::BandScanner(InputInterface& input,
+        RadioReceiverOptions rro,
+        BandScanSettings settings) :
+    input(input),
+    settings(settings),
+    params(1),
+    receiver(controller, input, rro)
+{ }
+
+vector<string> BandScanner::bandIIIChannels()
+{
+    // Band L follows Band III, starting with LA
+    vector<string> band;
+    Channels channels;
+    for (string c = Channels::firstChannel; not c.empty() and c != "LA";
+            c = channels.getNextChannel()) {
+        band.push_back(c);
+    }
+    return band;
+}
+
+vector<BandScanner::Result> BandScanner::scan(const vector<string>& channels,
+        function<void(const Result&)> onResult)
+{
+    cancelled = false;
+
+    vector<Result> results;
+    for (const auto& c : channels) {
+        if (cancelled) {
+            break;
+        }
+
+        results.push_back(scanChannel(c));
+        if (onResult) {
+            onResult(results.back());
+        }
+    }
+    return results;
+}
+
+void BandScanner::cancel()
+{
+    cancelled = true;
+}
+
+BandScanner::Result BandScanner::scanChannel(const string& channel)
+{
+    const auto start = chrono::steady_clock::now();
+
+    Result r;
+    r.channel = channel;
+    r.frequency = Channels().getFrequency(channel);
+    if (r.frequency == 0) {
+        return r;
+    }
+
+    const auto samples = capture(r.frequency);
+    r.probe = probe(samples, params);
+    r.probe_time = elapsed_since(start);
+
+    r.candidate = r.probe.num_samples > 0 and (
+            r.probe.null_dip_dB <= settings.null_dip_threshold_dB or
+            r.probe.occupancy_dB >= settings.occupancy_threshold_dB);
+
+    if (r.candidate and not cancelled) {
+        controller.reset();
+        receiver.restart(true);
+
+        const auto sync_start = chrono::steady_clock::now();
+        r.synced = controller.waitForSync(settings.sync_timeout, cancelled);
+        r.sync_time = elapsed_since(sync_start);
+
+        if (r.synced) {
+            const auto fic_start = chrono::steady_clock::now();
+            auto stable_since = fic_start;
+            uint32_t version = receiver.getEnsembleVersion();
+
+            while (not cancelled and elapsed_since(fic_start) < settings.fic_timeout) {
+                this_thread::sleep_for(chrono::milliseconds(50));
+
+                const uint32_t v = receiver.getEnsembleVersion();
+                if (v != version) {
+                    version = v;
+                    stable_since = chrono::steady_clock::now();
+                }
+                else if (elapsed_since(stable_since) >= settings.stable_duration) {
+                    const auto ensemble = receiver.getEnsemble();
+                    if (ensemble and ensemble->isComplete()) {
+                        break;
+                    }
+                }
+            }
+            r.fic_time = elapsed_since(fic_start);
+
+            r.ensemble = receiver.getEnsemble();
+            r.complete = r.ensemble and r.ensemble->isComplete();
+        }
+
+        receiver.stop();
+    }
+
+    r.total_time = elapsed_since(start);
+    return r;
+}
+
+vector<DSPCOMPLEX> BandScanner::capture(int frequency)
+{
+    const size_t num_settle = INPUT_RATE / 1000 * settings.settle_duration.count();
+    const size_t num_probe = INPUT_RATE / 1000 * settings.probe_duration.count();
+
+    input.setFrequency(frequency);
+    if (not input.restart()) {
+        return {};
+    }
+    input.reset();
+
+    // Give up if the input delivers nothing for much longer than the probe
+    const auto deadline = chrono::steady_clock::now() +
+        settings.settle_duration + 4 * settings.probe_duration;
+
+    vector<DSPCOMPLEX> samples(max(num_settle, num_probe));
+    size_t num_discarded = 0;
+    size_t num_read = 0;
+    while (num_read < num_probe) {
+        const int32_t available = input.getSamplesToRead();
+        if (available <= 0) {
+            if (not input.is_ok() or cancelled or
+                    chrono::steady_clock::now() > deadline) {
+                break;
+            }
+            this_thread::sleep_for(chrono::milliseconds(10));
+            continue;
+        }
+
+        if (num_discarded < num_settle) {
+            const size_t n = min((size_t)available, num_settle - num_discarded);
+            num_discarded += input.getSamples(samples.data(), n);
+        }
+        else {
+            const size_t n = min((size_t)available, num_probe - num_read);
+            num_read += input.getSamples(samples.data() + num_read, n);
+        }
+    }
+
+    samples.resize(num_read);
+    return samples;
+}
+
+BandScanner::Probe BandScanner::probe(const vector<DSPCOMPLEX>& samples,
+        const DABParams& params)
+{
+    Probe p;
+    p.num_samples = samples.size();
+
+    // The window is shorter than the null symbol, so that it fits entirely
+    // into it even if the frame timing is unknown.
+    const size_t window = params.T_null * 3 / 4;
+    if (samples.size() < 2 * window) {
+        return p;
+    }
+
+    vector<double> energy(samples.size() + 1);
+    energy[0] = 0.0;
+    for (size_t i = 0; i < samples.size(); i++) {
+        energy[i + 1] = energy[i] + norm(samples[i]);
+    }
+
+    // Look at every complete transmission frame separately. A DAB signal
+    // shows a dip in every one of them, while a burst of interference or an
+    // AGC step only affects some. The window starts at every sample of a
+    // frame, and may end in the next one, so that a null symbol across the
+    // boundary between two frames is found as well.
+    const size_t frame = params.T_F;
+    const bool complete = samples.size() >= frame + window;
+    const size_t num_frames = complete ? (samples.size() - window) / frame : 1;
+    const size_t frame_len = complete ? frame : samples.size();
+
+    float least_dip_dB = -100.0f;
+    for (size_t f = 0; f < num_frames; f++) {
+        const size_t begin = f * frame_len;
+        const size_t end = begin + frame_len;
+        const double mean = (energy[end] - energy[begin]) / frame_len;
+
+        double min_energy = energy[begin + window] - energy[begin];
+        for (size_t i = begin + 1; i < end and i + window <= samples.size(); i++) {
+            min_energy = min(min_energy, energy[i + window] - energy[i]);
+        }
+
+        least_dip_dB = max(least_dip_dB, to_dB(min_energy / window / mean));
+    }
+    p.null_dip_dB = least_dip_dB;
+
+    // Compare the spectrum within the ensemble bandwidth against the guard
+    // band between the ensemble and the lower edge of the adjacent channel,
+    // 1.712 MHz away, which a strong neighbour would otherwise raise. The
+    // bins around DC are skipped, some tuners have a spike there.
+    const int fft_size = 256;
+    const int hop = fft_size / 2;
+    const int num_segments = (samples.size() - fft_size) / hop + 1;
+    SpectrumService spectrum(fft_size, num_segments);
+    spectrum.feed(samples);
+    const auto s = spectrum.getSpectrum();
+    if (not s) {
+        return p;
+    }
+
+    const double bin_hz = (double)INPUT_RATE / fft_size;
+    const double half_bw = params.K / 2 * params.carrierDiff;
+    const double adjacent_edge = 1712000.0 - half_bw;
+    const double guard_start = half_bw + (adjacent_edge - half_bw) / 4;
+    const double guard_end = adjacent_edge - (adjacent_edge - half_bw) / 4;
+
+    double in_band = 0.0, guard = 0.0;
+    size_t num_in_band = 0, num_guard = 0;
+    for (int i = 0; i < fft_size; i++) {
+        const double f = fabs((i - fft_size / 2) * bin_hz);
+        const double power = s->bins[i] * s->bins[i];
+        if (f > 4 * bin_hz and f < half_bw * 0.9) {
+            in_band += power;
+            num_in_band++;
+        }
+        else if (f > guard_start and f < guard_end) {
+            guard += power;
+            num_guard++;
+        }
+    }
+
+    if (num_in_band > 0 and num_guard > 0 and guard > 0) {
+        p.occupancy_dB = to_dB((in_band / num_in_band) / (guard / num_guard));
+    }
+
+    return p;
+}
+
+void BandScanner::Controller::reset()
+{
+    lock_guard<mutex> lock(state_mutex);
+    synced = false;
+    noSignal = false;
+    inputFailed = false;
+}
+
+bool BandScanner::Controller::waitForSync(chrono::milliseconds timeout,
+        const atomic<bool>& cancelled)
+{
+    const auto deadline = chrono::steady_clock::now() + timeout;
+
+    // Wake up regularly to notice a cancellation
+    unique_lock<mutex> lock(state_mutex);
+    while (not synced and not noSignal and not inputFailed and not cancelled and
+            chrono::steady_clock::now() < deadline) {
+        cv.wait_for(lock, chrono::milliseconds(100));
+    }
+    return synced;
+}
+
+void BandScanner::Controller::onSyncChange(char isSync)
+{
+    {
+        lock_guard<mutex> lock(state_mutex);
+        synced = isSync;
+    }
+    cv.notify_all();
+}
+
+void BandScanner::Controller::onSignalPresence(bool isSignal)
+{
+    {
+        lock_guard<mutex> lock(state_mutex);
+        noSignal = not isSignal;
+    }
+    cv.notify_all();
+}
+
+void BandScanner::Controller::onInputFailure()
+{
+    {
+        lock_guard<mutex> lock(state_mutex);
+        inputFailed = true;
+    }
+    cv.notify_all();
+}
+
+void BandScanner::Controller::onMessage(message_level_t level,
+        const string& text, const string& text2)
+{
+    if (level == message_level_t::Error) {
+        clog << "BandScanner: " << text << text2 << endl;
+    }
+}
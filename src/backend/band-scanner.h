@@ -0,0 +1,178 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "dab-constants.h"
+#include "ensemble.h"
+#include "radio-controller.h"
+#include "radio-receiver.h"
+#include "radio-receiver-options.h"
+
+struct BandScanSettings {
+    // Duration of the IQ capture used to probe a channel. It should
+    // contain at least one full transmission frame.
+    std::chrono::milliseconds probe_duration = std::chrono::milliseconds(250);
+
+    // Samples discarded after tuning, to let the tuner settle
+    std::chrono::milliseconds settle_duration = std::chrono::milliseconds(20);
+
+    // A channel is a candidate if the power inside the null symbol is
+    // at least this much below the mean power, in every frame...
+    float null_dip_threshold_dB = -2.0f;
+
+    // ...or if the power within the ensemble bandwidth exceeds the
+    // power in the guard band by this much.
+    float occupancy_threshold_dB = 6.0f;
+
+    // Time given to the receiver to synchronise on a candidate
+    std::chrono::milliseconds sync_timeout = std::chrono::seconds(3);
+
+    // Maximum time spent decoding the FIC of a synchronised channel
+    std::chrono::milliseconds fic_timeout = std::chrono::seconds(10);
+
+    // The ensemble is complete once it has been consistent and
+    // unchanged for this long
+    std::chrono::milliseconds stable_duration = std::chrono::seconds(1);
+};
+
+/* The BandScanner looks for ensembles on a list of channels.
+ *
+ * Most channels of a band are empty, and waiting for the OFDM processor to
+ * give up on each of them makes a scan slow. Every channel is therefore
+ * first probed with a few hundred milliseconds of IQ samples. Only if the
+ * probe shows the null symbol of a DAB transmission frame, or a power
+ * spectrum that is clearly raised over the 1.536 MHz ensemble bandwidth,
+ * does the scanner start the receiver. It then stops as soon as the
+ * ensemble is complete, instead of waiting a fixed time.
+ *
+ * Scanning is blocking, and uses the input exclusively. */
+class BandScanner {
+    public:
+        struct Probe {
+            // Power of the quietest null-symbol-sized window relative to the
+            // mean power of its transmission frame, in dB. The least deep
+            // dip of all complete frames is kept.
+            float null_dip_dB = 0.0f;
+
+            // Power within the ensemble bandwidth relative to the power of
+            // the guard band, in dB
+            float occupancy_dB = 0.0f;
+
+            size_t num_samples = 0;
+        };
+
+        struct Result {
+            std::string channel;
+            int frequency = 0;
+
+            Probe probe;
+
+            // The probe found a possible ensemble, and the receiver was started
+            bool candidate = false;
+            bool synced = false;
+
+            // All services have a label and all components a subchannel
+            bool complete = false;
+
+            // nullptr if no FIC was decoded
+            ensemble_ptr ensemble;
+
+            std::chrono::milliseconds probe_time = std::chrono::milliseconds(0);
+            std::chrono::milliseconds sync_time = std::chrono::milliseconds(0);
+            std::chrono::milliseconds fic_time = std::chrono::milliseconds(0);
+            std::chrono::milliseconds total_time = std::chrono::milliseconds(0);
+        };
+
+        BandScanner(InputInterface& input,
+                RadioReceiverOptions rro,
+                BandScanSettings settings = BandScanSettings());
+        BandScanner(const BandScanner&) = delete;
+        BandScanner& operator=(const BandScanner&) = delete;
+
+        // The Band III channels, 5A to 13F
+        static std::vector<std::string> bandIIIChannels(void);
+
+        // Scan the channels in order, calling onResult after every channel
+        std::vector<Result> scan(const std::vector<std::string>& channels,
+                std::function<void(const Result&)> onResult = nullptr);
+
+        Result scanChannel(const std::string& channel);
+
+        // Abort a scan from another thread
+        void cancel(void);
+
+        // Measure the null symbol dip and the spectral occupancy of the given
+        // samples, which must have been received at INPUT_RATE.
+        static Probe probe(const std::vector<DSPCOMPLEX>& samples,
+                const DABParams& params);
+
+    private:
+        class Controller : public RadioControllerInterface {
+            public:
+                void reset(void);
+
+                // Wait until the receiver synchronised, gave up or the timeout
+                // expired. Returns true if synchronised.
+                bool waitForSync(std::chrono::milliseconds timeout,
+                        const std::atomic<bool>& cancelled);
+
+                virtual void onSNR(int /*snr*/) override {}
+                virtual void onFrequencyCorrectorChange(int /*fine*/, int /*coarse*/) override {}
+                virtual void onSyncChange(char isSync) override;
+                virtual void onSignalPresence(bool isSignal) override;
+                virtual void onServiceDetected(uint32_t /*sId*/) override {}
+                virtual void onNewEnsemble(uint16_t /*eId*/) override {}
+                virtual void onSetEnsembleLabel(DabLabel& /*label*/) override {}
+                virtual void onDateTimeUpdate(const dab_date_time_t& /*dateTime*/) override {}
+                virtual void onFIBDecodeSuccess(bool /*crcCheckOk*/, const uint8_t* /*fib*/) override {}
+                virtual void onNewImpulseResponse(std::vector<float>&& /*data*/) override {}
+                virtual void onConstellationPoints(std::vector<DSPCOMPLEX>&& /*data*/) override {}
+                virtual void onNewNullSymbol(std::vector<DSPCOMPLEX>&& /*data*/) override {}
+                virtual void onTIIMeasurement(tii_measurement_t&& /*m*/) override {}
+                virtual void onMessage(message_level_t level, const std::string& text,
+                        const std::string& text2 = std::string()) override;
+                virtual void onInputFailure(void) override;
+
+            private:
+                std::mutex state_mutex;
+                std::condition_variable cv;
+                bool synced = false;
+                bool noSignal = false;
+                bool inputFailed = false;
+        };
+
+        // Tune and read the probe. Returns fewer samples if the input fails.
+        std::vector<DSPCOMPLEX> capture(int frequency);
+
+        InputInterface& input;
+        const BandScanSettings settings;
+        DABParams params;
+        Controller controller;
+        RadioReceiver receiver;
+        std::atomic<bool> cancelled = ATOMIC_VAR_INIT(false);
+};
@@ -45,13 +45,30 @@
 //  fragmentsize == Length * CUSize
 DabAudio::DabAudio(
         AudioServiceComponentType dabModus,
+        int16_t subChId,
         int16_t fragmentSize,
         int16_t bitRate,
         ProtectionSettings protection,
         ProgrammeHandlerInterface& phi,
         const std::string& dumpFileName) :
     myProgrammeHandler(phi),
+    deinterleaver(fragmentSize),
     mscBuffer(64 * 32768),
+    mscBufferFill(metrics::registry().gauge("welle_msc_buffer_fill_bits",
+                "Number of soft bits waiting in the MSC buffer of the subchannel",
+                {{"subchannel", std::to_string(subChId)}})),
+    mscBufferOverruns(metrics::registry().counter("welle_msc_buffer_overruns_total",
+                "Number of times the MSC buffer of the subchannel was full",
+                {{"subchannel", std::to_string(subChId)}})),
+    bitCounter(metrics::registry().counter("welle_msc_viterbi_bits_total",
+                "Number of soft bits of the subchannel checked against the re-encoded Viterbi output",
+                {{"subchannel", std::to_string(subChId)}})),
+    bitErrorCounter(metrics::registry().counter("welle_msc_viterbi_bit_errors_total",
+                "Number of soft bits of the subchannel that differ from the re-encoded Viterbi output",
+                {{"subchannel", std::to_string(subChId)}})),
+    cifDuration(metrics::registry().histogram("welle_stage_duration_seconds",
+                "Processing time of the pipeline stages",
+                {{"stage", "msc"}, {"subchannel", std::to_string(subChId)}})),
     dumpFileName(dumpFileName)
 {
     this->dabModus         = dabModus;
@@ -59,9 +76,7 @@ DabAudio::DabAudio(
     this->bitRate          = bitRate;
 
     outV.resize(bitRate * 24);
-    for (int i = 0; i < 16; i ++) {
-        interleaveData[i].resize(fragmentSize);
-    }
+    reencoded.resize(fragmentSize);
 
     using std::make_unique;
 
@@ -76,7 +91,7 @@ DabAudio::DabAudio(
     }
 
     our_dabProcessor = make_unique<DecoderAdapter>(
-            myProgrammeHandler, bitRate, dabModus, dumpFileName);
+            myProgrammeHandler, subChId, bitRate, dabModus, dumpFileName);
 
     running = true;
     ourThread = std::thread(&DabAudio::run, this);
@@ -96,8 +111,10 @@ int32_t DabAudio::process(const softbit_t *v, int16_t cnt)
 {
     int32_t fr;
 
-    if (mscBuffer.GetRingBufferWriteAvailable () < cnt)
+    if (mscBuffer.GetRingBufferWriteAvailable () < cnt) {
         fprintf (stderr, "dab-concurrent: buffer full\n");
+        mscBufferOverruns.inc();
+    }
 
     while ((fr = mscBuffer.GetRingBufferWriteAvailable ()) <= cnt) {
         if (!running)
@@ -106,19 +123,14 @@ int32_t DabAudio::process(const softbit_t *v, int16_t cnt)
     }
 
     mscBuffer.putDataIntoBuffer(v, cnt);
+    mscBufferFill.set(mscBuffer.GetRingBufferReadAvailable());
     mscDataAvailable.notify_all();
     return fr;
 }
 
-const int16_t interleaveMap[] = {0,8,4,12,2,10,6,14,1,9,5,13,3,11,7,15};
-
 void DabAudio::run()
 {
-    int16_t i;
-    int16_t countforInterleaver = 0;
-    int16_t interleaverIndex    = 0;
-    std::vector<softbit_t> data(fragmentSize);
-    std::vector<softbit_t> tempX(fragmentSize);
+    std::vector<softbit_t> deinterleaved(fragmentSize);
 
     while (running) {
         std::unique_lock<std::mutex> lock(ourMutex);
@@ -132,24 +144,25 @@ void DabAudio::run()
         lock.unlock();
 
         PROFILE(DAGetMSCData);
-        mscBuffer.getDataFromBuffer(data.data(), fragmentSize);
+        mscBuffer.getDataFromBuffer(deinterleaver.nextCIF(), fragmentSize);
 
         PROFILE(DADeinterleave);
-        for (i = 0; i < fragmentSize; i ++) {
-            tempX[i] = interleaveData[(interleaverIndex +
-                    interleaveMap[i & 017]) & 017][i];
-            interleaveData[interleaverIndex][i] = data[i];
-        }
-        interleaverIndex = (interleaverIndex + 1) & 0x0F;
-
         //  only continue when de-interleaver is filled
-        if (countforInterleaver <= 15) {
-            countforInterleaver ++;
+        if (not deinterleaver.deinterleave(deinterleaved.data())) {
             continue;
         }
 
+        const auto cifStart = std::chrono::steady_clock::now();
+
         PROFILE(DADeconvolve);
-        protectionHandler->deconvolve(tempX.data(), fragmentSize, outV.data());
+        protectionHandler->deconvolve(deinterleaved.data(), fragmentSize, outV.data());
+
+        const auto bitErrors = countBitErrors(outV.data(), outV.size(),
+                protectionHandler->getPuncturing(), deinterleaved.data(),
+                reencoded.data());
+        bitCounter.inc(bitErrors.bits);
+        bitErrorCounter.inc(bitErrors.errors);
+        myProgrammeHandler.onBitErrors(bitErrors.errors, bitErrors.bits);
 
         PROFILE(DADispersal);
         // and the inline energy dispersal
@@ -160,6 +173,9 @@ void DabAudio::run()
             our_dabProcessor->addtoFrame(outV.data());
         }
         PROFILE(DADone);
+
+        cifDuration.observe(std::chrono::duration<double>(
+                    std::chrono::steady_clock::now() - cifStart).count());
     }
 }
 
@@ -35,7 +35,9 @@
 #include <cstdio>
 #include "ringbuffer.h"
 #include "energy_dispersal.h"
+#include "time-deinterleaver.h"
 #include "radio-controller.h"
+#include "metrics.h"
 
 class DabProcessor;
 class Protection;
@@ -44,6 +46,7 @@ class DabAudio : public DabVirtual
 {
     public:
         DabAudio(AudioServiceComponentType dabModus,
+                  int16_t subChId,
                   int16_t fragmentSize,
                   int16_t bitRate,
                   ProtectionSettings protection,
@@ -65,7 +68,8 @@ class DabAudio : public DabVirtual
         int16_t fragmentSize;
         int16_t bitRate;
         std::vector<uint8_t> outV;
-        std::vector<softbit_t> interleaveData[16];
+        std::vector<softbit_t> reencoded;
+        TimeDeinterleaver deinterleaver;
         EnergyDispersal energyDispersal;
 
         std::condition_variable  mscDataAvailable;
@@ -76,6 +80,12 @@ class DabAudio : public DabVirtual
         std::unique_ptr<DabProcessor> our_dabProcessor;
         RingBuffer<softbit_t> mscBuffer;
 
+        metrics::Gauge& mscBufferFill;
+        metrics::Counter& mscBufferOverruns;
+        metrics::Counter& bitCounter;
+        metrics::Counter& bitErrorCounter;
+        metrics::Histogram& cifDuration;
+
         const std::string dumpFileName;
 };
 
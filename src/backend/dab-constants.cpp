@@ -497,6 +497,19 @@ string Subchannel::protection() const
     return prot;
 }
 
+bool Subchannel::sameOrganisation(const Subchannel& other) const
+{
+    const auto& pa = protectionSettings;
+    const auto& pb = other.protectionSettings;
+    return subChId == other.subChId and
+        startAddr == other.startAddr and
+        length == other.length and
+        pa.shortForm == pb.shortForm and
+        (pa.shortForm ?
+         pa.uepTableIndex == pb.uepTableIndex :
+         pa.eepProfile == pb.eepProfile and pa.eepLevel == pb.eepLevel);
+}
+
 TransportMode ServiceComponent::transportMode() const
 {
     if (TMid == 0) {
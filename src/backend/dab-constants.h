@@ -194,6 +194,10 @@ struct Subchannel {
 
     std::string protection(void) const;
 
+    // True if both describe the same subchannel at the same position with
+    // the same protection, so that its decoder can keep running
+    bool sameOrganisation(const Subchannel& other) const;
+
     inline bool valid() const { return subChId != -1; }
 };
 
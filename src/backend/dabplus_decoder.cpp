@@ -18,6 +18,8 @@
 
 #include "dabplus_decoder.h"
 
+#include <map>
+
 
 // --- SuperframeFilter -----------------------------------------------------------------
 SuperframeFilter::SuperframeFilter(SubchannelSinkObserver* observer, bool decode_audio, bool enable_float32) : SubchannelSink(observer, "aac") {
@@ -28,7 +30,9 @@ SuperframeFilter::SuperframeFilter(SubchannelSinkObserver* observer, bool decode
 
 	frame_len = 0;
 	frame_count = 0;
+	frame_pos = 0;
 	sync_frames = 0;
+	synced = false;
 
 	sf_raw = nullptr;
 	sf = nullptr;
@@ -70,26 +74,39 @@ void SuperframeFilter::Feed(const uint8_t *data, size_t len) {
 		sf = new uint8_t[sf_len];
 	}
 
-	if(frame_count == 5) {
-		// shift previous frames
-		for(int i = 0; i < 4; i++)
-			memcpy(sf_raw + i * frame_len, sf_raw + (i + 1) * frame_len, frame_len);
-	} else {
+	// store frame into the circular buffer, replacing the oldest one
+	memcpy(sf_raw + frame_pos * frame_len, data, frame_len);
+	frame_pos = (frame_pos + 1) % 5;
+	if(frame_count < 5)
 		frame_count++;
-	}
-
-	// copy frame
-	memcpy(sf_raw + (frame_count - 1) * frame_len, data, frame_len);
 
 	if(frame_count < 5)
 		return;
 
+	// the oldest frame is the possible Superframe start
+	const uint8_t *sf_start = sf_raw + frame_pos * frame_len;
+
+	// While searching for sync, first check the Fire code on the raw data,
+	// before spending any RS decoding. As the raw data may be too corrupted
+	// for that, every sixth frame (i.e. with a different offset each time)
+	// is tried with RS decoding anyway.
+	if(!synced) {
+		if(!CheckSyncRaw(sf_start) && (sync_frames + 1) % 6) {
+			if(sync_frames == 0)
+				fprintf(stderr, "SuperframeFilter: Superframe sync started...\n");
+			sync_frames++;
+			return;
+		}
+	}
+
+	// linearise the Superframe
+	for(int i = 0; i < 5; i++)
+		memcpy(sf + i * frame_len, sf_raw + ((frame_pos + i) % 5) * frame_len, frame_len);
 
 	int total_corr_count;
 	bool uncorr_errors;
 
-	// append RS coding on copy
-	memcpy(sf, sf_raw, sf_len);
+	// append RS coding
 	rs_dec.DecodeSuperframe(sf, sf_len, total_corr_count, uncorr_errors);
 
 	// forward statistics if errors present
@@ -97,10 +114,12 @@ void SuperframeFilter::Feed(const uint8_t *data, size_t len) {
 		observer->FECInfo(total_corr_count, uncorr_errors);
 
 
-	if(!CheckSync()) {
+	// the Fire code may only be corrected, if a Superframe is expected here
+	if(!CheckSync(synced)) {
 		if(sync_frames == 0)
 			fprintf(stderr, "SuperframeFilter: Superframe sync started...\n");
 		sync_frames++;
+		synced = false;
 		return;
 	}
 
@@ -108,6 +127,7 @@ void SuperframeFilter::Feed(const uint8_t *data, size_t len) {
 		fprintf(stderr, "SuperframeFilter: Superframe sync succeeded after %d frame(s)\n", sync_frames);
 		sync_frames = 0;
 	}
+	synced = true;
 
 
 	// check announced format
@@ -118,6 +138,22 @@ void SuperframeFilter::Feed(const uint8_t *data, size_t len) {
 		ProcessFormat();
 	}
 
+	// create/release the AAC decoder, if audio decoding was switched on/off in the meantime
+	if(decode_audio) {
+		if(audio_decoding && !aac_dec) {
+#ifdef DABLIN_AAC_FAAD2
+			aac_dec = new AACDecoderFAAD2(observer, sf_format, enable_float32);
+#endif
+#ifdef DABLIN_AAC_FDKAAC
+			aac_dec = new AACDecoderFDKAAC(observer, sf_format);
+#endif
+		}
+		if(!audio_decoding && aac_dec) {
+			delete aac_dec;
+			aac_dec = nullptr;
+		}
+	}
+
 	// decode frames
 	for(int i = 0; i < num_aus; i++) {
 		uint8_t *au_data = sf + au_start[i];
@@ -139,6 +175,7 @@ void SuperframeFilter::Feed(const uint8_t *data, size_t len) {
 
 	// ensure getting a complete new Superframe
 	frame_count = 0;
+	frame_pos = 0;
 }
 
 
@@ -168,18 +205,76 @@ void SuperframeFilter::CheckForPAD(const uint8_t *data, size_t len) {
 }
 
 
-bool SuperframeFilter::CheckSync() {
-	// abort, if au_start is kind of zero (prevent sync on complete zero array)
-	if(sf[3] == 0x00 && sf[4] == 0x00)
+uint16_t SuperframeFilter::FireCodeSyndrome(const uint8_t *data) {
+	uint16_t crc_stored = data[0] << 8 | data[1];
+	uint16_t crc_calced = CalcCRC::CalcCRC_FIRE_CODE.Calc(data + 2, 9);
+	return crc_stored ^ crc_calced;
+}
+
+bool SuperframeFilter::CorrectFireCode(uint8_t *data) {
+	// The Fire code corrects single error bursts of up to 5 bits. As the code
+	// is linear, the syndrome of every such burst (anywhere in the 11 bytes)
+	// can be precomputed. Ambiguous syndromes are not used for correction.
+	struct Burst {
+		int byte;
+		uint16_t pattern;	// aligned to the byte, possibly extending into the next one
+		bool ambiguous;
+	};
+	static const std::map<uint16_t, Burst> bursts = [](){
+		std::map<uint16_t, Burst> result;
+		for(int bit = 0; bit < 11 * 8; bit++) {
+			for(int len = 1; len <= 5 && bit + len <= 11 * 8; len++) {
+				for(int middle = 0; middle < (len > 2 ? 1 << (len - 2) : 1); middle++) {
+					// bursts start and end with an error bit
+					uint16_t burst = len == 1 ? 1 : (1 << (len - 1)) | (middle << 1) | 1;
+
+					uint8_t error[12] = {0};
+					uint16_t pattern = burst << (16 - (bit % 8) - len);
+					error[bit / 8] = pattern >> 8;
+					error[bit / 8 + 1] = pattern & 0xFF;
+
+					auto it = result.find(FireCodeSyndrome(error));
+					if(it == result.end())
+						result[FireCodeSyndrome(error)] = Burst{bit / 8, pattern, false};
+					else
+						it->second.ambiguous = true;
+				}
+			}
+		}
+		return result;
+	}();
+
+	auto it = bursts.find(FireCodeSyndrome(data));
+	if(it == bursts.end() || it->second.ambiguous)
 		return false;
 
-	// TODO: use fire code for error correction
+	data[it->second.byte] ^= it->second.pattern >> 8;
+	if(it->second.byte + 1 < 11)
+		data[it->second.byte + 1] ^= it->second.pattern & 0xFF;
+	return true;
+}
+
+bool SuperframeFilter::CheckSyncRaw(const uint8_t *data) {
+	if(frame_len < 11)
+		return true;
 
-	// try to sync on fire code
-	uint16_t crc_stored = sf[0] << 8 | sf[1];
-	uint16_t crc_calced = CalcCRC::CalcCRC_FIRE_CODE.Calc(sf + 2, 9);
-	if(crc_stored != crc_calced)
+	// the same checks as in CheckSync, without correction
+	if(data[3] == 0x00 && data[4] == 0x00)
 		return false;
+	return FireCodeSyndrome(data) == 0;
+}
+
+bool SuperframeFilter::CheckSync(bool correct_fire_code) {
+	// abort, if au_start is kind of zero (prevent sync on complete zero array)
+	if(sf[3] == 0x00 && sf[4] == 0x00)
+		return false;
+
+	// try to sync on fire code; if a Superframe is expected here anyway, try to correct
+	if(FireCodeSyndrome(sf)) {
+		if(!correct_fire_code || !CorrectFireCode(sf))
+			return false;
+		fprintf(stderr, "SuperframeFilter: Fire code error corrected\n");
+	}
 
 
 	// handle format
@@ -242,15 +337,9 @@ void SuperframeFilter::ProcessFormat() {
 	format.bitrate_kbps = sf_len / 120 * 8;
 	observer->FormatChange(format);
 
-	if(decode_audio) {
-		delete aac_dec;
-#ifdef DABLIN_AAC_FAAD2
-		aac_dec = new AACDecoderFAAD2(observer, sf_format, enable_float32);
-#endif
-#ifdef DABLIN_AAC_FDKAAC
-		aac_dec = new AACDecoderFDKAAC(observer, sf_format);
-#endif
-	}
+	// the AAC decoder is (re)created for the new format before decoding the next AU, if needed
+	delete aac_dec;
+	aac_dec = nullptr;
 }
 
 
@@ -317,12 +406,77 @@ RSDecoder::RSDecoder() {
 	rs_handle = init_rs_char(8, 0x11D, 0, 1, 10, 135);
 	if(!rs_handle)
 		throw std::runtime_error("RSDecoder: error while init_rs_char");
+
+	// GF(2^8) tables for the same field polynomial
+	uint8_t gf_exp[255];
+	uint8_t gf_log[256] = {0};
+	int x = 1;
+	for(int i = 0; i < 255; i++) {
+		gf_exp[i] = x;
+		gf_log[x] = i;
+		x <<= 1;
+		if(x & 0x100)
+			x ^= 0x11D;
+	}
+
+	// the roots of the generator polynomial are alpha^0..alpha^9 (fcr = 0, prim = 1)
+	for(int j = 0; j < 10; j++) {
+		syndrome_mul[j][0] = 0;
+		for(int v = 1; v < 256; v++)
+			syndrome_mul[j][v] = gf_exp[(gf_log[v] + j) % 255];
+	}
 }
 
 RSDecoder::~RSDecoder() {
 	free_rs_char(rs_handle);
 }
 
+void RSDecoder::CalcSyndromes(const uint8_t *sf, int subch_index) {
+	// Evaluate all packets at once with Horner's scheme, directly on the
+	// interleaved Superframe: row pos holds byte pos of every packet.
+	// syndromes[j * subch_index + i] is syndrome j of packet i.
+	syndromes.assign(10 * subch_index, 0);
+
+	for(int pos = 0; pos < 120; pos++) {
+		const uint8_t *row = sf + pos * subch_index;
+
+		// syndrome 0 is the plain sum (alpha^0 = 1)
+		uint8_t *s0 = &syndromes[0];
+		for(int i = 0; i < subch_index; i++)
+			s0[i] ^= row[i];
+
+		for(int j = 1; j < 10; j++) {
+			uint8_t *s = &syndromes[j * subch_index];
+			const uint8_t *mul = syndrome_mul[j];
+			for(int i = 0; i < subch_index; i++)
+				s[i] = mul[s[i]] ^ row[i];
+		}
+	}
+}
+
+void RSDecoder::DecodePacket(uint8_t *sf, int subch_index, int i, int& total_corr_count, bool& uncorr_errors) {
+	for(int pos = 0; pos < 120; pos++)
+		rs_packet[pos] = sf[pos * subch_index + i];
+
+	// detect errors
+	int corr_count = decode_rs_char(rs_handle, rs_packet, corr_pos, 0);
+	if(corr_count == -1)
+		uncorr_errors = true;
+	else
+		total_corr_count += corr_count;
+
+	// correct errors
+	for(int j = 0; j < corr_count; j++) {
+
+		int pos = corr_pos[j] - 135;
+		if(pos < 0)
+			continue;
+
+//		fprintf(stderr, "j: %d, pos: %d, sf-index: %d\n", j, pos, pos * subch_index + i);
+		sf[pos * subch_index + i] = rs_packet[pos];
+	}
+}
+
 void RSDecoder::DecodeSuperframe(uint8_t *sf, size_t sf_len, int& total_corr_count, bool& uncorr_errors) {
 //	// insert errors for test
 //	sf[0] ^= 0xFF;
@@ -333,31 +487,28 @@ void RSDecoder::DecodeSuperframe(uint8_t *sf, size_t sf_len, int& total_corr_cou
 	total_corr_count = 0;
 	uncorr_errors = false;
 
-	// process all RS packets
-	for(int i = 0; i < subch_index; i++) {
-		for(int pos = 0; pos < 120; pos++)
-			rs_packet[pos] = sf[pos * subch_index + i];
-
-		// detect errors
-		int corr_count = decode_rs_char(rs_handle, rs_packet, corr_pos, 0);
-		if(corr_count == -1)
-			uncorr_errors = true;
-		else
-			total_corr_count += corr_count;
-
-		// correct errors
-		for(int j = 0; j < corr_count; j++) {
+	CalcSyndromes(sf, subch_index);
 
-			int pos = corr_pos[j] - 135;
-			if(pos < 0)
-				continue;
+	// only packets with a non-zero syndrome need the full decoder (Berlekamp-Massey, Chien search, Forney)
+	for(int i = 0; i < subch_index; i++) {
+		uint8_t syndromes_or = 0;
+		for(int j = 0; j < 10; j++)
+			syndromes_or |= syndromes[j * subch_index + i];
 
-//			fprintf(stderr, "j: %d, pos: %d, sf-index: %d\n", j, pos, pos * subch_index + i);
-			sf[pos * subch_index + i] = rs_packet[pos];
-		}
+		if(syndromes_or)
+			DecodePacket(sf, subch_index, i, total_corr_count, uncorr_errors);
 	}
 }
 
+void RSDecoder::DecodeSuperframeGeneric(uint8_t *sf, size_t sf_len, int& total_corr_count, bool& uncorr_errors) {
+	int subch_index = sf_len / 120;
+	total_corr_count = 0;
+	uncorr_errors = false;
+
+	// process all RS packets
+	for(int i = 0; i < subch_index; i++)
+		DecodePacket(sf, subch_index, i, total_corr_count, uncorr_errors);
+}
 
 
 // --- AACDecoder -----------------------------------------------------------------
@@ -24,6 +24,7 @@
 #include <stdio.h>
 #include <stdexcept>
 #include <string>
+#include <vector>
 
 #if !(defined(DABLIN_AAC_FAAD2) ^ defined(DABLIN_AAC_FDKAAC))
 #error "You must select a AAC decoder by defining either DABLIN_AAC_FAAD2 or DABLIN_AAC_FDKAAC!"
@@ -76,11 +77,21 @@ private:
 	void *rs_handle;
 	uint8_t rs_packet[120];
 	int corr_pos[10];
+
+	// multiplication by alpha^j in GF(2^8), for the syndrome j
+	uint8_t syndrome_mul[10][256];
+	std::vector<uint8_t> syndromes;
+
+	void CalcSyndromes(const uint8_t *sf, int subch_index);
+	void DecodePacket(uint8_t *sf, int subch_index, int i, int& total_corr_count, bool& uncorr_errors);
 public:
 	RSDecoder();
 	~RSDecoder();
 
 	void DecodeSuperframe(uint8_t *sf, size_t sf_len, int& total_corr_count, bool& uncorr_errors);
+
+	// same result as DecodeSuperframe, but passes every packet to the generic decoder (for tests)
+	void DecodeSuperframeGeneric(uint8_t *sf, size_t sf_len, int& total_corr_count, bool& uncorr_errors);
 };
 
 
@@ -142,7 +153,9 @@ private:
 
 	size_t frame_len;
 	int frame_count;
+	int frame_pos;	// next position in the circular buffer sf_raw
 	int sync_frames;
+	bool synced;
 
 	uint8_t *sf_raw;
 	uint8_t *sf;
@@ -157,7 +170,10 @@ private:
 
 	BitWriter au_bw;
 
-	bool CheckSync();
+	static uint16_t FireCodeSyndrome(const uint8_t *data);
+	static bool CorrectFireCode(uint8_t *data);
+	bool CheckSyncRaw(const uint8_t *data);
+	bool CheckSync(bool correct_fire_code);
 	void ProcessFormat();
 	void ProcessUntouchedStream(const uint8_t *data, size_t len);
 	void CheckForPAD(const uint8_t *data, size_t len);
@@ -27,10 +27,30 @@
 #include <vector>
 #include "decoder_adapter.h"
 
-DecoderAdapter::DecoderAdapter(ProgrammeHandlerInterface &mr, int16_t bitRate, AudioServiceComponentType &dabModus, const std::string &dumpFileName):
+static metrics::labels_t subchannel_labels(int16_t subChId)
+{
+    return {{"subchannel", std::to_string(subChId)}};
+}
+
+DecoderAdapter::DecoderAdapter(ProgrammeHandlerInterface &mr, int16_t subChId, int16_t bitRate, AudioServiceComponentType &dabModus, const std::string &dumpFileName):
     bitRate(bitRate),
     myInterface(mr),
-    padDecoder(this, true)
+    padDecoder(this, true),
+    frameErrors(metrics::registry().counter("welle_audio_frame_errors_total",
+                "Number of audio frames that could not be decoded",
+                subchannel_labels(subChId))),
+    rsCorrectedErrors(metrics::registry().counter("welle_rs_corrected_bytes_total",
+                "Number of bytes corrected by the DAB+ Reed-Solomon decoder",
+                subchannel_labels(subChId))),
+    rsUncorrectableFrames(metrics::registry().counter("welle_rs_uncorrectable_superframes_total",
+                "Number of DAB+ superframes with uncorrectable Reed-Solomon errors",
+                subchannel_labels(subChId))),
+    aacErrors(metrics::registry().counter("welle_aac_errors_total",
+                "Number of AAC decoder errors",
+                subchannel_labels(subChId))),
+    decodeDuration(metrics::registry().histogram("welle_stage_duration_seconds",
+                "Processing time of the pipeline stages",
+                {{"stage", "audio_decoder"}, {"subchannel", std::to_string(subChId)}}))
 {
     if (dabModus == AudioServiceComponentType::DAB)
         decoder = std::make_unique<MP2Decoder>(this, false);
@@ -54,22 +74,38 @@ DecoderAdapter::DecoderAdapter(ProgrammeHandlerInterface &mr, int16_t bitRate, A
 
 void DecoderAdapter::addtoFrame(uint8_t *v)
 {
+    metrics::ScopedTimer timer(decodeDuration);
+
     const size_t length = 24 * bitRate / 8;
-    std::vector<uint8_t> data(length);
+    frameBytes.resize(length);
 
     // Convert 8 bits (stored in one uint8) into one uint8
     for (size_t i = 0; i < length; i ++) {
-        data[i] = 0;
+        frameBytes[i] = 0;
         for (int j = 0; j < 8; j ++) {
-            data[i] <<= 1;
-            data[i] |= v[8 * i + j] & 01;
+            frameBytes[i] <<= 1;
+            frameBytes[i] |= v[8 * i + j] & 01;
+        }
+    }
+
+    audioDecodingEnabled = myInterface.wantsDecodedAudio();
+    decoder->SetAudioDecoding(audioDecodingEnabled);
+
+    const bool wantsEncodedAudio = myInterface.wantsEncodedAudio();
+    if (wantsEncodedAudio != untouchedStreamEnabled) {
+        if (wantsEncodedAudio) {
+            decoder->AddUntouchedStreamConsumer(this);
+        }
+        else {
+            decoder->RemoveUntouchedStreamConsumer(this);
         }
+        untouchedStreamEnabled = wantsEncodedAudio;
     }
 
-    decoder->Feed(data.data(), length);
+    decoder->Feed(frameBytes.data(), length);
 
     if (dumpFile) {
-        fwrite(data.data(), length, 1, dumpFile.get());
+        fwrite(frameBytes.data(), length, 1, dumpFile.get());
     }
 
     myInterface.onFrameErrors(frameErrorCounter);
@@ -79,44 +115,49 @@ void DecoderAdapter::addtoFrame(uint8_t *v)
 void DecoderAdapter::FormatChange(const AUDIO_SERVICE_FORMAT& format)
 {
     audioFormat = format.GetSummary();
+
+    // Without decoding, StartAudio and PutAudio are not called. Announce
+    // the format anyway, so that it can be shown.
+    if (not audioDecodingEnabled) {
+        const auto pp = myInterface.audioPostProcessing();
+
+        auto frame = audioFrames.acquire();
+        frame->samples.clear();
+        frame->resetLevels();
+        frame->sample_rate = pp.output_rate ? pp.output_rate : format.samplerate_khz * 1000;
+        myInterface.onNewAudio(frame, audioFormat);
+    }
 }
 
 void DecoderAdapter::StartAudio(int samplerate, int channels, bool float32)
 {
-    if (float32 == true)
-        throw std::runtime_error("DecoderAdapter: Float32 audio samples are not supported");
-
     audioSamplerate = samplerate;
     audioChannels = channels;
+    audioFloat32 = float32;
 }
 
 void DecoderAdapter::PutAudio(const uint8_t *data, size_t len)
 {
-    // Then len is given in bytes. For stereo it is the double times of mono.
-    // But we need two channels even if we have mono.
-    // Mono: len = len / 2 * 2 We have len to devide by 2 and for two channels we have multiply by two
-    // Stereo: len = len / 2 We just need to devide by 2 because it is stereo
-    size_t bufferSize = audioChannels == 2 ? len/2 : len;
-    std::vector<int16_t> audio(bufferSize);
-
-    // Convert two uint8 into a int16 sample
-    for(size_t i=0; i<len/2; ++i) {
-        int16_t sample =  ((int16_t) data[i * 2 +1] << 8) | ((int16_t) data[i * 2]);
-
-        if (audioChannels == 2) {
-            audio[i] = sample;
-        }
-        else {
-        	// upmix to stereo
-            audio[i*2] = sample;
-            audio[i*2+1] = sample;
+    auto frame = audioFrames.acquire();
+    frame->resetLevels();
+    frame->sample_rate = audioSamplerate;
+    convert_pcm(data, len, audioChannels, audioFloat32, *frame);
+
+    const auto pp = myInterface.audioPostProcessing();
+    if (pp.enabled()) {
+        if (not postProcessor or postProcessor->getSettings() != pp) {
+            postProcessor = std::make_unique<AudioPostProcessor>(pp);
         }
+
+        auto processed = audioFrames.acquire();
+        postProcessor->process(*frame, *processed);
+        frame = processed;
+    }
+    else {
+        postProcessor.reset();
     }
 
-    myInterface.onNewAudio(
-        std::move(audio),
-        audioSamplerate,
-        audioFormat);
+    myInterface.onNewAudio(frame, audioFormat);
 }
 
 void DecoderAdapter::ProcessPAD(const uint8_t *xpad_data, size_t xpad_len, bool exact_xpad_len, const uint8_t *fpad_data)
@@ -128,19 +169,30 @@ void DecoderAdapter::AudioError(const std::string &hint)
 {
     (void)hint;
     frameErrorCounter++;
+    frameErrors.inc();
 }
 
 void DecoderAdapter::AudioWarning(const std::string &hint)
 {
     (void)hint;
+    aacErrors.inc();
     myInterface.onAacErrors(1);
 }
 
 void DecoderAdapter::FECInfo(int total_corr_count, bool uncorr_errors)
 {
+    rsCorrectedErrors.inc(total_corr_count);
+    if (uncorr_errors) {
+        rsUncorrectableFrames.inc();
+    }
     myInterface.onRsErrors(uncorr_errors, total_corr_count);
 }
 
+void DecoderAdapter::ProcessUntouchedStream(const uint8_t *data, size_t len, size_t duration_ms)
+{
+    myInterface.onNewEncodedAudio(data, len, duration_ms);
+}
+
 void DecoderAdapter::PADChangeDynamicLabel(const DL_STATE &dl)
 {
     if (dl.raw.empty()) {
@@ -37,11 +37,15 @@
 #include "subchannel_sink.h"
 #include "dab_decoder.h"
 #include "dabplus_decoder.h"
+#include "audio-frame.h"
+#include "audio-postprocessor.h"
+#include "metrics.h"
 
-class DecoderAdapter: public DabProcessor, public SubchannelSinkObserver, public PADDecoderObserver
+class DecoderAdapter: public DabProcessor, public SubchannelSinkObserver, public UntouchedStreamConsumer, public PADDecoderObserver
 {
     public:
         DecoderAdapter(ProgrammeHandlerInterface& mr,
+                     int16_t subChId,
                      int16_t bitRate,
                      AudioServiceComponentType &dabModus,
                      const std::string& dumpFileName);
@@ -57,6 +61,9 @@ class DecoderAdapter: public DabProcessor, public SubchannelSinkObserver, public
         virtual void AudioWarning(const std::string& /*hint*/);
         virtual void FECInfo(int /*total_corr_count*/, bool /*uncorr_errors*/);
 
+        // UntouchedStreamConsumer impl
+        virtual void ProcessUntouchedStream(const uint8_t* /*data*/, size_t /*len*/, size_t /*duration_ms*/);
+
         // PADDecoderObserver impl
         virtual void PADChangeDynamicLabel(const DL_STATE& dl);
         virtual void PADChangeSlide(const MOT_FILE& slide);
@@ -64,16 +71,28 @@ class DecoderAdapter: public DabProcessor, public SubchannelSinkObserver, public
 
     private:
         int16_t bitRate;
+        std::vector<uint8_t> frameBytes;
         int frameErrorCounter = 0;
         ProgrammeHandlerInterface& myInterface;
         std::unique_ptr<SubchannelSink> decoder;
+        bool untouchedStreamEnabled = false;
+        bool audioDecodingEnabled = true;
         PADDecoder padDecoder;
 
         struct FILEDeleter{ void operator()(FILE* fd){ if (fd) fclose(fd); }};
         std::unique_ptr<FILE, FILEDeleter> dumpFile;
 
+        metrics::Counter& frameErrors;
+        metrics::Counter& rsCorrectedErrors;
+        metrics::Counter& rsUncorrectableFrames;
+        metrics::Counter& aacErrors;
+        metrics::Histogram& decodeDuration;
+
         int audioSamplerate = 0;
         int audioChannels = 0;
+        bool audioFloat32 = false;
+        AudioFramePool audioFrames;
+        std::unique_ptr<AudioPostProcessor> postProcessor;
         std::string audioFormat;
 };
 #endif // DECODER_ADAPTER_H
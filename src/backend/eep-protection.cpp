@@ -110,6 +110,8 @@ EEPProtection::EEPProtection(int16_t bitRate, bool profile_is_eep_a, int level)
                 throw std::logic_error("Invalid EEP_A level");
         }
     }
+
+    puncturing = { {L1, PI1}, {L2, PI2} };
 }
 
 bool EEPProtection::deconvolve(const softbit_t *v, int32_t size, uint8_t *outBuffer)
@@ -0,0 +1,278 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include "ensemble-cache.h"
+#include "libs/json.hpp"
+
+using namespace std;
+using json = nlohmann::json;
+
+// FIG 1 labels are not necessarily valid UTF-8, which JSON requires
+static string to_hex(const string& bytes)
+{
+    static const char digits[] = "0123456789abcdef";
+    string h;
+    for (const uint8_t c : bytes) {
+        h += digits[c >> 4];
+        h += digits[c & 0x0F];
+    }
+    return h;
+}
+
+static string from_hex(const string& h)
+{
+    string bytes;
+    for (size_t i = 0; i + 1 < h.size(); i += 2) {
+        bytes += (char)stoi(h.substr(i, 2), nullptr, 16);
+    }
+    return bytes;
+}
+
+static json label_to_json(const DabLabel& label)
+{
+    return {
+        {"charset", (int)label.charset},
+        {"label", to_hex(label.fig1_label)},
+        {"flag", label.fig1_flag}
+    };
+}
+
+static DabLabel label_from_json(const json& j)
+{
+    DabLabel label;
+    label.charset = (CharacterSet)j.at("charset").get<int>();
+    label.fig1_label = from_hex(j.at("label").get<string>());
+    label.fig1_flag = j.at("flag").get<uint16_t>();
+    return label;
+}
+
+static json ensemble_to_json(const Ensemble& e)
+{
+    json services = json::array();
+    for (const auto& s : e.services) {
+        services.push_back({
+                {"sid", s.serviceId},
+                {"label", label_to_json(s.serviceLabel)},
+                {"language", s.language},
+                {"pty", s.programType}});
+    }
+
+    json components = json::array();
+    for (const auto& sc : e.components) {
+        components.push_back({
+                {"tmid", sc.TMid},
+                {"sid", sc.SId},
+                {"nr", sc.componentNr},
+                {"label", label_to_json(sc.componentLabel)},
+                {"ascty", sc.ASCTy},
+                {"ps", sc.PS_flag},
+                {"subchid", sc.subchannelId},
+                {"scid", sc.SCId},
+                {"ca", sc.CAflag},
+                {"dscty", sc.DSCTy},
+                {"dg", sc.DGflag},
+                {"packetaddress", sc.packetAddress}});
+    }
+
+    json subchannels = json::array();
+    for (const auto& sub : e.subchannels) {
+        if (not sub.valid()) {
+            continue;
+        }
+
+        const auto& ps = sub.protectionSettings;
+        subchannels.push_back({
+                {"subchid", sub.subChId},
+                {"startaddr", sub.startAddr},
+                {"length", sub.length},
+                {"programme", sub.programmeNotData},
+                {"shortform", ps.shortForm},
+                {"uepindex", ps.uepTableIndex},
+                {"ueplevel", ps.uepLevel},
+                {"eepprofile", (int)ps.eepProfile},
+                {"eeplevel", (int)ps.eepLevel},
+                {"language", sub.language},
+                {"fec", sub.fecScheme}});
+    }
+
+    return {
+        {"id", e.id},
+        {"ecc", e.ecc},
+        {"label", label_to_json(e.label)},
+        {"services", services},
+        {"components", components},
+        {"subchannels", subchannels}
+    };
+}
+
+static ensemble_ptr ensemble_from_json(const json& j)
+{
+    auto e = make_shared<Ensemble>();
+    e->cached = true;
+    e->id = j.at("id").get<uint16_t>();
+    e->ecc = j.at("ecc").get<uint8_t>();
+    e->label = label_from_json(j.at("label"));
+
+    for (const auto& js : j.at("services")) {
+        Service s(js.at("sid").get<uint32_t>());
+        s.serviceLabel = label_from_json(js.at("label"));
+        s.language = js.at("language").get<int16_t>();
+        s.programType = js.at("pty").get<int16_t>();
+        e->services.push_back(s);
+    }
+
+    for (const auto& jc : j.at("components")) {
+        ServiceComponent sc;
+        sc.TMid = jc.at("tmid").get<int8_t>();
+        sc.SId = jc.at("sid").get<uint32_t>();
+        sc.componentNr = jc.at("nr").get<int16_t>();
+        sc.componentLabel = label_from_json(jc.at("label"));
+        sc.ASCTy = jc.at("ascty").get<int16_t>();
+        sc.PS_flag = jc.at("ps").get<int16_t>();
+        sc.subchannelId = jc.at("subchid").get<int16_t>();
+        sc.SCId = jc.at("scid").get<uint16_t>();
+        sc.CAflag = jc.at("ca").get<uint8_t>();
+        sc.DSCTy = jc.at("dscty").get<int16_t>();
+        sc.DGflag = jc.at("dg").get<uint8_t>();
+        sc.packetAddress = jc.at("packetaddress").get<int16_t>();
+        e->components.push_back(sc);
+    }
+
+    e->subchannels.resize(64);
+    for (const auto& jsub : j.at("subchannels")) {
+        Subchannel sub;
+        sub.subChId = jsub.at("subchid").get<int32_t>();
+        sub.startAddr = jsub.at("startaddr").get<int32_t>();
+        sub.length = jsub.at("length").get<int32_t>();
+        sub.programmeNotData = jsub.at("programme").get<bool>();
+        auto& ps = sub.protectionSettings;
+        ps.shortForm = jsub.at("shortform").get<bool>();
+        ps.uepTableIndex = jsub.at("uepindex").get<int16_t>();
+        ps.uepLevel = jsub.at("ueplevel").get<int16_t>();
+        ps.eepProfile = (EEPProtectionProfile)jsub.at("eepprofile").get<int>();
+        ps.eepLevel = (EEPProtectionLevel)jsub.at("eeplevel").get<int>();
+        sub.language = jsub.at("language").get<int16_t>();
+        sub.fecScheme = jsub.at("fec").get<int16_t>();
+
+        if (sub.subChId < 0 or sub.subChId >= 64) {
+            throw out_of_range("Invalid subchannel " + to_string(sub.subChId));
+        }
+        e->subchannels[sub.subChId] = sub;
+    }
+
+    e->buildIndex();
+    return e;
+}
+
+static json read_file(const string& filename)
+{
+    ifstream f(filename);
+    if (not f) {
+        return json();
+    }
+    return json::parse(f);
+}
+
+EnsembleCache::EnsembleCache(const string& directory) :
+    directory(directory)
+{ }
+
+string EnsembleCache::fileName(int frequency) const
+{
+    return directory + "/ensemble-" + to_string(frequency) + ".json";
+}
+
+ensemble_ptr EnsembleCache::load(int frequency) const
+{
+    lock_guard<mutex> lock(file_mutex);
+    try {
+        const auto j = read_file(fileName(frequency));
+        if (j.is_object()) {
+            const auto last = to_string(j.at("last").get<uint16_t>());
+            return ensemble_from_json(j.at("ensembles").at(last));
+        }
+    }
+    catch (const exception& e) {
+        clog << "EnsembleCache: cannot load " << fileName(frequency) <<
+            ": " << e.what() << endl;
+    }
+    return nullptr;
+}
+
+ensemble_ptr EnsembleCache::load(int frequency, uint16_t eId) const
+{
+    lock_guard<mutex> lock(file_mutex);
+    try {
+        const auto j = read_file(fileName(frequency));
+        if (j.is_object()) {
+            const auto& ensembles = j.at("ensembles");
+            const auto it = ensembles.find(to_string(eId));
+            if (it != ensembles.end()) {
+                return ensemble_from_json(*it);
+            }
+        }
+    }
+    catch (const exception& e) {
+        clog << "EnsembleCache: cannot load " << fileName(frequency) <<
+            ": " << e.what() << endl;
+    }
+    return nullptr;
+}
+
+bool EnsembleCache::store(int frequency, const Ensemble& ensemble)
+{
+    lock_guard<mutex> lock(file_mutex);
+    const auto filename = fileName(frequency);
+
+    json j;
+    try {
+        j = read_file(filename);
+    }
+    catch (const exception& e) {
+        clog << "EnsembleCache: replacing " << filename << ": " << e.what() << endl;
+    }
+
+    if (not j.is_object()) {
+        j = json::object();
+    }
+    j["last"] = ensemble.id;
+    j["ensembles"][to_string(ensemble.id)] = ensemble_to_json(ensemble);
+
+    // Replace the file atomically, a receiver killed while writing must
+    // not leave a truncated cache behind.
+    const auto tmpname = filename + ".tmp";
+    {
+        ofstream f(tmpname);
+        f << j.dump(1) << endl;
+        if (not f) {
+            clog << "EnsembleCache: cannot write " << tmpname << endl;
+            return false;
+        }
+    }
+
+    if (rename(tmpname.c_str(), filename.c_str()) != 0) {
+        clog << "EnsembleCache: cannot rename " << tmpname << endl;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,54 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include "ensemble.h"
+
+/* Keeps the ensembles received on every frequency on disk, so that a
+ * receiver tuning to a known frequency can present the services and start
+ * decoding before the FIC has been received again.
+ *
+ * The directory contains one file per frequency, holding the ensembles seen
+ * on it keyed by EId, and the EId that was seen last. Extended labels
+ * (FIG 2) are not stored, they are received again quickly enough. */
+class EnsembleCache {
+    public:
+        explicit EnsembleCache(const std::string& directory);
+        EnsembleCache(const EnsembleCache&) = delete;
+        EnsembleCache& operator=(const EnsembleCache&) = delete;
+
+        // The ensemble last seen on the frequency, or nullptr if none is
+        // known. The returned ensembles are marked as cached.
+        ensemble_ptr load(int frequency) const;
+        ensemble_ptr load(int frequency, uint16_t eId) const;
+
+        // Returns false if the file could not be written
+        bool store(int frequency, const Ensemble& ensemble);
+
+    private:
+        std::string fileName(int frequency) const;
+
+        const std::string directory;
+        mutable std::mutex file_mutex; // serialises accesses to the files
+};
@@ -0,0 +1,108 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include "ensemble.h"
+
+using namespace std;
+
+void Ensemble::buildIndex()
+{
+    serviceIndex.clear();
+    for (size_t i = 0; i < services.size(); i++) {
+        serviceIndex[services[i].serviceId] = i;
+    }
+
+    componentIndex.clear();
+    for (size_t i = 0; i < components.size(); i++) {
+        componentIndex[components[i].SId].push_back(i);
+    }
+}
+
+const Service *Ensemble::findService(uint32_t sId) const
+{
+    const auto it = serviceIndex.find(sId);
+    if (it == serviceIndex.end()) {
+        return nullptr;
+    }
+    return &services[it->second];
+}
+
+const ServiceComponent *Ensemble::findComponent(uint32_t sId, int16_t SCIdS) const
+{
+    const auto it = componentIndex.find(sId);
+    if (it == componentIndex.end()) {
+        return nullptr;
+    }
+
+    for (const size_t i : it->second) {
+        if (components[i].componentNr == SCIdS) {
+            return &components[i];
+        }
+    }
+    return nullptr;
+}
+
+vector<const ServiceComponent*> Ensemble::findComponents(uint32_t sId) const
+{
+    vector<const ServiceComponent*> comps;
+
+    const auto it = componentIndex.find(sId);
+    if (it != componentIndex.end()) {
+        for (const size_t i : it->second) {
+            comps.push_back(&components[i]);
+        }
+    }
+    return comps;
+}
+
+const Subchannel *Ensemble::findSubchannel(int16_t subChId) const
+{
+    if (subChId < 0 or (size_t)subChId >= subchannels.size() or
+            not subchannels[subChId].valid()) {
+        return nullptr;
+    }
+    return &subchannels[subChId];
+}
+
+bool Ensemble::isComplete() const
+{
+    if (label.utf8_label().empty() or services.empty()) {
+        return false;
+    }
+
+    for (const auto& s : services) {
+        if (s.serviceLabel.utf8_label().empty()) {
+            return false;
+        }
+
+        const auto comps = findComponents(s.serviceId);
+        if (comps.empty()) {
+            return false;
+        }
+
+        for (const auto *sc : comps) {
+            if (findSubchannel(sc->subchannelId) == nullptr) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,79 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include "dab-constants.h"
+
+/* An immutable view of the ensemble database built by the FIBProcessor
+ * from the FIC. The FIC thread publishes a new one every time the database
+ * changes, and readers hold on to it as long as they want without ever
+ * blocking FIB processing. Getting the whole ensemble is a pointer copy.
+ *
+ * Services, components and subchannels are indexed by SId, by SId and
+ * SCIdS, and by SubChId respectively. */
+class Ensemble {
+    public:
+        // Build the indices, once all members have been filled in
+        void buildIndex(void);
+
+        // Returns nullptr if the service or component is unknown
+        const Service *findService(uint32_t sId) const;
+        const ServiceComponent *findComponent(uint32_t sId, int16_t SCIdS) const;
+
+        // The components of a service, in the order FIG0/2 signals them
+        std::vector<const ServiceComponent*> findComponents(uint32_t sId) const;
+
+        // Returns nullptr if the subchannel is not in use
+        const Subchannel *findSubchannel(int16_t subChId) const;
+
+        // true if the ensemble has a label, at least one service, and every
+        // service has a label and components whose subchannels are known.
+        bool isComplete(void) const;
+
+        // The value of FIBProcessor::getDatabaseVersion() at the time this
+        // snapshot was taken
+        uint32_t version = 0;
+
+        // Restored from the EnsembleCache, not yet confirmed by the FIC
+        bool cached = false;
+
+        uint16_t id = 0;
+        uint8_t ecc = 0;
+        DabLabel label;
+
+        // In the order in which they were detected
+        std::vector<Service> services;
+        std::vector<ServiceComponent> components;
+
+        // Indexed by SubChId, unused entries are not valid()
+        std::vector<Subchannel> subchannels;
+
+    private:
+        std::unordered_map<uint32_t, size_t> serviceIndex;
+        std::unordered_map<uint32_t, std::vector<size_t> > componentIndex;
+};
+
+using ensemble_ptr = std::shared_ptr<const Ensemble>;
@@ -0,0 +1,278 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include "eti-reader.h"
+#include "eep-protection.h"
+#include "uep-protection.h"
+#include "protTables.h"
+
+using namespace std;
+
+// Soft bits of the FIC belonging to one CIF, after puncturing
+static const size_t FIC_SOFTBITS = 2304;
+
+// Soft bits in one CIF of 864 CUs
+static const size_t CIF_BITS = 864 * 64;
+
+static const int16_t interleaveMap[] = {0,8,4,12,2,10,6,14,1,9,5,13,3,11,7,15};
+
+static void unpackBits(const uint8_t *bytes, size_t num_bytes, uint8_t *bits)
+{
+    for (size_t i = 0; i < num_bytes; i++) {
+        for (int j = 0; j < 8; j++) {
+            bits[8 * i + j] = (bytes[i] >> (7 - j)) & 1;
+        }
+    }
+}
+
+EtiReader::EtiReader(const string& filename,
+        const DABParams& params,
+        RadioControllerInterface& rci,
+        FicHandler& ficHandler,
+        MscHandler& mscHandler,
+        bool throttle,
+        bool rewind) :
+    params(params),
+    radioInterface(rci),
+    ficHandler(ficHandler),
+    mscHandler(mscHandler),
+    throttle(throttle),
+    rewind(rewind),
+    cifsPerFrame(eti::cifs_per_frame(params.dabMode)),
+    frames(cifsPerFrame, vector<uint8_t>(eti::FRAME_SIZE)),
+    parsedFrames(cifsPerFrame),
+    ficBits(eti::FIC_SIZE * 8),
+    ficSoftbits(cifsPerFrame * FIC_SOFTBITS),
+    cifSoftbits(CIF_BITS)
+{
+    FILE *fd = fopen(filename.c_str(), "rb");
+    if (fd == nullptr) {
+        throw runtime_error("Cannot open ETI file " + filename + ": " + strerror(errno));
+    }
+    etiFile.reset(fd);
+
+    //  The FIC is punctured like in FicHandler::processFicInput
+    ficPuncturing = { {21, getPCodes(16 - 1)}, {3, getPCodes(15 - 1)} };
+
+    ficHandler.setBitsperBlock(2 * params.K);
+}
+
+EtiReader::~EtiReader()
+{
+    stop();
+}
+
+void EtiReader::restart()
+{
+    stop();
+
+    ::rewind(etiFile.get());
+    streams.clear();
+    transmissionFrames = 0;
+    endOfFile = false;
+    running = true;
+    thread = std::thread(&EtiReader::run, this);
+}
+
+void EtiReader::stop()
+{
+    running = false;
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+void EtiReader::run()
+{
+    const auto cifDuration = chrono::milliseconds(24);
+    auto nextFrame = chrono::steady_clock::now();
+    size_t framesInPass = 0;
+    size_t numFrames = 0;
+
+    radioInterface.onSignalPresence(true);
+    radioInterface.onSyncChange(true);
+
+    while (running) {
+        if (fread(frames[numFrames].data(), eti::FRAME_SIZE, 1, etiFile.get()) != 1) {
+            if (rewind and framesInPass > 0) {
+                ::rewind(etiFile.get());
+                framesInPass = 0;
+                numFrames = 0;
+                continue;
+            }
+
+            endOfFile = true;
+            radioInterface.onMessage(message_level_t::Information, "End of ETI file");
+            break;
+        }
+        framesInPass++;
+
+        auto& frame = parsedFrames[numFrames];
+        if (not eti::parse_frame(frames[numFrames].data(), frame)) {
+            clog << "EtiReader: invalid ETI frame" << endl;
+            numFrames = 0;
+            continue;
+        }
+
+        // Group the frames of one transmission frame
+        const size_t phase = frame.fp % cifsPerFrame;
+        if (phase != numFrames) {
+            if (phase != 0) {
+                numFrames = 0;
+                continue;
+            }
+
+            // Swapping the buffers keeps the parsed pointers valid
+            swap(frames[0], frames[numFrames]);
+            parsedFrames[0] = frame;
+            numFrames = 0;
+        }
+
+        if (++numFrames < (size_t)cifsPerFrame) {
+            continue;
+        }
+        numFrames = 0;
+
+        processTransmissionFrame();
+
+        if (throttle) {
+            nextFrame += cifsPerFrame * cifDuration;
+            const auto now = chrono::steady_clock::now();
+            if (nextFrame < now - chrono::seconds(1)) {
+                nextFrame = now;
+            }
+            this_thread::sleep_until(nextFrame);
+        }
+    }
+}
+
+void EtiReader::processTransmissionFrame()
+{
+    transmissionFrames++;
+
+    const int bitsperBlock = 2 * params.K;
+    for (int i = 0; i < cifsPerFrame; i++) {
+        encodeFIC(parsedFrames[i].fic, &ficSoftbits[i * FIC_SOFTBITS]);
+    }
+
+    for (int blkno = 1; blkno <= 3; blkno++) {
+        ficHandler.processFicBlock(&ficSoftbits[(blkno - 1) * bitsperBlock], blkno);
+    }
+
+    const int blocksPerCIF = (params.L - 4) / cifsPerFrame;
+    for (int i = 0; i < cifsPerFrame; i++) {
+        // Unused CUs carry no information
+        fill(cifSoftbits.begin(), cifSoftbits.end(), 0);
+
+        for (const auto& s : parsedFrames[i].streams) {
+            encodeStream(s, cifSoftbits.data());
+        }
+
+        for (int b = 0; b < blocksPerCIF; b++) {
+            mscHandler.processMscBlock(&cifSoftbits[b * bitsperBlock],
+                    4 + i * blocksPerCIF + b);
+        }
+    }
+
+    // Forget the subchannels that disappeared
+    for (auto it = streams.begin(); it != streams.end();) {
+        if (it->second.lastFrame != transmissionFrames) {
+            it = streams.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+}
+
+void EtiReader::encodeFIC(const uint8_t *fic, softbit_t *out)
+{
+    unpackBits(fic, eti::FIC_SIZE, ficBits.data());
+    ficEnergyDispersal.dedisperse(ficBits);
+    convolve(ficBits.data(), ficBits.size(), ficPuncturing, out);
+}
+
+void EtiReader::encodeStream(const eti::stream_t& s, softbit_t *cif)
+{
+    auto& state = streams[s.subChId];
+    state.lastFrame = transmissionFrames;
+
+    if (not state.protection or state.startAddr != s.startAddr or
+            state.tpl != s.tpl or state.stl != s.stl) {
+        const int bitrate = eti::bitrate_from_stl(s.stl);
+
+        ProtectionSettings ps;
+        if (not eti::protection_from_tpl(s.tpl, bitrate, ps)) {
+            streams.erase(s.subChId);
+            return;
+        }
+
+        try {
+            if (ps.shortForm) {
+                state.protection = make_unique<UEPProtection>(bitrate, ps.uepLevel);
+            }
+            else {
+                state.protection = make_unique<EEPProtection>(bitrate,
+                        ps.eepProfile == EEPProtectionProfile::EEP_A, (int)ps.eepLevel);
+            }
+        }
+        catch (const logic_error& e) {
+            clog << "EtiReader: subchannel " << s.subChId << ": " << e.what() << endl;
+            streams.erase(s.subChId);
+            return;
+        }
+
+        const size_t fragmentSize = puncturedSize(state.protection->getPuncturing());
+        if (s.startAddr * 64 + fragmentSize > CIF_BITS) {
+            streams.erase(s.subChId);
+            return;
+        }
+
+        state.startAddr = s.startAddr;
+        state.tpl = s.tpl;
+        state.stl = s.stl;
+        state.bits.resize(s.stl * 64);
+        for (auto& d : state.interleaveData) {
+            d.assign(fragmentSize, 0);
+        }
+        state.interleaverIndex = 0;
+    }
+
+    unpackBits(s.data, s.stl * 8, state.bits.data());
+    state.energyDispersal.dedisperse(state.bits);
+
+    auto& current = state.interleaveData[state.interleaverIndex];
+    convolve(state.bits.data(), state.bits.size(),
+            state.protection->getPuncturing(), current.data());
+
+    // Delay bit i by interleaveMap[i % 16] CIFs, the deinterleaver
+    // adds the remaining delay up to 16 CIFs
+    softbit_t *out = cif + s.startAddr * 64;
+    for (size_t i = 0; i < current.size(); i++) {
+        out[i] = state.interleaveData[(state.interleaverIndex + 16 -
+                interleaveMap[i & 0x0F]) & 0x0F][i];
+    }
+    state.interleaverIndex = (state.interleaverIndex + 1) & 0x0F;
+}
@@ -0,0 +1,114 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#pragma once
+
+#include <atomic>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "dab-constants.h"
+#include "energy_dispersal.h"
+#include "eti.h"
+#include "fic-handler.h"
+#include "msc-handler.h"
+#include "protection.h"
+#include "radio-controller.h"
+
+/* Replays an ETI-NI file into the FicHandler and MscHandler, bypassing the
+ * OFDM demodulator.
+ *
+ * ETI carries the decoded FIC and subchannels, so the reader applies the
+ * channel coding of the transmitter again: energy dispersal, convolutional
+ * encoding with the puncturing of each subchannel and time interleaving.
+ * The handlers then receive the soft bits the OfdmDecoder would deliver for
+ * a perfect signal, and the whole channel decoding runs as fast as the CPU
+ * allows. */
+class EtiReader {
+    public:
+        // Throws a runtime_error if the file cannot be opened. With throttle,
+        // the file is replayed in real time, otherwise as fast as possible.
+        // With rewind, the replay starts over at the end of the file.
+        EtiReader(const std::string& filename,
+                const DABParams& params,
+                RadioControllerInterface& rci,
+                FicHandler& ficHandler,
+                MscHandler& mscHandler,
+                bool throttle,
+                bool rewind);
+        ~EtiReader();
+        EtiReader(const EtiReader&) = delete;
+        EtiReader& operator=(const EtiReader&) = delete;
+
+        // Start the replay from the beginning of the file
+        void restart(void);
+        void stop(void);
+
+        // True once the whole file was replayed, never with rewind
+        bool endReached(void) const { return endOfFile; }
+
+    private:
+        // The encoding state of one subchannel
+        struct stream_state_t {
+            int startAddr = 0;
+            uint8_t tpl = 0;
+            size_t stl = 0;
+            std::unique_ptr<Protection> protection;
+            std::vector<uint8_t> bits;
+            EnergyDispersal energyDispersal;
+            std::vector<softbit_t> interleaveData[16];
+            int interleaverIndex = 0;
+            size_t lastFrame = 0;
+        };
+
+        void run(void);
+        void processTransmissionFrame(void);
+        void encodeFIC(const uint8_t *fic, softbit_t *out);
+        void encodeStream(const eti::stream_t& s, softbit_t *cif);
+
+        const DABParams params;
+        RadioControllerInterface& radioInterface;
+        FicHandler& ficHandler;
+        MscHandler& mscHandler;
+        const bool throttle;
+        const bool rewind;
+        const int cifsPerFrame;
+
+        struct FILEDeleter{ void operator()(FILE* fd){ if (fd) fclose(fd); }};
+        std::unique_ptr<FILE, FILEDeleter> etiFile;
+
+        std::atomic<bool> running = ATOMIC_VAR_INIT(false);
+        std::atomic<bool> endOfFile = ATOMIC_VAR_INIT(false);
+        std::thread thread;
+
+        // Only accessed by the thread
+        std::vector<std::vector<uint8_t> > frames;
+        std::vector<eti::frame_t> parsedFrames;
+        std::map<int, stream_state_t> streams;
+        size_t transmissionFrames = 0;
+        std::vector<PuncturingBlock> ficPuncturing;
+        std::vector<uint8_t> ficBits;
+        EnergyDispersal ficEnergyDispersal;
+        std::vector<softbit_t> ficSoftbits;
+        std::vector<softbit_t> cifSoftbits;
+};
@@ -0,0 +1,280 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include "eti-writer.h"
+#include "eep-protection.h"
+#include "uep-protection.h"
+
+using namespace std;
+
+// Soft bits in one CIF of 864 CUs
+static const size_t CIF_BITS = 864 * 64;
+
+// The file is written in chunks of about 170 frames
+static const size_t FILE_BUFFER_SIZE = 1024 * 1024;
+
+static void packBits(const uint8_t *bits, size_t num_bytes, uint8_t *bytes)
+{
+    for (size_t i = 0; i < num_bytes; i++) {
+        uint8_t b = 0;
+        for (int j = 0; j < 8; j++) {
+            b = (b << 1) | (bits[8 * i + j] & 1);
+        }
+        bytes[i] = b;
+    }
+}
+
+EtiWriter::EtiWriter(const string& filename,
+        const DABParams& params,
+        const FIBProcessor& fibProcessor,
+        bool lossless) :
+    dabMode(params.dabMode),
+    fibProcessor(fibProcessor),
+    lossless(lossless),
+    frameBuffer(eti::FRAME_SIZE),
+    framesCounter(metrics::registry().counter("welle_eti_frames_total",
+                "Number of ETI frames written")),
+    droppedCounter(metrics::registry().counter("welle_eti_dropped_cifs_total",
+                "Number of CIFs dropped because the ETI writer fell behind"))
+{
+    FILE *fd = fopen(filename.c_str(), "wb");
+    if (fd == nullptr) {
+        throw runtime_error("Cannot open ETI file " + filename + ": " + strerror(errno));
+    }
+    setvbuf(fd, nullptr, _IOFBF, FILE_BUFFER_SIZE);
+    etiFile.reset(fd);
+
+    for (auto& fic : ficBytes) {
+        fic.resize(eti::FIC_SIZE);
+    }
+    for (auto& fic : ficDelayLine) {
+        fic.resize(eti::FIC_SIZE);
+    }
+
+    thread = std::thread(&EtiWriter::run, this);
+}
+
+EtiWriter::~EtiWriter()
+{
+    {
+        lock_guard<mutex> lock(queueMutex);
+        running = false;
+    }
+    queueCondition.notify_all();
+
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+void EtiWriter::processFIC(const uint8_t *fic, int ficno)
+{
+    if (ficno < 0 or ficno >= 4) {
+        return;
+    }
+    copy(fic, fic + eti::FIC_SIZE, ficBytes[ficno].begin());
+}
+
+void EtiWriter::processCIF(const softbit_t *cif, int cifno)
+{
+    unique_ptr<job_t> job;
+    bool discontinuity = false;
+    {
+        unique_lock<mutex> lock(queueMutex);
+        if (lossless) {
+            spaceCondition.wait(lock, [&]{ return queue.size() < MAX_QUEUED_CIFS; });
+        }
+        else if (queue.size() >= MAX_QUEUED_CIFS) {
+            cifsDropped = true;
+            droppedCounter.inc();
+            return;
+        }
+        discontinuity = cifsDropped;
+        cifsDropped = false;
+
+        if (not freeJobs.empty()) {
+            job = move(freeJobs.back());
+            freeJobs.pop_back();
+        }
+    }
+
+    if (not job) {
+        job = make_unique<job_t>();
+    }
+    job->cifno = cifno;
+    job->fic = ficBytes[cifno & 0x03];
+    job->cif.assign(cif, cif + CIF_BITS);
+    job->subchannels = fibProcessor.getSubchannels();
+    job->discontinuity = discontinuity;
+
+    {
+        lock_guard<mutex> lock(queueMutex);
+        queue.push_back(move(job));
+    }
+    queueCondition.notify_one();
+}
+
+void EtiWriter::run()
+{
+    while (true) {
+        unique_ptr<job_t> job;
+        {
+            unique_lock<mutex> lock(queueMutex);
+            queueCondition.wait(lock, [&]{ return not queue.empty() or not running; });
+
+            // Write what is still queued before stopping
+            if (queue.empty()) {
+                break;
+            }
+            job = move(queue.front());
+            queue.pop_front();
+        }
+        spaceCondition.notify_one();
+
+        writeFrame(*job);
+
+        lock_guard<mutex> lock(queueMutex);
+        freeJobs.push_back(move(job));
+    }
+
+    fflush(etiFile.get());
+}
+
+void EtiWriter::writeFrame(job_t& job)
+{
+    const auto& subchannels = job.subchannels;
+
+    // After dropped CIFs, the deinterleavers and the FIC delay line hold
+    // data that does not belong together. Start over as after startup,
+    // which skips the next 16 CIFs.
+    if (job.discontinuity) {
+        streams.clear();
+        cifCount = 0;
+    }
+
+    // Forget the decoders of subchannels that were removed or changed
+    for (auto it = streams.begin(); it != streams.end();) {
+        auto sub = find_if(subchannels.begin(), subchannels.end(),
+                [&](const Subchannel& s) { return s.subChId == it->first; });
+
+        if (sub == subchannels.end() or not sub->sameOrganisation(it->second.sub)) {
+            it = streams.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+
+    eti::frame_t frame;
+    for (const auto& sub : subchannels) {
+        if (sub.length <= 0 or sub.bitrate() <= 0 or
+                (size_t)(sub.startAddr + sub.length) * 64 > CIF_BITS) {
+            continue;
+        }
+
+        auto& state = streams[sub.subChId];
+        if (not state.protection) {
+            initStream(state, sub);
+        }
+        decodeStream(state, job.cif.data());
+
+        eti::stream_t s;
+        s.subChId = sub.subChId;
+        s.startAddr = sub.startAddr;
+        s.tpl = eti::tpl_from_protection(sub.protectionSettings);
+        s.stl = eti::stl_from_bitrate(sub.bitrate());
+        s.data = state.bytes.data();
+        frame.streams.push_back(s);
+    }
+
+    // Exchange the FIC of this CIF against the one from 16 CIFs ago, which
+    // belongs to the data the deinterleavers output now.
+    swap(ficDelayLine[cifCount % 16], job.fic);
+    cifCount++;
+    if (cifCount <= 16) {
+        return;
+    }
+
+    // Keep the frame phase aligned to the transmission frames, even
+    // if the demodulator lost CIFs
+    const int cifsPerFrame = eti::cifs_per_frame(dabMode);
+    frame.fct = framesWritten % 250;
+    frame.fp = (transmissionFrames * cifsPerFrame + job.cifno) % 8;
+    if (job.cifno == cifsPerFrame - 1) {
+        transmissionFrames++;
+    }
+    frame.dabMode = dabMode;
+    frame.fic = job.fic.data();
+    frame.fic_len = job.fic.size();
+
+    if (not eti::build_frame(frame, frameBuffer.data())) {
+        clog << "EtiWriter: ensemble does not fit into an ETI frame" << endl;
+        return;
+    }
+
+    if (fwrite(frameBuffer.data(), frameBuffer.size(), 1, etiFile.get()) != 1) {
+        clog << "EtiWriter: write error: " << strerror(errno) << endl;
+        return;
+    }
+    framesWritten++;
+    framesCounter.inc();
+}
+
+void EtiWriter::initStream(stream_state_t& state, const Subchannel& sub)
+{
+    state.sub = sub;
+
+    const int bitrate = sub.bitrate();
+    const auto& ps = sub.protectionSettings;
+    if (ps.shortForm) {
+        state.protection = make_unique<UEPProtection>(bitrate, ps.uepLevel);
+    }
+    else {
+        state.protection = make_unique<EEPProtection>(bitrate,
+                ps.eepProfile == EEPProtectionProfile::EEP_A, (int)ps.eepLevel);
+    }
+
+    const size_t fragmentSize = sub.length * 64;
+    state.deinterleaver = make_unique<TimeDeinterleaver>(fragmentSize);
+    state.deinterleaved.resize(fragmentSize);
+    state.bits.resize(24 * bitrate);
+    state.bytes.assign(3 * bitrate, 0);
+}
+
+void EtiWriter::decodeStream(stream_state_t& state, const softbit_t *cif)
+{
+    const softbit_t *data = cif + state.sub.startAddr * 64;
+    const size_t fragmentSize = state.deinterleaved.size();
+    copy(data, data + fragmentSize, state.deinterleaver->nextCIF());
+
+    // Until the deinterleaver is filled, the stream stays zero
+    if (not state.deinterleaver->deinterleave(state.deinterleaved.data())) {
+        return;
+    }
+
+    state.protection->deconvolve(state.deinterleaved.data(), fragmentSize, state.bits.data());
+    state.energyDispersal.dedisperse(state.bits);
+    packBits(state.bits.data(), state.bytes.size(), state.bytes.data());
+}
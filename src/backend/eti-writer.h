@@ -0,0 +1,133 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "dab-constants.h"
+#include "energy_dispersal.h"
+#include "eti.h"
+#include "fib-processor.h"
+#include "metrics.h"
+#include "protection.h"
+#include "time-deinterleaver.h"
+
+/* Writes the whole ensemble to a file in the ETI-NI format.
+ *
+ * The demodulator hands over the FIC and the soft bits of every CIF. A
+ * single thread then deinterleaves and decodes all subchannels, and writes
+ * one ETI frame per CIF through a large file buffer. The FIC is delayed by
+ * the 16 CIFs the time deinterleaver needs, so that each frame carries the
+ * FIC matching its subchannels.
+ *
+ * The demodulator is never held up by the writer: if the writer falls more
+ * than MAX_QUEUED_CIFS behind, CIFs are dropped and counted. Only for the
+ * offline conversion of a file, where the input can wait, a lossless writer
+ * blocks instead. */
+class EtiWriter {
+    public:
+        // Throws a runtime_error if the file cannot be opened
+        EtiWriter(const std::string& filename,
+                const DABParams& params,
+                const FIBProcessor& fibProcessor,
+                bool lossless = false);
+        ~EtiWriter();
+        EtiWriter(const EtiWriter&) = delete;
+        EtiWriter& operator=(const EtiWriter&) = delete;
+
+        // Called from the demodulator thread, with the 96 bytes of the
+        // FIC belonging to CIF ficno of the transmission frame
+        void processFIC(const uint8_t *fic, int ficno);
+
+        // Called from the demodulator thread, with the soft bits of CIF
+        // cifno of the transmission frame. Drops the CIF if the writer is
+        // more than MAX_QUEUED_CIFS behind, or waits if it is lossless.
+        void processCIF(const softbit_t *cif, int cifno);
+
+        static constexpr size_t MAX_QUEUED_CIFS = 32;
+
+    private:
+        struct job_t {
+            int cifno = 0;
+            std::vector<uint8_t> fic;
+            std::vector<softbit_t> cif;
+
+            // The organisation in force when the CIF was received
+            std::vector<Subchannel> subchannels;
+
+            // CIFs were dropped before this one
+            bool discontinuity = false;
+        };
+
+        // The decoding state of one subchannel
+        struct stream_state_t {
+            Subchannel sub;
+            std::unique_ptr<Protection> protection;
+            std::unique_ptr<TimeDeinterleaver> deinterleaver;
+            std::vector<softbit_t> deinterleaved;
+            std::vector<uint8_t> bits;
+            std::vector<uint8_t> bytes;
+            EnergyDispersal energyDispersal;
+        };
+
+        void run(void);
+        void writeFrame(job_t& job);
+        void initStream(stream_state_t& state, const Subchannel& sub);
+        void decodeStream(stream_state_t& state, const softbit_t *cif);
+
+        const int dabMode;
+        const FIBProcessor& fibProcessor;
+        const bool lossless;
+
+        struct FILEDeleter{ void operator()(FILE* fd){ if (fd) fclose(fd); }};
+        std::unique_ptr<FILE, FILEDeleter> etiFile;
+
+        // FIC of the CIFs of the current transmission frame, packed
+        std::vector<uint8_t> ficBytes[4];
+
+        std::mutex queueMutex;
+        std::condition_variable queueCondition;
+        std::condition_variable spaceCondition;
+        std::deque<std::unique_ptr<job_t> > queue;
+        std::vector<std::unique_ptr<job_t> > freeJobs;
+        bool running = true;
+        bool cifsDropped = false;
+        std::thread thread;
+
+        // Only accessed by the thread
+        std::map<int, stream_state_t> streams;
+        std::vector<uint8_t> ficDelayLine[16];
+        size_t cifCount = 0;
+        size_t transmissionFrames = 0;
+        size_t framesWritten = 0;
+        std::vector<uint8_t> frameBuffer;
+
+        metrics::Counter& framesCounter;
+        metrics::Counter& droppedCounter;
+};
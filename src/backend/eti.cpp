@@ -0,0 +1,203 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include <cstring>
+#include "eti.h"
+#include "tools.h"
+
+using namespace std;
+
+namespace eti {
+
+static const uint32_t FSYNC_EVEN = 0x073AB6;
+static const uint32_t FSYNC_ODD = 0xF8C549;
+
+// Size of the SYNC, FC, EOH, EOF and TIST fields
+static const size_t FIXED_FIELDS_SIZE = 4 + 4 + 4 + 4 + 4;
+
+uint8_t tpl_from_protection(const ProtectionSettings& ps)
+{
+    if (ps.shortForm) {
+        return 0x10 | ((ps.uepLevel - 1) & 0x07);
+    }
+    else {
+        const uint8_t option = ps.eepProfile == EEPProtectionProfile::EEP_A ? 0 : 1;
+        return 0x20 | (option << 2) | (((int)ps.eepLevel - 1) & 0x03);
+    }
+}
+
+bool protection_from_tpl(uint8_t tpl, int bitrate, ProtectionSettings& ps)
+{
+    if (tpl & 0x20) {
+        const int option = (tpl >> 2) & 0x07;
+        if (option > 1) {
+            return false;
+        }
+
+        ps.shortForm = false;
+        ps.eepProfile = option == 0 ? EEPProtectionProfile::EEP_A : EEPProtectionProfile::EEP_B;
+        ps.eepLevel = (EEPProtectionLevel)((tpl & 0x03) + 1);
+        return true;
+    }
+    else if (tpl & 0x10) {
+        const int level = (tpl & 0x07) + 1;
+        for (int i = 0; i < 64; i++) {
+            if (ProtLevel[i][2] == bitrate and ProtLevel[i][1] == level) {
+                ps.shortForm = true;
+                ps.uepTableIndex = i;
+                ps.uepLevel = level;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+bool build_frame(const frame_t& frame, uint8_t *buf)
+{
+    const size_t nst = frame.streams.size();
+    size_t mst_len = frame.fic_len;
+    for (const auto& s : frame.streams) {
+        mst_len += 8 * s.stl;
+    }
+
+    if (nst > 64 or frame.fic_len % 4 != 0 or
+            FIXED_FIELDS_SIZE + 4 * nst + mst_len > FRAME_SIZE) {
+        return false;
+    }
+
+    // FL counts the words of STC, EOH and MST
+    const size_t fl = nst + 1 + mst_len / 4;
+
+    // SYNC: ERR and FSYNC
+    const uint32_t fsync = (frame.fct % 2) ? FSYNC_ODD : FSYNC_EVEN;
+    buf[0] = 0xFF;
+    buf[1] = fsync >> 16;
+    buf[2] = fsync >> 8;
+    buf[3] = fsync;
+
+    // FC
+    const uint8_t mid = frame.dabMode == 4 ? 0 : frame.dabMode;
+    buf[4] = frame.fct;
+    buf[5] = (frame.fic_len ? 0x80 : 0x00) | nst;
+    buf[6] = ((frame.fp & 0x07) << 5) | ((mid & 0x03) << 3) | ((fl >> 8) & 0x07);
+    buf[7] = fl;
+
+    // STC
+    size_t pos = 8;
+    for (const auto& s : frame.streams) {
+        buf[pos++] = ((s.subChId & 0x3F) << 2) | ((s.startAddr >> 8) & 0x03);
+        buf[pos++] = s.startAddr;
+        buf[pos++] = ((s.tpl & 0x3F) << 2) | ((s.stl >> 8) & 0x03);
+        buf[pos++] = s.stl;
+    }
+
+    // EOH: MNSC is not used, the CRC covers FC, STC and MNSC
+    buf[pos++] = 0xFF;
+    buf[pos++] = 0xFF;
+    uint16_t crc = CalcCRC::CalcCRC_CRC16_CCITT.Calc(buf + 4, pos - 4);
+    buf[pos++] = crc >> 8;
+    buf[pos++] = crc;
+
+    // MST
+    const size_t mst_start = pos;
+    if (frame.fic_len) {
+        memcpy(buf + pos, frame.fic, frame.fic_len);
+        pos += frame.fic_len;
+    }
+    for (const auto& s : frame.streams) {
+        memcpy(buf + pos, s.data, 8 * s.stl);
+        pos += 8 * s.stl;
+    }
+
+    // EOF: CRC over the MST, and RFU
+    crc = CalcCRC::CalcCRC_CRC16_CCITT.Calc(buf + mst_start, pos - mst_start);
+    buf[pos++] = crc >> 8;
+    buf[pos++] = crc;
+    buf[pos++] = 0xFF;
+    buf[pos++] = 0xFF;
+
+    // TIST: no timestamp
+    memset(buf + pos, 0xFF, 4);
+    pos += 4;
+
+    memset(buf + pos, 0x55, FRAME_SIZE - pos);
+    return true;
+}
+
+bool parse_frame(const uint8_t *buf, frame_t& frame)
+{
+    const uint32_t fsync = (buf[1] << 16) | (buf[2] << 8) | buf[3];
+    if (fsync != FSYNC_EVEN and fsync != FSYNC_ODD) {
+        return false;
+    }
+
+    const bool ficf = buf[5] & 0x80;
+    const size_t nst = buf[5] & 0x7F;
+    const uint8_t mid = (buf[6] >> 3) & 0x03;
+    const size_t fl = ((buf[6] & 0x07) << 8) | buf[7];
+
+    // FL counts the words of STC, EOH and MST
+    if (nst > 64 or fl < nst + 1 or 16 + 4 * fl > FRAME_SIZE) {
+        return false;
+    }
+
+    size_t pos = 8 + 4 * nst + 2;
+    uint16_t crc = CalcCRC::CalcCRC_CRC16_CCITT.Calc(buf + 4, pos - 4);
+    if (crc != ((buf[pos] << 8) | buf[pos + 1])) {
+        return false;
+    }
+    pos += 2;
+
+    frame.fct = buf[4];
+    frame.fp = buf[6] >> 5;
+    frame.dabMode = mid == 0 ? 4 : mid;
+    frame.fic_len = ficf ? (mid == 3 ? 128 : FIC_SIZE) : 0;
+
+    const size_t mst_start = pos;
+    const size_t mst_len = 4 * (fl - nst - 1);
+    if (mst_len < frame.fic_len) {
+        return false;
+    }
+
+    crc = CalcCRC::CalcCRC_CRC16_CCITT.Calc(buf + mst_start, mst_len);
+    if (crc != ((buf[mst_start + mst_len] << 8) | buf[mst_start + mst_len + 1])) {
+        return false;
+    }
+
+    frame.fic = buf + mst_start;
+    size_t data_pos = mst_start + frame.fic_len;
+
+    frame.streams.resize(nst);
+    for (size_t i = 0; i < nst; i++) {
+        const uint8_t *stc = buf + 8 + 4 * i;
+        auto& s = frame.streams[i];
+        s.subChId = stc[0] >> 2;
+        s.startAddr = ((stc[0] & 0x03) << 8) | stc[1];
+        s.tpl = stc[2] >> 2;
+        s.stl = ((stc[2] & 0x03) << 8) | stc[3];
+        s.data = buf + data_pos;
+        data_pos += 8 * s.stl;
+    }
+
+    return data_pos == mst_start + mst_len;
+}
+
+} // namespace eti
@@ -0,0 +1,84 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "dab-constants.h"
+
+/* The ETI(NI, G.703) frame of ETS 300 799. Each frame carries the FIC and
+ * the content of all subchannels of one CIF, in 6144 bytes. */
+namespace eti {
+
+constexpr size_t FRAME_SIZE = 6144;
+
+// Bytes of FIC per CIF, valid for all transmission modes but III
+constexpr size_t FIC_SIZE = 96;
+
+struct stream_t {
+    int subChId = 0;
+    int startAddr = 0;
+
+    // Type and protection level, see tpl_from_protection()
+    uint8_t tpl = 0;
+
+    // Length of the stream in 64-bit words
+    size_t stl = 0;
+
+    const uint8_t *data = nullptr;
+};
+
+struct frame_t {
+    // Frame count, modulo 250
+    uint8_t fct = 0;
+
+    // Frame phase, the CIF count modulo 8
+    uint8_t fp = 0;
+
+    int dabMode = 1;
+
+    const uint8_t *fic = nullptr;
+    size_t fic_len = 0;
+
+    std::vector<stream_t> streams;
+};
+
+uint8_t tpl_from_protection(const ProtectionSettings& ps);
+
+// The inverse of tpl_from_protection(), which additionally needs the bitrate
+// for short form protection. Returns false if the tpl is not valid.
+bool protection_from_tpl(uint8_t tpl, int bitrate, ProtectionSettings& ps);
+
+// Number of CIFs, and therefore ETI frames, per transmission frame
+inline int cifs_per_frame(int dabMode) { return dabMode == 2 ? 1 : (dabMode == 4 ? 2 : 4); }
+
+inline int bitrate_from_stl(size_t stl) { return stl * 8 / 3; }
+inline size_t stl_from_bitrate(int bitrate) { return bitrate * 3 / 8; }
+
+// Writes the frame to buf, which must hold FRAME_SIZE bytes. Returns false
+// if the FIC and the streams do not fit into one frame.
+bool build_frame(const frame_t& frame, uint8_t *buf);
+
+// Checks the frame in buf, and on success fills frame with pointers into buf.
+bool parse_frame(const uint8_t *buf, frame_t& frame);
+
+} // namespace eti
@@ -27,80 +27,177 @@
 #include <algorithm>
 #include <iomanip>
 #include <cstring>
+#include <type_traits>
 
 #include "fib-processor.h"
 #include "charsets.h"
 #include "MathHelper.h"
 
 FIBProcessor::FIBProcessor(RadioControllerInterface& mr) :
-    myRadioInterface(mr)
+    myRadioInterface(mr),
+    figsParsed(metrics::registry().counter("welle_fic_figs_total",
+                "Number of FIGs received", {{"result", "parsed"}})),
+    figsCached(metrics::registry().counter("welle_fic_figs_total",
+                "Number of FIGs received", {{"result", "cached"}}))
 {
     clearEnsemble();
 }
 
-//  FIB's are segments of 256 bits. When here, we already
+//  FIB's are segments of 32 bytes. When here, we already
 //  passed the crc and we start unpacking into FIGs
 //  This is merely a dispatcher
-void FIBProcessor::processFIB(uint8_t *p, uint16_t fib)
+void FIBProcessor::processFIB(const uint8_t *p, uint16_t fib)
 {
     int8_t  processedBytes  = 0;
-    uint8_t *d = p;
+    const uint8_t *d = p;
 
-    std::lock_guard<std::mutex> lock(mutex);
+    std::unique_lock<std::mutex> lock(mutex);
 
     (void)fib;
     while (processedBytes  < 30) {
-        const uint8_t FIGtype = getBits_3 (d, 0);
-        switch (FIGtype) {
-            case 0:
-                process_FIG0(d);
-                break;
+        const uint8_t FIGtype = d[0] >> 5;
+        if (FIGtype == 7) {
+            break;
+        }
 
-            case 1:
-                process_FIG1(d);
-                break;
+        const int16_t figLength = d[0] & 0x1F;
+        processFIG(d, std::min(figLength + 1, 30 - processedBytes));
 
-            case 2:
-                process_FIG2(d);
-                break;
+        processedBytes += figLength + 1;
+        d = p + processedBytes;
+    }
 
-            case 7:
-                return;
+    if (publishedVersion != databaseVersion) {
+        publishEnsemble();
 
-            default:
-                //std::clog << "FIG%d present" << FIGtype << std::endl;
-                break;
+        if (ensembleCallback) {
+            const auto e = getEnsemble();
+            lock.unlock();
+            ensembleCallback(e);
+        }
+    }
+}
+
+// FIG0/0 carries the CIF counter and FIG0/10 the date and time, they
+// change with every repetition and would only pollute the cache.
+//
+// A FIG may only be cached if everything its handler writes is covered by
+// databaseFingerprint(), otherwise a repetition that reverts a change is
+// wrongly taken from the cache. FIG0/9 also sets the local time offset,
+// which is not part of the ensemble, and is parsed every time.
+static bool is_cacheable(const uint8_t *fig, size_t figSize)
+{
+    const uint8_t FIGtype = fig[0] >> 5;
+    if (FIGtype == 0) {
+        const uint8_t extension = figSize > 1 ? fig[1] & 0x1F : 0;
+        return extension != 0 and extension != 9 and extension != 10;
+    }
+    return FIGtype <= 2;
+}
+
+// FNV-1a
+static uint64_t fig_hash(const uint8_t *data, size_t size)
+{
+    uint64_t h = 14695981039346656037ull;
+    for (size_t i = 0; i < size; i++) {
+        h ^= data[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+void FIBProcessor::processFIG(const uint8_t *d, size_t figSize)
+{
+    const uint8_t FIGtype = d[0] >> 5;
+    const bool cacheable = is_cacheable(d, figSize);
+
+    uint64_t hash = 0;
+    if (cacheable) {
+        hash = fig_hash(d, figSize);
+
+        const auto& cache = figCache[FIGtype];
+        const auto entry = cache.find(hash);
+        if (entry != cache.end() and
+                entry->second.databaseVersion == databaseVersion and
+                entry->second.bytes.compare(0, std::string::npos,
+                    reinterpret_cast<const char*>(d), figSize) == 0) {
+            figsCached.inc();
+
+            bool changed = false;
+            for (const uint32_t SId : entry->second.signalledServices) {
+                changed |= serviceSignalled(SId);
+            }
+            if (changed) {
+                databaseVersion++;
+            }
+            return;
         }
-        //  Thanks to Ronny Kunze, who discovered that I used
-        //  a p rather than a d
-        processedBytes += getBits_5 (d, 3) + 1;
-        d = p + processedBytes * 8;
+    }
+
+    figsParsed.inc();
+    signalledServices.clear();
+
+    // FIG types 0 to 2 have at least a type byte after the header
+    if (FIGtype <= 2 and figSize < 2) {
+        return;
+    }
+
+    switch (FIGtype) {
+        case 0:
+            process_FIG0(d, figSize);
+            break;
+        case 1:
+            process_FIG1(d, figSize);
+            break;
+        case 2:
+            process_FIG2(d, figSize);
+            break;
+        default:
+            //std::clog << "FIG%d present" << FIGtype << std::endl;
+            break;
+    }
+
+    if (cacheable) {
+        updateDatabaseVersion();
+
+        auto& cache = figCache[FIGtype];
+        if (cache.size() > 1024) {
+            // Content that keeps changing, e.g. corrupt FIGs that passed
+            // the CRC, must not let the cache grow without bounds.
+            cache.clear();
+        }
+
+        auto& entry = cache[hash];
+        entry.bytes.assign(reinterpret_cast<const char*>(d), figSize);
+        entry.databaseVersion = databaseVersion;
+        entry.signalledServices = signalledServices;
     }
 }
+
 //
 //  Handle ensemble is all through FIG0
 //
-void FIBProcessor::process_FIG0 (uint8_t *d)
+void FIBProcessor::process_FIG0 (const uint8_t *d, int16_t figSize)
 {
-    uint8_t extension   = getBits_5 (d, 8 + 3);
-    //uint8_t   CN  = getBits_1 (d, 8 + 0);
+    uint8_t extension   = getPackedBits(d, 8 + 3, 5);
+    //uint8_t   CN  = getPackedBits(d, 8 + 0, 1);
 
     switch (extension) {
-        case 0: FIG0Extension0 (d); break;
-        case 1: FIG0Extension1 (d); break;
-        case 2: FIG0Extension2 (d); break;
-        case 3: FIG0Extension3 (d); break;
-        case 5: FIG0Extension5 (d); break;
-        case 8: FIG0Extension8 (d); break;
-        case 9: FIG0Extension9 (d); break;
-        case 10: FIG0Extension10 (d); break;
-        case 14: FIG0Extension14 (d); break;
-        case 13: FIG0Extension13 (d); break;
-        case 17: FIG0Extension17 (d); break;
-        case 18: FIG0Extension18 (d); break;
-        case 19: FIG0Extension19 (d); break;
-        case 21: FIG0Extension21 (d); break;
-        case 22: FIG0Extension22 (d); break;
+        case 0: FIG0Extension0 (d, figSize); break;
+        case 1: FIG0Extension1 (d, figSize); break;
+        case 2: FIG0Extension2 (d, figSize); break;
+        case 3: FIG0Extension3 (d, figSize); break;
+        case 5: FIG0Extension5 (d, figSize); break;
+        case 8: FIG0Extension8 (d, figSize); break;
+        case 9: FIG0Extension9 (d, figSize); break;
+        case 10: FIG0Extension10 (d, figSize); break;
+        case 14: FIG0Extension14 (d, figSize); break;
+        case 13: FIG0Extension13 (d, figSize); break;
+        case 17: FIG0Extension17 (d, figSize); break;
+        case 18: FIG0Extension18 (d, figSize); break;
+        case 19: FIG0Extension19 (d, figSize); break;
+        case 21: FIG0Extension21 (d, figSize); break;
+        case 22: FIG0Extension22 (d, figSize); break;
         default:
             //        std::clog << "fib-processor:" << "FIG0/%d passed by\n", extension) << std::endl;
             break;
@@ -111,30 +208,34 @@ void FIBProcessor::process_FIG0 (uint8_t *d)
 //  FOG0/0 indicated a change in channel organization
 //  we are not equipped for that, so we just return
 //  control to the init
-void FIBProcessor::FIG0Extension0 (uint8_t *d)
+void FIBProcessor::FIG0Extension0 (const uint8_t *d, int16_t figSize)
 {
     uint8_t     changeflag;
     uint16_t    highpart, lowpart;
     int16_t     occurrenceChange;
-    uint8_t CN  = getBits_1 (d, 8 + 0);
+    uint8_t CN  = getPackedBits(d, 8 + 0, 1);
     (void)CN;
 
-    uint16_t eId  = getBits(d, 16, 16);
+    if (16 + 32 > 8 * figSize)
+        return;
+
+    uint16_t eId  = getPackedBits(d, 16, 16);
 
     if (ensembleId != eId) {
         ensembleId = eId;
+        databaseVersion++;
         myRadioInterface.onNewEnsemble(ensembleId);
     }
 
-    changeflag  = getBits_2 (d, 16 + 16);
-    if (changeflag == 0)
+    changeflag  = getPackedBits(d, 16 + 16, 2);
+    if (changeflag == 0 or 16 + 40 > 8 * figSize)
         return;
 
-    highpart        = getBits_5 (d, 16 + 19) % 20;
+    highpart        = getPackedBits(d, 16 + 19, 5) % 20;
     (void)highpart;
-    lowpart         = getBits_8 (d, 16 + 24) % 250;
+    lowpart         = getPackedBits(d, 16 + 24, 8) % 250;
     (void)lowpart;
-    occurrenceChange    = getBits_8 (d, 16 + 32);
+    occurrenceChange    = getPackedBits(d, 16 + 32, 8);
     (void)occurrenceChange;
 
     //  if (changeflag == 1) {
@@ -153,31 +254,39 @@ void FIBProcessor::FIG0Extension0 (uint8_t *d)
 //  FIG0 extension 1 creates a mapping between the
 //  sub channel identifications and the positions in the
 //  relevant CIF.
-void FIBProcessor::FIG0Extension1 (uint8_t *d)
+void FIBProcessor::FIG0Extension1 (const uint8_t *d, int16_t figSize)
 {
     int16_t used    = 2;        // offset in bytes
-    int16_t Length  = getBits_5 (d, 3);
-    uint8_t PD_bit  = getBits_1 (d, 8 + 2);
-    //uint8_t   CN  = getBits_1 (d, 8 + 0);
+    int16_t Length  = figSize - 1;
+    uint8_t PD_bit  = getPackedBits(d, 8 + 2, 1);
+    //uint8_t   CN  = getPackedBits(d, 8 + 0, 1);
 
     while (used < Length - 1)
-        used = HandleFIG0Extension1 (d, used, PD_bit);
+        used = HandleFIG0Extension1 (d, used, PD_bit, figSize);
 }
 
 //  defining the channels
 int16_t FIBProcessor::HandleFIG0Extension1(
-        uint8_t *d,
+        const uint8_t *d,
         int16_t offset,
-        uint8_t pd)
+        uint8_t pd,
+        int16_t figSize)
 {
     int16_t bitOffset = offset * 8;
-    const int16_t subChId   = getBits_6 (d, bitOffset);
-    const int16_t startAdr  = getBits(d, bitOffset + 6, 10);
+    // The short form has 24 bits, the long form 32
+    if (bitOffset + 24 > 8 * figSize or
+            (getPackedBits(d, bitOffset + 16, 1) == 1 and
+             bitOffset + 32 > 8 * figSize)) {
+        return figSize;
+    }
+
+    const int16_t subChId   = getPackedBits(d, bitOffset, 6);
+    const int16_t startAdr  = getPackedBits(d, bitOffset + 6, 10);
     subChannels[subChId].programmeNotData = pd;
     subChannels[subChId].subChId = subChId;
     subChannels[subChId].startAddr = startAdr;
-    if (getBits_1 (d, bitOffset + 16) == 0) {   // UEP, short form
-        int16_t tableIx = getBits_6 (d, bitOffset + 18);
+    if (getPackedBits(d, bitOffset + 16, 1) == 0) {   // UEP, short form
+        int16_t tableIx = getPackedBits(d, bitOffset + 18, 6);
         auto& ps = subChannels[subChId].protectionSettings;
         ps.uepTableIndex = tableIx;
         ps.shortForm = true;
@@ -189,7 +298,7 @@ int16_t FIBProcessor::HandleFIG0Extension1(
     else {  // EEP, long form
         auto& ps = subChannels[subChId].protectionSettings;
         ps.shortForm  = false;
-        int16_t option = getBits_3(d, bitOffset + 17);
+        int16_t option = getPackedBits(d, bitOffset + 17, 3);
         if (option == 0) {
             ps.eepProfile = EEPProtectionProfile::EEP_A;
         }
@@ -199,7 +308,7 @@ int16_t FIBProcessor::HandleFIG0Extension1(
 
         if (option == 0 or   // EEP-A protection
             option == 1) {   // EEP-B protection
-            int16_t protLevel = getBits_2(d, bitOffset + 20);
+            int16_t protLevel = getPackedBits(d, bitOffset + 20, 2);
             switch (protLevel) {
                 case 0:
                     ps.eepLevel = EEPProtectionLevel::EEP_1;
@@ -220,7 +329,7 @@ int16_t FIBProcessor::HandleFIG0Extension1(
                     break;
             }
 
-            int16_t subChanSize = getBits(d, bitOffset + 22, 10);
+            int16_t subChanSize = getPackedBits(d, bitOffset + 22, 10);
             subChannels[subChId].length = subChanSize;
         }
         else {
@@ -234,25 +343,26 @@ int16_t FIBProcessor::HandleFIG0Extension1(
     return bitOffset / 8;   // we return bytes
 }
 
-void FIBProcessor::FIG0Extension2 (uint8_t *d)
+void FIBProcessor::FIG0Extension2 (const uint8_t *d, int16_t figSize)
 {
     int16_t used    = 2;        // offset in bytes
-    int16_t Length  = getBits_5 (d, 3);
-    uint8_t PD_bit  = getBits_1 (d, 8 + 2);
-    uint8_t CN      = getBits_1 (d, 8 + 0);
+    int16_t Length  = figSize - 1;
+    uint8_t PD_bit  = getPackedBits(d, 8 + 2, 1);
+    uint8_t CN      = getPackedBits(d, 8 + 0, 1);
 
     while (used < Length) {
-        used = HandleFIG0Extension2(d, used, CN, PD_bit);
+        used = HandleFIG0Extension2(d, used, CN, PD_bit, figSize);
     }
 }
 
 //  Note Offset is in bytes
 //  With FIG0/2 we bind the channels to Service Ids
 int16_t FIBProcessor::HandleFIG0Extension2(
-        uint8_t *d,
+        const uint8_t *d,
         int16_t offset,
         uint8_t cn,
-        uint8_t pd)
+        uint8_t pd,
+        int16_t figSize)
 {
     (void)cn;
     int16_t     lOffset = 8 * offset;
@@ -262,25 +372,70 @@ int16_t FIBProcessor::HandleFIG0Extension2(
     uint32_t    SId;
     int16_t     numberofComponents;
 
+    if (lOffset + (pd == 1 ? 32 : 16) + 8 > 8 * figSize) {
+        return figSize;
+    }
+
     if (pd == 1) {      // long Sid
-        ecc = getBits_8(d, lOffset);   (void)ecc;
-        cId = getBits_4(d, lOffset + 1);
-        SId = getBits(d, lOffset, 32);
+        ecc = getPackedBits(d, lOffset, 8);   (void)ecc;
+        cId = getPackedBits(d, lOffset + 1, 4);
+        SId = getPackedBits(d, lOffset, 32);
         lOffset += 32;
     }
     else {
-        cId = getBits_4(d, lOffset);   (void)cId;
-        SId = getBits(d, lOffset + 4, 12);
-        SId = getBits(d, lOffset, 16);
+        cId = getPackedBits(d, lOffset, 4);   (void)cId;
+        SId = getPackedBits(d, lOffset + 4, 12);
+        SId = getPackedBits(d, lOffset, 16);
         lOffset += 16;
     }
 
+    signalledServices.push_back(SId);
+    serviceSignalled(SId);
+
+    numberofComponents = getPackedBits(d, lOffset + 4, 4);
+    lOffset += 8;
+
+    for (i = 0; i < numberofComponents; i ++) {
+        if (lOffset + 16 > 8 * figSize) {
+            return figSize;
+        }
+
+        uint8_t TMid    = getPackedBits(d, lOffset, 2);
+        if (TMid == 00)  {  // Audio
+            uint8_t ASCTy   = getPackedBits(d, lOffset + 2, 6);
+            uint8_t SubChId = getPackedBits(d, lOffset + 8, 6);
+            uint8_t PS_flag = getPackedBits(d, lOffset + 14, 1);
+            bindAudioService(TMid, SId, i, SubChId, PS_flag, ASCTy);
+        }
+        else if (TMid == 1) { // MSC stream data
+            uint8_t DSCTy   = getPackedBits(d, lOffset + 2, 6);
+            uint8_t SubChId = getPackedBits(d, lOffset + 8, 6);
+            uint8_t PS_flag = getPackedBits(d, lOffset + 14, 1);
+            bindDataStreamService(TMid, SId, i, SubChId, PS_flag, DSCTy);
+        }
+        else if (TMid == 3) { // MSC packet data
+            int16_t SCId    = getPackedBits(d, lOffset + 2, 12);
+            uint8_t PS_flag = getPackedBits(d, lOffset + 14, 1);
+            uint8_t CA_flag = getPackedBits(d, lOffset + 15, 1);
+            bindPacketService(TMid, SId, i, SCId, PS_flag, CA_flag);
+        }
+        else {
+            // reserved
+        }
+        lOffset += 16;
+    }
+    return lOffset / 8;     // in Bytes
+}
+
+bool FIBProcessor::serviceSignalled(uint32_t SId)
+{
     // Keep track how often we see a service using a saturating counter.
     // Every time a service is signalled, we increment the counter.
     // If the counter is >= 2, we consider the service. Every second, we
     // decrement all counters by one.
     // This avoids that misdecoded services appear and stay in the list.
     using namespace std::chrono;
+    bool changed = false;
     const auto now = steady_clock::now();
     if (timeLastServiceDecrement + seconds(1) < now) {
 
@@ -291,7 +446,8 @@ int16_t FIBProcessor::HandleFIG0Extension2(
                 ++it;
             }
             else if (it->second == 0) {
-                dropService(it->second);
+                changed |= findServiceId(it->first) != nullptr;
+                dropService(it->first);
                 it = serviceRepeatCount.erase(it);
             }
             else {
@@ -318,62 +474,40 @@ int16_t FIBProcessor::HandleFIG0Extension2(
     if (findServiceId(SId) == nullptr and serviceRepeatCount[SId] >= 2) {
         services.emplace_back(SId);
         myRadioInterface.onServiceDetected(SId);
+        changed = true;
     }
 
-    numberofComponents = getBits_4(d, lOffset + 4);
-    lOffset += 8;
-
-    for (i = 0; i < numberofComponents; i ++) {
-        uint8_t TMid    = getBits_2 (d, lOffset);
-        if (TMid == 00)  {  // Audio
-            uint8_t ASCTy   = getBits_6 (d, lOffset + 2);
-            uint8_t SubChId = getBits_6 (d, lOffset + 8);
-            uint8_t PS_flag = getBits_1 (d, lOffset + 14);
-            bindAudioService(TMid, SId, i, SubChId, PS_flag, ASCTy);
-        }
-        else if (TMid == 1) { // MSC stream data
-            uint8_t DSCTy   = getBits_6 (d, lOffset + 2);
-            uint8_t SubChId = getBits_6 (d, lOffset + 8);
-            uint8_t PS_flag = getBits_1 (d, lOffset + 14);
-            bindDataStreamService(TMid, SId, i, SubChId, PS_flag, DSCTy);
-        }
-        else if (TMid == 3) { // MSC packet data
-            int16_t SCId    = getBits (d, lOffset + 2, 12);
-            uint8_t PS_flag = getBits_1 (d, lOffset + 14);
-            uint8_t CA_flag = getBits_1 (d, lOffset + 15);
-            bindPacketService(TMid, SId, i, SCId, PS_flag, CA_flag);
-        }
-        else {
-            // reserved
-        }
-        lOffset += 16;
-    }
-    return lOffset / 8;     // in Bytes
+    return changed;
 }
 
 //      The Extension 3 of FIG type 0 (FIG 0/3) gives
 //      additional information about the service component
 //      description in packet mode.
 //      manual: page 55
-void FIBProcessor::FIG0Extension3 (uint8_t *d)
+void FIBProcessor::FIG0Extension3 (const uint8_t *d, int16_t figSize)
 {
     int16_t used    = 2;
-    int16_t Length  = getBits_5 (d, 3);
+    int16_t Length  = figSize - 1;
 
     while (used < Length)
-        used = HandleFIG0Extension3 (d, used);
+        used = HandleFIG0Extension3 (d, used, figSize);
 }
 
 //      DSCTy   DataService Component Type
-int16_t FIBProcessor::HandleFIG0Extension3(uint8_t *d, int16_t used)
+int16_t FIBProcessor::HandleFIG0Extension3(const uint8_t *d, int16_t used,
+        int16_t figSize)
 {
-    int16_t SCId            = getBits (d, used * 8, 12);
-    //int16_t CAOrgflag       = getBits_1 (d, used * 8 + 15);
-    int16_t DGflag          = getBits_1 (d, used * 8 + 16);
-    int16_t DSCTy           = getBits_6 (d, used * 8 + 18);
-    int16_t SubChId         = getBits_6 (d, used * 8 + 24);
-    int16_t packetAddress   = getBits (d, used * 8 + 30, 10);
-    //uint16_t        CAOrg   = getBits (d, used * 8 + 40, 16);
+    if (used * 8 + 40 > 8 * figSize) {
+        return figSize;
+    }
+
+    int16_t SCId            = getPackedBits(d, used * 8, 12);
+    //int16_t CAOrgflag       = getPackedBits(d, used * 8 + 15, 1);
+    int16_t DGflag          = getPackedBits(d, used * 8 + 16, 1);
+    int16_t DSCTy           = getPackedBits(d, used * 8 + 18, 6);
+    int16_t SubChId         = getPackedBits(d, used * 8 + 24, 6);
+    int16_t packetAddress   = getPackedBits(d, used * 8 + 30, 10);
+    //uint16_t        CAOrg   = getPackedBits(d, used * 8 + 40, 16);
 
     ServiceComponent *packetComp = findPacketComponent(SCId);
 
@@ -387,33 +521,38 @@ int16_t FIBProcessor::HandleFIG0Extension3(uint8_t *d, int16_t used)
     return used;
 }
 
-void FIBProcessor::FIG0Extension5 (uint8_t *d)
+void FIBProcessor::FIG0Extension5 (const uint8_t *d, int16_t figSize)
 {
     int16_t used    = 2;        // offset in bytes
-    int16_t Length  = getBits_5 (d, 3);
+    int16_t Length  = figSize - 1;
 
     while (used < Length) {
-        used = HandleFIG0Extension5 (d, used);
+        used = HandleFIG0Extension5 (d, used, figSize);
     }
 }
 
-int16_t FIBProcessor::HandleFIG0Extension5(uint8_t* d, int16_t offset)
+int16_t FIBProcessor::HandleFIG0Extension5(const uint8_t* d, int16_t offset,
+        int16_t figSize)
 {
     int16_t loffset = offset * 8;
-    uint8_t lsFlag  = getBits_1 (d, loffset);
+    uint8_t lsFlag  = getPackedBits(d, loffset, 1);
     int16_t subChId, serviceComp, language;
 
+    if (loffset + (lsFlag == 0 ? 16 : 24) > 8 * figSize) {
+        return figSize;
+    }
+
     if (lsFlag == 0) {  // short form
-        if (getBits_1 (d, loffset + 1) == 0) {
-            subChId = getBits_6 (d, loffset + 2);
-            language = getBits_8 (d, loffset + 8);
+        if (getPackedBits(d, loffset + 1, 1) == 0) {
+            subChId = getPackedBits(d, loffset + 2, 6);
+            language = getPackedBits(d, loffset + 8, 8);
             subChannels[subChId].language = language;
         }
         loffset += 16;
     }
     else {          // long form
-        serviceComp = getBits (d, loffset + 4, 12);
-        language    = getBits_8 (d, loffset + 16);
+        serviceComp = getPackedBits(d, loffset + 4, 12);
+        language    = getPackedBits(d, loffset + 16, 8);
         loffset += 24;
     }
     (void)serviceComp;
@@ -421,24 +560,30 @@ int16_t FIBProcessor::HandleFIG0Extension5(uint8_t* d, int16_t offset)
     return loffset / 8;
 }
 
-void FIBProcessor::FIG0Extension8 (uint8_t *d)
+void FIBProcessor::FIG0Extension8 (const uint8_t *d, int16_t figSize)
 {
     int16_t used    = 2;        // offset in bytes
-    int16_t Length  = getBits_5 (d, 3);
-    uint8_t PD_bit  = getBits_1 (d, 8 + 2);
+    int16_t Length  = figSize - 1;
+    uint8_t PD_bit  = getPackedBits(d, 8 + 2, 1);
 
     while (used < Length) {
-        used = HandleFIG0Extension8 (d, used, PD_bit);
+        used = HandleFIG0Extension8 (d, used, PD_bit, figSize);
     }
 }
 
 int16_t FIBProcessor::HandleFIG0Extension8(
-        uint8_t *d,
+        const uint8_t *d,
         int16_t used,
-        uint8_t pdBit)
+        uint8_t pdBit,
+        int16_t figSize)
 {
     int16_t  lOffset = used * 8;
-    uint32_t SId = getBits(d, lOffset, pdBit == 1 ? 32 : 16);
+    // Identifier, flags and the 16 bits read below
+    if (lOffset + (pdBit == 1 ? 32 : 16) + 8 + 16 > 8 * figSize) {
+        return figSize;
+    }
+
+    uint32_t SId = getPackedBits(d, lOffset, pdBit == 1 ? 32 : 16);
     uint8_t  lsFlag;
     uint16_t SCIds;
     int16_t  SCid;
@@ -447,21 +592,21 @@ int16_t FIBProcessor::HandleFIG0Extension8(
     uint8_t  extensionFlag;
 
     lOffset += pdBit == 1 ? 32 : 16;
-    extensionFlag   = getBits_1 (d, lOffset);
-    SCIds   = getBits_4 (d, lOffset + 4);
+    extensionFlag   = getPackedBits(d, lOffset, 1);
+    SCIds   = getPackedBits(d, lOffset + 4, 4);
     lOffset += 8;
 
-    lsFlag  = getBits_1 (d, lOffset + 8);
+    lsFlag  = getPackedBits(d, lOffset + 8, 1);
     if (lsFlag == 1) {
-        SCid = getBits (d, lOffset + 4, 12);
+        SCid = getPackedBits(d, lOffset + 4, 12);
         lOffset += 16;
         //           if (findPacketComponent ((SCIds << 4) | SCid) != NULL) {
         //              std::clog << "fib-processor:" << "packet component bestaat !!\n") << std::endl;
         //           }
     }
     else {
-        MSCflag = getBits_1 (d, lOffset + 1);
-        SubChId = getBits_6 (d, lOffset + 2);
+        MSCflag = getPackedBits(d, lOffset + 1, 1);
+        SubChId = getPackedBits(d, lOffset + 2, 6);
         lOffset += 8;
     }
     if (extensionFlag)
@@ -476,23 +621,29 @@ int16_t FIBProcessor::HandleFIG0Extension8(
 
 //  FIG0/9 and FIG0/10 are copied from the work of
 //  Michael Hoehn
-void FIBProcessor::FIG0Extension9(uint8_t *d)
+void FIBProcessor::FIG0Extension9(const uint8_t *d, int16_t figSize)
 {
     int16_t offset  = 16;
 
-    dateTime.hourOffset = (getBits_1 (d, offset + 2) == 1) ?
-        -1 * getBits_4 (d, offset + 3):
-        getBits_4 (d, offset + 3);
-    dateTime.minuteOffset = (getBits_1 (d, offset + 7) == 1) ? 30 : 0;
+    if (offset + 16 > 8 * figSize)
+        return;
+
+    dateTime.hourOffset = (getPackedBits(d, offset + 2, 1) == 1) ?
+        -1 * getPackedBits(d, offset + 3, 4):
+        getPackedBits(d, offset + 3, 4);
+    dateTime.minuteOffset = (getPackedBits(d, offset + 7, 1) == 1) ? 30 : 0;
     timeOffsetReceived = true;
 
-    ensembleEcc = getBits(d, offset + 8, 8);
+    ensembleEcc = getPackedBits(d, offset + 8, 8);
 }
 
-void FIBProcessor::FIG0Extension10(uint8_t *fig)
+void FIBProcessor::FIG0Extension10(const uint8_t *fig, int16_t figSize)
 {
     int16_t     offset = 16;
-    int32_t     mjd = getBits(fig, offset + 1, 17);
+    if (offset + 32 > 8 * figSize)
+        return;
+
+    int32_t     mjd = getPackedBits(fig, offset + 1, 17);
     // Convert Modified Julian Date (according to wikipedia)
     int32_t J   = mjd + 2400001;
     int32_t j   = J + 32044;
@@ -514,13 +665,14 @@ void FIBProcessor::FIG0Extension10(uint8_t *fig)
     dateTime.year = Y;
     dateTime.month = M;
     dateTime.day = D;
-    dateTime.hour = getBits_5(fig, offset + 21);
-    if (getBits_6(fig, offset + 26) != dateTime.minutes)
+    dateTime.hour = getPackedBits(fig, offset + 21, 5);
+    if ((int)getPackedBits(fig, offset + 26, 6) != dateTime.minutes)
         dateTime.seconds =  0;  // handle overflow
 
-    dateTime.minutes = getBits_6(fig, offset + 26);
-    if (fig [offset + 20] == 1) {
-        dateTime.seconds = getBits_6(fig, offset + 32);
+    dateTime.minutes = getPackedBits(fig, offset + 26, 6);
+    if (getPackedBits(fig, offset + 20, 1) == 1 and
+            offset + 48 <= 8 * figSize) {
+        dateTime.seconds = getPackedBits(fig, offset + 32, 6);
     }
 
     if (timeOffsetReceived) {
@@ -528,38 +680,50 @@ void FIBProcessor::FIG0Extension10(uint8_t *fig)
     }
 }
 
-void FIBProcessor::FIG0Extension13 (uint8_t *d)
+void FIBProcessor::FIG0Extension13 (const uint8_t *d, int16_t figSize)
 {
     int16_t used    = 2;        // offset in bytes
-    int16_t Length  = getBits_5 (d, 3);
-    uint8_t PD_bit  = getBits_1 (d, 8 + 2);
+    int16_t Length  = figSize - 1;
+    uint8_t PD_bit  = getPackedBits(d, 8 + 2, 1);
 
     while (used < Length) {
-        used = HandleFIG0Extension13 (d, used, PD_bit);
+        used = HandleFIG0Extension13 (d, used, PD_bit, figSize);
     }
 }
 
 int16_t FIBProcessor::HandleFIG0Extension13(
-        uint8_t *d,
+        const uint8_t *d,
         int16_t used,
-        uint8_t pdBit)
+        uint8_t pdBit,
+        int16_t figSize)
 {
     int16_t  lOffset = used * 8;
-    uint32_t SId = getBits(d, lOffset, pdBit == 1 ? 32 : 16);
+    if (lOffset + (pdBit == 1 ? 32 : 16) + 8 > 8 * figSize) {
+        return figSize;
+    }
+
+    uint32_t SId = getPackedBits(d, lOffset, pdBit == 1 ? 32 : 16);
     uint16_t SCIds;
     int16_t  NoApplications;
     int16_t  i;
 
     lOffset     += pdBit == 1 ? 32 : 16;
-    SCIds       = getBits_4 (d, lOffset);
-    NoApplications = getBits_4 (d, lOffset + 4);
+    SCIds       = getPackedBits(d, lOffset, 4);
+    NoApplications = getPackedBits(d, lOffset + 4, 4);
     lOffset += 8;
 
 //    std::clog << "fib-processor: HandleFIG0Extension13 NoApplications " << NoApplications << " ";
 
     for (i = 0; i < NoApplications; i++) {
-        int16_t appType = getBits (d, lOffset, 11);
-        int16_t length  = getBits_5 (d, lOffset + 11);
+        if (lOffset + 16 > 8 * figSize) {
+            return figSize;
+        }
+
+        int16_t appType = getPackedBits(d, lOffset, 11);
+        int16_t length  = getPackedBits(d, lOffset + 11, 5);
+        if (lOffset + 16 + 8 * length > 8 * figSize) {
+            return figSize;
+        }
         lOffset += (11 + 5 + 8 * length);
 //        std::clog << " ";
         switch (appType) {
@@ -606,14 +770,14 @@ int16_t FIBProcessor::HandleFIG0Extension13(
     return lOffset / 8;
 }
 
-void FIBProcessor::FIG0Extension14 (uint8_t *d)
+void FIBProcessor::FIG0Extension14 (const uint8_t *d, int16_t figSize)
 {
-    int16_t length = getBits_5 (d, 3); // in Bytes
+    int16_t length = figSize - 1; // in Bytes
     int16_t used   = 2; // in Bytes
 
     while (used < length) {
-        int16_t subChId = getBits_6 (d, used * 8);
-        uint8_t fecScheme = getBits_2 (d, used * 8 + 6);
+        int16_t subChId = getPackedBits(d, used * 8, 6);
+        uint8_t fecScheme = getPackedBits(d, used * 8 + 6, 2);
         used = used + 1;
 
         for (int i = 0; i < 64; i++) {
@@ -625,28 +789,34 @@ void FIBProcessor::FIG0Extension14 (uint8_t *d)
     }
 }
 
-void FIBProcessor::FIG0Extension17(uint8_t *d)
+void FIBProcessor::FIG0Extension17(const uint8_t *d, int16_t figSize)
 {
-    int16_t length  = getBits_5 (d, 3);
+    int16_t length  = figSize - 1;
     int16_t offset  = 16;
     Service *s;
 
     while (offset < length * 8) {
-        uint16_t    SId = getBits (d, offset, 16);
-        bool    L_flag  = getBits_1 (d, offset + 18);
-        bool    CC_flag = getBits_1 (d, offset + 19);
+        if (offset + 32 > 8 * figSize)
+            break;
+
+        uint16_t    SId = getPackedBits(d, offset, 16);
+        bool    L_flag  = getPackedBits(d, offset + 18, 1);
+        bool    CC_flag = getPackedBits(d, offset + 19, 1);
+        if (L_flag and offset + 40 > 8 * figSize)
+            break;
+
         int16_t type;
         int16_t Language = 0x00;    // init with unknown language
         s = findServiceId(SId);
         if (L_flag) {       // language field present
-            Language = getBits_8 (d, offset + 24);
+            Language = getPackedBits(d, offset + 24, 8);
             if (s) {
                 s->language = Language;
             }
             offset += 8;
         }
 
-        type = getBits_5 (d, offset + 27);
+        type = getPackedBits(d, offset + 27, 5);
         if (s) {
             s->programType = type;
         }
@@ -659,16 +829,19 @@ void FIBProcessor::FIG0Extension17(uint8_t *d)
     }
 }
 
-void FIBProcessor::FIG0Extension18(uint8_t *d)
+void FIBProcessor::FIG0Extension18(const uint8_t *d, int16_t figSize)
 {
     int16_t  offset  = 16;       // bits
     uint16_t SId, AsuFlags;
-    int16_t  Length  = getBits_5 (d, 3);
+    int16_t  Length  = figSize - 1;
 
     while (offset / 8 < Length - 1 ) {
-        int16_t NumClusters = getBits_5 (d, offset + 35);
-        SId = getBits (d, offset, 16);
-        AsuFlags = getBits (d, offset + 16, 16);
+        if (offset + 40 > 8 * figSize)
+            break;
+
+        int16_t NumClusters = getPackedBits(d, offset + 35, 5);
+        SId = getPackedBits(d, offset, 16);
+        AsuFlags = getPackedBits(d, offset + 16, 16);
         //     std::clog << "fib-processor:" << "Announcement %d for SId %d with %d clusters\n",
         //                      AsuFlags, SId, NumClusters) << std::endl;
         offset += 40 + NumClusters * 8;
@@ -677,26 +850,31 @@ void FIBProcessor::FIG0Extension18(uint8_t *d)
     (void)AsuFlags;
 }
 
-void FIBProcessor::FIG0Extension19(uint8_t *d)
+void FIBProcessor::FIG0Extension19(const uint8_t *d, int16_t figSize)
 {
     int16_t  offset  = 16;       // bits
-    int16_t  Length  = getBits_5 (d, 3);
+    int16_t  Length  = figSize - 1;
     uint8_t  region_Id_Lower;
 
     while (offset / 8 < Length - 1) {
-        uint8_t clusterId   = getBits_8 (d, offset);
-        bool    new_flag    = getBits_1(d, offset + 24);
-        bool    region_flag = getBits_1 (d, offset + 25);
-        uint8_t subChId     = getBits_6 (d, offset + 26);
+        if (offset + 32 > 8 * figSize)
+            break;
+
+        uint8_t clusterId   = getPackedBits(d, offset, 8);
+        bool    new_flag    = getPackedBits(d, offset + 24, 1);
+        bool    region_flag = getPackedBits(d, offset + 25, 1);
+        uint8_t subChId     = getPackedBits(d, offset + 26, 6);
 
-        uint16_t aswFlags = getBits (d, offset + 8, 16);
+        uint16_t aswFlags = getPackedBits(d, offset + 8, 16);
         //     std::clog << "fib-processor:" <<
         //            "%s %s Announcement %d for Cluster %2u on SubCh %2u ",
         //                ((new_flag==1)?"new":"old"),
         //                ((region_flag==1)?"regional":""),
         //                aswFlags, clusterId,subChId) << std::endl;
         if (region_flag) {
-            region_Id_Lower = getBits_6 (d, offset + 34);
+            if (offset + 40 > 8 * figSize)
+                break;
+            region_Id_Lower = getPackedBits(d, offset + 34, 6);
             offset += 40;
             //           fprintf(stderr,"for region %u",region_Id_Lower);
         }
@@ -713,36 +891,45 @@ void FIBProcessor::FIG0Extension19(uint8_t *d)
     (void)region_Id_Lower;
 }
 
-void FIBProcessor::FIG0Extension21(uint8_t *d)
+void FIBProcessor::FIG0Extension21(const uint8_t *d, int16_t figSize)
 {
     //  std::clog << "fib-processor:" << "Frequency information\n") << std::endl;
     (void)d;
+    (void)figSize;
 }
 
-void FIBProcessor::FIG0Extension22(uint8_t *d)
+void FIBProcessor::FIG0Extension22(const uint8_t *d, int16_t figSize)
 {
-    int16_t Length  = getBits_5 (d, 3);
+    int16_t Length  = figSize - 1;
     int16_t offset  = 16;       // on bits
     int16_t used    = 2;
 
     while (used < Length) {
-        used = HandleFIG0Extension22 (d, used);
+        used = HandleFIG0Extension22 (d, used, figSize);
     }
     (void)offset;
 }
 
-int16_t FIBProcessor::HandleFIG0Extension22(uint8_t *d, int16_t used)
+int16_t FIBProcessor::HandleFIG0Extension22(const uint8_t *d, int16_t used,
+        int16_t figSize)
 {
     uint8_t MS;
     int16_t mainId;
     int16_t noSubfields;
 
-    mainId  = getBits_7 (d, used * 8 + 1);
+    if (used * 8 + 16 > 8 * figSize) {
+        return figSize;
+    }
+
+    mainId  = getPackedBits(d, used * 8 + 1, 7);
     (void)mainId;
-    MS  = getBits_1 (d, used * 8);
+    MS  = getPackedBits(d, used * 8, 1);
     if (MS == 0) {      // fixed size
-        int16_t latitudeCoarse = getBits (d, used * 8 + 8, 16);
-        int16_t longitudeCoarse = getBits (d, used * 8 + 24, 16);
+        if (used * 8 + 40 > 8 * figSize) {
+            return figSize;
+        }
+        int16_t latitudeCoarse = getPackedBits(d, used * 8 + 8, 16);
+        int16_t longitudeCoarse = getPackedBits(d, used * 8 + 24, 16);
         //     std::clog << "fib-processor:" << "Id = %d, (%d %d)\n", mainId,
         //                                latitudeCoarse, longitudeCoarse) << std::endl;
         (void)latitudeCoarse;
@@ -751,7 +938,7 @@ int16_t FIBProcessor::HandleFIG0Extension22(uint8_t *d, int16_t used)
     }
     //  MS == 1
 
-    noSubfields = getBits_3 (d, used * 8 + 13);
+    noSubfields = getPackedBits(d, used * 8 + 13, 3);
     //  std::clog << "fib-processor:" << "Id = %d, subfields = %d\n", mainId, noSubfields) << std::endl;
     used += (16 + noSubfields * 48) / 8;
 
@@ -759,7 +946,7 @@ int16_t FIBProcessor::HandleFIG0Extension22(uint8_t *d, int16_t used)
 }
 
 //  FIG 1 - Labels
-void FIBProcessor::process_FIG1(uint8_t *d)
+void FIBProcessor::process_FIG1(const uint8_t *d, int16_t figSize)
 {
     uint32_t    SId = 0;
     int16_t     offset = 0;
@@ -770,9 +957,9 @@ void FIBProcessor::process_FIG1(uint8_t *d)
     char        label[17];
 
     // FIG 1 first byte
-    const uint8_t charSet = getBits_4(d, 8);
-    const uint8_t oe = getBits_1(d, 8 + 4);
-    const uint8_t extension = getBits_3(d, 8 + 5);
+    const uint8_t charSet = getPackedBits(d, 8, 4);
+    const uint8_t oe = getPackedBits(d, 8 + 4, 1);
+    const uint8_t extension = getPackedBits(d, 8 + 5, 3);
     label[16]  = 0x00;
     if (oe == 1) {
         return;
@@ -781,15 +968,18 @@ void FIBProcessor::process_FIG1(uint8_t *d)
     switch (extension) {
         case 0: // ensemble label
             {
-                const uint32_t EId = getBits(d, 16, 16);
+                if (32 + 128 + 16 > 8 * figSize) {
+                    return;
+                }
+                const uint32_t EId = getPackedBits(d, 16, 16);
                 offset = 32;
                 for (int i = 0; i < 16; i ++) {
-                    label[i] = getBits_8 (d, offset);
+                    label[i] = getPackedBits(d, offset, 8);
                     offset += 8;
                 }
                 // std::clog << "fib-processor:" << "Ensemblename: " << label << std::endl;
                 if (!oe and EId == ensembleId) {
-                    ensembleLabel.fig1_flag = getBits(d, offset, 16);
+                    ensembleLabel.fig1_flag = getPackedBits(d, offset, 16);
                     ensembleLabel.fig1_label = label;
                     ensembleLabel.setCharset(charSet);
                     myRadioInterface.onSetEnsembleLabel(ensembleLabel);
@@ -798,15 +988,18 @@ void FIBProcessor::process_FIG1(uint8_t *d)
             }
 
         case 1: // 16 bit Identifier field for service label
-            SId = getBits(d, 16, 16);
+            if (32 + 128 + 16 > 8 * figSize) {
+                return;
+            }
+            SId = getPackedBits(d, 16, 16);
             offset  = 32;
             service = findServiceId(SId);
             if (service) {
                 for (int i = 0; i < 16; i++) {
-                    label[i] = getBits_8(d, offset);
+                    label[i] = getPackedBits(d, offset, 8);
                     offset += 8;
                 }
-                service->serviceLabel.fig1_flag = getBits(d, offset, 16);
+                service->serviceLabel.fig1_flag = getPackedBits(d, offset, 16);
                 service->serviceLabel.fig1_label = label;
                 service->serviceLabel.setCharset(charSet);
                 // std::clog << "fib-processor:" << "FIG1/1: SId = %4x\t%s\n", SId, label) << std::endl;
@@ -815,10 +1008,10 @@ void FIBProcessor::process_FIG1(uint8_t *d)
 
         /*
         case 3: // Region label
-            //uint8_t region_id = getBits_6 (d, 16 + 2);
+            //uint8_t region_id = getPackedBits(d, 16 + 2, 6);
             offset = 24;
             for (int i = 0; i < 16; i ++) {
-                label[i] = getBits_8 (d, offset + 8 * i);
+                label[i] = getPackedBits(d, offset + 8 * i, 8);
             }
 
             //        std::clog << "fib-processor:" << "FIG1/3: RegionID = %2x\t%s\n", region_id, label) << std::endl;
@@ -826,25 +1019,27 @@ void FIBProcessor::process_FIG1(uint8_t *d)
         */
 
         case 4: // Component label
-            pd_flag = getBits(d, 16, 1);
-            SCidS   = getBits(d, 20, 4);
+            pd_flag = getPackedBits(d, 16, 1);
+            SCidS   = getPackedBits(d, 20, 4);
             if (pd_flag) {  // 32 bit identifier field for service component label
-                SId = getBits(d, 24, 32);
                 offset  = 56;
             }
             else {  // 16 bit identifier field for service component label
-                SId = getBits(d, 24, 16);
                 offset  = 40;
             }
+            if (offset + 128 + 16 > 8 * figSize) {
+                return;
+            }
+            SId = getPackedBits(d, 24, pd_flag ? 32 : 16);
 
             for (int i = 0; i < 16; i ++) {
-                label[i] = getBits_8 (d, offset);
+                label[i] = getPackedBits(d, offset, 8);
                 offset += 8;
             }
 
             component = findComponent(SId, SCidS);
             if (component) {
-                component->componentLabel.fig1_flag = getBits(d, offset, 16);
+                component->componentLabel.fig1_flag = getPackedBits(d, offset, 16);
                 component->componentLabel.setCharset(charSet);
                 component->componentLabel.fig1_label = label;
             }
@@ -854,15 +1049,18 @@ void FIBProcessor::process_FIG1(uint8_t *d)
 
 
         case 5: // 32 bit Identifier field for service label
-            SId = getBits(d, 16, 32);
+            if (48 + 128 + 16 > 8 * figSize) {
+                return;
+            }
+            SId = getPackedBits(d, 16, 32);
             offset  = 48;
             service = findServiceId(SId);
             if (service) {
                 for (int i = 0; i < 16; i ++) {
-                    label[i] = getBits_8(d, offset);
+                    label[i] = getPackedBits(d, offset, 8);
                     offset += 8;
                 }
-                service->serviceLabel.fig1_flag = getBits(d, offset, 16);
+                service->serviceLabel.fig1_flag = getPackedBits(d, offset, 16);
                 service->serviceLabel.fig1_label = label;
                 service->serviceLabel.setCharset(charSet);
 
@@ -875,21 +1073,21 @@ void FIBProcessor::process_FIG1(uint8_t *d)
         /*
         case 6: // XPAD label
             uint8_t XPAD_aid;
-            pd_flag = getBits(d, 16, 1);
-            SCidS   = getBits(d, 20, 4);
+            pd_flag = getPackedBits(d, 16, 1);
+            SCidS   = getPackedBits(d, 20, 4);
             if (pd_flag) {  // 32 bits identifier for XPAD label
-                SId       = getBits(d, 24, 32);
-                XPAD_aid  = getBits(d, 59, 5);
+                SId       = getPackedBits(d, 24, 32);
+                XPAD_aid  = getPackedBits(d, 59, 5);
                 offset    = 64;
             }
             else {  // 16 bit identifier for XPAD label
-                SId       = getBits(d, 24, 16);
-                XPAD_aid  = getBits(d, 43, 5);
+                SId       = getPackedBits(d, 24, 16);
+                XPAD_aid  = getPackedBits(d, 43, 5);
                 offset    = 48;
             }
 
             for (int i = 0; i < 16; i ++) {
-                label[i] = getBits_8 (d, offset + 8 * i);
+                label[i] = getPackedBits(d, offset + 8 * i, 8);
             }
 
             // fprintf(stderr, "fib-processor:"
@@ -960,18 +1158,12 @@ static void handle_ext_label_data_field(const uint8_t *f, uint8_t len_bytes,
 }
 
 // UTF-8 or UCS2 Labels
-void FIBProcessor::process_FIG2(uint8_t *d)
+void FIBProcessor::process_FIG2(const uint8_t *d, int16_t figSize)
 {
-    // In order to reuse code with etisnoop, convert
-    // the bit-vector into a byte-vector
-    std::vector<uint8_t> fig_bytes;
-    for (size_t i = 0; i < 30; i++) {
-        fig_bytes.push_back(getBits_8(d, 8*i));
-    }
+    // The FIB is already a byte-vector, as in etisnoop
+    const uint8_t *f = d;
 
-    uint8_t *f = fig_bytes.data();
-
-    const uint8_t figlen = f[0] & 0x1F;
+    const uint8_t figlen = figSize - 1;
     f++;
 
     const uint8_t toggle_flag = (f[0] & 0x80) >> 7;
@@ -989,7 +1181,7 @@ void FIBProcessor::process_FIG2(uint8_t *d)
             break;
         case 4: // Service component label
             {
-                uint8_t pd = (f[1] & 0x80) >> 7;
+                uint8_t pd = figlen > 1 ? (f[1] & 0x80) >> 7 : 0;
                 identifier_len = (pd == 0) ? 3 : 5;
                 break;
             }
@@ -1002,6 +1194,11 @@ void FIBProcessor::process_FIG2(uint8_t *d)
 
     const size_t header_length = 1; // FIG data field header
 
+    if (figlen <= header_length + identifier_len) {
+        std::clog << "FIG2/" << ext << " length error " << (int)figlen << std::endl;
+        return;
+    }
+
     const uint8_t *figdata = f + header_length + identifier_len;
     const size_t data_len_bytes = figlen - header_length - identifier_len;
 
@@ -1011,10 +1208,7 @@ void FIBProcessor::process_FIG2(uint8_t *d)
         case 0: // Ensemble label
             {   // ETSI EN 300 401 8.1.13
                 uint16_t eid = f[1] * 256 + f[2];
-                if (figlen <= header_length + identifier_len) {
-                    std::clog << "FIG2/0 length error " << (int)figlen << std::endl;
-                }
-                else if (eid == ensembleId) {
+                if (eid == ensembleId) {
                     handle_ext_label_data_field(figdata, data_len_bytes,
                             toggle_flag, segment_index, rfu, ensembleLabel);
                 }
@@ -1024,15 +1218,10 @@ void FIBProcessor::process_FIG2(uint8_t *d)
         case 1: // Programme service label
             {   // ETSI EN 300 401 8.1.14.1
                 uint16_t sid = f[1] * 256 + f[2];
-                if (figlen <= header_length + identifier_len) {
-                    std::clog << "FIG2/1 length error " << (int)figlen << std::endl;
-                }
-                else {
-                    auto *service = findServiceId(sid);
-                    if (service) {
-                        handle_ext_label_data_field(figdata, data_len_bytes,
-                                toggle_flag, segment_index, rfu, service->serviceLabel);
-                    }
+                auto *service = findServiceId(sid);
+                if (service) {
+                    handle_ext_label_data_field(figdata, data_len_bytes,
+                            toggle_flag, segment_index, rfu, service->serviceLabel);
                 }
             }
             break;
@@ -1052,15 +1241,10 @@ void FIBProcessor::process_FIG2(uint8_t *d)
                           ((uint32_t)f[4] << 8) |
                           ((uint32_t)f[5]);
                 }
-                if (figlen <= header_length + identifier_len) {
-                    std::clog << "FIG2/4 length error " << (int)figlen << std::endl;
-                }
-                else {
-                    auto *component = findComponent(sid, SCIdS);
-                    if (component) {
-                        handle_ext_label_data_field(figdata, data_len_bytes,
-                                toggle_flag, segment_index, rfu, component->componentLabel);
-                    }
+                auto *component = findComponent(sid, SCIdS);
+                if (component) {
+                    handle_ext_label_data_field(figdata, data_len_bytes,
+                            toggle_flag, segment_index, rfu, component->componentLabel);
                 }
             }
             break;
@@ -1073,15 +1257,10 @@ void FIBProcessor::process_FIG2(uint8_t *d)
                     ((uint32_t)f[3] << 8) |
                     ((uint32_t)f[4]);
 
-                if (figlen <= header_length + identifier_len) {
-                    std::clog << "FIG2/5 length error " << (int)figlen << std::endl;
-                }
-                else {
-                    auto *service = findServiceId(sid);
-                    if (service) {
-                        handle_ext_label_data_field(figdata, data_len_bytes,
-                                toggle_flag, segment_index, rfu, service->serviceLabel);
-                    }
+                auto *service = findServiceId(sid);
+                if (service) {
+                    handle_ext_label_data_field(figdata, data_len_bytes,
+                            toggle_flag, segment_index, rfu, service->serviceLabel);
                 }
             }
             break;
@@ -1262,29 +1441,168 @@ void FIBProcessor::dropService(uint32_t SId)
 void FIBProcessor::clearEnsemble()
 {
     std::lock_guard<std::mutex> lock(mutex);
+    ensembleId = 0;
+    ensembleEcc = 0;
+    ensembleLabel = DabLabel();
     components.clear();
-    subChannels.resize(64);
+    subChannels.assign(64, Subchannel());
     services.clear();
     serviceRepeatCount.clear();
     timeLastServiceDecrement = std::chrono::steady_clock::now();
+
+    for (auto& cache : figCache) {
+        cache.clear();
+    }
+    databaseVersion++;
+    publishEnsemble();
 }
 
-std::vector<Service> FIBProcessor::getServiceList() const
+// FNV-1a over everything the FIGs can write into the database
+class Fingerprint {
+    public:
+        template<typename T>
+        void add(const T& value) {
+            static_assert(std::is_integral<T>::value or std::is_enum<T>::value,
+                    "Fingerprint only takes integers");
+            const auto *p = reinterpret_cast<const uint8_t*>(&value);
+            add(p, sizeof(T));
+        }
+
+        void add(const std::string& s) { add(s.size()); add(s.data(), s.size()); }
+        void add(const std::vector<uint8_t>& v) { add(v.size()); add(v.data(), v.size()); }
+
+        void add(const DabLabel& l) {
+            add(l.charset);
+            add(l.fig1_label);
+            add(l.fig1_flag);
+            add(l.segments.size());
+            for (const auto& seg : l.segments) {
+                add(seg.first);
+                add(seg.second);
+            }
+            add(l.segment_count);
+            add(l.extended_label_charset);
+            add(l.toggle_flag);
+            add(l.fig2_rfu);
+        }
+
+        uint64_t get() const { return hash; }
+
+    private:
+        void add(const void *data, size_t size) {
+            const auto *p = reinterpret_cast<const uint8_t*>(data);
+            for (size_t i = 0; i < size; i++) {
+                hash ^= p[i];
+                hash *= 1099511628211ull;
+            }
+        }
+
+        uint64_t hash = 14695981039346656037ull;
+};
+
+uint64_t FIBProcessor::databaseFingerprint() const
 {
-    std::lock_guard<std::mutex> lock(mutex);
-    return services;
+    Fingerprint fp;
+    fp.add(ensembleId);
+    fp.add(ensembleEcc);
+    fp.add(ensembleLabel);
+
+    for (const auto& s : services) {
+        fp.add(s.serviceId);
+        fp.add(s.serviceLabel);
+        fp.add(s.language);
+        fp.add(s.programType);
+    }
+
+    for (const auto& c : components) {
+        fp.add(c.TMid);
+        fp.add(c.SId);
+        fp.add(c.componentNr);
+        fp.add(c.componentLabel);
+        fp.add(c.ASCTy);
+        fp.add(c.PS_flag);
+        fp.add(c.subchannelId);
+        fp.add(c.SCId);
+        fp.add(c.CAflag);
+        fp.add(c.DSCTy);
+        fp.add(c.DGflag);
+        fp.add(c.packetAddress);
+    }
+
+    for (const auto& sub : subChannels) {
+        fp.add(sub.subChId);
+        fp.add(sub.startAddr);
+        fp.add(sub.length);
+        fp.add(sub.programmeNotData);
+        fp.add(sub.protectionSettings.shortForm);
+        fp.add(sub.protectionSettings.uepTableIndex);
+        fp.add(sub.protectionSettings.uepLevel);
+        fp.add(sub.protectionSettings.eepProfile);
+        fp.add(sub.protectionSettings.eepLevel);
+        fp.add(sub.language);
+        fp.add(sub.fecScheme);
+    }
+
+    return fp.get();
 }
 
-Service FIBProcessor::getService(uint32_t sId) const
+// Called after a FIG was parsed. Hashing the database is much cheaper
+// than tracking every assignment in the FIG handlers, and only happens
+// for FIGs that missed the cache.
+void FIBProcessor::updateDatabaseVersion()
 {
-    std::lock_guard<std::mutex> lock(mutex);
+    const uint64_t fingerprint = databaseFingerprint();
+    if (fingerprint != lastFingerprint) {
+        lastFingerprint = fingerprint;
+        databaseVersion++;
+    }
+}
 
-    auto srv = std::find_if(services.begin(), services.end(),
-                [&](const Service& s) {
-                    return s.serviceId == sId;
-                });
+uint32_t FIBProcessor::getDatabaseVersion() const
+{
+    return databaseVersion;
+}
+
+// Called with the mutex held
+void FIBProcessor::publishEnsemble()
+{
+    auto e = std::make_shared<Ensemble>();
+    e->version = databaseVersion;
+    e->id = ensembleId;
+    e->ecc = ensembleEcc;
+    e->label = ensembleLabel;
+    e->services = services;
+    e->components = components;
+    e->subchannels = subChannels;
+    e->buildIndex();
+
+    publishedVersion = e->version;
+
+    std::lock_guard<std::mutex> lock(ensembleMutex);
+    ensemble = std::move(e);
+}
 
-    if (srv != services.end()) {
+void FIBProcessor::setEnsembleCallback(ensemble_callback_t callback)
+{
+    ensembleCallback = callback;
+}
+
+ensemble_ptr FIBProcessor::getEnsemble() const
+{
+    std::lock_guard<std::mutex> lock(ensembleMutex);
+    return ensemble;
+}
+
+std::vector<Service> FIBProcessor::getServiceList() const
+{
+    return getEnsemble()->services;
+}
+
+Service FIBProcessor::getService(uint32_t sId) const
+{
+    const auto e = getEnsemble();
+    const auto srv = e->findService(sId);
+    if (srv) {
         return *srv;
     }
     else {
@@ -1295,11 +1613,9 @@ Service FIBProcessor::getService(uint32_t sId) const
 std::list<ServiceComponent> FIBProcessor::getComponents(const Service& s) const
 {
     std::list<ServiceComponent> c;
-    std::lock_guard<std::mutex> lock(mutex);
-    for (const auto& component : components) {
-        if (component.SId == s.serviceId) {
-            c.push_back(component);
-        }
+    const auto e = getEnsemble();
+    for (const auto component : e->findComponents(s.serviceId)) {
+        c.push_back(*component);
     }
 
     return c;
@@ -1307,24 +1623,36 @@ std::list<ServiceComponent> FIBProcessor::getComponents(const Service& s) const
 
 Subchannel FIBProcessor::getSubchannel(const ServiceComponent& sc) const
 {
-    std::lock_guard<std::mutex> lock(mutex);
-    return subChannels.at(sc.subchannelId);
+    return getEnsemble()->subchannels.at(sc.subchannelId);
+}
+
+std::vector<Subchannel> FIBProcessor::getSubchannels() const
+{
+    std::vector<Subchannel> subs;
+    for (const auto& sub : getEnsemble()->subchannels) {
+        if (sub.valid()) {
+            subs.push_back(sub);
+        }
+    }
+
+    std::sort(subs.begin(), subs.end(),
+            [](const Subchannel& a, const Subchannel& b) {
+                return a.startAddr < b.startAddr;
+            });
+    return subs;
 }
 
 uint16_t FIBProcessor::getEnsembleId() const
 {
-    std::lock_guard<std::mutex> lock(mutex);
-    return ensembleId;
+    return getEnsemble()->id;
 }
 
 uint8_t FIBProcessor::getEnsembleEcc() const
 {
-    std::lock_guard<std::mutex> lock(mutex);
-    return ensembleEcc;
+    return getEnsemble()->ecc;
 }
 
 DabLabel FIBProcessor::getEnsembleLabel() const
 {
-    std::lock_guard<std::mutex> lock(mutex);
-    return ensembleLabel;
+    return getEnsemble()->label;
 }
@@ -30,21 +30,28 @@
 #include <unordered_map>
 #include <chrono>
 #include <array>
+#include <atomic>
 #include <mutex>
+#include <string>
 #include <cstdint>
 #include <cstdio>
+#include <functional>
 #include "msc-handler.h"
 #include "radio-controller.h"
+#include "ensemble.h"
+#include "metrics.h"
 
 class FIBProcessor {
     public:
         FIBProcessor(RadioControllerInterface& mr);
 
-        // called from the demodulator
-        void processFIB(uint8_t *p, uint16_t fib);
+        // called from the demodulator, with the 32 bytes of a FIB
+        void processFIB(const uint8_t *p, uint16_t fib);
         void clearEnsemble();
 
-        // Called from the frontend
+        // Called from the frontend. None of these wait for the FIC thread,
+        // they all read the latest published snapshot of the ensemble.
+        ensemble_ptr getEnsemble() const;
         uint16_t getEnsembleId() const;
         uint8_t getEnsembleEcc() const;
         DabLabel getEnsembleLabel() const;
@@ -53,6 +60,19 @@ class FIBProcessor {
         std::list<ServiceComponent> getComponents(const Service& s) const;
         Subchannel getSubchannel(const ServiceComponent& sc) const;
 
+        // All subchannels in use, ordered by start address
+        std::vector<Subchannel> getSubchannels() const;
+
+        // Incremented every time the ensemble database (services, components,
+        // subchannels and labels) changes. Consumers can compare it with the
+        // value they saw last to avoid rebuilding their view of the ensemble.
+        uint32_t getDatabaseVersion() const;
+
+        // Called from the FIC thread after a new snapshot of the ensemble
+        // has been published. Must be set before the FIC is processed.
+        using ensemble_callback_t = std::function<void(const ensemble_ptr&)>;
+        void setEnsembleCallback(ensemble_callback_t callback);
+
     private:
         RadioControllerInterface& myRadioInterface;
         Service *findServiceId(uint32_t serviceId);
@@ -85,39 +105,55 @@ class FIBProcessor {
 
         void dropService(uint32_t SId);
 
-        void process_FIG0(uint8_t *);
-        void process_FIG1(uint8_t *);
-        void process_FIG2(uint8_t *);
-        void FIG0Extension0(uint8_t *);
-        void FIG0Extension1(uint8_t *);
-        void FIG0Extension2(uint8_t *);
-        void FIG0Extension3(uint8_t *);
-        void FIG0Extension5(uint8_t *);
-        void FIG0Extension8(uint8_t *);
-        void FIG0Extension9(uint8_t *);
-        void FIG0Extension10(uint8_t *);
-        void FIG0Extension13(uint8_t *);
-        void FIG0Extension14(uint8_t *);
-        void FIG0Extension16(uint8_t *);
-        void FIG0Extension17(uint8_t *);
-        void FIG0Extension18(uint8_t *);
-        void FIG0Extension19(uint8_t *);
-        void FIG0Extension21(uint8_t *);
-        void FIG0Extension22(uint8_t *);
-
-        int16_t HandleFIG0Extension1(uint8_t *d, int16_t offset, uint8_t pd);
+        // Liveness of the services signalled in FIG0/2. Returns true if
+        // the service list changed.
+        bool serviceSignalled(uint32_t SId);
+
+        void processFIG(const uint8_t *d, size_t figSize);
+        uint64_t databaseFingerprint() const;
+        void updateDatabaseVersion();
+        void publishEnsemble();
+
+        // The handlers get the size of the FIG in bytes, header included,
+        // and do not read past it. The Handle functions return the offset
+        // of the next entry, or figSize if the entry is truncated.
+        void process_FIG0(const uint8_t *d, int16_t figSize);
+        void process_FIG1(const uint8_t *d, int16_t figSize);
+        void process_FIG2(const uint8_t *d, int16_t figSize);
+        void FIG0Extension0(const uint8_t *d, int16_t figSize);
+        void FIG0Extension1(const uint8_t *d, int16_t figSize);
+        void FIG0Extension2(const uint8_t *d, int16_t figSize);
+        void FIG0Extension3(const uint8_t *d, int16_t figSize);
+        void FIG0Extension5(const uint8_t *d, int16_t figSize);
+        void FIG0Extension8(const uint8_t *d, int16_t figSize);
+        void FIG0Extension9(const uint8_t *d, int16_t figSize);
+        void FIG0Extension10(const uint8_t *d, int16_t figSize);
+        void FIG0Extension13(const uint8_t *d, int16_t figSize);
+        void FIG0Extension14(const uint8_t *d, int16_t figSize);
+        void FIG0Extension16(const uint8_t *d, int16_t figSize);
+        void FIG0Extension17(const uint8_t *d, int16_t figSize);
+        void FIG0Extension18(const uint8_t *d, int16_t figSize);
+        void FIG0Extension19(const uint8_t *d, int16_t figSize);
+        void FIG0Extension21(const uint8_t *d, int16_t figSize);
+        void FIG0Extension22(const uint8_t *d, int16_t figSize);
+
+        int16_t HandleFIG0Extension1(const uint8_t *d, int16_t offset,
+                uint8_t pd, int16_t figSize);
 
         int16_t HandleFIG0Extension2(
-                uint8_t *d,
+                const uint8_t *d,
                 int16_t offset,
                 uint8_t cn,
-                uint8_t pd);
+                uint8_t pd,
+                int16_t figSize);
 
-        int16_t HandleFIG0Extension3(uint8_t *d, int16_t used);
-        int16_t HandleFIG0Extension5(uint8_t *d, int16_t offset);
-        int16_t HandleFIG0Extension8(uint8_t *d, int16_t used, uint8_t pdBit);
-        int16_t HandleFIG0Extension13(uint8_t *d, int16_t used, uint8_t pdBit);
-        int16_t HandleFIG0Extension22(uint8_t *d, int16_t used);
+        int16_t HandleFIG0Extension3(const uint8_t *d, int16_t used, int16_t figSize);
+        int16_t HandleFIG0Extension5(const uint8_t *d, int16_t offset, int16_t figSize);
+        int16_t HandleFIG0Extension8(const uint8_t *d, int16_t used,
+                uint8_t pdBit, int16_t figSize);
+        int16_t HandleFIG0Extension13(const uint8_t *d, int16_t used,
+                uint8_t pdBit, int16_t figSize);
+        int16_t HandleFIG0Extension22(const uint8_t *d, int16_t used, int16_t figSize);
 
         bool timeOffsetReceived = false;
         dab_date_time_t dateTime = {};
@@ -130,6 +166,30 @@ class FIBProcessor {
         std::vector<Service> services;
         std::unordered_map<uint32_t, uint8_t> serviceRepeatCount;
         std::chrono::steady_clock::time_point timeLastServiceDecrement;
+
+        // FIGs are repeated many times per second with identical content.
+        // A FIG whose bytes have already been parsed since the last change
+        // of the database cannot change it again, and only needs to refresh
+        // the liveness of the services it signals. The cache is indexed by
+        // FIG type and keyed by a hash of the raw FIG bytes, header included.
+        struct FigCacheEntry {
+            std::string bytes;
+            uint32_t databaseVersion = 0;
+            std::vector<uint32_t> signalledServices;
+        };
+        std::array<std::unordered_map<uint64_t, FigCacheEntry>, 3> figCache;
+        std::vector<uint32_t> signalledServices; // filled while parsing FIG0/2
+
+        uint64_t lastFingerprint = 0;
+        std::atomic<uint32_t> databaseVersion = ATOMIC_VAR_INIT(0);
+
+        mutable std::mutex ensembleMutex; // only guards the pointer
+        ensemble_ptr ensemble;
+        uint32_t publishedVersion = 0;
+        ensemble_callback_t ensembleCallback;
+
+        metrics::Counter& figsParsed;
+        metrics::Counter& figsCached;
 };
 
 #endif
@@ -25,6 +25,7 @@
 
 #include "fic-handler.h"
 #include "msc-handler.h"
+#include "eti-writer.h"
 #include "protTables.h"
 
 //  The 3072 bits of the serial motherword shall be split into
@@ -53,21 +54,36 @@ FicHandler::FicHandler(RadioControllerInterface& mr) :
     Viterbi(768),
     fibProcessor(mr),
     myRadioInterface(mr),
-    bitBuffer_out(768),
+    fibBytes(96),
     ofdm_input(2304),
-    viterbiBlock(3072 + 24)
+    viterbiBlock(3072 + 24),
+    ficBits(768),
+    reencoded(2304),
+    fibCounter(metrics::registry().counter("welle_fic_fibs_total",
+                "Number of FIBs received")),
+    fibCrcErrorCounter(metrics::registry().counter("welle_fic_crc_errors_total",
+                "Number of FIBs with an invalid CRC")),
+    bitCounter(metrics::registry().counter("welle_fic_viterbi_bits_total",
+                "Number of FIC soft bits checked against the re-encoded Viterbi output")),
+    bitErrorCounter(metrics::registry().counter("welle_fic_viterbi_bit_errors_total",
+                "Number of FIC soft bits that differ from the re-encoded Viterbi output")),
+    ficDuration(metrics::registry().histogram("welle_stage_duration_seconds",
+                "Processing time of the pipeline stages", {{"stage", "fic"}}))
 {
     PI_15 = getPCodes(15 - 1);
     PI_16 = getPCodes(16 - 1);
+    puncturing = { {21, PI_16}, {3, PI_15} };
     std::vector<uint8_t> shiftRegister(9, 1);
 
+    memset(PRBS, 0, sizeof(PRBS));
     for (int i = 0; i < 768; i++) {
-        PRBS[i] = shiftRegister[8] ^ shiftRegister[4];
+        const uint8_t bit = shiftRegister[8] ^ shiftRegister[4];
         for (int j = 8; j > 0; j--) {
             shiftRegister[j] = shiftRegister[j - 1];
         }
 
-        shiftRegister[0] = PRBS[i];
+        shiftRegister[0] = bit;
+        PRBS[i / 8] |= bit << (7 - i % 8);
     }
 }
 
@@ -147,6 +163,8 @@ void FicHandler::processFicInput(const softbit_t *ficblock, int16_t ficno)
     int16_t i, k;
     int32_t local         = 0;
 
+    metrics::ScopedTimer timer(ficDuration);
+
     memset(viterbiBlock.data(), 0, viterbiBlock.size() * sizeof(*viterbiBlock.data()));
 
     /**
@@ -194,17 +212,38 @@ void FicHandler::processFicInput(const softbit_t *ficblock, int16_t ficno)
      * Now we have the full word ready for deconvolution
      * deconvolution is according to DAB standard section 11.2
      */
-    deconvolve(viterbiBlock.data(), bitBuffer_out.data());
+    deconvolvePacked(viterbiBlock.data(), fibBytes.data());
+
+    /**
+     * Encoding the decoded bits again tells how many of the soft bits
+     * the Viterbi decoder had to correct.
+     */
+    for (i = 0; i < 768; i++) {
+        ficBits[i] = (fibBytes[i / 8] >> (7 - i % 8)) & 1;
+    }
+    const auto bitErrors = countBitErrors(ficBits.data(), ficBits.size(),
+            puncturing, ficblock, reencoded.data());
+    bitCounter.inc(bitErrors.bits);
+    bitErrorCounter.inc(bitErrors.errors);
+    myRadioInterface.onFICBitErrors(bitErrors.errors, bitErrors.bits);
 
     /**
      * if everything worked as planned, we now have a
-     * 768 bit vector containing three FIB's
+     * 768 bit vector containing three FIB's, packed into 96 bytes.
+     * From here on, everything works on these bytes.
      *
      * first step: energy dispersal according to the DAB standard
      * We use a predefined vector PRBS
      */
-    for (i = 0; i < 768; i ++) {
-        bitBuffer_out[i] ^= PRBS[i];
+    for (i = 0; i < 96; i ++) {
+        fibBytes[i] ^= PRBS[i];
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(etiMutex);
+        if (etiWriter) {
+            etiWriter->processFIC(fibBytes.data(), ficno);
+        }
     }
 
     /**
@@ -213,9 +252,14 @@ void FicHandler::processFicInput(const softbit_t *ficblock, int16_t ficno)
      * we keep track of the successrate
      */
     for (i = ficno * 3; i < ficno * 3 + 3; i ++) {
-        uint8_t *p = &bitBuffer_out[(i % 3) * 256];
-        const bool crcvalid = check_CRC_bits(p, 256);
+        const uint8_t *p = &fibBytes[(i % 3) * 32];
+        const bool crcvalid = check_crc_bytes(p, 30);
         myRadioInterface.onFIBDecodeSuccess(crcvalid, p);
+
+        fibCounter.inc();
+        if (not crcvalid) {
+            fibCrcErrorCounter.inc();
+        }
         if (crcvalid) {
             fibProcessor.processFIB(p, ficno);
 
@@ -234,6 +278,12 @@ void FicHandler::clearEnsemble()
     fibProcessor.clearEnsemble();
 }
 
+void FicHandler::setEtiWriter(std::shared_ptr<EtiWriter> writer)
+{
+    std::lock_guard<std::mutex> lock(etiMutex);
+    etiWriter = writer;
+}
+
 int FicHandler::getFicDecodeRatioPercent()
 {
     return fic_decode_success_ratio * 10;
@@ -28,12 +28,17 @@
 #ifndef __FIC_HANDLER
 #define __FIC_HANDLER
 
+#include <memory>
 #include <mutex>
 #include <cstdio>
 #include <cstdint>
 #include "viterbi.h"
+#include "protection.h"
 #include "fib-processor.h"
 #include "radio-controller.h"
+#include "metrics.h"
+
+class EtiWriter;
 
 class FicHandler: public Viterbi
 {
@@ -44,6 +49,9 @@ class FicHandler: public Viterbi
         void    clearEnsemble();
         int     getFicDecodeRatioPercent();
 
+        // Also hand the decoded FIC to the writer, nullptr to stop
+        void    setEtiWriter(std::shared_ptr<EtiWriter> writer);
+
         FIBProcessor fibProcessor;
 
     private:
@@ -51,17 +59,32 @@ class FicHandler: public Viterbi
         void        processFicInput(const softbit_t *ficblock, int16_t ficno);
         const int8_t *PI_15;
         const int8_t *PI_16;
-        std::vector<uint8_t> bitBuffer_out;
+        std::vector<PuncturingBlock> puncturing;
+        std::vector<uint8_t> fibBytes; // the three FIBs, packed
         std::vector<softbit_t> ofdm_input;
         std::vector<softbit_t> viterbiBlock;
+
+        // The Viterbi output unpacked, and encoded again to estimate
+        // the bit errors in the codeword
+        std::vector<uint8_t> ficBits;
+        std::vector<softbit_t> reencoded;
         int16_t     index = 0;
         int16_t     bitsperBlock = 2 * 1536;
         int16_t     ficno = 0;
-        uint8_t     PRBS[768];
+        uint8_t     PRBS[96];
 
         // Saturating up/down-counter in range [0, 10] corresponding
         // to the number of FICs with correct CRC
         int         fic_decode_success_ratio = 0;
+
+        std::mutex  etiMutex;
+        std::shared_ptr<EtiWriter> etiWriter;
+
+        metrics::Counter& fibCounter;
+        metrics::Counter& fibCrcErrorCounter;
+        metrics::Counter& bitCounter;
+        metrics::Counter& bitErrorCounter;
+        metrics::Histogram& ficDuration;
 };
 
 #endif
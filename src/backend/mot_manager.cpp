@@ -22,56 +22,120 @@
 
 
 // --- MOTEntity -----------------------------------------------------------------
-void MOTEntity::AddSeg(int seg_number, bool last_seg, const uint8_t* data, size_t len) {
-	if(last_seg)
-		last_seg_number = seg_number;
+void MOTEntity::Reset() {
+	data.clear();
+	seg_received.clear();
+	segs_received = 0;
+	seg_size = 0;
+	last_seg_number = -1;
+	last_seg_size = 0;
+	pending_last_seg.clear();
+}
 
-	if(segs.find(seg_number) != segs.end())
-		return;
+void MOTEntity::Reserve(size_t len) {
+	data.reserve(len);
+}
+
+bool MOTEntity::PlaceSeg(int seg_number, const uint8_t* seg_data, size_t len, size_t max_size) {
+	// check before growing the buffer, as a single segment with a high
+	// number could otherwise allocate hundreds of megabytes
+	size_t offset = seg_number * seg_size;
+	if(offset + len > max_size)
+		return false;
 
-	// copy data
-	segs[seg_number] = seg_t(len);
-	memcpy(&segs[seg_number][0], data, len);
-	size += len;
+	if(data.size() < offset + len)
+		data.resize(offset + len);
+	memcpy(&data[offset], seg_data, len);
+	return true;
 }
 
-bool MOTEntity::IsFinished() {
-	if(last_seg_number == -1)
+bool MOTEntity::AddSeg(int seg_number, bool last_seg, const uint8_t* seg_data, size_t len, size_t max_size) {
+	if(seg_number < (int) seg_received.size() && seg_received[seg_number])
+		return true;
+	if(!last_seg && len == 0)
+		return true;
+
+	// start over, if the segment contradicts the ones received so far
+	bool consistent = true;
+	if(last_seg_number != -1 && (last_seg ? seg_number != last_seg_number : seg_number > last_seg_number))
+		consistent = false;
+	if(last_seg && seg_number + 1 < (int) seg_received.size())
+		consistent = false;
+	if(seg_size != 0 && (last_seg ? len > seg_size : len != seg_size))
+		consistent = false;
+	if(!consistent)
+		Reset();
+
+	if(seg_number >= (int) seg_received.size())
+		seg_received.resize(seg_number + 1);
+	seg_received[seg_number] = true;
+	segs_received++;
+
+	if(last_seg) {
+		last_seg_number = seg_number;
+		last_seg_size = len;
+
+		// the position of the last segment depends on the size of the others
+		if(seg_number > 0 && seg_size == 0) {
+			pending_last_seg.assign(seg_data, seg_data + len);
+			return true;
+		}
+	} else {
+		seg_size = len;
+	}
+	if(!PlaceSeg(seg_number, seg_data, len, max_size)) {
+		Reset();
 		return false;
+	}
 
-	// check if all segments are available
-	for(int i = 0; i <= last_seg_number; i++)
-		if(segs.find(i) == segs.end())
+	if(!pending_last_seg.empty()) {
+		if(pending_last_seg.size() > seg_size) {
+			Reset();
+			return true;
+		}
+		if(!PlaceSeg(last_seg_number, &pending_last_seg[0], pending_last_seg.size(), max_size)) {
+			Reset();
 			return false;
+		}
+		pending_last_seg.clear();
+	}
 	return true;
 }
 
-std::vector<uint8_t> MOTEntity::GetData() {
-	std::vector<uint8_t> result(size);
-	size_t offset = 0;
+bool MOTEntity::IsFinished() const {
+	if(last_seg_number == -1 || !pending_last_seg.empty())
+		return false;
 
-	// concatenate all segments
-	for(int i = 0; i <= last_seg_number; i++) {
-		seg_t& seg = segs[i];
-		memcpy(&result[offset], &seg[0], seg.size());
-		offset += seg.size();
-	}
+	// check if all segments are available
+	return segs_received == (size_t) last_seg_number + 1;
+}
 
+size_t MOTEntity::GetSize() const {
+	if(last_seg_number == -1)
+		return 0;
+	return last_seg_number * seg_size + last_seg_size;
+}
+
+std::shared_ptr<const std::vector<uint8_t>> MOTEntity::TakeData() {
+	data.resize(GetSize());
+	std::shared_ptr<const std::vector<uint8_t>> result = std::make_shared<const std::vector<uint8_t>>(std::move(data));
+	Reset();
 	return result;
 }
 
 
 // --- MOTObject -----------------------------------------------------------------
-void MOTObject::AddSeg(bool dg_type_header, int seg_number, bool last_seg, const uint8_t* data, size_t len) {
-	(dg_type_header ? header : body).AddSeg(seg_number, last_seg, data, len);
+bool MOTObject::AddSeg(bool dg_type_header, int seg_number, bool last_seg, const uint8_t* data, size_t len, size_t max_size) {
+	return (dg_type_header ? header : body).AddSeg(seg_number, last_seg, data, len, max_size);
 }
 
 bool MOTObject::ParseCheckHeader(MOT_FILE& target_file) {
 	MOT_FILE file = target_file;
-	std::vector<uint8_t> data = header.GetData();
+	const uint8_t* data = header.GetData();
+	size_t data_size = header.GetSize();
 
 	// parse/check header core
-	if(data.size() < 7)
+	if(data_size < 7)
 		return false;
 
 	size_t body_size = (data[0] << 20) | (data[1] << 12) | (data[2] << 4) | (data[3] >> 4);
@@ -104,7 +168,7 @@ bool MOTObject::ParseCheckHeader(MOT_FILE& target_file) {
 	std::string new_content_name;
 
     // parse/check header extension
-	for(size_t offset = 7; offset < data.size();) {
+	for(size_t offset = 7; offset < data_size;) {
 		int pli = data[offset] >> 6;
 		int param_id = data[offset] & 0x3F;
 		offset++;
@@ -122,14 +186,14 @@ bool MOTObject::ParseCheckHeader(MOT_FILE& target_file) {
 			data_len = 4;
 			break;
 		case 0b11:
-			if(offset >= data.size())
+			if(offset >= data_size)
 				return false;
 			bool ext = data[offset] & 0x80;
 			data_len = data[offset] & 0x7F;
 			offset++;
 
 			if(ext) {
-				if(offset >= data.size())
+				if(offset >= data_size)
 					return false;
 				data_len = (data_len << 8) + data[offset];
 				offset++;
@@ -137,7 +201,7 @@ bool MOTObject::ParseCheckHeader(MOT_FILE& target_file) {
 			break;
 		}
 
-		if(offset + data_len - 1 >= data.size())
+		if(offset + data_len - 1 >= data_size)
 			return false;
 
 		// process parameter
@@ -200,6 +264,10 @@ bool MOTObject::IsToBeShown() {
 		header.Reset();	// allow for header updates
 		if(!result)
 			return false;
+
+		// the body size is known now, so the body needs a single allocation
+		if(result_file.body_size <= MOTBudget::Instance().GetLimit())
+			body.Reserve(result_file.body_size);
 	}
 
 	// abort, if incomplete/not yet triggered
@@ -210,27 +278,129 @@ bool MOTObject::IsToBeShown() {
 	if(!result_file.trigger_time_now)
 		return false;
 
-	// add body data
-	result_file.data = body.GetData();
+	// hand over body data
+	result_file.data = body.TakeData();
 
 	shown = true;
 	return true;
 }
 
 
+// --- MOTBudget -----------------------------------------------------------------
+MOTBudget& MOTBudget::Instance() {
+	static MOTBudget budget;
+	return budget;
+}
+
+void MOTBudget::SetLimit(size_t limit) {
+	std::lock_guard<std::mutex> lock(mutex);
+	this->limit = limit;
+}
+
+size_t MOTBudget::GetLimit() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return limit;
+}
+
+size_t MOTBudget::GetTotal() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return total;
+}
+
+bool MOTBudget::Update(MOTManager* manager, size_t usage) {
+	std::lock_guard<std::mutex> lock(mutex);
+
+	std::list<entry_t>::iterator own = lru.begin();
+	while(own != lru.end() && own->manager != manager)
+		own++;
+
+	if(own != lru.end()) {
+		total -= own->usage;
+		own->usage = 0;
+		if(usage == 0) {
+			lru.erase(own);
+			return true;
+		}
+		lru.splice(lru.end(), lru, own);
+	} else {
+		if(usage == 0)
+			return true;
+		lru.push_back({manager, 0});
+		own = --lru.end();
+	}
+
+	// evict least recently used objects until the new usage fits
+	for(std::list<entry_t>::iterator it = lru.begin(); it != own && total + usage > limit;) {
+		if(it->manager->TryEvict()) {
+			total -= it->usage;
+			it = lru.erase(it);
+		} else {
+			it++;
+		}
+	}
+
+	if(total + usage > limit) {
+		lru.erase(own);
+		return false;
+	}
+
+	own->usage = usage;
+	total += usage;
+	return true;
+}
+
+void MOTBudget::Remove(MOTManager* manager) {
+	std::lock_guard<std::mutex> lock(mutex);
+
+	for(std::list<entry_t>::iterator it = lru.begin(); it != lru.end(); it++) {
+		if(it->manager == manager) {
+			total -= it->usage;
+			lru.erase(it);
+			return;
+		}
+	}
+}
+
+
 // --- MOTManager -----------------------------------------------------------------
 MOTManager::MOTManager() {
+	MOTBudget::Instance();	// ensure the budget outlives all managers
 	Reset();
 }
 
-void MOTManager::Reset() {
+MOTManager::~MOTManager() {
+	MOTBudget::Instance().Remove(this);
+}
+
+void MOTManager::ResetObject() {
 	object = MOTObject();
 	current_transport_id = -1;
 }
 
-bool MOTManager::ParseCheckDataGroupHeader(const std::vector<uint8_t>& dg, size_t& offset, int& dg_type) {
+void MOTManager::Reset() {
+	std::lock_guard<std::mutex> lock(mutex);
+	ResetObject();
+	last_file = MOT_FILE();
+	MOTBudget::Instance().Update(this, 0);
+}
+
+bool MOTManager::TryEvict() {
+	std::unique_lock<std::mutex> lock(mutex, std::try_to_lock);
+	if(!lock.owns_lock())
+		return false;
+
+	ResetObject();
+	return true;
+}
+
+MOT_FILE MOTManager::GetFile() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return last_file;
+}
+
+bool MOTManager::ParseCheckDataGroupHeader(const uint8_t* dg, size_t dg_len, size_t& offset, int& dg_type) {
 	// parse/check Data Group header
-	if(dg.size() < (offset + 2))
+	if(dg_len < (offset + 2))
 		return false;
 
 	bool extension_flag = dg[offset] & 0x80;
@@ -252,9 +422,9 @@ bool MOTManager::ParseCheckDataGroupHeader(const std::vector<uint8_t>& dg, size_
 	return true;
 }
 
-bool MOTManager::ParseCheckSessionHeader(const std::vector<uint8_t>& dg, size_t& offset, bool& last_seg, int& seg_number, int& transport_id) {
+bool MOTManager::ParseCheckSessionHeader(const uint8_t* dg, size_t dg_len, size_t& offset, bool& last_seg, int& seg_number, int& transport_id) {
 	// parse/check session header
-	if(dg.size() < (offset + 3))
+	if(dg_len < (offset + 3))
 		return false;
 
 	last_seg = dg[offset] & 0x80;
@@ -269,7 +439,7 @@ bool MOTManager::ParseCheckSessionHeader(const std::vector<uint8_t>& dg, size_t&
 		return false;
 
 	// handle transport ID
-	if(dg.size() < (offset + len_indicator))
+	if(dg_len < (offset + len_indicator))
 		return false;
 
 	transport_id = (dg[offset] << 8) | dg[offset + 1];
@@ -278,22 +448,22 @@ bool MOTManager::ParseCheckSessionHeader(const std::vector<uint8_t>& dg, size_t&
 	return true;
 }
 
-bool MOTManager::ParseCheckSegmentationHeader(const std::vector<uint8_t>& dg, size_t& offset, size_t& seg_size) {
+bool MOTManager::ParseCheckSegmentationHeader(const uint8_t* dg, size_t dg_len, size_t& offset, size_t& seg_size) {
 	// parse/check segmentation header (MOT)
-	if(dg.size() < (offset + 2))
+	if(dg_len < (offset + 2))
 		return false;
 
 	seg_size = ((dg[offset] & 0x1F) << 8) | dg[offset + 1];
 	offset += 2;
 
 	// compare announced/actual segment size
-	if(seg_size != dg.size() - offset - CalcCRC::CRCLen)
+	if(dg_len < offset + CalcCRC::CRCLen || seg_size != dg_len - offset - CalcCRC::CRCLen)
 		return false;
 
 	return true;
 }
 
-bool MOTManager::HandleMOTDataGroup(const std::vector<uint8_t>& dg) {
+bool MOTManager::HandleMOTDataGroup(const uint8_t* dg, size_t dg_len) {
 	size_t offset = 0;
 
 	// parse/check headers
@@ -303,26 +473,40 @@ bool MOTManager::HandleMOTDataGroup(const std::vector<uint8_t>& dg) {
 	int transport_id;
 	size_t seg_size;
 
-	if(!ParseCheckDataGroupHeader(dg, offset, dg_type))
+	if(!ParseCheckDataGroupHeader(dg, dg_len, offset, dg_type))
 		return false;
-	if(!ParseCheckSessionHeader(dg, offset, last_seg, seg_number, transport_id))
+	if(!ParseCheckSessionHeader(dg, dg_len, offset, last_seg, seg_number, transport_id))
 		return false;
-	if(!ParseCheckSegmentationHeader(dg, offset, seg_size))
+	if(!ParseCheckSegmentationHeader(dg, dg_len, offset, seg_size))
 		return false;
 
+	std::lock_guard<std::mutex> lock(mutex);
 
 	// add segment to MOT object (reset if necessary)
 	if(current_transport_id != transport_id) {
 		current_transport_id = transport_id;
 		object = MOTObject();
 	}
-	object.AddSeg(dg_type == 3, seg_number, last_seg, &dg[offset], seg_size);
+	// an object can never be larger than the whole budget
+	if(!object.AddSeg(dg_type == 3, seg_number, last_seg, &dg[offset], seg_size, MOTBudget::Instance().GetLimit())) {
+		ResetObject();
+		MOTBudget::Instance().Update(this, 0);
+		return false;
+	}
 
 	// check if object shall be shown
 	bool display = object.IsToBeShown();
 //	fprintf(stderr, "dg_type: %d, seg_number: %2d%s, transport_id: %5d, size: %4zu; display: %s\n",
 //			dg_type, seg_number, last_seg ? " (LAST)" : "", transport_id, seg_size, display ? "true" : "false");
 
+	// drop the object, if it does not fit into the budget
+	if(!MOTBudget::Instance().Update(this, object.GetMemoryUsage())) {
+		ResetObject();
+		return false;
+	}
+
 	// if object shall be shown, update it
+	if(display)
+		last_file = object.GetFile();
 	return display;
 }
@@ -23,7 +23,9 @@
 #include <stdio.h>
 #include <string.h>
 #include <string>
-#include <map>
+#include <list>
+#include <memory>
+#include <mutex>
 #include <vector>
 
 #include "charsets.h"
@@ -32,7 +34,8 @@
 
 // --- MOT_FILE -----------------------------------------------------------------
 struct MOT_FILE {
-	std::vector<uint8_t> data;
+	// shared with all receivers of the file, never modified once complete
+	std::shared_ptr<const std::vector<uint8_t>> data;
 
 	// from header core
 	size_t body_size;
@@ -64,27 +67,38 @@ struct MOT_FILE {
 };
 
 
-typedef std::vector<uint8_t> seg_t;
-typedef std::map<int,seg_t> segs_t;
-
 // --- MOTEntity -----------------------------------------------------------------
+// Reassembles the header or body of an object in place. All segments but the
+// last one have the same size, so each segment is copied straight to its
+// final position and a bitmap records which segments were received.
 class MOTEntity {
 private:
-	segs_t segs;
+	std::vector<uint8_t> data;
+	std::vector<bool> seg_received;
+	size_t segs_received;
+	size_t seg_size;	// of all segments but the last; 0 = not yet known
 	int last_seg_number;
-	size_t size;
+	size_t last_seg_size;
+
+	// a last segment received before the size of the others was known
+	std::vector<uint8_t> pending_last_seg;
+
+	bool PlaceSeg(int seg_number, const uint8_t* seg_data, size_t len, size_t max_size);
 public:
 	MOTEntity() {Reset();}
-	void Reset() {
-		segs.clear();
-		last_seg_number = -1;
-		size = 0;
-	}
-
-	void AddSeg(int seg_number, bool last_seg, const uint8_t* data, size_t len);
-	bool IsFinished();
-	size_t GetSize() {return size;}
-	std::vector<uint8_t> GetData();
+	void Reset();
+
+	void Reserve(size_t len);
+	// Returns false and starts over, if the segment would place data beyond
+	// max_size.
+	bool AddSeg(int seg_number, bool last_seg, const uint8_t* data, size_t len, size_t max_size);
+	bool IsFinished() const;
+	size_t GetSize() const;
+	size_t GetMemoryUsage() const {return data.capacity() + pending_last_seg.capacity();}
+	const uint8_t* GetData() const {return data.data();}
+
+	// hands the finished data over without copying and resets the entity
+	std::shared_ptr<const std::vector<uint8_t>> TakeData();
 };
 
 
@@ -102,27 +116,75 @@ private:
 public:
 	MOTObject(): header_received(false), shown(false) {}
 
-	void AddSeg(bool dg_type_header, int seg_number, bool last_seg, const uint8_t* data, size_t len);
+	bool AddSeg(bool dg_type_header, int seg_number, bool last_seg, const uint8_t* data, size_t len, size_t max_size);
 	bool IsToBeShown();
 	MOT_FILE GetFile() {return result_file;}
+	size_t GetMemoryUsage() const {return header.GetMemoryUsage() + body.GetMemoryUsage();}
+};
+
+
+class MOTManager;
+
+// --- MOTBudget -----------------------------------------------------------------
+// Limits the memory that all MOTManagers together use for objects still being
+// reassembled. When the limit is exceeded, the objects of the managers which
+// least recently received a segment are dropped first.
+class MOTBudget {
+private:
+	struct entry_t {
+		MOTManager* manager;
+		size_t usage;
+	};
+
+	std::mutex mutex;
+	std::list<entry_t> lru;	// least recently used first
+	size_t limit;
+	size_t total;
+
+	MOTBudget() : limit(DEFAULT_LIMIT), total(0) {}
+public:
+	static const size_t DEFAULT_LIMIT = 16 * 1024 * 1024;
+
+	static MOTBudget& Instance();
+
+	void SetLimit(size_t limit);
+	size_t GetLimit();
+	size_t GetTotal();
+
+	// Records the current usage of the manager and marks it as most recently
+	// used. Returns false if the usage cannot be accommodated, in which case
+	// the manager has to drop its object.
+	bool Update(MOTManager* manager, size_t usage);
+	void Remove(MOTManager* manager);
 };
 
 
 // --- MOTManager -----------------------------------------------------------------
 class MOTManager {
 private:
+	// Each manager is used by the thread decoding its service, but the
+	// budget may evict its object from another thread.
+	std::mutex mutex;
 	MOTObject object;
 	int current_transport_id;
+	MOT_FILE last_file;
 
-	bool ParseCheckDataGroupHeader(const std::vector<uint8_t>& dg, size_t& offset, int& dg_type);
-	bool ParseCheckSessionHeader(const std::vector<uint8_t>& dg, size_t& offset, bool& last_seg, int& seg_number, int& transport_id);
-	bool ParseCheckSegmentationHeader(const std::vector<uint8_t>& dg, size_t& offset, size_t& seg_size);
+	bool ParseCheckDataGroupHeader(const uint8_t* dg, size_t dg_len, size_t& offset, int& dg_type);
+	bool ParseCheckSessionHeader(const uint8_t* dg, size_t dg_len, size_t& offset, bool& last_seg, int& seg_number, int& transport_id);
+	bool ParseCheckSegmentationHeader(const uint8_t* dg, size_t dg_len, size_t& offset, size_t& seg_size);
+	void ResetObject();
 public:
 	MOTManager();
+	~MOTManager();
+	MOTManager(const MOTManager&) = delete;
+	MOTManager& operator=(const MOTManager&) = delete;
 
 	void Reset();
-	bool HandleMOTDataGroup(const std::vector<uint8_t>& dg);
-	MOT_FILE GetFile() {return object.GetFile();}
+	bool HandleMOTDataGroup(const uint8_t* dg, size_t dg_len);
+	MOT_FILE GetFile();
+
+	// Called by the budget with its lock held; gives up if the manager is busy
+	bool TryEvict();
 };
 
 #endif /* MOT_MANAGER_H_ */
@@ -26,6 +26,7 @@
 #include "msc-handler.h"
 #include "dab-virtual.h"
 #include "dab-audio.h"
+#include "eti-writer.h"
 
 //  Interface program for processing the MSC.
 //  Merely a dispatcher for the selected service
@@ -77,6 +78,7 @@ bool MscHandler::addSubchannel(
 
     s.dabHandler = std::make_shared<DabAudio>(
                 ascty,
+                sub.subChId,
                 sub.length * CUSize,
                 sub.bitrate(),
                 sub.protectionSettings,
@@ -130,7 +132,7 @@ void MscHandler::processMscBlock(const softbit_t *fbits, int16_t blkno)
 {
     std::lock_guard<std::mutex> lock(mutex);
 
-    if (!work_to_be_done)
+    if (!work_to_be_done and !etiWriter)
         return;
 
     int16_t currentblk = (blkno - 4) % numberofblocksperCIF;
@@ -145,6 +147,10 @@ void MscHandler::processMscBlock(const softbit_t *fbits, int16_t blkno)
     blkCount = 0;
     cifCount = (cifCount + 1) & 03;
 
+    if (etiWriter) {
+        etiWriter->processCIF(cifVector.data(), (blkno - 4) / numberofblocksperCIF);
+    }
+
     for (auto& stream : streams) {
         softbit_t *myBegin = &cifVector[stream.subCh.startAddr * CUSize];
 
@@ -157,6 +163,12 @@ void MscHandler::processMscBlock(const softbit_t *fbits, int16_t blkno)
     }
 }
 
+void MscHandler::setEtiWriter(std::shared_ptr<EtiWriter> writer)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    etiWriter = writer;
+}
+
 void MscHandler::stopProcessing()
 {
     std::lock_guard<std::mutex> lock(mutex);
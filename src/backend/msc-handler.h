@@ -42,6 +42,7 @@
 #include "radio-controller.h"
 
 class DabVirtual;
+class EtiWriter;
 
 class MscHandler
 {
@@ -59,8 +60,12 @@ class MscHandler
 
         bool removeSubchannel(const Subchannel& sub);
 
+        // Also hand every CIF to the writer, nullptr to stop
+        void setEtiWriter(std::shared_ptr<EtiWriter> writer);
+
     private:
         friend class OfdmDecoder;
+        friend class EtiReader;
         void processMscBlock(const softbit_t *fbits, int16_t blkno);
 
         struct SelectedStream {
@@ -85,6 +90,7 @@ class MscHandler
 
         std::mutex mutex;
         std::list<SelectedStream> streams;
+        std::shared_ptr<EtiWriter> etiWriter;
 
         const int16_t bitsperBlock;
         int16_t numberofblocksperCIF;
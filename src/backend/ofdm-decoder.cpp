@@ -52,7 +52,12 @@ OfdmDecoder::OfdmDecoder(
     phaseReference(params.T_u),
     fft_handler(p.T_u),
     interleaver(p),
-    ibits(2 * params.K)
+    ibits(2 * params.K),
+    frameDuration(metrics::registry().histogram("welle_stage_duration_seconds",
+                "Processing time of the pipeline stages", {{"stage", "ofdm_decoder"}})),
+    carriers(params.T_u),
+    clockCorrection(params.T_u, 1.0f),
+    merAmplitude(params.T_u, 0.0f)
 {
     T_g = params.T_s - params.T_u;
     fft_buffer = fft_handler.getVector();
@@ -93,6 +98,7 @@ void OfdmDecoder::reset()
 void OfdmDecoder::workerthread()
 {
     int currentSym = 0;
+    std::chrono::steady_clock::duration frameTime{};
 
     running = true;
 
@@ -107,16 +113,26 @@ void OfdmDecoder::workerthread()
         }
 
         while (num_pending_symbols > 0 && running) {
+            const auto symbolStart = std::chrono::steady_clock::now();
 
             if (currentSym == 0)
                 processPRS();
             else
                 decodeDataSymbol(currentSym);
 
+            frameTime += std::chrono::steady_clock::now() - symbolStart;
+
             currentSym = (currentSym + 1) % (params.L);
             num_pending_symbols -= 1;
 
             if (currentSym == 0) {
+                updateClockOffset();
+                updateMER();
+
+                frameDuration.observe(
+                        std::chrono::duration<double>(frameTime).count());
+                frameTime = std::chrono::steady_clock::duration::zero();
+
                 radioInterface.onConstellationPoints(
                         std::move(constellationPoints));
                 constellationPoints.clear();
@@ -205,9 +221,25 @@ void OfdmDecoder::decodeDataSymbol(int32_t sym_ix)
          * The carrier of a symbols is the reference for the carrier
          * on the same position in the next symbols
          */
-        const DSPCOMPLEX r1 = fft_buffer[index] * conj (phaseReference[index]);
+        const DSPCOMPLEX r1 = fft_buffer[index] * conj (phaseReference[index]) *
+            clockCorrection[index];
         phaseReference[index] = fft_buffer[index];
+        carriers[index] = r1;
         const DSPFLOAT ab1 = 127.0f / l1_norm(r1);
+
+        // Folded into the first quadrant, the decided point is
+        // amplitude * (1 + j)
+        const DSPFLOAT re = std::abs(real(r1));
+        const DSPFLOAT im = std::abs(imag(r1));
+        DSPFLOAT& amplitude = merAmplitude[index];
+        if (amplitude == 0) {
+            amplitude = 0.5f * (re + im);
+        }
+        merSignal += 2 * amplitude * amplitude;
+        merError += (re - amplitude) * (re - amplitude) +
+            (im - amplitude) * (im - amplitude);
+        amplitude += 0.1f * (0.5f * (re + im) - amplitude);
+
         /// split the real and the imaginary part and scale it
 
         ibits[i]            = -real (r1) * ab1;
@@ -218,6 +250,8 @@ void OfdmDecoder::decodeDataSymbol(int32_t sym_ix)
         }
     }
 
+    measureClockSlope();
+
     if (sym_ix < 4) {
         PROFILE(FICHandler);
         ficHandler.processFicBlock(ibits.data(), sym_ix);
@@ -229,6 +263,103 @@ void OfdmDecoder::decodeDataSymbol(int32_t sym_ix)
     PROFILE(SymbolProcessed);
 }
 
+/**
+ * Accumulate the phase slope that remains on the corrected carriers of
+ * the current symbol. The DQPSK modulation is removed by rotating every
+ * carrier back from the quadrant it was decided in, and the common phase
+ * of the symbol by referring all carriers to their mean. For the small
+ * phases that remain, the imaginary part of the unit carrier is close to
+ * its phase, and the slope is the least-squares fit of it over k.
+ */
+void OfdmDecoder::measureClockSlope()
+{
+    const int halfK = params.K / 2;
+    DSPCOMPLEX mean = 0;
+    DSPCOMPLEX previous = 0;
+
+    for (int k = -halfK; k <= halfK; k++) {
+        if (k == 0) {
+            previous = 0;
+            continue;
+        }
+
+        DSPCOMPLEX& c = carriers[k < 0 ? k + params.T_u : k];
+        const float n = std::norm(c);
+        if (n == 0) {
+            continue;
+        }
+
+        const DSPCOMPLEX c2 = c * c / n;
+        const DSPCOMPLEX c4 = c2 * c2;
+        clockCoherence += c4 * conj(previous);
+        previous = c4;
+
+        c *= DSPCOMPLEX(real(c) < 0 ? -1 : 1, imag(c) < 0 ? 1 : -1) /
+            std::sqrt(2 * n);
+        mean += c;
+    }
+    clockCoherenceCount += params.K - 2;
+
+    if (mean == DSPCOMPLEX(0, 0)) {
+        return;
+    }
+
+    mean /= std::abs(mean);
+    for (int k = 1; k <= halfK; k++) {
+        clockResidual += k * imag(carriers[k] * conj(mean));
+        clockResidual -= k * imag(carriers[params.T_u - k] * conj(mean));
+        clockResidualWeight += 2 * k * k;
+    }
+}
+
+/**
+ * At the end of every frame, update the slope correction applied to the
+ * carriers of the next frame, unless the frame was mostly noise.
+ */
+void OfdmDecoder::updateClockOffset()
+{
+    const float coherence = clockCoherenceCount ?
+        abs(clockCoherence) / clockCoherenceCount : 0;
+
+    if (coherence > 0.05f and clockResidualWeight > 0) {
+        clockSlope += 0.2f * clockResidual / clockResidualWeight;
+
+        for (int k = 1; k <= params.K / 2; k++) {
+            clockCorrection[k] = std::polar(1.0f, -clockSlope * k);
+            clockCorrection[params.T_u - k] = std::polar(1.0f, clockSlope * k);
+        }
+    }
+
+    clockResidual = 0;
+    clockResidualWeight = 0;
+    clockCoherence = 0;
+    clockCoherenceCount = 0;
+
+    if (++clockOffsetCount > 10) {
+        /* A symbol that starts tau samples late rotates carrier k by
+         * -2 pi k tau / T_u, and the delay grows by T_s times the
+         * offset from one symbol to the next. */
+        const float offset = -clockSlope * params.T_u /
+            (2 * M_PI * params.T_s);
+        radioInterface.onSampleClockOffset(offset * 1e6f);
+        clockOffsetCount = 0;
+    }
+}
+
+void OfdmDecoder::updateMER()
+{
+    if (merSignal > 0 and merError > 0) {
+        mer = 0.9f * mer + 0.1f * 10 * std::log10(merSignal / merError);
+    }
+    merSignal = 0;
+    merError = 0;
+
+    if (++merCount > 10) {
+        radioInterface.onMER(mer);
+        merCount = 0;
+    }
+}
+
 /**
  * for the snr we have a full T_u wide vector, with in the middle
  * K carriers.
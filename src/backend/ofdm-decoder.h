@@ -37,6 +37,7 @@
 #include "radio-controller.h"
 #include "fic-handler.h"
 #include "msc-handler.h"
+#include "metrics.h"
 
 class OfdmDecoder
 {
@@ -67,6 +68,9 @@ class OfdmDecoder
         void workerthread(void);
         void processPRS();
         void decodeDataSymbol(int32_t n);
+        void measureClockSlope(void);
+        void updateClockOffset(void);
+        void updateMER(void);
 
         int32_t T_g;
         std::vector<DSPCOMPLEX> phaseReference;
@@ -75,11 +79,47 @@ class OfdmDecoder
         FrequencyInterleaver interleaver;
 
         std::vector<softbit_t> ibits;
+
+        // Time spent decoding all symbols of a frame, including
+        // the FIC and MSC handlers
+        metrics::Histogram& frameDuration;
+
         int16_t snrCount = 0;
         int16_t snr = 0;
 
-        const double mer_alpha = 1e-7;
-        std::atomic<double> mer = ATOMIC_VAR_INIT(0.0);
+        /* A sample clock offset delays every symbol a bit more than the
+         * previous one, which shows up in the differential demodulation as
+         * a phase that increases linearly with the carrier index.
+         * clockSlope, in radians per carrier, is removed from the carriers
+         * before they are converted to soft bits. What remains of the slope
+         * is measured on the corrected carriers with a least-squares fit
+         * over all data symbols of a frame, and used to update clockSlope
+         * at the end of the frame. */
+        std::vector<DSPCOMPLEX> carriers;
+        std::vector<DSPCOMPLEX> clockCorrection;
+        float clockSlope = 0;
+        double clockResidual = 0;
+        double clockResidualWeight = 0;
+
+        // Sum of the products of adjacent carriers raised to the fourth
+        // power, which is close to zero if the frame contained only noise.
+        DSPCOMPLEX clockCoherence = 0;
+        size_t clockCoherenceCount = 0;
+        int16_t clockOffsetCount = 0;
+
+        /* The modulation error ratio compares the power of the decided
+         * differential QPSK points to the power of the error vectors from
+         * the received points to them. Both are summed over the data
+         * symbols of a frame, and the ratio, in dB, is averaged over
+         * frames. The amplitude of the decided point is followed for every
+         * carrier, so that a frequency selective channel does not count as
+         * error. As the differential product contains the noise of two
+         * symbols, the MER is about 3dB below that of the carriers. */
+        std::vector<DSPFLOAT> merAmplitude;
+        float merSignal = 0;
+        float merError = 0;
+        float mer = 0;
+        int16_t merCount = 0;
 
     public:
         // Plotting all points is too costly, we decimate the number of points.
@@ -30,7 +30,9 @@
  *
  */
 
+#include <algorithm>
 #include <cstddef>
+#include <cstdlib>
 #include "ofdm-processor.h"
 #include "various/profiling.h"
 #include <iostream>
@@ -71,6 +73,16 @@ OFDMProcessor::OFDMProcessor(
     oscillatorTable(INPUT_RATE),
     phaseRef(params, rro.fftPlacementMethod),
     ofdmDecoder(params, ri, fic, msc),
+    framesCounter(metrics::registry().counter("welle_ofdm_frames_total",
+                "Number of transmission frames handed to the OFDM decoder")),
+    syncLostCounter(metrics::registry().counter("welle_ofdm_sync_lost_total",
+                "Number of times the phase synchronisation failed")),
+    flywheelFramesCounter(metrics::registry().counter("welle_ofdm_flywheel_frames_total",
+                "Number of frames decoded at the predicted timing after the phase synchronisation failed")),
+    flywheelRecoveriesCounter(metrics::registry().counter("welle_ofdm_flywheel_recoveries_total",
+                "Number of signal dropouts bridged by the flywheel without searching the NULL symbol")),
+    inputBufferFill(metrics::registry().gauge("welle_input_buffer_fill_samples",
+                "Number of samples waiting in the input buffer")),
     fft_handler(params.T_u),
     fft_buffer(fft_handler.getVector())
 {
@@ -126,6 +138,8 @@ void OFDMProcessor::restart()
     syncBufferIndex    = 0;
     sLevel             = 0;
     localPhase         = 0;
+    flywheelFramesLeft = 0;
+    flywheelActive     = false;
     input.restart();
     running            = true;
     threadHandle       = std::thread(&OFDMProcessor::run, this);
@@ -191,6 +205,7 @@ void OFDMProcessor::getSamples(DSPCOMPLEX *v, int16_t n, int32_t phase)
         throw NotRunningAnymore();
     if (n > bufferContent) {
         bufferContent = input.getSamplesToRead ();
+        inputBufferFill.set(bufferContent);
         while ((bufferContent < n) && running) {
             if (not input.is_ok()) {
                 throw InputFailure();
@@ -232,9 +247,26 @@ void OFDMProcessor::getSamples(DSPCOMPLEX *v, int16_t n, int32_t phase)
  *    and sending them to the ofdmDecoder who will transfer the results
  *    Finally, estimating the small freqency error
  */
+// True if the impulse response has a peak that clearly stands out of the
+// noise, which is much stricter than the threshold used by findIndex.
+static bool isClearPeak(const std::vector<float>& impulseResponse)
+{
+    constexpr float minPeakToMean = 8;
+
+    float peak = 0;
+    float sum = 0;
+    for (const float v : impulseResponse) {
+        peak = std::max(peak, v);
+        sum += v;
+    }
+    return not impulseResponse.empty() and
+        peak * impulseResponse.size() >= minPeakToMean * sum;
+}
+
 void OFDMProcessor::run()
 {
     int32_t startIndex;
+    bool confidentSync;
     int32_t i;
     int32_t counter;
     float currentStrength;
@@ -255,6 +287,8 @@ void OFDMProcessor::run()
         }
 notSynced:
         PROFILE(NotSynced);
+        flywheelFramesLeft = 0;
+        flywheelActive = false;
         if (scanMode && ++attempts > 5) {
             radioInterface.onSignalPresence(false);
             scanMode  = false;
@@ -341,12 +375,54 @@ SyncOnPhase:
         startIndex = phaseRef.findIndex(ofdmBuffer.data(),
                 impulseResponseBuffer);
         PROFILE(FindIndex);
+        confidentSync = startIndex >= 0 and
+            isClearPeak(impulseResponseBuffer);
         radioInterface.onNewImpulseResponse(std::move(impulseResponseBuffer));
         impulseResponseBuffer.clear();
 
-        if (startIndex < 0) { // no sync, try again
-            std::clog << "ofdm-processor: " << "SyncOnPhase failed" << std::endl;
-            goto notSynced;
+        if (not confidentSync and flywheelFramesLeft > 0 and
+                std::abs(startIndex - lastGoodStartIndex) > flywheelMaxOffset) {
+            // While the frame timing is known, a weak correlation peak
+            // far from the predicted start is more likely to be noise
+            // than the PRS.
+            startIndex = -1;
+        }
+
+        if (startIndex < 0) {
+            syncLostCounter.inc();
+
+            if (flywheelFramesLeft == 0) { // no sync, try again
+                std::clog << "ofdm-processor: " << "SyncOnPhase failed" << std::endl;
+                goto notSynced;
+            }
+
+            /* The previous frame was synchronised. Every frame is read
+             * relative to the start of the previous one, so the frame most
+             * likely starts at the same index, which already includes the
+             * drift of the sample clock over one frame. */
+            if (not flywheelActive) {
+                std::clog << "ofdm-processor: " << "SyncOnPhase failed, using predicted frame timing" << std::endl;
+            }
+            flywheelFramesLeft--;
+            flywheelActive = true;
+            flywheelFramesCounter.inc();
+            startIndex = lastGoodStartIndex;
+        }
+        else {
+            if (flywheelActive) {
+                std::clog << "ofdm-processor: " << "SyncOnPhase recovered after " <<
+                    flywheelMaxFrames - flywheelFramesLeft << " predicted frames" << std::endl;
+                flywheelRecoveriesCounter.inc();
+            }
+            flywheelActive = false;
+
+            // Only a clear correlation peak arms the flywheel. A weak
+            // peak close to the prediction is used, but does not extend
+            // the number of frames that may still be predicted.
+            if (confidentSync) {
+                flywheelFramesLeft = flywheelMaxFrames;
+            }
+            lastGoodStartIndex = startIndex;
         }
         if (scanMode) {
             radioInterface.onSignalPresence(true);
@@ -394,7 +470,11 @@ SyncOnPhase:
         //  reception glitch might provoke a long delay until it resyncs properly.
         //  As long as some FICs have correct CRC, we assume the coarse corrector cannot
         //  be off.
-        if (!rro.disableCoarseCorrector and ficHandler.getFicDecodeRatioPercent() < 50) {
+        if (flywheelActive) {
+            // The PRS of a frame decoded at the predicted timing was not
+            // found, it must not be used to correct the frequency.
+        }
+        else if (!rro.disableCoarseCorrector and ficHandler.getFicDecodeRatioPercent() < 50) {
             if (!coarseSyncCounter) {
                 std::clog << "ofdm-processor: " << "Lost coarse sync (coarseCorrector: " << lastValidCoarseCorrector << "; fineCorrector: " <<  lastValidFineCorrector << ")" << std::endl;
             }
@@ -443,12 +523,15 @@ SyncOnPhase:
 
         PROFILE(PushAllSymbols);
         ofdmDecoder.pushAllSymbols(move(allSymbols));
+        framesCounter.inc();
 
         //NewOffset:
         /// we integrate the newly found frequency error with the
         /// existing frequency error.
-        fineCorrector += 0.1 * arg(FreqCorr) / M_PI *
-            (params.carrierDiff / 2);
+        if (not flywheelActive) {
+            fineCorrector += 0.1 * arg(FreqCorr) / M_PI *
+                (params.carrierDiff / 2);
+        }
         //
         /**
          * OK,  here we are at the end of the frame
@@ -461,7 +544,7 @@ SyncOnPhase:
         // The NULL is interesting to save because it carries the TII.
         std::vector<DSPCOMPLEX> nullSymbol(T_null);
         getSamples(nullSymbol.data(), T_null, coarseCorrector + fineCorrector);
-        if (rro.decodeTII) {
+        if (rro.decodeTII and not flywheelActive) {
             tiiDecoder.pushSymbols(nullSymbol, prs);
         }
 
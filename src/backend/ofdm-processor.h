@@ -47,6 +47,7 @@
 #include "radio-receiver-options.h"
 #include "fic-handler.h"
 #include "msc-handler.h"
+#include "metrics.h"
 
 class OFDMProcessor
 {
@@ -110,8 +111,28 @@ class OFDMProcessor
         bool scanMode = false;
         int attempts = 0;
 
+        /* Flywheel: after phase synchronisation failed on a frame that
+         * followed one with a clear correlation peak, the frame is assumed
+         * to start where the last good one did, and phase synchronisation
+         * is tried again on the next frame. Only after flywheelMaxFrames
+         * consecutive failures does the processor fall back to searching
+         * the NULL symbol. While the flywheel is armed, a weak correlation
+         * peak is accepted if it is within flywheelMaxOffset samples of the
+         * predicted start, and counts as a failure otherwise. */
+        static constexpr int flywheelMaxFrames = 5;
+        static constexpr int32_t flywheelMaxOffset = 4;
+        int flywheelFramesLeft = 0;
+        bool flywheelActive = false;
+        int32_t lastGoodStartIndex = 0;
+
         int32_t bufferContent = 0;
 
+        metrics::Counter& framesCounter;
+        metrics::Counter& syncLostCounter;
+        metrics::Counter& flywheelFramesCounter;
+        metrics::Counter& flywheelRecoveriesCounter;
+        metrics::Gauge& inputBufferFill;
+
         fft::Forward fft_handler;
         DSPCOMPLEX *fft_buffer; // of size T_u
 
@@ -165,7 +165,7 @@ void PADDecoder::Process(const uint8_t *xpad_data, size_t xpad_len, bool exact_x
 				// if new Data Group available, append it
 				if(mot_decoder.ProcessDataSubfield(start, xpad + xpad_offset, xpad_ci.len)) {
 					// if new slide available, show it
-					if(mot_manager.HandleMOTDataGroup(mot_decoder.GetMOTDataGroup())) {
+					if(mot_manager.HandleMOTDataGroup(mot_decoder.GetMOTDataGroup(), mot_decoder.GetMOTDataGroupLen())) {
 						const MOT_FILE new_slide = mot_manager.GetFile();
 
 						// check file type
@@ -437,9 +437,3 @@ bool MOTDecoder::DecodeDataGroup() {
 
 	return true;
 }
-
-std::vector<uint8_t> MOTDecoder::GetMOTDataGroup() {
-	std::vector<uint8_t> result(mot_len);
-	memcpy(&result[0], &dg_raw[0], mot_len);
-	return result;
-}
@@ -137,7 +137,8 @@ public:
 
 	void SetLen(size_t mot_len) {this->mot_len = mot_len;}
 
-	std::vector<uint8_t> GetMOTDataGroup();
+	const uint8_t* GetMOTDataGroup() const {return &dg_raw[0];}
+	size_t GetMOTDataGroupLen() const {return mot_len;}
 };
 
 
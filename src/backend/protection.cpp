@@ -0,0 +1,129 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include <stdexcept>
+#include "protection.h"
+
+//  The generator polynomials of the convolutional code, in the
+//  notation of EN 300 401 clause 11.1.1, applied to a register
+//  holding the current input bit in bit 6
+static const uint8_t polys[4] = { 0133, 0171, 0145, 0133 };
+
+//  The demodulator maps a 0 to negative soft bits
+static const softbit_t softbit_zero = -127;
+static const softbit_t softbit_one = 127;
+
+static inline uint8_t parity(uint8_t x)
+{
+    x ^= x >> 4;
+    x ^= x >> 2;
+    x ^= x >> 1;
+    return x & 1;
+}
+
+size_t puncturedSize(const std::vector<PuncturingBlock>& puncturing)
+{
+    size_t size = 0;
+    for (const auto& p : puncturing) {
+        for (int j = 0; j < 32; j++) {
+            if (p.PI[j] != 0) {
+                size += 4 * p.count;
+            }
+        }
+    }
+
+    for (int i = 0; i < 24; i++) {
+        if (PI_X[i] != 0) {
+            size++;
+        }
+    }
+    return size;
+}
+
+size_t convolve(const uint8_t *bits, size_t nbits,
+        const std::vector<PuncturingBlock>& puncturing, softbit_t *out)
+{
+    size_t codewordBits = 0;
+    for (const auto& p : puncturing) {
+        codewordBits += 128 * p.count;
+    }
+
+    if (codewordBits != 4 * nbits) {
+        throw std::logic_error("Puncturing does not match the number of bits");
+    }
+
+    //  The mother code of nbits data bits followed by six zero tail bits,
+    //  punctured on the fly
+    uint8_t shiftRegister = 0;
+    size_t outCounter = 0;
+    auto blockIt = puncturing.cbegin();
+    int16_t blockCount = 0;
+    size_t blockPos = 0;
+    while (blockIt != puncturing.cend() and blockIt->count == 0) {
+        ++blockIt;
+    }
+
+    for (size_t i = 0; i < nbits + 6; i++) {
+        const uint8_t bit = i < nbits ? (bits[i] & 1) : 0;
+        shiftRegister = (shiftRegister >> 1) | (bit << 6);
+
+        for (int k = 0; k < 4; k++) {
+            bool keep;
+            if (i < nbits) {
+                keep = blockIt->PI[blockPos % 32] != 0;
+                if (++blockPos == 128) {
+                    blockPos = 0;
+                    if (++blockCount == blockIt->count) {
+                        blockCount = 0;
+                        do {
+                            ++blockIt;
+                        } while (blockIt != puncturing.cend() and blockIt->count == 0);
+                    }
+                }
+            }
+            else {
+                keep = PI_X[4 * (i - nbits) + k] != 0;
+            }
+
+            if (keep) {
+                out[outCounter++] = parity(shiftRegister & polys[k]) ?
+                    softbit_one : softbit_zero;
+            }
+        }
+    }
+
+    return outCounter;
+}
+
+BitErrors countBitErrors(const uint8_t *bits, size_t nbits,
+        const std::vector<PuncturingBlock>& puncturing,
+        const softbit_t *received, softbit_t *encoded)
+{
+    const size_t size = convolve(bits, nbits, puncturing, encoded);
+
+    BitErrors e;
+    for (size_t i = 0; i < size; i++) {
+        if (received[i] != 0) {
+            e.bits++;
+            e.errors += (received[i] > 0) != (encoded[i] > 0);
+        }
+    }
+    return e;
+}
@@ -25,15 +25,56 @@
 #define __PROTECTION
 
 #include <cstdint>
+#include <cstddef>
+#include <vector>
 #include "dab-constants.h"
 
 extern uint8_t PI_X[];
 
+//  count blocks of 128 bits of the mother code, punctured
+//  according to the vector PI
+struct PuncturingBlock {
+    int16_t count;
+    const int8_t *PI;
+};
+
 class Protection
 {
     public:
         virtual ~Protection() = default;
         virtual bool deconvolve(const softbit_t *, int32_t, uint8_t *) = 0;
+
+        //  The puncturing of the codeword, the final 24 bits are
+        //  always punctured according to PI_X
+        const std::vector<PuncturingBlock>& getPuncturing(void) const
+            { return puncturing; }
+
+    protected:
+        std::vector<PuncturingBlock> puncturing;
 };
+
+//  Apply the convolutional code and the puncturing to nbits bits
+//  (one bit per byte), the opposite of what the deconvolvers do.
+//  The output are soft bits of full confidence, as the demodulator
+//  would deliver them for a perfect signal.
+//  Returns the number of soft bits written to out.
+size_t convolve(const uint8_t *bits, size_t nbits,
+        const std::vector<PuncturingBlock>& puncturing, softbit_t *out);
+
+//  Number of soft bits a punctured codeword consists of
+size_t puncturedSize(const std::vector<PuncturingBlock>& puncturing);
+
+struct BitErrors {
+    size_t errors = 0;
+    size_t bits = 0;
+};
+
+//  Encode the nbits bits the Viterbi decoder delivered again, into
+//  encoded, and compare the hard decisions of the soft bits it received
+//  against them. This estimates the bit error rate before the Viterbi
+//  decoder. Erased soft bits are not counted.
+BitErrors countBitErrors(const uint8_t *bits, size_t nbits,
+        const std::vector<PuncturingBlock>& puncturing,
+        const softbit_t *received, softbit_t *encoded);
 #endif
 
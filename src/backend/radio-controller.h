@@ -34,10 +34,13 @@
 #define RADIOCONTROLLER_H
 
 #include <cstddef>
+#include <memory>
 #include <vector>
 #include <string>
 #include <complex>
 #include "dab-constants.h"
+#include "audio-frame.h"
+#include "audio-postprocessor.h"
 
 struct dab_date_time_t {
     int year = 0;
@@ -63,7 +66,8 @@ struct tii_measurement_t {
 };
 
 struct mot_file_t {
-    std::vector<uint8_t> data;
+    // Shared by all receivers, never modified
+    std::shared_ptr<const std::vector<uint8_t> > data;
     int content_sub_type;
 
     std::string content_name;
@@ -90,6 +94,17 @@ class RadioControllerInterface {
          * same units, measured in number of samples. */
         virtual void onFrequencyCorrectorChange(int fine, int coarse) = 0;
 
+        /* Modulation error ratio, in dB, of the differential QPSK points
+         * of the data symbols, averaged over frames. The differential
+         * demodulation doubles the noise, so it is about 3dB below the
+         * MER of the carriers. */
+        virtual void onMER(float /*mer*/) { };
+
+        /* The OFDM decoder estimated the offset of the sample clock from
+         * its nominal rate, in parts per million. It is positive when the
+         * input delivers more samples per frame than it should. */
+        virtual void onSampleClockOffset(float /*ppm*/) { };
+
         /* Indicate if receive signal synchronisation was acquired or lost. */
         virtual void onSyncChange(char isSync) = 0;
 
@@ -108,9 +123,14 @@ class RadioControllerInterface {
 
         virtual void onDateTimeUpdate(const dab_date_time_t& dateTime) = 0;
 
-        /* For every FIB, tell if the CRC check passed. fib points to a bit-vector with 256 bits of FIB data  */
+        /* For every FIB, tell if the CRC check passed. fib points to the 32 bytes of FIB data, CRC included */
         virtual void onFIBDecodeSuccess(bool crcCheckOk, const uint8_t* fib) = 0;
 
+        /* For every FIC codeword, the number of soft bits whose hard
+         * decision differs from the re-encoded output of the Viterbi
+         * decoder, out of numBits, see countBitErrors in protection.h. */
+        virtual void onFICBitErrors(size_t /*bitErrors*/, size_t /*numBits*/) { };
+
         /* When a new channel impulse response vector was calculated */
         virtual void onNewImpulseResponse(std::vector<float>&& data) = 0;
 
@@ -140,11 +160,12 @@ class ProgrammeHandlerInterface {
          * decoder.  */
         virtual void onFrameErrors(int frameErrors) = 0;
 
-        /* New audio data is available. The sampleRate and the
-         * stereo indicator may change at any time.
+        /* New audio data is available. The sample rate may change at
+         * any time. The frame is shared and reused by the decoder once
+         * all references to it are dropped, see audio-frame.h.
          * mode is an information related to the audio encoding
          * used.  */
-        virtual void onNewAudio(std::vector<int16_t>&& audioData, int sampleRate, const std::string& mode) = 0;
+        virtual void onNewAudio(const audio_frame_ptr& frame, const std::string& mode) = 0;
 
         /* (DAB+ only) Reed-Solomon decoding error indicator, and
          * number of corrected errors.
@@ -152,6 +173,11 @@ class ProgrammeHandlerInterface {
          * with an count of 0. */
         virtual void onRsErrors(bool uncorrectedErrors, int numCorrectedErrors) = 0;
 
+        /* For every CIF of the subchannel, the number of soft bits whose
+         * hard decision differs from the re-encoded output of the Viterbi
+         * decoder, out of numBits. */
+        virtual void onBitErrors(size_t /*bitErrors*/, size_t /*numBits*/) { }
+
         /* (DAB+ only) Audio Decoder error */
         virtual void onAacErrors(int aacErrors) = 0;
 
@@ -168,6 +194,33 @@ class ProgrammeHandlerInterface {
          * and effective X-PAD length.
          */
         virtual void onPADLengthError(size_t announced_xpad_len, size_t xpad_len) = 0;
+
+        /* Return false if onNewAudio is not needed. The audio decoder is
+         * then skipped, but PAD, the Reed-Solomon and CRC error counters and
+         * the encoded audio are still delivered. onNewAudio is only called
+         * with frames without samples, to announce the sample rate and mode.
+         * This is polled for every DAB frame, a change takes effect
+         * within one superframe.  */
+        virtual bool wantsDecodedAudio() const { return true; }
+
+        /* Resampling and loudness processing to apply to the decoded
+         * audio before onNewAudio, see audio-postprocessor.h. Disabled
+         * by default. This is polled for every audio frame.  */
+        virtual audio_postprocessing_t audioPostProcessing() const {
+            return audio_postprocessing_t();
+        }
+
+        /* Return true to receive the audio as broadcast, through
+         * onNewEncodedAudio. This is polled for every DAB frame.  */
+        virtual bool wantsEncodedAudio() const { return false; }
+
+        /* The audio as broadcast, without decoding: MPEG-1/2 Layer II
+         * frames for DAB, AAC access units in LATM/LOAS (AudioSyncStream)
+         * for DAB+. duration_ms is the duration of the audio contained
+         * in data.  */
+        virtual void onNewEncodedAudio(const uint8_t *data, size_t len, size_t duration_ms) {
+            (void)data; (void)len; (void)duration_ms;
+        }
 };
 
 enum class DeviceParam {
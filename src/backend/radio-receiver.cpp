@@ -37,6 +37,10 @@
 
 using namespace std;
 
+// How long a cached ensemble is presented if the FIC never delivers a
+// complete ensemble
+static const auto cachedEnsembleLifetime = chrono::seconds(30);
+
 const char* fftPlacementMethodToString(FFTPlacementMethod fft_placement)
 {
     switch (fft_placement) {
@@ -68,6 +72,8 @@ RadioReceiver::RadioReceiver(
                 InputInterface& input,
                 RadioReceiverOptions rro,
                 int transmission_mode) :
+    radioInterface(rci),
+    input(input),
     params(transmission_mode),
     mscHandler(params, false),
     ficHandler(rci),
@@ -77,26 +83,81 @@ RadioReceiver::RadioReceiver(
         mscHandler,
         ficHandler,
         rro)
-{ }
+{
+    ficHandler.fibProcessor.setEnsembleCallback(
+            [this](const ensemble_ptr& e) { onEnsemblePublished(e); });
+}
+
+RadioReceiver::~RadioReceiver()
+{
+    stopExpiryTimer();
+
+    if (etiReader) {
+        etiReader->stop();
+    }
+    stopEtiOutput();
+
+    lock_guard<mutex> lock(cacheMutex);
+    storeEnsemble();
+}
+
+void RadioReceiver::setEnsembleCache(shared_ptr<EnsembleCache> cache)
+{
+    lock_guard<mutex> lock(cacheMutex);
+    ensembleCache = cache;
+}
 
 void RadioReceiver::restart(bool doScan)
 {
-    ofdmProcessor.set_scanMode(doScan);
+    stopExpiryTimer();
     mscHandler.stopProcessing();
+    {
+        lock_guard<mutex> lock(cacheMutex);
+        storeEnsemble();
+    }
     ficHandler.clearEnsemble();
-    ofdmProcessor.restart();
+    {
+        lock_guard<mutex> lock(cacheMutex);
+        loadCachedEnsemble();
+    }
+
+    if (etiReader) {
+        etiReader->restart();
+        etiReaderRunning = true;
+    }
+    else {
+        ofdmProcessor.set_scanMode(doScan);
+        ofdmProcessor.restart();
+    }
 }
 
 void RadioReceiver::restart_decoder()
 {
     mscHandler.stopProcessing();
+    {
+        lock_guard<mutex> lock(cacheMutex);
+        provisionalDecoders.clear();
+    }
     ficHandler.clearEnsemble();
 }
 
 void RadioReceiver::stop()
 {
-    ofdmProcessor.stop();
+    if (etiReader) {
+        etiReader->stop();
+        etiReaderRunning = false;
+    }
+    else {
+        ofdmProcessor.stop();
+    }
+    stopExpiryTimer();
     mscHandler.stopProcessing();
+    {
+        lock_guard<mutex> lock(cacheMutex);
+        storeEnsemble();
+        cachedEnsemble.reset();
+        provisionalDecoders.clear();
+    }
     ficHandler.clearEnsemble();
 }
 
@@ -131,12 +192,21 @@ bool RadioReceiver::addServiceToDecode(ProgrammeHandlerInterface& handler,
 
 bool RadioReceiver::removeServiceToDecode(const Service& s)
 {
-    const auto comps = ficHandler.fibProcessor.getComponents(s);
-    for (const auto& sc : comps) {
-        if (sc.transportMode() == TransportMode::Audio) {
-            const auto& subch = ficHandler.fibProcessor.getSubchannel(sc);
-            if (subch.valid()) {
-                return mscHandler.removeSubchannel(subch);
+    lock_guard<mutex> lock(cacheMutex);
+
+    const auto p = provisionalDecoders.find(s.serviceId);
+    if (p != provisionalDecoders.end()) {
+        const bool removed = mscHandler.removeSubchannel(p->second.subchannel);
+        provisionalDecoders.erase(p);
+        return removed;
+    }
+
+    const auto ensemble = currentEnsemble();
+    for (const auto sc : ensemble->findComponents(s.serviceId)) {
+        if (sc->transportMode() == TransportMode::Audio) {
+            const auto subch = ensemble->findSubchannel(sc->subchannelId);
+            if (subch) {
+                return mscHandler.removeSubchannel(*subch);
             }
         }
     }
@@ -146,20 +216,32 @@ bool RadioReceiver::removeServiceToDecode(const Service& s)
 bool RadioReceiver::playProgramme(ProgrammeHandlerInterface& handler,
         const Service& s, const std::string& dumpFileName, bool unique)
 {
-    const auto comps = ficHandler.fibProcessor.getComponents(s);
-    for (const auto& sc : comps) {
-        if (sc.transportMode() == TransportMode::Audio) {
-            const auto& subch = ficHandler.fibProcessor.getSubchannel(sc);
+    lock_guard<mutex> lock(cacheMutex);
 
-            if (subch.valid()) {
+    const auto ensemble = currentEnsemble();
+    for (const auto sc : ensemble->findComponents(s.serviceId)) {
+        if (sc->transportMode() == TransportMode::Audio) {
+            const auto subch = ensemble->findSubchannel(sc->subchannelId);
+
+            if (subch) {
                 if (unique) {
                     mscHandler.stopProcessing();
+                    provisionalDecoders.clear();
                 }
 
-                if (sc.audioType() == AudioServiceComponentType::DAB ||
-                    sc.audioType() == AudioServiceComponentType::DABPlus) {
+                if (sc->audioType() == AudioServiceComponentType::DAB ||
+                    sc->audioType() == AudioServiceComponentType::DABPlus) {
                     mscHandler.addSubchannel(
-                            handler, sc.audioType(), dumpFileName, subch);
+                            handler, sc->audioType(), dumpFileName, *subch);
+
+                    if (ensemble->cached) {
+                        ProvisionalDecoder p;
+                        p.handler = &handler;
+                        p.dumpFileName = dumpFileName;
+                        p.audioType = sc->audioType();
+                        p.subchannel = *subch;
+                        provisionalDecoders[s.serviceId] = p;
+                    }
                     return true;
                 }
             }
@@ -169,42 +251,226 @@ bool RadioReceiver::playProgramme(ProgrammeHandlerInterface& handler,
     return false;
 }
 
+ensemble_ptr RadioReceiver::currentEnsemble() const
+{
+    auto live = ficHandler.fibProcessor.getEnsemble();
+
+    // The live ensemble has no EId until FIG0/0 was received
+    if (cachedEnsemble and
+            (live->id == 0 or live->id == cachedEnsemble->id) and
+            chrono::steady_clock::now() < cachedEnsembleExpiry) {
+        return cachedEnsemble;
+    }
+    return live;
+}
+
+void RadioReceiver::loadCachedEnsemble()
+{
+    cachedEnsemble.reset();
+    provisionalDecoders.clear();
+    ensembleStored = false;
+    cacheFrequency = 0;
+
+    // An ETI input has no frequency
+    if (ensembleCache and not etiReader) {
+        cacheFrequency = input.getFrequency();
+        cachedEnsemble = ensembleCache->load(cacheFrequency);
+        cachedEnsembleExpiry = chrono::steady_clock::now() + cachedEnsembleLifetime;
+
+        if (cachedEnsemble) {
+            startExpiryTimer();
+        }
+    }
+}
+
+void RadioReceiver::startExpiryTimer()
+{
+    expiryTimerStopped = false;
+    expiryThread = thread(&RadioReceiver::runExpiryTimer, this);
+}
+
+void RadioReceiver::stopExpiryTimer()
+{
+    {
+        lock_guard<mutex> lock(cacheMutex);
+        expiryTimerStopped = true;
+    }
+    expiryCondition.notify_all();
+
+    if (expiryThread.joinable()) {
+        expiryThread.join();
+    }
+}
+
+void RadioReceiver::runExpiryTimer()
+{
+    unique_lock<mutex> lock(cacheMutex);
+    if (expiryCondition.wait_until(lock, cachedEnsembleExpiry,
+                [&]{ return expiryTimerStopped; })) {
+        return;
+    }
+
+    // Without any FIC, the first ensemble published finalises them instead
+    const auto live = ficHandler.fibProcessor.getEnsemble();
+    if (live->id == 0) {
+        return;
+    }
+
+    // The live ensemble may have stopped changing before it was complete,
+    // in which case onEnsemblePublished() is not called any more.
+    if (not provisionalDecoders.empty()) {
+        updateProvisionalDecoders(*live, true, true);
+    }
+    cachedEnsemble.reset();
+}
+
+void RadioReceiver::storeEnsemble()
+{
+    if (not ensembleCache or cacheFrequency == 0) {
+        return;
+    }
+
+    const auto live = ficHandler.fibProcessor.getEnsemble();
+    if (live->isComplete()) {
+        ensembleCache->store(cacheFrequency, *live);
+        ensembleStored = true;
+    }
+}
+
+void RadioReceiver::updateProvisionalDecoders(const Ensemble& reference,
+        bool confirmed, bool final)
+{
+    for (auto it = provisionalDecoders.begin(); it != provisionalDecoders.end();) {
+        auto& p = it->second;
+
+        const ServiceComponent *component = nullptr;
+        const Subchannel *subch = nullptr;
+        for (const auto sc : reference.findComponents(it->first)) {
+            if (sc->transportMode() == TransportMode::Audio and
+                    reference.findSubchannel(sc->subchannelId)) {
+                component = sc;
+                subch = reference.findSubchannel(sc->subchannelId);
+                break;
+            }
+        }
+
+        if (component) {
+            if (component->audioType() != p.audioType or
+                    not subch->sameOrganisation(p.subchannel)) {
+                clog << "RadioReceiver: cached subchannel of service 0x" <<
+                    hex << it->first << dec << " changed" << endl;
+                mscHandler.removeSubchannel(p.subchannel);
+                mscHandler.addSubchannel(*p.handler,
+                        component->audioType(), p.dumpFileName, *subch);
+                p.audioType = component->audioType();
+                p.subchannel = *subch;
+            }
+
+            if (confirmed) {
+                it = provisionalDecoders.erase(it);
+                continue;
+            }
+        }
+        else if (final) {
+            clog << "RadioReceiver: cached service 0x" <<
+                hex << it->first << dec << " is gone" << endl;
+            mscHandler.removeSubchannel(p.subchannel);
+            it = provisionalDecoders.erase(it);
+            continue;
+        }
+
+        ++it;
+    }
+}
+
+void RadioReceiver::onEnsemblePublished(const ensemble_ptr& live)
+{
+    lock_guard<mutex> lock(cacheMutex);
+
+    if (live->id == 0) {
+        return;
+    }
+
+    if (cachedEnsemble and live->id != cachedEnsemble->id) {
+        // Not the ensemble last seen on this frequency, maybe one seen before
+        cachedEnsemble = ensembleCache->load(cacheFrequency, live->id);
+        if (cachedEnsemble) {
+            updateProvisionalDecoders(*cachedEnsemble, false, true);
+        }
+    }
+
+    const bool complete = live->isComplete();
+    const bool final = complete or
+        chrono::steady_clock::now() >= cachedEnsembleExpiry;
+
+    if (not provisionalDecoders.empty()) {
+        updateProvisionalDecoders(*live, true, final);
+    }
+
+    if (final) {
+        cachedEnsemble.reset();
+    }
+
+    // Write the ensemble as soon as it is known, so that it is not lost if
+    // the receiver is not shut down cleanly. This happens once per tune.
+    if (complete and not ensembleStored) {
+        storeEnsemble();
+    }
+}
+
+ensemble_ptr RadioReceiver::getEnsemble(void) const
+{
+    lock_guard<mutex> lock(cacheMutex);
+    return currentEnsemble();
+}
+
 uint16_t RadioReceiver::getEnsembleId(void) const
 {
-    return ficHandler.fibProcessor.getEnsembleId();
+    return getEnsemble()->id;
 }
 
 uint8_t RadioReceiver::getEnsembleEcc(void) const
 {
-    return ficHandler.fibProcessor.getEnsembleEcc();
+    return getEnsemble()->ecc;
 }
 
 DabLabel RadioReceiver::getEnsembleLabel(void) const
 {
-    return ficHandler.fibProcessor.getEnsembleLabel();
+    return getEnsemble()->label;
 }
 
 std::vector<Service> RadioReceiver::getServiceList(void) const
 {
-    return ficHandler.fibProcessor.getServiceList();
+    return getEnsemble()->services;
+}
+
+uint32_t RadioReceiver::getEnsembleVersion(void) const
+{
+    return ficHandler.fibProcessor.getDatabaseVersion();
 }
 
 Service RadioReceiver::getService(uint32_t sId) const
 {
-    return ficHandler.fibProcessor.getService(sId);
+    const auto srv = getEnsemble()->findService(sId);
+    return srv ? *srv : Service(0);
 }
 
 std::list<ServiceComponent> RadioReceiver::getComponents(const Service& s) const
 {
-    return ficHandler.fibProcessor.getComponents(s);
+    std::list<ServiceComponent> c;
+    for (const auto component : getEnsemble()->findComponents(s.serviceId)) {
+        c.push_back(*component);
+    }
+    return c;
 }
 
 bool RadioReceiver::serviceHasAudioComponent(const Service& s) const
 {
-    for (const auto& sc : getComponents(s)) {
-        if (sc.transportMode() == TransportMode::Audio and
-                (sc.audioType() == AudioServiceComponentType::DAB or
-                 sc.audioType() == AudioServiceComponentType::DABPlus)) {
+    const auto ensemble = getEnsemble();
+    for (const auto sc : ensemble->findComponents(s.serviceId)) {
+        if (sc->transportMode() == TransportMode::Audio and
+                (sc->audioType() == AudioServiceComponentType::DAB or
+                 sc->audioType() == AudioServiceComponentType::DABPlus)) {
             return true;
         }
     }
@@ -214,10 +480,69 @@ bool RadioReceiver::serviceHasAudioComponent(const Service& s) const
 
 Subchannel RadioReceiver::getSubchannel(const ServiceComponent& sc) const
 {
-    return ficHandler.fibProcessor.getSubchannel(sc);
+    return getEnsemble()->subchannels.at(sc.subchannelId);
 }
 
 DABParams& RadioReceiver::getParams()
 {
     return params;
 }
+
+bool RadioReceiver::startEtiOutput(const std::string& filename, bool lossless)
+{
+    stopEtiOutput();
+
+    try {
+        etiWriter = make_shared<EtiWriter>(filename, params, ficHandler.fibProcessor, lossless);
+    }
+    catch (const runtime_error& e) {
+        clog << e.what() << endl;
+        return false;
+    }
+
+    ficHandler.setEtiWriter(etiWriter);
+    mscHandler.setEtiWriter(etiWriter);
+    return true;
+}
+
+void RadioReceiver::stopEtiOutput()
+{
+    ficHandler.setEtiWriter(nullptr);
+    mscHandler.setEtiWriter(nullptr);
+
+    // The writer flushes the file once the handlers released it
+    etiWriter.reset();
+}
+
+bool RadioReceiver::setEtiInput(const std::string& filename, bool throttle, bool rewind)
+{
+    const bool wasRunning = etiReaderRunning;
+    if (etiReader) {
+        etiReader->stop();
+        etiReaderRunning = false;
+    }
+    else {
+        ofdmProcessor.stop();
+    }
+
+    try {
+        etiReader = make_unique<EtiReader>(filename, params,
+                radioInterface, ficHandler, mscHandler,
+                throttle, rewind);
+    }
+    catch (const runtime_error& e) {
+        clog << e.what() << endl;
+        etiReader.reset();
+        return false;
+    }
+
+    if (wasRunning) {
+        restart(false);
+    }
+    return true;
+}
+
+bool RadioReceiver::etiEndReached() const
+{
+    return etiReader and etiReader->endReached();
+}
@@ -33,13 +33,21 @@
 #ifndef RADIO_RECEIVER_H
 #define RADIO_RECEIVER_H
 
+#include <chrono>
+#include <condition_variable>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include "radio-controller.h"
 #include "radio-receiver-options.h"
 #include "fic-handler.h"
 #include "msc-handler.h"
 #include "ofdm-processor.h"
+#include "eti-reader.h"
+#include "eti-writer.h"
+#include "ensemble-cache.h"
 
 const char* fftPlacementMethodToString(FFTPlacementMethod fft_placement);
 const char* freqSyncMethodToString(FreqsyncMethod method);
@@ -51,6 +59,7 @@ class RadioReceiver {
                 InputInterface& input,
                 RadioReceiverOptions rro,
                 int transmission_mode = 1);
+        ~RadioReceiver();
 
         /* Restart the receiver, and specify if we want
          * to scan or receive. */
@@ -62,6 +71,14 @@ class RadioReceiver {
 
         void stop();
 
+        /* Keep the ensembles in the given cache. When the receiver is
+         * restarted on a frequency where an ensemble was seen before, the
+         * cached ensemble is presented until the FIC has delivered a complete
+         * one, and its services can be decoded right away. The decoders
+         * started that way are checked against the live subchannel
+         * organisation as it arrives, and corrected or removed. */
+        void setEnsembleCache(std::shared_ptr<EnsembleCache> cache);
+
         /* Update the currently running receiver with new configuration */
         void setReceiverOptions(const RadioReceiverOptions rro);
 
@@ -75,11 +92,20 @@ class RadioReceiver {
 
         bool removeServiceToDecode(const Service& s);
 
+        /* The latest snapshot of the ensemble database. It never changes,
+         * and getting it does not wait for the FIC decoder. Prefer it over
+         * the getters below when querying the ensemble several times. */
+        ensemble_ptr getEnsemble(void) const;
+
         uint16_t getEnsembleId(void) const;
         uint8_t getEnsembleEcc(void) const;
         DabLabel getEnsembleLabel(void) const;
         std::vector<Service> getServiceList(void) const;
 
+        /* Changes every time the FIC changes the ensemble database, use it
+         * to avoid rebuilding views of the ensemble when nothing changed. */
+        uint32_t getEnsembleVersion(void) const;
+
         /* Returns a service with sid 0 in case it is missing */
         // TODO use std::optional<Service> once using C++17 makes sense
         Service getService(uint32_t sId) const;
@@ -95,17 +121,78 @@ class RadioReceiver {
 
         DABParams& getParams(void);
 
+        /* Write the whole ensemble to an ETI-NI file. Returns false if
+         * the file cannot be opened. A lossless output holds up the
+         * demodulator instead of dropping CIFs, which is only suitable
+         * for input from a file that is not throttled. */
+        bool startEtiOutput(const std::string& filename, bool lossless = false);
+        void stopEtiOutput(void);
+
+        /* Decode the given ETI-NI file instead of the input samples.
+         * With throttle the file is replayed in real time, and with
+         * rewind it is replayed in a loop. Takes effect immediately if the
+         * receiver is running, otherwise at the next restart(). */
+        bool setEtiInput(const std::string& filename, bool throttle, bool rewind);
+
+        /* True once the ETI input was replayed completely */
+        bool etiEndReached(void) const;
+
     private:
         bool playProgramme(ProgrammeHandlerInterface& handler,
                 const Service& s,
                 const std::string& dumpFileName,
                 bool unique);
 
+        // All below must be called with cacheMutex held
+        ensemble_ptr currentEnsemble(void) const;
+        void loadCachedEnsemble(void);
+        void storeEnsemble(void);
+        void updateProvisionalDecoders(const Ensemble& reference,
+                bool confirmed, bool final);
+        void startExpiryTimer(void);
+
+        // Must be called without cacheMutex
+        void stopExpiryTimer(void);
+        void runExpiryTimer(void);
+
+        // Called from the FIC thread
+        void onEnsemblePublished(const ensemble_ptr& live);
+
+        RadioControllerInterface& radioInterface;
+        InputInterface& input;
         DABParams params; // Defaults to TM1 parameters
 
+        // A decoder started from the cached ensemble, which the FIC did not
+        // confirm yet
+        struct ProvisionalDecoder {
+            ProgrammeHandlerInterface *handler = nullptr;
+            std::string dumpFileName;
+            AudioServiceComponentType audioType;
+            Subchannel subchannel;
+        };
+
+        // Declared before the decoders, so that it outlives the FIC thread
+        mutable std::mutex cacheMutex;
+        std::shared_ptr<EnsembleCache> ensembleCache;
+        ensemble_ptr cachedEnsemble;
+        std::chrono::steady_clock::time_point cachedEnsembleExpiry;
+        std::map<uint32_t, ProvisionalDecoder> provisionalDecoders;
+        int cacheFrequency = 0;
+        bool ensembleStored = false;
+
+        // Finalises the provisional decoders when the cached ensemble
+        // expires, even if no new ensemble is published by then
+        std::thread expiryThread;
+        std::condition_variable expiryCondition;
+        bool expiryTimerStopped = false;
+
         MscHandler mscHandler;
         FicHandler ficHandler;
         OFDMProcessor ofdmProcessor;
+
+        std::shared_ptr<EtiWriter> etiWriter;
+        std::unique_ptr<EtiReader> etiReader;
+        bool etiReaderRunning = false;
 };
 
 #endif
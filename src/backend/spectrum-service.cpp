@@ -0,0 +1,179 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include "spectrum-service.h"
+
+using namespace std;
+
+SpectrumService::SpectrumService(int fft_size, int num_averages) :
+    fft_size(fft_size),
+    num_averages(num_averages),
+    window(fft_size),
+    fft_handler(fft_size),
+    power_acc(fft_size)
+{
+    if (fft_size < 2 or num_averages < 1) {
+        throw invalid_argument("Invalid SpectrumService parameters");
+    }
+
+    // Hann window, scaled so that the window has unit power. Noise-like
+    // signals such as OFDM then keep the level they would have without
+    // windowing.
+    double power = 0.0;
+    for (int i = 0; i < fft_size; i++) {
+        window[i] = 0.5f * (1.0f - cosf(2.0f * (float)M_PI * i / fft_size));
+        power += window[i] * window[i];
+    }
+
+    const float scale = sqrt(fft_size / power);
+    for (auto& w : window) {
+        w *= scale;
+    }
+}
+
+SpectrumService::~SpectrumService()
+{
+    stop();
+}
+
+void SpectrumService::start(sample_source_t src, chrono::milliseconds ival)
+{
+    stop();
+
+    source = src;
+    interval = ival;
+    running = true;
+    thread = std::thread(&SpectrumService::run, this);
+}
+
+void SpectrumService::stop()
+{
+    {
+        lock_guard<mutex> lock(thread_mutex);
+        running = false;
+    }
+    thread_cv.notify_all();
+
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+size_t SpectrumService::blockSize() const
+{
+    return fft_size / 2 * (num_averages + 1);
+}
+
+void SpectrumService::run()
+{
+    while (running) {
+        auto samples = source(blockSize());
+        feed(samples);
+
+        unique_lock<mutex> lock(thread_mutex);
+        thread_cv.wait_for(lock, interval, [&]{ return not running; });
+    }
+}
+
+void SpectrumService::feed(const vector<DSPCOMPLEX>& samples)
+{
+    feed(samples.data(), samples.size());
+}
+
+void SpectrumService::feed(const DSPCOMPLEX *samples, size_t num_samples)
+{
+    const size_t hop = fft_size / 2;
+
+    lock_guard<mutex> lock(fft_mutex);
+    for (size_t pos = 0; pos + fft_size <= num_samples; pos += hop) {
+        processSegment(samples + pos);
+
+        if (segments_acc >= (size_t)num_averages) {
+            publish();
+        }
+    }
+}
+
+void SpectrumService::processSegment(const DSPCOMPLEX *segment)
+{
+    DSPCOMPLEX *fftBuffer = fft_handler.getVector();
+    for (int i = 0; i < fft_size; i++) {
+        fftBuffer[i] = segment[i] * window[i];
+    }
+
+    fft_handler.do_FFT();
+
+    for (int i = 0; i < fft_size; i++) {
+        power_acc[i] += norm(fftBuffer[i]);
+    }
+    segments_acc++;
+}
+
+void SpectrumService::publish()
+{
+    auto spectrum = make_shared<Spectrum>();
+    spectrum->bins.resize(fft_size);
+    spectrum->num_segments = segments_acc;
+    spectrum->sequence = ++sequence;
+    spectrum->timestamp = chrono::steady_clock::now();
+
+    const size_t half = fft_size / 2;
+    double total_power = 0.0;
+    for (int i = 0; i < fft_size; i++) {
+        const float p = power_acc[i] / segments_acc;
+        total_power += p;
+
+        // Shift FFT samples
+        spectrum->bins[(i + half) % fft_size] = sqrt(p);
+    }
+
+    const double mean_power = total_power / fft_size;
+    spectrum->level_dB = mean_power > 0 ? 10.0 * log10(mean_power) : -1000.0;
+
+    fill(power_acc.begin(), power_acc.end(), 0.0f);
+    segments_acc = 0;
+
+    lock_guard<mutex> lock(snapshot_mutex);
+    snapshot = move(spectrum);
+}
+
+shared_ptr<const SpectrumService::Spectrum> SpectrumService::getSpectrum() const
+{
+    lock_guard<mutex> lock(snapshot_mutex);
+    return snapshot;
+}
+
+vector<float> SpectrumService::decimate(const vector<float>& bins, size_t num_bins)
+{
+    if (num_bins == 0 or num_bins >= bins.size()) {
+        return bins;
+    }
+
+    vector<float> decimated(num_bins);
+    for (size_t i = 0; i < num_bins; i++) {
+        const size_t first = i * bins.size() / num_bins;
+        const size_t last = (i + 1) * bins.size() / num_bins;
+        decimated[i] = *max_element(bins.begin() + first, bins.begin() + last);
+    }
+    return decimated;
+}
@@ -0,0 +1,119 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "dab-constants.h"
+#include "fft.h"
+
+/* The SpectrumService computes a Hann-windowed power spectrum, averaged
+ * over several half-overlapping segments (Welch's method). One FFT plan is
+ * created in the constructor and reused for every segment.
+ *
+ * The result is published as an immutable snapshot, which any number of
+ * readers can hold on to without locking the FFT buffers.
+ *
+ * Samples either come from a source that the service polls at a fixed
+ * cadence (see start()), or are pushed by the caller with feed(). */
+class SpectrumService {
+    public:
+        struct Spectrum {
+            // Magnitude (square root of the averaged power) of every bin,
+            // shifted so that DC is in the middle.
+            std::vector<float> bins;
+
+            // Mean power over all bins, in dB
+            float level_dB = 0.0f;
+
+            // Number of segments that were averaged
+            size_t num_segments = 0;
+
+            // Incremented for every published spectrum
+            uint64_t sequence = 0;
+
+            std::chrono::steady_clock::time_point timestamp;
+        };
+
+        // Returns up to the given number of most recent samples
+        using sample_source_t = std::function<std::vector<DSPCOMPLEX>(int)>;
+
+        SpectrumService(int fft_size, int num_averages);
+        ~SpectrumService();
+        SpectrumService(const SpectrumService&) = delete;
+        SpectrumService& operator=(const SpectrumService&) = delete;
+
+        // Start polling the source every interval in a separate thread
+        void start(sample_source_t source, std::chrono::milliseconds interval);
+        void stop(void);
+
+        // Number of samples required to fill all segments of one average
+        size_t blockSize(void) const;
+
+        // Process a block of samples. Every full segment contained in the
+        // block is used, a new spectrum is published once num_averages
+        // segments have been accumulated.
+        void feed(const DSPCOMPLEX *samples, size_t num_samples);
+        void feed(const std::vector<DSPCOMPLEX>& samples);
+
+        // Get the latest spectrum, or nullptr if none is available yet
+        std::shared_ptr<const Spectrum> getSpectrum(void) const;
+
+        // Reduce the number of bins by keeping the peak of every group of
+        // bins. Returns the input unchanged if num_bins is zero or not smaller
+        // than the input size.
+        static std::vector<float> decimate(
+                const std::vector<float>& bins, size_t num_bins);
+
+    private:
+        void run(void);
+        void processSegment(const DSPCOMPLEX *segment);
+        void publish(void);
+
+        const int fft_size;
+        const int num_averages;
+        std::vector<float> window;
+
+        // Protects the FFT and the accumulator
+        std::mutex fft_mutex;
+        fft::Forward fft_handler;
+        std::vector<float> power_acc;
+        size_t segments_acc = 0;
+        uint64_t sequence = 0;
+
+        mutable std::mutex snapshot_mutex;
+        std::shared_ptr<const Spectrum> snapshot;
+
+        std::mutex thread_mutex;
+        std::condition_variable thread_cv;
+        std::atomic<bool> running = ATOMIC_VAR_INIT(false);
+        sample_source_t source;
+        std::chrono::milliseconds interval;
+        std::thread thread;
+};
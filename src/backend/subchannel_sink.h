@@ -75,6 +75,8 @@ protected:
 	std::mutex uscs_mutex;
 	std::set<UntouchedStreamConsumer*> uscs;
 
+	bool audio_decoding;
+
 	void ForwardUntouchedStream(const uint8_t *data, size_t len, size_t duration_ms) {
 		// mutex must already be locked!
 		for(UntouchedStreamConsumer* usc : uscs)
@@ -82,7 +84,7 @@ protected:
 	}
 public:
 	SubchannelSink(SubchannelSinkObserver* observer, std::string untouched_stream_file_extension) :
-		observer(observer), untouched_stream_file_extension(untouched_stream_file_extension) {}
+		observer(observer), untouched_stream_file_extension(untouched_stream_file_extension), audio_decoding(true) {}
 	virtual ~SubchannelSink() {}
 
 	virtual void Feed(const uint8_t *data, size_t len) = 0;
@@ -95,6 +97,10 @@ public:
 		std::lock_guard<std::mutex> lock(uscs_mutex);
 		uscs.erase(consumer);
 	}
+
+	// When disabled, no audio is decoded, but PAD, FEC info and the untouched stream are still output.
+	// A change takes effect with the next Superframe (DAB+) or frame (DAB), without resync.
+	void SetAudioDecoding(bool enabled) {audio_decoding = enabled;}
 };
 
 #endif /* SUBCHANNEL_SINK_H_ */
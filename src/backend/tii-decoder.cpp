@@ -19,6 +19,7 @@
  *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
  */
 #include <array>
+#include <cmath>
 #include <algorithm>
 #include <stdexcept>
 #include <iostream>
@@ -138,22 +139,48 @@ TIIDecoder::TIIDecoder(const DABParams& params, RadioControllerInterface& ri) :
     m_radioInterface(ri),
     m_params(params),
     m_fft_null(params.T_u),
-    m_fft_prs(params.T_u)
+    m_fft_prs(params.T_u),
+    m_error_per_delay(num_cps),
+    m_duration(metrics::registry().histogram("welle_stage_duration_seconds",
+                "Processing time of the pipeline stages", {{"stage", "tii"}}))
 {
     if (m_params.dabMode != 1) {
         clog << "TII decoder does not support mode " << m_params.dabMode << endl;
         return;
     }
 
-    for (int c = 0; c < 24; c++) {
-        for (int p = 0; p < 70; p++) {
-            for (carrier_t k = 0; k < 384; k++) {
-                for (int b = 0; b < 8; b++) {
-                    if (k == 1 + 2*c + 48*b and tii_pattern[p][b]) {
-                        m_cp_per_carrier[k].emplace(c, p);
-                    }
+    auto k_to_ix = [](carrier_t k) -> int {
+        if (k < 0)
+            return 2048 + k;
+        else
+            return k; };
+
+    m_cps_per_carrier.resize(385);
+    m_cp_carriers.resize(num_cps);
+
+    for (int c = 0; c < num_combs; c++) {
+        for (int p = 0; p < num_patterns; p++) {
+            const size_t cp_index = c * num_patterns + p;
+
+            for (int b = 0; b < 8; b++) {
+                if (tii_pattern[p][b]) {
+                    m_cps_per_carrier[1 + 2*c + 48*b].push_back(cp_index);
                 }
             }
+
+            const auto carriers = CombPattern(c, p).generateCarriers();
+            auto& cpc = m_cp_carriers[cp_index];
+
+            // Both TII carriers take the phase from the first PRS frequency
+            // of the pair. This assumes carriers is sorted.
+            for (size_t i = 0; i < carriers.size(); i++) {
+                cpc.null_bin.push_back(k_to_ix(carriers[i]));
+                cpc.prs_bin.push_back(k_to_ix(carriers[i & ~1]));
+
+                // The rotator for a delay of one sample turns the phase by
+                // k/2048 of a full turn, that is k * 2^32 / 2048 in fixed point.
+                cpc.phase_step.push_back((uint32_t)carriers[i] << 21);
+            }
         }
     }
 
@@ -204,6 +231,7 @@ void TIIDecoder::run()
 
         lock.unlock();
         // We are in NullPrsReady state, and the state will not change now
+        metrics::ScopedTimer timer(m_duration);
 
         // Take the NULL symbol from that frame, but skip the cyclic prefix and
         // truncate
@@ -285,29 +313,25 @@ void TIIDecoder::run()
             }
         }
 
-        unordered_map<CombPattern, int> cp_count;
+        vector<int> cp_count(num_cps);
         for (const carrier_t k : carriers) {
-            if (m_cp_per_carrier.count(k)) {
-                for (const auto& cps : m_cp_per_carrier[k]) {
-                    cp_count[cps]++;
-                }
+            for (const size_t cp_index : m_cps_per_carrier[k]) {
+                cp_count[cp_index]++;
             }
         }
 
-        size_t num_likely_cps = 0;
-        for (const auto& cp : cp_count) {
-            if (cp.second >= 4) {
-                num_likely_cps++;
+        vector<size_t> likely_cps;
+        for (size_t cp_index = 0; cp_index < cp_count.size(); cp_index++) {
+            if (cp_count[cp_index] >= 4) {
+                likely_cps.push_back(cp_index);
             }
         }
 
         // Sometimes the number of likely CPs is huge because
         // the threshold is wrong. Skip these cases.
-        if (num_likely_cps < 10) {
-            for (const auto& cp : cp_count) {
-                if (cp.second >= 4) {
-                    analyse_phase(cp.first);
-                }
+        if (likely_cps.size() < 10) {
+            for (const size_t cp_index : likely_cps) {
+                analyse_phase(cp_index);
             }
         }
 
@@ -317,68 +341,59 @@ void TIIDecoder::run()
     }
 }
 
-void TIIDecoder::analyse_phase(const CombPattern& cp)
+// Phase of z in 32-bit fixed point, where 2^32 is a full turn
+static int32_t fixed_phase(complexf z)
+{
+    constexpr double turn = 4294967296.0;
+    return (int32_t)(uint32_t)llrint(arg(z) / (2 * M_PI) * turn);
+}
+
+void TIIDecoder::analyse_phase(size_t cp_index)
 {
-    const auto carriers = cp.generateCarriers();
+    const auto& cpc = m_cp_carriers[cp_index];
 
     const complexf *n = m_fft_null.getVector();
     const complexf *p = m_fft_prs.getVector();
 
-    auto k_to_ix = [](carrier_t k) -> int {
-        if (k < 0)
-            return 2048 + k;
-        else
-            return k; };
-
-    // Both TII carriers take the phase from the first PRS frequency of the pair.
-    // This assumes carriers is sorted.
-    vector<float> phases_prs(carriers.size());
-
-    for (size_t i = 0; i < carriers.size(); i += 2) {
-        const int ix = k_to_ix(carriers[i]);
-
-        phases_prs[i] = arg(p[ix]);
-        phases_prs[i+1] = arg(p[ix]);
+    auto& meas = m_error_per_delay[cp_index];
+    if (meas.error_per_delay.empty()) {
+        meas.error_per_delay.resize((size_t)num_delays);
     }
-
-    auto& meas = m_error_per_correction[cp];
-
-    for (int err = -4; err < 500; err++) {
-        float abs_err = 0;
-
-        for (size_t j = 0; j < carriers.size(); j++) {
-            const int ix = k_to_ix(carriers[j]);
-            constexpr float pi = M_PI;
-            complexf rotator = polar(1.0f, 2.0f * pi * err * carriers[j] / 2048.0f);
-            float delta = arg(n[ix] * rotator) - phases_prs[j];
-            abs_err += abs(delta);
+    float *error = meas.error_per_delay.data();
+
+    /* For every delay, rotate the NULL carrier by the phase the delay
+     * would introduce, and compare it to the phase of the PRS. The phases
+     * are kept in fixed point so that the rotation is an integer addition
+     * that wraps around at a full turn, and the loop over the delays
+     * contains no trigonometry and can be vectorised. */
+    for (size_t j = 0; j < cpc.null_bin.size(); j++) {
+        const uint32_t step = cpc.phase_step[j];
+        const uint32_t start = (uint32_t)fixed_phase(n[cpc.null_bin[j]]) +
+            step * (uint32_t)min_delay;
+        const float phase_prs = fixed_phase(p[cpc.prs_bin[j]]);
+
+        for (int d = 0; d < num_delays; d++) {
+            const int32_t phase_null = start + step * (uint32_t)d;
+            error[d] += fabsf((float)phase_null - phase_prs);
         }
-        meas.error_per_correction[err] += abs_err;
     }
 
     meas.num_measurements++;
 
     if (meas.num_measurements >= 5) {
-        auto best = min_element(
-                meas.error_per_correction.begin(),
-                meas.error_per_correction.end(),
-                [](const pair<float, int>& lhs,
-                    const pair<float, int>& rhs) {
-                return lhs.second < rhs.second;
-                });
-
-        if (best != meas.error_per_correction.end()) {
-            tii_measurement_t m;
-            m.error = best->second;
-            m.delay_samples = best->first;
-            m.comb = cp.comb;
-            m.pattern = cp.pattern;
-
-            m_radioInterface.onTIIMeasurement(move(m));
-        }
+        const float *best = min_element(error, error + num_delays);
 
-        meas.error_per_correction.clear();
+        constexpr float fixed_to_rad = 2.0 * M_PI / 4294967296.0;
+
+        tii_measurement_t m;
+        m.error = *best * fixed_to_rad;
+        m.delay_samples = min_delay + (best - error);
+        m.comb = cp_index / num_patterns;
+        m.pattern = cp_index % num_patterns;
+
+        m_radioInterface.onTIIMeasurement(move(m));
+
+        fill(meas.error_per_delay.begin(), meas.error_per_delay.end(), 0.0f);
         meas.num_measurements = 0;
     }
 }
-
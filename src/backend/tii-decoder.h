@@ -20,8 +20,6 @@
  */
 #include <cstddef>
 #include "dab-constants.h"
-#include <unordered_map>
-#include <unordered_set>
 #include <list>
 #include <vector>
 #include <mutex>
@@ -30,6 +28,7 @@
 #include <complex>
 #include "fft.h"
 #include "radio-controller.h"
+#include "metrics.h"
 
 using complexf = std::complex<float>;
 
@@ -47,20 +46,8 @@ struct CombPattern {
     std::vector<carrier_t> generateCarriers(void) const;
 };
 
-// Make CombPattern satisfy Hash and Compare
 bool operator==(const CombPattern& lhs, const CombPattern& rhs);
 
-namespace std {
-    template<> struct hash<CombPattern> {
-        typedef CombPattern argument_type;
-        typedef std::size_t result_type;
-        result_type operator()(argument_type const& cp) const noexcept
-        {
-            return cp.comb * 100 + cp.pattern;
-        }
-    };
-}
-
 class TIIDecoder {
     public:
         TIIDecoder(const DABParams& params, RadioControllerInterface& ri);
@@ -74,7 +61,16 @@ class TIIDecoder {
 
     private:
         void run(void);
-        void analyse_phase(const CombPattern& cp);
+        void analyse_phase(size_t cp_index);
+
+        static constexpr int num_combs = 24;
+        static constexpr int num_patterns = 70;
+        static constexpr int num_cps = num_combs * num_patterns;
+
+        // Range of delays in samples tried by analyse_phase
+        static constexpr int min_delay = -4;
+        static constexpr int max_delay = 500;
+        static constexpr int num_delays = max_delay - min_delay;
 
         RadioControllerInterface& m_radioInterface;
         const DABParams& m_params;
@@ -82,8 +78,20 @@ class TIIDecoder {
         std::vector<complexf> m_null;
         std::vector<complexf> m_prs;
 
-        std::unordered_map<carrier_t, std::unordered_set<CombPattern> >
-            m_cp_per_carrier;
+        // For each carrier k in ]0, 384], the indices comb*num_patterns+pattern
+        // of the CombPatterns that use it.
+        std::vector<std::vector<size_t> > m_cps_per_carrier;
+
+        // For each CombPattern, the FFT bins of its carriers, the bin of the
+        // PRS carrier whose phase they take, and the phase increment of the
+        // delay rotator for one sample, as a fraction of a full turn in
+        // 32-bit fixed point.
+        struct cp_carriers_t {
+            std::vector<int> null_bin;
+            std::vector<int> prs_bin;
+            std::vector<uint32_t> phase_step;
+        };
+        std::vector<cp_carriers_t> m_cp_carriers;
 
         enum class State { Idle, NullPrsReady, Abort };
 
@@ -96,11 +104,14 @@ class TIIDecoder {
         fft::Forward m_fft_prs;
 
         struct cp_error_measurement_t {
-            std::unordered_map<float, uint64_t> error_per_correction;
+            // Accumulated phase error for every delay from min_delay
+            // to max_delay, in fixed point turns
+            std::vector<float> error_per_delay;
             size_t num_measurements = 0;
         };
 
-        std::unordered_map<CombPattern,
-            cp_error_measurement_t> m_error_per_correction;
+        std::vector<cp_error_measurement_t> m_error_per_delay;
+
+        metrics::Histogram& m_duration;
 };
 
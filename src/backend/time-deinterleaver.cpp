@@ -0,0 +1,70 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include <stdexcept>
+#include "time-deinterleaver.h"
+
+using namespace std;
+
+static const size_t interleaveMap[16] = {0,8,4,12,2,10,6,14,1,9,5,13,3,11,7,15};
+
+constexpr size_t TimeDeinterleaver::NUM_SLOTS;
+
+TimeDeinterleaver::TimeDeinterleaver(size_t fragmentSize) :
+    fragmentSize(fragmentSize),
+    buffer(NUM_SLOTS * fragmentSize)
+{
+    // Subchannels consist of CUs of 64 bits
+    if (fragmentSize % 16 != 0) {
+        throw invalid_argument("TimeDeinterleaver: fragment size must be a multiple of 16");
+    }
+}
+
+softbit_t *TimeDeinterleaver::nextCIF()
+{
+    return &buffer[writeSlot * fragmentSize];
+}
+
+bool TimeDeinterleaver::deinterleave(softbit_t *out)
+{
+    const size_t currentSlot = writeSlot;
+    writeSlot = (writeSlot + 1) % NUM_SLOTS;
+
+    if (cifsReceived < 16) {
+        cifsReceived++;
+        return false;
+    }
+
+    // Bit i comes from the CIF received 16 - interleaveMap[i % 16] CIFs
+    // ago. Resolve the slot of each of the 16 lanes once per CIF, the
+    // gather below then has a fixed pattern and no branches.
+    const softbit_t *lanes[16];
+    for (size_t k = 0; k < 16; k++) {
+        const size_t slot = (currentSlot + interleaveMap[k] + 1) % NUM_SLOTS;
+        lanes[k] = &buffer[slot * fragmentSize + k];
+    }
+
+    for (size_t j = 0; j < fragmentSize; j += 16) {
+        for (size_t k = 0; k < 16; k++) {
+            out[j + k] = lanes[k][j];
+        }
+    }
+    return true;
+}
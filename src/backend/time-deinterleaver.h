@@ -0,0 +1,55 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#pragma once
+
+#include <cstddef>
+#include <vector>
+#include "dab-constants.h"
+
+/* The time deinterleaver of one subchannel, EN 300 401 clause 12.
+ *
+ * Bit i of a CIF is delayed by 16 - interleaveMap[i % 16] CIFs, so that all
+ * bits leave the deinterleaver 16 CIFs after they arrived. The last CIFs
+ * are kept in one contiguous circular buffer of 17 slots. The new CIF is
+ * written into its slot first, directly by the producer, and the output is
+ * then gathered from the other slots. */
+class TimeDeinterleaver {
+    public:
+        explicit TimeDeinterleaver(size_t fragmentSize);
+
+        // Where the soft bits of the next CIF have to be written to,
+        // before calling deinterleave()
+        softbit_t *nextCIF(void);
+
+        // Deinterleave, writing fragmentSize soft bits to out. Returns
+        // false, leaving out untouched, until 16 CIFs have been received.
+        bool deinterleave(softbit_t *out);
+
+        size_t getFragmentSize(void) const { return fragmentSize; }
+
+    private:
+        static constexpr size_t NUM_SLOTS = 17;
+
+        const size_t fragmentSize;
+        std::vector<softbit_t> buffer;
+        size_t writeSlot = 0;
+        size_t cifsReceived = 0;
+};
@@ -164,6 +164,11 @@ UEPProtection::UEPProtection(
         PI4 = getPCodes(profileTable[index].PI4 -1);
     else
         PI4 = nullptr;
+
+    puncturing = { {L1, PI1}, {L2, PI2}, {L3, PI3} };
+    if (L4 > 0) {
+        puncturing.push_back({L4, PI4});
+    }
 }
 
 bool UEPProtection::deconvolve(const softbit_t *v, int32_t size, uint8_t *outBuffer)
@@ -224,7 +224,7 @@ uint8_t getbit (uint8_t v, int32_t o)
 //  Note that our DAB environment maps the softbits to -127 .. 127
 //  we have to map that onto 0 .. 255
 
-void Viterbi::deconvolve(softbit_t *input, uint8_t *output)
+void Viterbi::decode(softbit_t *input)
 {
     uint32_t    i;
 
@@ -239,11 +239,23 @@ void Viterbi::deconvolve(softbit_t *input, uint8_t *output)
     update_viterbi_blk_GENERIC (&vp, symbols, frameBits + (K - 1));
 
     chainback_viterbi (&vp, data, frameBits, 0);
+}
+
+void Viterbi::deconvolve(softbit_t *input, uint8_t *output)
+{
+    decode(input);
 
-    for (i = 0; i < (uint16_t)frameBits; i ++)
+    for (int32_t i = 0; i < frameBits; i ++)
         output[i] = getbit (data[i >> 3], i & 07);
 }
 
+void Viterbi::deconvolvePacked(softbit_t *input, uint8_t *output)
+{
+    decode(input);
+
+    memcpy(output, data, frameBits / 8);
+}
+
 /* C-language butterfly */
 void Viterbi::BFLY(
         int i,
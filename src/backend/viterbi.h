@@ -44,7 +44,12 @@ class Viterbi
         Viterbi& operator=(const Viterbi& other) = delete;
         void deconvolve(softbit_t *input, uint8_t *output);
 
+        // Same as deconvolve, but writes frameBits / 8 bytes, MSB first
+        void deconvolvePacked(softbit_t *input, uint8_t *output);
+
     private:
+        void decode(softbit_t *input);
+
         struct v    vp;
         COMPUTETYPE Branchtab   [NUMSTATES / 2 * RATE] __attribute__ ((aligned (16)));
         //  int parityb     (uint8_t);
@@ -50,6 +50,8 @@ CAirspy::CAirspy(RadioControllerInterface &radioController) :
     SampleBuffer(256 * 1024),
     SpectrumSampleBuffer(8192)
 {
+    SampleBuffer.setDroppedElementsCounter(droppedSamplesCounter());
+
     std::clog << "Airspy: " << "Open airspy" << std::endl;
 
     device = {};
@@ -48,6 +48,8 @@ CLimeSDR::CLimeSDR(RadioControllerInterface &radioController) :
     SampleBuffer(256 * 1024),
     SpectrumSampleBuffer(8192)
 {
+    SampleBuffer.setDroppedElementsCounter(droppedSamplesCounter());
+
     std::clog << "LimeSDR: " << "Open LimeSDR" << std::endl;
 
     //
@@ -52,6 +52,8 @@ CRTL_SDR::CRTL_SDR(RadioControllerInterface& radioController) :
     sampleBuffer(1024 * 1024),
     spectrumSampleBuffer(8192)
 {
+    sampleBuffer.setDroppedElementsCounter(droppedSamplesCounter());
+
     open_device();
 }
 
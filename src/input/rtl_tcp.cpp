@@ -65,6 +65,8 @@ CRTL_TCP_Client::CRTL_TCP_Client(RadioControllerInterface& radioController) :
     sampleBuffer(32 * 32768),
     spectrumSampleBuffer(8192)
 {
+    sampleBuffer.setDroppedElementsCounter(droppedSamplesCounter());
+
     memset(&dongleInfo, 0, sizeof(dongle_info_t));
     dongleInfo.tuner_type = RTLSDR_TUNER_UNKNOWN;
 }
@@ -47,6 +47,7 @@ CSoapySdr::CSoapySdr(RadioControllerInterface& radioController) :
     m_sampleBuffer(1024 * 1024),
     m_spectrumSampleBuffer(8192)
 {
+    m_sampleBuffer.setDroppedElementsCounter(droppedSamplesCounter());
 }
 
 CSoapySdr::~CSoapySdr()
@@ -37,6 +37,7 @@
 #include "dab-constants.h"
 #include "radio-controller.h"
 #include "ringbuffer.h"
+#include "metrics.h"
 
 enum class CDeviceID {
     UNKNOWN, NULLDEVICE, AIRSPY, RAWFILE, RTL_SDR, RTL_TCP, SOAPYSDR, ANDROID_RTL_SDR, LIMESDR};
@@ -83,6 +84,13 @@ public:
     }
 
 protected:
+    // Shared by all devices, to be attached to their sample buffer
+    static metrics::Counter& droppedSamplesCounter(void) {
+        return metrics::registry().counter("welle_input_dropped_elements_total",
+                "Number of elements dropped because the input sample buffer was full. "
+                "For devices delivering 8-bit I/Q, each element is one I or Q byte");
+    }
+
     void putIntoRecordBuffer(uint8_t &data, uint32_t size) {
         if(!recordBuffer)
             return;
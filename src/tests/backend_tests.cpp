@@ -26,6 +26,7 @@
 #include <QtTest>
 
 #include <algorithm>
+#include <atomic>
 #include <numeric>
 #include <random>
 #include <condition_variable>
@@ -33,9 +34,37 @@
 #include <iostream>
 #include <utility>
 #include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <thread>
 
 #include "radio-receiver.h"
 #include "raw_file.h"
+#include "mot_manager.h"
+#include "welle-cli/measurement-history.h"
+#include "audio-frame.h"
+
+// Counts the allocations of the whole test binary
+static std::atomic<size_t> numAllocations(0);
+
+void *operator new(size_t size)
+{
+    numAllocations++;
+    if (void *p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    std::free(p);
+}
 
 class TestRadioInterface : public RadioControllerInterface {
     public:
@@ -65,8 +94,8 @@ public:
 
     virtual void onFrameErrors(int frameErrors) override { (void)frameErrors; }
 
-    virtual void onNewAudio(std::vector<int16_t>&& audioData, int sampleRate, const std::string& mode) override {
-        (void) audioData; (void)sampleRate; (void)mode;}
+    virtual void onNewAudio(const audio_frame_ptr& frame, const std::string& mode) override {
+        (void)frame; (void)mode;}
 
     virtual void onRsErrors(bool uncorrectedErrors, int numCorrectedErrors) override {
         (void)uncorrectedErrors; (void)numCorrectedErrors; }
@@ -93,6 +122,16 @@ private slots:
     void cleanupTestCase() {}
     void testTuneToService();
     void testDLS();
+    void testMOTOutOfOrder();
+    void testMOTLastSegmentFirst();
+    void testMOTOversizedSegment();
+    void testMOTBudgetEviction();
+    void testTimeSeriesRing();
+    void testTimeSeriesRollOver();
+    void testTimeSeriesQueryRange();
+    void testTimeSeriesConcurrentQuery();
+    void testMeasurementHistoryLimit();
+    void testAudioFramePoolAllocations();
 
 private:
     void runRadio(const std::string &rawFileName,
@@ -192,6 +231,309 @@ void BackendTests::testDLS()
     QCOMPARE(isOK, true);
 }
 
+// MOT data group of the given type (3 = header, 4 = body) carrying one
+// segment. The CRC is not checked by the MOTManager and is left zero.
+static std::vector<uint8_t> motDataGroup(int dg_type, int transport_id,
+        int seg_number, bool last_seg, const std::vector<uint8_t>& seg)
+{
+    std::vector<uint8_t> dg;
+    dg.push_back(0x70 | dg_type);   // CRC, segment and user access flags
+    dg.push_back(0x00);
+    dg.push_back((last_seg ? 0x80 : 0x00) | (seg_number >> 8));
+    dg.push_back(seg_number & 0xFF);
+    dg.push_back(0x12);             // transport ID, length indicator 2
+    dg.push_back(transport_id >> 8);
+    dg.push_back(transport_id & 0xFF);
+    dg.push_back(seg.size() >> 8);
+    dg.push_back(seg.size() & 0xFF);
+    dg.insert(dg.end(), seg.begin(), seg.end());
+    dg.push_back(0x00);
+    dg.push_back(0x00);
+    return dg;
+}
+
+// MOT header of a JFIF image of body_size bytes, triggered now
+static std::vector<uint8_t> motHeader(size_t body_size)
+{
+    const size_t header_size = 12;
+    return {
+        (uint8_t)(body_size >> 20), (uint8_t)(body_size >> 12),
+        (uint8_t)(body_size >> 4),
+        (uint8_t)(((body_size & 0x0F) << 4) | (header_size >> 9)),
+        (uint8_t)(header_size >> 1),
+        (uint8_t)(((header_size & 0x01) << 7) | (MOT_FILE::CONTENT_TYPE_IMAGE << 1)),
+        MOT_FILE::CONTENT_SUB_TYPE_JFIF,
+        0x85, 0x00, 0x00, 0x00, 0x00};  // TriggerTime: now
+}
+
+static std::vector<uint8_t> motBody(size_t len)
+{
+    std::vector<uint8_t> body(len);
+    std::iota(body.begin(), body.end(), 1);
+    return body;
+}
+
+// Sends the body in segments of seg_size bytes, in the given order
+static bool sendMOTBody(MOTManager& manager, int transport_id,
+        const std::vector<uint8_t>& body, size_t seg_size,
+        const std::vector<int>& order)
+{
+    const int last = (body.size() - 1) / seg_size;
+    bool display = false;
+    for (int n : order) {
+        const size_t start = n * seg_size;
+        const size_t end = std::min(start + seg_size, body.size());
+        std::vector<uint8_t> seg(body.begin() + start, body.begin() + end);
+        auto dg = motDataGroup(4, transport_id, n, n == last, seg);
+        display = manager.HandleMOTDataGroup(dg.data(), dg.size());
+    }
+    return display;
+}
+
+void BackendTests::testMOTOutOfOrder()
+{
+    MOTManager manager;
+    const auto body = motBody(30);
+
+    auto dg = motDataGroup(3, 1, 0, true, motHeader(body.size()));
+    QCOMPARE(manager.HandleMOTDataGroup(dg.data(), dg.size()), false);
+
+    QCOMPARE(sendMOTBody(manager, 1, body, 8, {2, 0}), false);
+    QCOMPARE(sendMOTBody(manager, 1, body, 8, {3, 1}), true);
+
+    const MOT_FILE file = manager.GetFile();
+    QCOMPARE(file.body_size, body.size());
+    QCOMPARE(*file.data, body);
+}
+
+void BackendTests::testMOTLastSegmentFirst()
+{
+    MOTManager manager;
+    const auto body = motBody(30);
+
+    // the last segment cannot be placed before the size of the others is known
+    QCOMPARE(sendMOTBody(manager, 2, body, 8, {3}), false);
+
+    auto dg = motDataGroup(3, 2, 0, true, motHeader(body.size()));
+    QCOMPARE(manager.HandleMOTDataGroup(dg.data(), dg.size()), false);
+
+    QCOMPARE(sendMOTBody(manager, 2, body, 8, {1, 2}), false);
+    QCOMPARE(sendMOTBody(manager, 2, body, 8, {0}), true);
+    QCOMPARE(*manager.GetFile().data, body);
+}
+
+void BackendTests::testMOTOversizedSegment()
+{
+    MOTManager manager;
+    const auto seg = motBody(8000);
+
+    // would be placed at almost 256 MB, far beyond the budget
+    auto first = motDataGroup(4, 3, 0, false, seg);
+    QCOMPARE(manager.HandleMOTDataGroup(first.data(), first.size()), false);
+    auto far = motDataGroup(4, 3, 0x7FFF, false, seg);
+    QCOMPARE(manager.HandleMOTDataGroup(far.data(), far.size()), false);
+
+    QCOMPARE(MOTBudget::Instance().GetTotal(), (size_t)0);
+}
+
+void BackendTests::testMOTBudgetEviction()
+{
+    MOTBudget& budget = MOTBudget::Instance();
+    budget.SetLimit(256);
+
+    const auto body = motBody(200);
+    MOTManager older, newer;
+
+    auto dg = motDataGroup(3, 4, 0, true, motHeader(body.size()));
+    older.HandleMOTDataGroup(dg.data(), dg.size());
+    QCOMPARE(sendMOTBody(older, 4, body, 50, {0, 1}), false);
+
+    // the second object does not fit besides the first, which is dropped
+    dg = motDataGroup(3, 5, 0, true, motHeader(body.size()));
+    newer.HandleMOTDataGroup(dg.data(), dg.size());
+    QCOMPARE(sendMOTBody(newer, 5, body, 50, {0, 1, 2, 3}), true);
+    QCOMPARE(*newer.GetFile().data, body);
+
+    QCOMPARE(sendMOTBody(older, 4, body, 50, {2, 3}), false);
+    QCOMPARE((bool)older.GetFile().data, false);
+
+    budget.SetLimit(MOTBudget::DEFAULT_LIMIT);
+}
+
+// A multiple of all resolutions
+static const int64_t historyStart = 3600 * 400000;
+
+void BackendTests::testTimeSeriesRing()
+{
+    TimeSeries s;
+    const int64_t t = historyStart;
+
+    s.record(1, t);
+    s.record(2, t + 599);
+    QCOMPARE(s.query(1, t, t + 599).size(), (size_t)2);
+
+    // The ring of 600 one second buckets wraps, t + 600 replaces t
+    s.record(3, t + 600);
+    auto points = s.query(1, t, t + 600);
+    QCOMPARE(points.size(), (size_t)2);
+    QCOMPARE(points[0].time, t + 599);
+    QCOMPARE(points[1].time, t + 600);
+
+    // Samples older than the bucket in their slot are ignored
+    s.record(9, t);
+    points = s.query(1, t + 600, t + 600);
+    QCOMPARE(points.size(), (size_t)1);
+    QCOMPARE(points[0].count, (uint32_t)1);
+    QCOMPARE(points[0].mean, 3.0f);
+    QCOMPARE(s.latest(), t + 600);
+}
+
+void BackendTests::testTimeSeriesRollOver()
+{
+    TimeSeries s;
+    const int64_t t = historyStart;
+
+    s.record(1, t);
+    s.record(2, t + 10);
+    s.record(3, t + 59);
+    s.record(4, t + 60);
+
+    auto minutes = s.query(60, t, t + 60);
+    QCOMPARE(minutes.size(), (size_t)2);
+    QCOMPARE(minutes[0].time, t);
+    QCOMPARE(minutes[0].count, (uint32_t)3);
+    QCOMPARE(minutes[0].min, 1.0f);
+    QCOMPARE(minutes[0].max, 3.0f);
+    QCOMPARE(minutes[0].mean, 2.0f);
+    QCOMPARE(minutes[1].time, t + 60);
+    QCOMPARE(minutes[1].count, (uint32_t)1);
+    QCOMPARE(minutes[1].mean, 4.0f);
+
+    auto hours = s.query(3600, t, t + 60);
+    QCOMPARE(hours.size(), (size_t)1);
+    QCOMPARE(hours[0].count, (uint32_t)4);
+    QCOMPARE(hours[0].mean, 2.5f);
+
+    // A day later, the ring of 1440 one minute buckets wraps, t + 24 h
+    // replaces the bucket of t
+    s.record(5, t + 24 * 3600);
+    minutes = s.query(60, t, t + 24 * 3600);
+    QCOMPARE(minutes.size(), (size_t)2);
+    QCOMPARE(minutes[0].time, t + 60);
+    QCOMPARE(minutes[1].time, t + 24 * 3600);
+    QCOMPARE(minutes[1].mean, 5.0f);
+}
+
+void BackendTests::testTimeSeriesQueryRange()
+{
+    TimeSeries s;
+    const int64_t t = historyStart;
+    s.record(1, t);
+
+    // Only the buckets still in the ring are visited, not the whole range
+    QCOMPARE(s.query(1, 0, t).size(), (size_t)1);
+    QCOMPARE(s.query(3600, 0, t + 7200).size(), (size_t)1);
+    QCOMPARE(s.query(1, 0, t + 600).size(), (size_t)0);
+
+    // Buckets must start within the range
+    QCOMPARE(s.query(60, t + 1, t + 59).size(), (size_t)0);
+    QCOMPARE(s.query(1, t + 1, t).size(), (size_t)0);
+
+    QVERIFY_EXCEPTION_THROWN(s.query(2, 0, t), std::out_of_range);
+}
+
+void BackendTests::testTimeSeriesConcurrentQuery()
+{
+    TimeSeries s;
+    const int64_t t = historyStart;
+    const int64_t duration = 100;
+    std::atomic<bool> done(false);
+
+    // Every bucket only receives ones, so a bucket read while it was
+    // modified shows up as a mean, min or max that is not one.
+    std::thread writer([&]() {
+            for (int64_t i = 0; i < duration * 20000; i++) {
+                s.record(1.0f, t + i / 20000);
+            }
+            done = true;
+        });
+
+    bool consistent = true;
+    size_t num_queries = 0;
+    while (not done or num_queries == 0) {
+        for (const auto& p : s.query(1, t, t + duration)) {
+            consistent = consistent and p.count > 0 and
+                p.mean == 1.0f and p.min == 1.0f and p.max == 1.0f;
+        }
+        num_queries++;
+    }
+    writer.join();
+
+    QCOMPARE(consistent, true);
+    QCOMPARE(s.query(1, t, t + duration).size(), (size_t)duration);
+}
+
+void BackendTests::testMeasurementHistoryLimit()
+{
+    const int64_t t = historyStart;
+    MeasurementHistory history(3);
+
+    auto snr = history.series("5A/snr");
+    snr->record(1, t);
+    history.series("5A/mer")->record(1, t + 10);
+    history.series("5C/snr")->record(1, t + 20);
+
+    // The least recently recorded series of another channel makes room
+    QVERIFY(history.series("5C/mer") != nullptr);
+    QVERIFY(history.find("5A/snr") == nullptr);
+    QVERIFY(history.find("5A/mer") != nullptr);
+
+    // A dropped series stays valid for those holding it
+    QCOMPARE(snr->query(1, t, t).size(), (size_t)1);
+
+    QVERIFY(history.series("5C/fic_ber") != nullptr);
+    QVERIFY(history.find("5A/mer") == nullptr);
+
+    // All series belong to 5C
+    QVERIFY(history.series("5C/tii/1/2/delay") == nullptr);
+    QCOMPARE(history.names().size(), (size_t)3);
+}
+
+void BackendTests::testAudioFramePoolAllocations()
+{
+    AudioFramePool pool;
+    const std::vector<int16_t> pcm(1152 * 2);
+
+    // Decode into a frame while a consumer still holds the previous one,
+    // like a DecoderAdapter whose frames are queued by an output.
+    const auto cycle = [&](audio_frame_ptr& held) {
+        auto frame = pool.acquire();
+        convert_pcm(reinterpret_cast<const uint8_t*>(pcm.data()),
+                pcm.size() * sizeof(int16_t), 2, false, *frame);
+        held = std::move(frame);
+    };
+
+    audio_frame_ptr held;
+    for (int i = 0; i < 4; i++) {
+        cycle(held);
+    }
+
+    const size_t before = numAllocations;
+    for (int i = 0; i < 1000; i++) {
+        cycle(held);
+    }
+    QCOMPARE(numAllocations - before, (size_t)0);
+
+    // Frames and their control blocks may outlive the pool
+    audio_frame_ptr survivor;
+    {
+        AudioFramePool shortLived;
+        survivor = shortLived.acquire();
+    }
+    QCOMPARE(survivor.use_count(), (long)1);
+    survivor.reset();
+}
+
 QTEST_APPLESS_MAIN(BackendTests)
 
 #include "backend_tests.moc"
@@ -9,4 +9,5 @@ CONFIG -= app_bundle
 TEMPLATE = app
 
 SOURCES += \  
-    backend_tests.cpp
+    backend_tests.cpp \
+    ../welle-cli/measurement-history.cpp
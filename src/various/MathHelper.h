@@ -219,4 +219,23 @@ static inline uint16_t getBits_8(const uint8_t* d, int16_t offset)
     return res;
 }
 
+// The getBits variants above take one bit per byte. This one reads from
+// packed bytes, MSB first, loading only the bytes that hold the field.
+static inline uint32_t getPackedBits(const uint8_t* d, int16_t offset, uint8_t size)
+{
+    if (size > 32) {
+        throw std::logic_error("getPackedBits called with size>32");
+    }
+
+    const uint8_t *p = d + offset / 8;
+    const int shift = offset % 8;
+    const int num_bytes = (shift + size + 7) / 8;
+
+    uint64_t word = 0;
+    for (int i = 0; i < num_bytes; i++) {
+        word = (word << 8) | p[i];
+    }
+    return (word >> (num_bytes * 8 - shift - size)) & ((1ull << size) - 1);
+}
+
 #endif // MATHHELPER_H
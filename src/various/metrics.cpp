@@ -0,0 +1,215 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+#include <sstream>
+#include <stdexcept>
+#include "various/metrics.h"
+
+using namespace std;
+
+namespace metrics {
+
+Histogram::Histogram(const vector<double>& bounds) :
+    bounds(bounds),
+    counts(new atomic<uint64_t>[bounds.size() + 1])
+{
+    for (size_t i = 0; i < bounds.size() + 1; i++) {
+        counts[i] = 0;
+    }
+}
+
+void Histogram::observe(double v)
+{
+    size_t i = 0;
+    while (i < bounds.size() and v > bounds[i]) {
+        i++;
+    }
+    counts[i].fetch_add(1, memory_order_relaxed);
+
+    double s = sum.load(memory_order_relaxed);
+    while (not sum.compare_exchange_weak(s, s + v, memory_order_relaxed)) {
+    }
+}
+
+vector<uint64_t> Histogram::getCounts() const
+{
+    vector<uint64_t> c(bounds.size() + 1);
+    for (size_t i = 0; i < c.size(); i++) {
+        c[i] = counts[i].load(memory_order_relaxed);
+    }
+    return c;
+}
+
+const vector<double>& latency_buckets()
+{
+    static const vector<double> buckets = {
+        0.00005, 0.0001, 0.00025, 0.0005,
+        0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.096, 0.25 };
+    return buckets;
+}
+
+static string escape_label_value(const string& value)
+{
+    string escaped;
+    for (const char c : value) {
+        switch (c) {
+            case '\\': escaped += "\\\\"; break;
+            case '"': escaped += "\\\""; break;
+            case '\n': escaped += "\\n"; break;
+            default: escaped += c;
+        }
+    }
+    return escaped;
+}
+
+// Returns the labels as name="value" pairs separated by commas,
+// without the surrounding braces.
+static string format_labels(const labels_t& labels)
+{
+    string s;
+    for (const auto& l : labels) {
+        if (not s.empty()) {
+            s += ",";
+        }
+        s += l.first + "=\"" + escape_label_value(l.second) + "\"";
+    }
+    return s;
+}
+
+static string braced(const string& labels)
+{
+    return labels.empty() ? "" : "{" + labels + "}";
+}
+
+Registry::Family& Registry::family(
+        const string& name, const string& help, Type type)
+{
+    auto it = families.find(name);
+    if (it == families.end()) {
+        Family f;
+        f.type = type;
+        f.help = help;
+        it = families.emplace(name, move(f)).first;
+    }
+    else if (it->second.type != type) {
+        throw logic_error("Metric " + name + " registered with different types");
+    }
+    return it->second;
+}
+
+Counter& Registry::counter(const string& name, const string& help,
+        const labels_t& labels)
+{
+    lock_guard<mutex> lock(registry_mutex);
+    auto& c = family(name, help, Type::Counter).counters[format_labels(labels)];
+    if (not c) {
+        c = make_unique<Counter>();
+    }
+    return *c;
+}
+
+Gauge& Registry::gauge(const string& name, const string& help,
+        const labels_t& labels)
+{
+    lock_guard<mutex> lock(registry_mutex);
+    auto& g = family(name, help, Type::Gauge).gauges[format_labels(labels)];
+    if (not g) {
+        g = make_unique<Gauge>();
+    }
+    return *g;
+}
+
+Histogram& Registry::histogram(const string& name, const string& help,
+        const labels_t& labels, const vector<double>& bounds)
+{
+    lock_guard<mutex> lock(registry_mutex);
+    auto& h = family(name, help, Type::Histogram).histograms[format_labels(labels)];
+    if (not h) {
+        h = make_unique<Histogram>(bounds);
+    }
+    return *h;
+}
+
+string Registry::render() const
+{
+    stringstream ss;
+
+    lock_guard<mutex> lock(registry_mutex);
+    for (const auto& f : families) {
+        const auto& name = f.first;
+        const auto& fam = f.second;
+
+        ss << "# HELP " << name << " " << fam.help << "\n";
+
+        switch (fam.type) {
+            case Type::Counter:
+                ss << "# TYPE " << name << " counter\n";
+                for (const auto& c : fam.counters) {
+                    ss << name << braced(c.first) << " " << c.second->get() << "\n";
+                }
+                break;
+            case Type::Gauge:
+                ss << "# TYPE " << name << " gauge\n";
+                for (const auto& g : fam.gauges) {
+                    ss << name << braced(g.first) << " " << g.second->get() << "\n";
+                }
+                break;
+            case Type::Histogram:
+                ss << "# TYPE " << name << " histogram\n";
+                for (const auto& h : fam.histograms) {
+                    const string sep = h.first.empty() ? "" : ",";
+                    const auto& bounds = h.second->getBounds();
+                    const auto counts = h.second->getCounts();
+
+                    uint64_t cumulative = 0;
+                    for (size_t i = 0; i < counts.size(); i++) {
+                        cumulative += counts[i];
+                        ss << name << "_bucket{" << h.first << sep << "le=\"";
+                        if (i < bounds.size()) {
+                            ss << bounds[i];
+                        }
+                        else {
+                            ss << "+Inf";
+                        }
+                        ss << "\"} " << cumulative << "\n";
+                    }
+                    ss << name << "_sum" << braced(h.first) << " " <<
+                        h.second->getSum() << "\n";
+                    ss << name << "_count" << braced(h.first) << " " <<
+                        cumulative << "\n";
+                }
+                break;
+        }
+    }
+
+    return ss.str();
+}
+
+Registry& registry()
+{
+    static Registry r;
+    return r;
+}
+
+} // namespace metrics
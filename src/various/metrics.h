@@ -0,0 +1,149 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+/* Counters, gauges and histograms that can be updated from the
+ * signal processing threads without taking a lock, and rendered in the
+ * Prometheus text exposition format.
+ *
+ * Metrics are created once through the Registry, which hands out references
+ * that stay valid for the lifetime of the program. Asking twice for the same
+ * name and labels returns the same metric. Only creation and rendering lock
+ * the registry, updates are plain relaxed atomic operations. */
+namespace metrics {
+
+using labels_t = std::vector<std::pair<std::string, std::string> >;
+
+class Counter {
+    public:
+        void inc(uint64_t n = 1) { value.fetch_add(n, std::memory_order_relaxed); }
+        uint64_t get(void) const { return value.load(std::memory_order_relaxed); }
+
+    private:
+        std::atomic<uint64_t> value = ATOMIC_VAR_INIT(0);
+};
+
+class Gauge {
+    public:
+        void set(double v) { value.store(v, std::memory_order_relaxed); }
+        double get(void) const { return value.load(std::memory_order_relaxed); }
+
+    private:
+        std::atomic<double> value = ATOMIC_VAR_INIT(0.0);
+};
+
+class Histogram {
+    public:
+        // bounds are the upper bounds of the buckets, in increasing order.
+        // The +Inf bucket is added implicitly.
+        explicit Histogram(const std::vector<double>& bounds);
+        Histogram(const Histogram&) = delete;
+        Histogram& operator=(const Histogram&) = delete;
+
+        void observe(double v);
+
+        const std::vector<double>& getBounds(void) const { return bounds; }
+
+        // Non-cumulative bucket counts, the last one being +Inf
+        std::vector<uint64_t> getCounts(void) const;
+        double getSum(void) const { return sum.load(std::memory_order_relaxed); }
+
+    private:
+        const std::vector<double> bounds;
+        std::unique_ptr<std::atomic<uint64_t>[]> counts;
+        std::atomic<double> sum = ATOMIC_VAR_INIT(0.0);
+};
+
+// Bucket bounds in seconds, suitable for per-stage processing times
+// that must stay well below the 96ms DAB transmission frame.
+const std::vector<double>& latency_buckets(void);
+
+// Measures the time between construction and destruction
+class ScopedTimer {
+    public:
+        explicit ScopedTimer(Histogram& h) :
+            histogram(h),
+            start(std::chrono::steady_clock::now()) {}
+        ~ScopedTimer() {
+            const std::chrono::duration<double> d =
+                std::chrono::steady_clock::now() - start;
+            histogram.observe(d.count());
+        }
+        ScopedTimer(const ScopedTimer&) = delete;
+        ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+    private:
+        Histogram& histogram;
+        std::chrono::steady_clock::time_point start;
+};
+
+class Registry {
+    public:
+        Registry() = default;
+        Registry(const Registry&) = delete;
+        Registry& operator=(const Registry&) = delete;
+
+        Counter& counter(const std::string& name, const std::string& help,
+                const labels_t& labels = labels_t());
+        Gauge& gauge(const std::string& name, const std::string& help,
+                const labels_t& labels = labels_t());
+        Histogram& histogram(const std::string& name, const std::string& help,
+                const labels_t& labels = labels_t(),
+                const std::vector<double>& bounds = latency_buckets());
+
+        // Render all metrics in the Prometheus text format, version 0.0.4
+        std::string render(void) const;
+
+    private:
+        enum class Type { Counter, Gauge, Histogram };
+
+        struct Family {
+            Type type;
+            std::string help;
+            std::map<std::string, std::unique_ptr<Counter> > counters;
+            std::map<std::string, std::unique_ptr<Gauge> > gauges;
+            std::map<std::string, std::unique_ptr<Histogram> > histograms;
+        };
+
+        Family& family(const std::string& name, const std::string& help, Type type);
+
+        mutable std::mutex registry_mutex;
+        std::map<std::string, Family> families;
+};
+
+// The registry shared by the whole program
+Registry& registry(void);
+
+} // namespace metrics
@@ -24,8 +24,10 @@
  */
 
 #if defined(WITH_PROFILING)
+#include <algorithm>
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <map>
 #include <utility>
 #include <cmath>
@@ -70,9 +72,91 @@ const char* mark_to_cstr(const ProfilingMark& m) {
     return "unknown";
 }
 
+// Marks the buffer of a thread as released when the thread exits,
+// the aggregator then frees it once it has read all timepoints.
+struct ThreadBufferHandle {
+    ProfilingThreadBuffer *buffer = nullptr;
+    ~ThreadBufferHandle() {
+        if (buffer) {
+            buffer->released = true;
+        }
+    }
+};
+
+static thread_local ThreadBufferHandle thread_buffer_handle;
+
+static constexpr uint64_t mark_bits = 8;
+static constexpr uint64_t mark_mask = (1 << mark_bits) - 1;
+
+void ProfilingThreadBuffer::push(uint64_t timestamp_ns, ProfilingMark m) {
+    const uint64_t ix = write_index.load(memory_order_relaxed);
+    slots[ix % capacity].store(
+            (timestamp_ns << mark_bits) | (uint64_t)m, memory_order_relaxed);
+    write_index.store(ix + 1, memory_order_release);
+}
+
+size_t ProfilingThreadBuffer::drain(vector<ProfilingTimepoint>& points) {
+    const uint64_t end = write_index.load(memory_order_acquire);
+
+    size_t lost = 0;
+    if (end - read_index > capacity) {
+        lost = end - read_index - capacity;
+        read_index = end - capacity;
+    }
+
+    const size_t first_new = points.size();
+    for (uint64_t ix = read_index; ix < end; ix++) {
+        const uint64_t v = slots[ix % capacity].load(memory_order_relaxed);
+        points.emplace_back(v >> mark_bits, (ProfilingMark)(v & mark_mask));
+    }
+
+    // The writer could have overwritten slots while we were reading them,
+    // discard those.
+    atomic_thread_fence(memory_order_acquire);
+    const uint64_t end_after = write_index.load(memory_order_relaxed);
+    if (end_after - read_index > capacity) {
+        const size_t overwritten = min<uint64_t>(
+                end_after - read_index - capacity, end - read_index);
+        points.erase(points.begin() + first_new,
+                points.begin() + first_new + overwritten);
+        lost += overwritten;
+    }
+
+    read_index = end;
+    return lost;
+}
+
+void ProfilingTransitionStats::add(uint64_t duration_ns) {
+    count++;
+    total_ns += duration_ns;
+    max_ns = max(max_ns, duration_ns);
+
+    uint64_t us = duration_ns / 1000;
+    size_t bucket = 0;
+    while (us and bucket < num_buckets - 1) {
+        us >>= 1;
+        bucket++;
+    }
+    buckets[bucket]++;
+}
+
+uint64_t ProfilingTransitionStats::percentile_us(double p) const {
+    const double target = p * count;
+    uint64_t cumulative = 0;
+    for (size_t i = 0; i < num_buckets; i++) {
+        cumulative += buckets[i];
+        if (cumulative >= target) {
+            return 1ull << i;
+        }
+    }
+    return 1ull << (num_buckets - 1);
+}
+
 Profiler::Profiler() {
     clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &startup_time_cputime);
     clock_gettime(CLOCK_MONOTONIC, &startup_time_monotonic);
+
+    m_aggregator = thread(&Profiler::aggregator_run, this);
 }
 
 struct timespec& operator+=(struct timespec& t1, const struct timespec& t2) {
@@ -116,20 +200,176 @@ std::ostream& operator<<(std::ostream& out, const struct timespec& ts)
     return out << ts.tv_sec << "." << nanos;
 }
 
+uint64_t Profiler::now_ns() const {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    const struct timespec t = now - startup_time_monotonic;
+    return t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+
+ProfilingThreadBuffer& Profiler::thread_buffer() {
+    if (thread_buffer_handle.buffer == nullptr) {
+        lock_guard<mutex> lock(m_mutex);
+        ThreadState state;
+        state.index = m_next_thread_index++;
+        state.buffer = make_unique<ProfilingThreadBuffer>();
+        thread_buffer_handle.buffer = state.buffer.get();
+        m_threads.push_back(move(state));
+    }
+
+    return *thread_buffer_handle.buffer;
+}
+
+void Profiler::save_time(const ProfilingMark m) {
+    thread_buffer().push(now_ns(), m);
+}
+
+void Profiler::frame_decoded() {
+    num_frames_decoded++;
+}
+
+void Profiler::aggregate() {
+    lock_guard<mutex> lock(m_mutex);
+
+    vector<ProfilingTimepoint> points;
+    for (auto& ts : m_threads) {
+        if (not ts.buffer) {
+            continue;
+        }
+
+        // Read released before draining, so that no timepoint
+        // written before the release gets lost
+        const bool released = ts.buffer->released.load();
+
+        points.clear();
+        m_num_lost_timepoints += ts.buffer->drain(points);
+
+        for (const auto& tp : points) {
+            if (ts.has_last) {
+                m_transitions[make_pair(ts.last.p, tp.p)].add(
+                        tp.timestamp_ns - ts.last.timestamp_ns);
+            }
+            ts.last = tp;
+            ts.has_last = true;
+
+            ts.recent.push_back(tp);
+        }
+
+        while (ts.recent.size() > num_recent_timepoints) {
+            ts.recent.pop_front();
+        }
+
+        if (released) {
+            ts.buffer.reset();
+        }
+    }
+
+    // Threads get appended, the oldest exited ones are at the front
+    size_t num_exited = count_if(m_threads.begin(), m_threads.end(),
+            [](const ThreadState& ts) { return not ts.buffer; });
+    for (auto it = m_threads.begin();
+            num_exited > num_exited_threads and it != m_threads.end(); ) {
+        if (not it->buffer) {
+            it = m_threads.erase(it);
+            num_exited--;
+        }
+        else {
+            ++it;
+        }
+    }
+}
+
+void Profiler::aggregator_run() {
+    unique_lock<mutex> lock(m_aggregator_mutex);
+    while (m_aggregator_running) {
+        m_aggregator_cv.wait_for(lock, chrono::milliseconds(100));
+
+        lock.unlock();
+        aggregate();
+        lock.lock();
+    }
+}
+
+string Profiler::stats_json() {
+    aggregate();
+
+    stringstream ss;
+    lock_guard<mutex> lock(m_mutex);
+    ss << "{\"frames_decoded\":" << num_frames_decoded <<
+        ",\"lost_timepoints\":" << m_num_lost_timepoints <<
+        ",\"transitions\":[";
+
+    bool first = true;
+    for (const auto& t : m_transitions) {
+        const auto& st = t.second;
+        ss << (first ? "" : ",") <<
+            "{\"from\":\"" << mark_to_cstr(t.first.first) <<
+            "\",\"to\":\"" << mark_to_cstr(t.first.second) <<
+            "\",\"count\":" << st.count <<
+            ",\"total_ms\":" << st.total_ns / 1000000 <<
+            ",\"mean_us\":" << (st.count ? st.total_ns / st.count / 1000 : 0) <<
+            ",\"p50_us\":" << st.percentile_us(0.5) <<
+            ",\"p99_us\":" << st.percentile_us(0.99) <<
+            ",\"max_us\":" << st.max_ns / 1000 << "}";
+        first = false;
+    }
+    ss << "]}";
+    return ss.str();
+}
+
+string Profiler::chrome_trace_json() {
+    aggregate();
+
+    stringstream ss;
+    ss << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+
+    lock_guard<mutex> lock(m_mutex);
+    bool first = true;
+    for (const auto& ts : m_threads) {
+        ss << (first ? "" : ",") <<
+            "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" <<
+            ts.index << ",\"args\":{\"name\":\"thread " <<
+            ts.index << "\"}}";
+        first = false;
+
+        // Every mark opens a slice that lasts until the next mark
+        for (auto it = ts.recent.begin(); it != ts.recent.end() and
+                next(it) != ts.recent.end(); ++it) {
+            ss << ",{\"name\":\"" << mark_to_cstr(it->p) <<
+                "\",\"cat\":\"welle\",\"ph\":\"X\",\"pid\":1,\"tid\":" <<
+                ts.index <<
+                ",\"ts\":" << it->timestamp_ns / 1000.0 <<
+                ",\"dur\":" << (next(it)->timestamp_ns - it->timestamp_ns) / 1000.0 <<
+                "}";
+        }
+    }
+    ss << "]}";
+    return ss.str();
+}
+
 Profiler::~Profiler() {
+    {
+        lock_guard<mutex> lock(m_aggregator_mutex);
+        m_aggregator_running = false;
+    }
+    m_aggregator_cv.notify_all();
+    m_aggregator.join();
+
+    aggregate();
+
     struct timespec stop_time_cputime;
     struct timespec stop_time_monotonic;
     clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &stop_time_cputime);
     clock_gettime(CLOCK_MONOTONIC, &stop_time_monotonic);
 
     ofstream dump("profiling_points.csv");
-    dump << "thread_id,mark,time_sec,time_ns" << endl;
-    for (const auto tp: m_timepoints) {
-        for (const auto points : tp.second) {
-            dump << tp.first << "," <<
-                mark_to_cstr(points.p) << "," <<
-                points.timestamp.tv_sec << "," <<
-                points.timestamp.tv_nsec << endl;
+    dump << "thread_index,mark,time_sec,time_ns" << endl;
+    for (const auto& ts : m_threads) {
+        for (const auto& point : ts.recent) {
+            dump << ts.index << "," <<
+                mark_to_cstr(point.p) << "," <<
+                point.timestamp_ns / 1000000000ull << "," <<
+                point.timestamp_ns % 1000000000ull << endl;
         }
     }
 
@@ -141,64 +381,35 @@ Profiler::~Profiler() {
     profiling << "cputime,diff," << stop_time_cputime - startup_time_cputime << endl;
     profiling << "monotonic,diff," << stop_time_monotonic - startup_time_monotonic << endl;
     profiling << "frames,decoded," << num_frames_decoded << endl;
+    profiling << "timepoints,lost," << m_num_lost_timepoints << endl;
+
+    ofstream trace("profiling_trace.json");
+    trace << chrome_trace_json() << endl;
 
     // See http://www.graphviz.org/documentation/
     ofstream graph("profiling.dot");
 
     graph << "digraph G { " << endl;
 
-    size_t count = 0;
-
-    for (const auto tp: m_timepoints) {
-        if (tp.second.size() < 2) {
-            continue;
-        }
-
-        graph << "subgraph cluster_" << tp.first << " { " << endl;
-        graph << "colorscheme=\"gnbu8\";" << endl;
-        graph << "bgcolor=" << (count % 8) + 1 << ";" << endl;
-        count++;
-
-        map<pair<ProfilingMark, ProfilingMark>, struct timespec> from_to_times;
-
-        for (auto it = tp.second.begin(); next(it) != tp.second.end(); ++it) {
-            from_to_times[make_pair(it->p, next(it)->p)] += next(it)->timestamp - it->timestamp;
-        }
-
-        double maxw = 0;
-        for (auto& d : from_to_times) {
-            double w = log10(1 + d.second.tv_sec * 1000 + d.second.tv_nsec / 1000000);
-            if (w > maxw) maxw = w;
-        }
+    double maxw = 0;
+    for (const auto& d : m_transitions) {
+        double w = log10(1 + d.second.total_ns / 1000000);
+        if (w > maxw) maxw = w;
+    }
 
-        for (auto& d : from_to_times) {
-            int w = (d.second.tv_sec * 1000 + d.second.tv_nsec / 1000000);
+    for (const auto& d : m_transitions) {
+        const uint64_t w = d.second.total_ns / 1000000;
 
-            char color[16];
-            snprintf(color, 15, "#%02x%02x%02x", (int)(255 * log10(w+1)/maxw), 0, 0);
+        char color[16];
+        snprintf(color, 15, "#%02x%02x%02x",
+                maxw > 0 ? (int)(255 * log10(w+1)/maxw) : 0, 0, 0);
 
-            graph << mark_to_cstr(d.first.first) << " -> " << mark_to_cstr(d.first.second) <<
-                " [color=\"" << color << "\""
-                " label=\"" << w << "ms\""
-                "];" << endl;
-        }
-        graph << "}" << endl;
+        graph << mark_to_cstr(d.first.first) << " -> " << mark_to_cstr(d.first.second) <<
+            " [color=\"" << color << "\""
+            " label=\"" << w << "ms p99 " << d.second.percentile_us(0.99) << "us\""
+            "];" << endl;
     }
     graph << "}" << endl;
 }
 
-void Profiler::save_time(const ProfilingMark m) {
-    const auto id = this_thread::get_id();
-
-    struct timespec now;
-    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
-
-    lock_guard<mutex> lock(m_mutex);
-    m_timepoints[id].emplace_back(now, m);
-}
-
-void Profiler::frame_decoded() {
-    num_frames_decoded++;
-}
-
 #endif // defined(WITH_PROFILING)
@@ -22,16 +22,23 @@
  *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
  *
  */
-
+#pragma once
 
 #if defined(WITH_PROFILING)
 
+#include <array>
+#include <atomic>
+#include <condition_variable>
 #include <cstdint>
 #include <ctime>
-#include <list>
-#include <unordered_map>
-#include <thread>
+#include <deque>
+#include <map>
+#include <memory>
 #include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 
 #define PROFILE(m) get_profiler().save_time(ProfilingMark::m)
 #define PROFILE_FRAME_DECODED() get_profiler().frame_decoded()
@@ -63,15 +70,55 @@ enum class ProfilingMark {
 
 struct ProfilingTimepoint {
     ProfilingTimepoint(
-            struct timespec timestamp,
+            uint64_t timestamp_ns,
             ProfilingMark p) :
-        timestamp(timestamp),
+        timestamp_ns(timestamp_ns),
         p(p) { }
 
-    struct timespec timestamp;
+    // CLOCK_MONOTONIC time since the start of the profiler
+    uint64_t timestamp_ns;
     ProfilingMark p;
 };
 
+/* Preallocated ring buffer of timepoints, written only by the thread that
+ * owns it and read only by the aggregation thread. Every slot stores the
+ * timestamp and the mark packed into one atomic, so that the writer never
+ * waits and a slot overwritten during a read can be detected. */
+class ProfilingThreadBuffer
+{
+    public:
+        static constexpr size_t capacity = 8192;
+
+        void push(uint64_t timestamp_ns, ProfilingMark m);
+
+        // Append all timepoints written since the last call to points,
+        // returns the number of timepoints that were overwritten before
+        // they could be read.
+        size_t drain(std::vector<ProfilingTimepoint>& points);
+
+        std::atomic<bool> released = ATOMIC_VAR_INIT(false);
+
+    private:
+        std::array<std::atomic<uint64_t>, capacity> slots;
+        std::atomic<uint64_t> write_index = ATOMIC_VAR_INIT(0);
+        uint64_t read_index = 0;
+};
+
+/* Latency statistics for the time elapsed between two consecutive marks
+ * of the same thread. */
+struct ProfilingTransitionStats {
+    // Bucket i counts durations below 2^i microseconds
+    static constexpr size_t num_buckets = 24;
+
+    void add(uint64_t duration_ns);
+    uint64_t percentile_us(double p) const;
+
+    uint64_t count = 0;
+    uint64_t total_ns = 0;
+    uint64_t max_ns = 0;
+    std::array<uint64_t, num_buckets> buckets = {};
+};
+
 class Profiler
 {
     public:
@@ -82,15 +129,57 @@ class Profiler
 
         void save_time(const ProfilingMark m);
         void frame_decoded();
+
+        // Per-transition latency statistics as JSON
+        std::string stats_json(void);
+
+        // Recent timepoints of all threads in the Chrome trace event format,
+        // to be loaded into chrome://tracing or https://ui.perfetto.dev
+        std::string chrome_trace_json(void);
+
     private:
+        using transition_t = std::pair<ProfilingMark, ProfilingMark>;
+
+        struct ThreadState {
+            // Sequential number of the thread, used as tid in the trace
+            size_t index = 0;
+
+            // nullptr once the thread has exited
+            std::unique_ptr<ProfilingThreadBuffer> buffer;
+            bool has_last = false;
+            ProfilingTimepoint last = ProfilingTimepoint(0, ProfilingMark::NotSynced);
+
+            // The most recent timepoints, for the trace export
+            std::deque<ProfilingTimepoint> recent;
+        };
+
+        // How many timepoints per thread are kept for the trace export
+        static constexpr size_t num_recent_timepoints = 16384;
+
+        // How many exited threads are kept for the trace export
+        static constexpr size_t num_exited_threads = 16;
+
+        ProfilingThreadBuffer& thread_buffer(void);
+        uint64_t now_ns(void) const;
+
+        void aggregate(void);
+        void aggregator_run(void);
+
+        // Protects the list of threads and all aggregated data
         std::mutex m_mutex;
-        std::unordered_map<
-            std::thread::id,
-            std::list<ProfilingTimepoint> > m_timepoints;
+        std::vector<ThreadState> m_threads;
+        size_t m_next_thread_index = 0;
+        uint64_t m_num_lost_timepoints = 0;
+        std::map<transition_t, ProfilingTransitionStats> m_transitions;
+
+        std::mutex m_aggregator_mutex;
+        std::condition_variable m_aggregator_cv;
+        bool m_aggregator_running = true;
+        std::thread m_aggregator;
 
         struct timespec startup_time_cputime;
         struct timespec startup_time_monotonic;
-        size_t num_frames_decoded = 0;
+        std::atomic<size_t> num_frames_decoded = ATOMIC_VAR_INIT(0);
 };
 
 Profiler& get_profiler(void);
@@ -99,4 +188,3 @@ Profiler& get_profiler(void);
 # define PROFILE(m)
 # define PROFILE_FRAME_DECODED()
 #endif // defined(WITH_PROFILING)
-
@@ -75,6 +75,7 @@
 #include    <string.h>
 #include    <stdint.h>
 #include    <iostream>
+#include    "metrics.h"
 
 /*
  *  a simple ringbuffer, lockfree, however only for a
@@ -139,11 +140,12 @@ class RingBuffer
         uint32_t    bigMask;
         uint32_t    smallMask;
         std::vector<char> buffer;
+        metrics::Counter *droppedCounter = nullptr;
 
     protected:
         void onDroppedData(int32_t droppedElements) {
-            (void) droppedElements;
-            // In case a warning should be output, do it here
+            if (droppedCounter)
+                droppedCounter->inc(droppedElements);
         }
 
     public:
@@ -163,6 +165,11 @@ class RingBuffer
          *  functions for checking available data for reading and space
          *  for writing
          */
+        // Count the elements that could not be written because the buffer was full
+        void setDroppedElementsCounter(metrics::Counter& counter) {
+            droppedCounter = &counter;
+        }
+
         int32_t GetRingBufferReadAvailable (void) {
             return (writeIndex - readIndex) & bigMask;
         }
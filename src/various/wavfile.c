@@ -59,7 +59,7 @@ FILE* wavfile_open(const char *filename, int rate, int channels)
     return file;
 }
 
-void wavfile_write( FILE *file, short data[], int length )
+void wavfile_write( FILE *file, const short data[], int length )
 {
     fwrite(data,sizeof(short),length,file);
 }
@@ -11,7 +11,7 @@ http://www.nd.edu/~dthain/courses/cse20211/fall2013/wavfile
 #include <stdio.h>
 
 FILE *wavfile_open(const char *filename, int rate, int channels);
-void wavfile_write(FILE *file, short data[], int length );
+void wavfile_write(FILE *file, const short data[], int length );
 void wavfile_close(FILE * file );
 
 #endif
@@ -101,7 +101,7 @@ AlsaOutput::~AlsaOutput() {
     snd_pcm_close(pcm_handle);
 }
 
-void AlsaOutput::playPCM(std::vector<int16_t>&& pcm)
+void AlsaOutput::playPCM(const std::vector<int16_t>& pcm)
 {
     if (pcm.empty())
         return;
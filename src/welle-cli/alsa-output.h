@@ -36,7 +36,7 @@ class AlsaOutput {
         AlsaOutput(const AlsaOutput& other) = delete;
         AlsaOutput& operator=(const AlsaOutput& other) = delete;
 
-        void playPCM(std::vector<int16_t>&& pcm);
+        void playPCM(const std::vector<int16_t>& pcm);
 
     private:
         int channels = 2;
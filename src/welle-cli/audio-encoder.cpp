@@ -0,0 +1,334 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+#include "audio-encoder.h"
+#include <lame/lame.h>
+#if defined(HAVE_OPUS)
+#  include <opus/opus.h>
+#  include <random>
+#endif
+#include <cstring>
+#include <stdexcept>
+
+using namespace std;
+
+bool encoder_key_t::operator<(const encoder_key_t& other) const
+{
+    if (encoding != other.encoding) {
+        return encoding < other.encoding;
+    }
+    return bitrate_kbps < other.bitrate_kbps;
+}
+
+bool parse_audio_encoding(const string& name, AudioEncoding& encoding)
+{
+    if (name == "mp3") {
+        encoding = AudioEncoding::MP3;
+        return true;
+    }
+#if defined(HAVE_OPUS)
+    else if (name == "opus") {
+        encoding = AudioEncoding::Opus;
+        return true;
+    }
+#endif
+    else if (name == "wav") {
+        encoding = AudioEncoding::WAV;
+        return true;
+    }
+    return false;
+}
+
+const char *audio_content_type(AudioEncoding encoding)
+{
+    switch (encoding) {
+        case AudioEncoding::MP3: return "audio/mpeg";
+        case AudioEncoding::Opus: return "audio/ogg; codecs=opus";
+        case AudioEncoding::WAV: return "audio/wav";
+    }
+    throw logic_error("Unknown audio encoding");
+}
+
+static void append_le(vector<uint8_t>& out, uint64_t value, int bytes)
+{
+    for (int i = 0; i < bytes; i++) {
+        out.push_back((value >> (8 * i)) & 0xFF);
+    }
+}
+
+class Mp3Encoder : public AudioEncoder {
+    public:
+        Mp3Encoder(int sample_rate, int bitrate_kbps) {
+            lame = lame_init();
+            if (lame == nullptr) {
+                throw runtime_error("Cannot initialise LAME");
+            }
+
+            lame_set_in_samplerate(lame, sample_rate);
+            lame_set_num_channels(lame, audio_frame_t::channels);
+            if (bitrate_kbps) {
+                lame_set_VBR(lame, vbr_off);
+                lame_set_brate(lame, bitrate_kbps);
+            }
+            else {
+                lame_set_VBR(lame, vbr_default);
+                lame_set_VBR_q(lame, 2);
+            }
+
+            if (lame_init_params(lame) < 0) {
+                lame_close(lame);
+                throw runtime_error("Invalid mp3 encoder parameters");
+            }
+        }
+
+        Mp3Encoder(const Mp3Encoder& other) = delete;
+        Mp3Encoder& operator=(const Mp3Encoder& other) = delete;
+
+        ~Mp3Encoder() {
+            lame_close(lame);
+        }
+
+        virtual void encode(const audio_frame_t& frame, vector<uint8_t>& out) override {
+            // LAME does not modify the input, it only lacks the const
+            int written = lame_encode_buffer_interleaved(lame,
+                    const_cast<int16_t*>(frame.samples.data()), frame.num_frames(),
+                    mp3buf.data(), mp3buf.size());
+
+            if (written < 0) {
+                throw runtime_error("Failed to encode mp3: " + to_string(written));
+            }
+            out.insert(out.end(), mp3buf.begin(), mp3buf.begin() + written);
+        }
+
+    private:
+        lame_t lame;
+        // Large enough for the worst case of 1.25 * 2304 + 7200 bytes
+        vector<uint8_t> mp3buf = vector<uint8_t>(16384);
+};
+
+/* WAV with the maximum length in the headers, as the stream has no end */
+class WavEncoder : public AudioEncoder {
+    public:
+        WavEncoder(int sample_rate) {
+            const int channels = audio_frame_t::channels;
+            const int bytes_per_frame = channels * sizeof(int16_t);
+
+            const char *riff = "RIFF";
+            header.insert(header.end(), riff, riff + 4);
+            append_le(header, 0xFFFFFFFF, 4);
+            const char *fmt = "WAVEfmt ";
+            header.insert(header.end(), fmt, fmt + 8);
+            append_le(header, 16, 4);
+            append_le(header, 1, 2); // PCM
+            append_le(header, channels, 2);
+            append_le(header, sample_rate, 4);
+            append_le(header, sample_rate * bytes_per_frame, 4);
+            append_le(header, bytes_per_frame, 2);
+            append_le(header, 16, 2);
+            const char *data = "data";
+            header.insert(header.end(), data, data + 4);
+            append_le(header, 0xFFFFFFFF, 4);
+        }
+
+        virtual void encode(const audio_frame_t& frame, vector<uint8_t>& out) override {
+            // Like wavfile.c, this assumes a little-endian host
+            const uint8_t *pcm = reinterpret_cast<const uint8_t*>(frame.samples.data());
+            out.insert(out.end(), pcm, pcm + frame.samples.size() * sizeof(int16_t));
+        }
+};
+
+#if defined(HAVE_OPUS)
+/* Opus in Ogg, see RFC 7845. Every call to encode() that completes at least
+ * one 20ms Opus packet emits one Ogg page. A listener joining later gets the
+ * two header pages, followed by the current pages. */
+class OggOpusEncoder : public AudioEncoder {
+    public:
+        OggOpusEncoder(int sample_rate, int bitrate_kbps) :
+            frame_size(sample_rate / 50)
+        {
+            int err = 0;
+            opus = opus_encoder_create(sample_rate, audio_frame_t::channels,
+                    OPUS_APPLICATION_AUDIO, &err);
+            if (err != OPUS_OK) {
+                throw runtime_error(string("Cannot create Opus encoder: ") +
+                        opus_strerror(err));
+            }
+
+            opus_encoder_ctl(opus, OPUS_SET_BITRATE(
+                        (bitrate_kbps ? bitrate_kbps : 64) * 1000));
+
+            opus_int32 lookahead = 0;
+            opus_encoder_ctl(opus, OPUS_GET_LOOKAHEAD(&lookahead));
+
+            serial = random_device()();
+            pending.reserve(8 * frame_size * audio_frame_t::channels);
+            packet.resize(max_packet_size);
+
+            vector<uint8_t> head;
+            const char *opushead = "OpusHead";
+            head.insert(head.end(), opushead, opushead + 8);
+            head.push_back(1); // version
+            head.push_back(audio_frame_t::channels);
+            append_le(head, lookahead * (48000 / sample_rate), 2); // pre-skip at 48kHz
+            append_le(head, sample_rate, 4);
+            append_le(head, 0, 2); // output gain
+            head.push_back(0); // channel mapping family
+            addPacket(head.data(), head.size());
+            writePage(header, 0x02);
+
+            vector<uint8_t> tags;
+            const char *opustags = "OpusTags";
+            tags.insert(tags.end(), opustags, opustags + 8);
+            const char *vendor = opus_get_version_string();
+            append_le(tags, strlen(vendor), 4);
+            tags.insert(tags.end(), vendor, vendor + strlen(vendor));
+            append_le(tags, 0, 4); // no user comments
+            addPacket(tags.data(), tags.size());
+            writePage(header, 0x00);
+        }
+
+        OggOpusEncoder(const OggOpusEncoder& other) = delete;
+        OggOpusEncoder& operator=(const OggOpusEncoder& other) = delete;
+
+        ~OggOpusEncoder() {
+            opus_encoder_destroy(opus);
+        }
+
+        virtual void encode(const audio_frame_t& frame, vector<uint8_t>& out) override {
+            pending.insert(pending.end(), frame.samples.begin(), frame.samples.end());
+
+            const size_t samples_per_packet = frame_size * audio_frame_t::channels;
+            size_t pos = 0;
+            while (pending.size() - pos >= samples_per_packet) {
+                int len = opus_encode(opus, pending.data() + pos, frame_size,
+                        packet.data(), packet.size());
+                pos += samples_per_packet;
+
+                if (len < 0) {
+                    throw runtime_error(string("Failed to encode Opus: ") +
+                            opus_strerror(len));
+                }
+
+                // Flush the packets collected so far if this one does not
+                // fit, while the granule position is still that of the
+                // last packet on the page
+                if (segments.size() + len / 255 + 1 > 255) {
+                    writePage(out, 0x00);
+                }
+                addPacket(packet.data(), len);
+
+                // The granule position is always counted at 48kHz
+                granule += 960;
+            }
+            pending.erase(pending.begin(), pending.begin() + pos);
+
+            if (not segments.empty()) {
+                writePage(out, 0x00);
+            }
+        }
+
+    private:
+        static constexpr size_t max_packet_size = 4000;
+
+        void addPacket(const uint8_t *data, size_t len) {
+            page_data.insert(page_data.end(), data, data + len);
+            for (size_t i = 0; i < len / 255; i++) {
+                segments.push_back(255);
+            }
+            segments.push_back(len % 255);
+        }
+
+        void writePage(vector<uint8_t>& out, uint8_t header_type) {
+            const size_t start = out.size();
+            const char *capture = "OggS";
+            out.insert(out.end(), capture, capture + 4);
+            out.push_back(0); // version
+            out.push_back(header_type);
+            append_le(out, granule, 8);
+            append_le(out, serial, 4);
+            append_le(out, sequence++, 4);
+            append_le(out, 0, 4); // CRC, written below
+            out.push_back(segments.size());
+            out.insert(out.end(), segments.begin(), segments.end());
+            out.insert(out.end(), page_data.begin(), page_data.end());
+
+            uint32_t crc = ogg_crc(out.data() + start, out.size() - start);
+            for (int i = 0; i < 4; i++) {
+                out[start + 22 + i] = (crc >> (8 * i)) & 0xFF;
+            }
+
+            segments.clear();
+            page_data.clear();
+        }
+
+        static uint32_t ogg_crc(const uint8_t *data, size_t len) {
+            static const vector<uint32_t> table = [](){
+                vector<uint32_t> t(256);
+                for (uint32_t i = 0; i < 256; i++) {
+                    uint32_t r = i << 24;
+                    for (int j = 0; j < 8; j++) {
+                        r = (r & 0x80000000) ? (r << 1) ^ 0x04C11DB7 : (r << 1);
+                    }
+                    t[i] = r;
+                }
+                return t;
+            }();
+
+            uint32_t crc = 0;
+            for (size_t i = 0; i < len; i++) {
+                crc = (crc << 8) ^ table[((crc >> 24) ^ data[i]) & 0xFF];
+            }
+            return crc;
+        }
+
+        ::OpusEncoder *opus = nullptr;
+        int frame_size;
+
+        uint32_t serial = 0;
+        uint32_t sequence = 0;
+        uint64_t granule = 0;
+
+        vector<int16_t> pending;
+        vector<uint8_t> packet;
+        vector<uint8_t> segments;
+        vector<uint8_t> page_data;
+};
+#endif // defined(HAVE_OPUS)
+
+unique_ptr<AudioEncoder> make_audio_encoder(const encoder_key_t& key, int sample_rate)
+{
+    switch (key.encoding) {
+        case AudioEncoding::MP3:
+            return make_unique<Mp3Encoder>(sample_rate, key.bitrate_kbps);
+        case AudioEncoding::Opus:
+#if defined(HAVE_OPUS)
+            return make_unique<OggOpusEncoder>(sample_rate, key.bitrate_kbps);
+#else
+            throw runtime_error("welle-cli was built without Opus support");
+#endif
+        case AudioEncoding::WAV:
+            return make_unique<WavEncoder>(sample_rate);
+    }
+    throw logic_error("Unknown audio encoding");
+}
@@ -0,0 +1,73 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "backend/audio-frame.h"
+
+/* The formats in which welle-cli streams the decoded audio. For every
+ * programme, each format and bitrate is encoded only once, and the result
+ * is sent to all listeners that asked for it. */
+enum class AudioEncoding { MP3, Opus, WAV };
+
+struct encoder_key_t {
+    AudioEncoding encoding = AudioEncoding::MP3;
+    int bitrate_kbps = 0; // 0 selects the default of the encoder
+
+    bool operator<(const encoder_key_t& other) const;
+};
+
+// Parse the name used in the URLs ("mp3", "opus" or "wav"). Returns false
+// for unknown formats, and for Opus if welle-cli was built without it.
+bool parse_audio_encoding(const std::string& name, AudioEncoding& encoding);
+
+// The value of the Content-Type header of the stream
+const char *audio_content_type(AudioEncoding encoding);
+
+class AudioEncoder {
+    public:
+        virtual ~AudioEncoder() = default;
+
+        // Encode a frame and append the result, that has to be sent to all
+        // listeners, to out. Depending on the format, the encoder may buffer
+        // some audio and append nothing.
+        virtual void encode(const audio_frame_t& frame, std::vector<uint8_t>& out) = 0;
+
+        // Data that a listener joining the stream has to receive before
+        // the encoded audio, e.g. container headers. Empty for formats
+        // a decoder can synchronise to anywhere.
+        const std::vector<uint8_t>& streamHeader(void) const { return header; }
+
+    protected:
+        std::vector<uint8_t> header;
+};
+
+// Create an encoder for audio at the given sample rate. Throws a
+// runtime_error if the encoder cannot be set up for it.
+std::unique_ptr<AudioEncoder> make_audio_encoder(
+        const encoder_key_t& key, int sample_rate);
@@ -153,8 +153,10 @@ function ensembleInfoTemplate() {
     html += ' <tr><th>Ensemble ID </th>';
     html += ' <th>ECC </th>';
     html += ' <th>SNR </th>';
+    html += ' <th><abbr title="Modulation Error Ratio of the differential QPSK points, about 3 dB below that of the carriers">MER</abbr></th>';
     html += ' <th>RX gain </th>';
     html += ' <th>Freq corr</th>';
+    html += ' <th><abbr title="Sample clock offset">Clock</abbr></th>';
     html += ' <th>Date</th></th>';
     html += ' <th><abbr title="Local Time Offset">LTO</abbr></th></th>';
     html += ' <th>FIC CRC Errors</th>';
@@ -163,8 +165,10 @@ function ensembleInfoTemplate() {
     html += ' <tr><td>${EId}</td>';
     html += ' <td>${ecc}</td>';
     html += ' <td>${SNR}</td>';
+    html += ' <td>${MER}</td>';
     html += ' <td>${gain}</td>';
     html += ' <td>${FrequencyCorrection}</td>';
+    html += ' <td>${SampleClockOffset} ppm</td>';
     html += ' <td>${year}-${month}-${day} ${hour}:${minutes} UTC</td>';
     html += ' <td>${lto}</td>';
     html += ' <td>${ficcrcerrors}</td>';
@@ -416,7 +420,9 @@ function populateEnsembleinfo() {
         ens["hw_name"] = data.receiver.hardware.name;
         ens["sw_name"] = data.receiver.software.name;
         ens["SNR"] = data.demodulator.snr.toFixed(1);
+        ens["MER"] = data.demodulator.mer.toFixed(1);
         ens["FrequencyCorrection"] = data.demodulator.frequencycorrection;
+        ens["SampleClockOffset"] = data.demodulator.sampleclockoffset.toFixed(1);
         ens["services"] = servicehtml;
         ens["ficcrcerrors"] = data.demodulator.fic.numcrcerrors;
         var lcc = new Date(data.receiver.software.lastchannelchange * 1000);
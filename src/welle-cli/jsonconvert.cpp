@@ -24,6 +24,7 @@
  */
 
 #include "welle-cli/jsonconvert.h"
+#include <cmath>
 #include "libs/json.hpp"
 
 using namespace std;
@@ -128,7 +129,8 @@ static void to_json(nlohmann::json& j, const ServiceJson& s) {
         {"mode", s.mode},
         {"mot", nlohmann::json{
             {"time", s.mot_time},
-            {"lastchange", s.mot_lastchange}}},
+            {"lastchange", s.mot_lastchange},
+            {"hash", s.mot_hash}}},
         {"dls", nlohmann::json{
             {"label", s.dls_label},
             {"time", s.dls_time},
@@ -137,6 +139,8 @@ static void to_json(nlohmann::json& j, const ServiceJson& s) {
             {"frameerrors", s.errorcounters_frameerrors},
             {"rserrors", s.errorcounters_rserrors},
             {"aacerrors", s.errorcounters_aacerrors},
+            {"viterbibits", s.errorcounters_viterbibits},
+            {"viterbibiterrors", s.errorcounters_viterbibiterrors},
             {"time", s.errorcounters_time}}}};
 
     if (s.xpaderror_haserror) {
@@ -161,7 +165,22 @@ static void to_json(nlohmann::json& j, const ServiceJson& s) {
         j["audiolevel"] = nlohmann::json{
             {"time", s.audiolevel_time},
             {"left", s.audiolevel_left},
-            {"right", s.audiolevel_right}};
+            {"right", s.audiolevel_right},
+            {"gain", s.audiolevel_gain}};
+
+        if (std::isfinite(s.audiolevel_momentary)) {
+            j["audiolevel"]["momentary"] = s.audiolevel_momentary;
+        }
+        else {
+            j["audiolevel"]["momentary"] = nullptr;
+        }
+
+        if (std::isfinite(s.audiolevel_shortterm)) {
+            j["audiolevel"]["shortterm"] = s.audiolevel_shortterm;
+        }
+        else {
+            j["audiolevel"]["shortterm"] = nullptr;
+        }
     }
     else {
         j["audiolevel"] = nullptr;
@@ -217,8 +236,14 @@ static void to_json(nlohmann::json& j, const MuxJson& mux) {
     };
 
     j["demodulator"]["fic"]["numcrcerrors"] = mux.demodulator_fic_numcrcerrors;
+    j["demodulator"]["fic"]["viterbibits"] = mux.demodulator_fic_viterbibits;
+    j["demodulator"]["fic"]["viterbibiterrors"] = mux.demodulator_fic_viterbibiterrors;
     j["demodulator"]["snr"] = mux.demodulator_snr;
+    j["demodulator"]["mer"] = mux.demodulator_mer;
     j["demodulator"]["frequencycorrection"] = mux.demodulator_frequencycorrection;
+    j["demodulator"]["sampleclockoffset"] = mux.demodulator_sampleclockoffset;
+    j["demodulator"]["spectrum"]["level"] = mux.demodulator_spectrum_level;
+    j["demodulator"]["spectrum"]["nulllevel"] = mux.demodulator_null_spectrum_level;
 }
 
 std::string build_mux_json(const MuxJson& mux)
@@ -226,3 +251,49 @@ std::string build_mux_json(const MuxJson& mux)
     nlohmann::json j = mux;
     return j.dump();
 }
+
+static void to_json(nlohmann::json& j, const SlideJson& slide)
+{
+    j = nlohmann::json{
+        {"hash", slide.hash},
+        {"contenttype", slide.contenttype},
+        {"url", slide.url},
+        {"firstreceived", slide.firstreceived},
+        {"lastreceived", slide.lastreceived}};
+}
+
+std::string build_slide_history_json(const std::vector<SlideJson>& slides)
+{
+    nlohmann::json j = slides;
+    return j.dump();
+}
+
+std::string build_history_index_json(const std::vector<std::string>& names)
+{
+    nlohmann::json j;
+    j["series"] = names;
+    j["resolutions"] = nlohmann::json::array();
+    for (const auto& r : TimeSeries::resolutions()) {
+        j["resolutions"].push_back(r.seconds);
+    }
+    return j.dump();
+}
+
+static void to_json(nlohmann::json& j, const TimeSeries::Point& p)
+{
+    j = nlohmann::json{
+        {"time", p.time},
+        {"count", p.count},
+        {"min", p.min},
+        {"max", p.max},
+        {"mean", p.mean}};
+}
+
+std::string build_history_json(const HistoryJson& history)
+{
+    nlohmann::json j{
+        {"name", history.name},
+        {"resolution", history.resolution},
+        {"points", history.points}};
+    return j.dump();
+}
@@ -31,6 +31,7 @@
 #include <ctime>
 #include "dab-constants.h"
 #include "backend/radio-controller.h"
+#include "welle-cli/measurement-history.h"
 
 struct SoftwareJson {
     std::string name;
@@ -84,6 +85,10 @@ struct ServiceJson {
     std::time_t audiolevel_time = 0;
     int audiolevel_left = -1;
     int audiolevel_right = -1;
+    // EBU R128 loudness in LUFS, not finite if not measured
+    float audiolevel_momentary = 0.0f;
+    float audiolevel_shortterm = 0.0f;
+    float audiolevel_gain = 0.0f;
 
     int channels = 0;
     int samplerate = 0;
@@ -91,6 +96,7 @@ struct ServiceJson {
 
     std::time_t mot_time = 0;
     std::time_t mot_lastchange = 0;
+    std::string mot_hash;
 
     std::string dls_label;
     std::time_t dls_time = 0;
@@ -99,6 +105,10 @@ struct ServiceJson {
     size_t errorcounters_frameerrors = 0;
     size_t errorcounters_rserrors = 0;
     size_t errorcounters_aacerrors = 0;
+    // Soft bits before the Viterbi decoder, and those that differ from the
+    // re-encoded Viterbi output
+    size_t errorcounters_viterbibits = 0;
+    size_t errorcounters_viterbibiterrors = 0;
     std::time_t errorcounters_time = 0;
 
     bool xpaderror_haserror = false;
@@ -132,14 +142,45 @@ struct MuxJson {
     EnsembleJson ensemble;
     std::vector<ServiceJson> services;
     size_t demodulator_fic_numcrcerrors = 0;
+    size_t demodulator_fic_viterbibits = 0;
+    size_t demodulator_fic_viterbibiterrors = 0;
     UTCJson utctime;
     std::vector<std::string> messages;
 
     double demodulator_snr = 0.0;
+    double demodulator_mer = 0.0;
     double demodulator_frequencycorrection = 0.0;
+    // In parts per million
+    double demodulator_sampleclockoffset = 0.0;
+
+    // Mean power of the averaged spectra, in dB
+    double demodulator_spectrum_level = 0.0;
+    double demodulator_null_spectrum_level = 0.0;
 
     std::list<tii_measurement_t> tii;
     std::vector<PeakJson> cir_peaks;
 };
 
 std::string build_mux_json(const MuxJson& mux);
+
+struct SlideJson {
+    std::string hash;
+    std::string contenttype;
+    std::string url;
+    std::time_t firstreceived = 0;
+    std::time_t lastreceived = 0;
+};
+
+std::string build_slide_history_json(const std::vector<SlideJson>& slides);
+
+// The names of the series of the measurement history, and the resolutions
+// at which they can be queried
+std::string build_history_index_json(const std::vector<std::string>& names);
+
+struct HistoryJson {
+    std::string name;
+    int resolution = 0;
+    std::vector<TimeSeries::Point> points;
+};
+
+std::string build_history_json(const HistoryJson& history);
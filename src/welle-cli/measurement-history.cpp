@@ -0,0 +1,222 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+#include "welle-cli/measurement-history.h"
+
+using namespace std;
+
+const vector<TimeSeries::Resolution>& TimeSeries::resolutions()
+{
+    static const vector<Resolution> r = {
+        {1, 600},
+        {60, 24 * 60},
+        {3600, 92 * 24} };
+    return r;
+}
+
+TimeSeries::TimeSeries()
+{
+    for (const auto& r : resolutions()) {
+        Ring ring;
+        ring.seconds = r.seconds;
+        ring.num_buckets = r.num_buckets;
+        ring.buckets.reset(new Bucket[r.num_buckets]);
+        rings.push_back(move(ring));
+    }
+}
+
+void TimeSeries::record(float value)
+{
+    using namespace std::chrono;
+    const auto now = system_clock::now().time_since_epoch();
+    record(value, duration_cast<seconds>(now).count());
+}
+
+void TimeSeries::record(float value, int64_t time)
+{
+    if (time > latest_time.load(memory_order_relaxed)) {
+        latest_time.store(time, memory_order_relaxed);
+    }
+
+    for (auto& ring : rings) {
+        const int64_t start = time - time % ring.seconds;
+        Bucket& b = ring.buckets[(start / ring.seconds) % ring.num_buckets];
+
+        const int64_t bucket_time = b.time.load(memory_order_relaxed);
+        if (bucket_time > start) {
+            continue;
+        }
+
+        // Only this thread modifies the bucket, the sequence is odd while
+        // it is being modified.
+        const uint32_t seq = b.sequence.load(memory_order_relaxed);
+        b.sequence.store(seq + 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+
+        if (bucket_time != start) {
+            b.time.store(start, memory_order_relaxed);
+            b.count.store(1, memory_order_relaxed);
+            b.sum.store(value, memory_order_relaxed);
+            b.min.store(value, memory_order_relaxed);
+            b.max.store(value, memory_order_relaxed);
+        }
+        else {
+            b.count.store(b.count.load(memory_order_relaxed) + 1,
+                    memory_order_relaxed);
+            b.sum.store(b.sum.load(memory_order_relaxed) + value,
+                    memory_order_relaxed);
+            b.min.store(std::min(b.min.load(memory_order_relaxed), value),
+                    memory_order_relaxed);
+            b.max.store(std::max(b.max.load(memory_order_relaxed), value),
+                    memory_order_relaxed);
+        }
+
+        b.sequence.store(seq + 2, memory_order_release);
+    }
+}
+
+int64_t TimeSeries::latest() const
+{
+    return latest_time.load(memory_order_relaxed);
+}
+
+vector<TimeSeries::Point> TimeSeries::query(
+        int resolution, int64_t from, int64_t to) const
+{
+    const auto ring = find_if(rings.begin(), rings.end(),
+            [&](const Ring& r) { return r.seconds == resolution; });
+    if (ring == rings.end()) {
+        throw out_of_range("Unknown resolution " + to_string(resolution));
+    }
+
+    vector<Point> points;
+    if (from > to) {
+        return points;
+    }
+
+    // Older buckets have been overwritten already
+    const int64_t last = to - to % ring->seconds;
+    const int64_t oldest = last - (int64_t)(ring->num_buckets - 1) * ring->seconds;
+    int64_t first = from - from % ring->seconds;
+    if (first < from) {
+        first += ring->seconds;
+    }
+    first = std::max(first, oldest);
+
+    for (int64_t start = first; start <= last; start += ring->seconds) {
+        const Bucket& b = ring->buckets[(start / ring->seconds) % ring->num_buckets];
+
+        Point p;
+        double sum = 0;
+        while (true) {
+            const uint32_t seq = b.sequence.load(memory_order_acquire);
+            if (seq % 2 == 1) {
+                this_thread::yield();
+                continue;
+            }
+
+            p.time = b.time.load(memory_order_relaxed);
+            p.count = b.count.load(memory_order_relaxed);
+            sum = b.sum.load(memory_order_relaxed);
+            p.min = b.min.load(memory_order_relaxed);
+            p.max = b.max.load(memory_order_relaxed);
+
+            atomic_thread_fence(memory_order_acquire);
+            if (b.sequence.load(memory_order_relaxed) == seq) {
+                break;
+            }
+        }
+
+        if (p.time == start and p.count > 0) {
+            p.mean = sum / p.count;
+            points.push_back(p);
+        }
+    }
+
+    return points;
+}
+
+MeasurementHistory::MeasurementHistory(size_t max_series) :
+    max_series(max_series)
+{
+}
+
+static string channel_of(const string& name)
+{
+    return name.substr(0, name.find('/'));
+}
+
+shared_ptr<TimeSeries> MeasurementHistory::series(const string& name)
+{
+    lock_guard<mutex> lock(history_mutex);
+    const auto it = all_series.find(name);
+    if (it != all_series.end()) {
+        return it->second;
+    }
+
+    if (all_series.size() >= max_series) {
+        const string channel = channel_of(name);
+        auto oldest = all_series.end();
+        for (auto s = all_series.begin(); s != all_series.end(); ++s) {
+            if (channel_of(s->first) != channel and
+                    (oldest == all_series.end() or
+                     s->second->latest() < oldest->second->latest())) {
+                oldest = s;
+            }
+        }
+
+        if (oldest == all_series.end()) {
+            clog << "MeasurementHistory: limit of " << max_series <<
+                " series reached, cannot record " << name << endl;
+            return nullptr;
+        }
+        clog << "MeasurementHistory: dropping " << oldest->first << endl;
+        all_series.erase(oldest);
+    }
+
+    auto s = make_shared<TimeSeries>();
+    all_series.emplace(name, s);
+    return s;
+}
+
+shared_ptr<const TimeSeries> MeasurementHistory::find(const string& name) const
+{
+    lock_guard<mutex> lock(history_mutex);
+    const auto it = all_series.find(name);
+    if (it == all_series.end()) {
+        return nullptr;
+    }
+    return it->second;
+}
+
+vector<string> MeasurementHistory::names() const
+{
+    lock_guard<mutex> lock(history_mutex);
+    vector<string> n;
+    for (const auto& s : all_series) {
+        n.push_back(s.first);
+    }
+    return n;
+}
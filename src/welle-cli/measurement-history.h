@@ -0,0 +1,129 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/* A time-series store for the measurements of the receiver, so that the
+ * reception of a channel can be followed over weeks or months.
+ *
+ * Every series aggregates its samples into buckets of one second, one minute
+ * and one hour. For each resolution, the buckets are kept in a ring of fixed
+ * size that overwrites the oldest bucket, so that the memory used by a series
+ * does not grow with the uptime.
+ *
+ * Recording and querying a series never block each other. Every bucket is
+ * protected by a sequence counter that the writer increments before and
+ * after modifying it, and a query reads the bucket again if it was modified
+ * in the meantime. A series must only be recorded from one thread at a time. */
+
+class TimeSeries {
+    public:
+        struct Resolution {
+            int seconds;
+            size_t num_buckets;
+        };
+
+        // Ten minutes of one second buckets, one day of one minute buckets
+        // and 92 days of one hour buckets.
+        static const std::vector<Resolution>& resolutions(void);
+
+        // A bucket of the series
+        struct Point {
+            int64_t time = 0; // Start of the bucket, in seconds since the epoch
+            uint32_t count = 0;
+            float min = 0.0f;
+            float max = 0.0f;
+            float mean = 0.0f;
+        };
+
+        TimeSeries();
+        TimeSeries(const TimeSeries&) = delete;
+        TimeSeries& operator=(const TimeSeries&) = delete;
+
+        // Add a sample taken at time, in seconds since the epoch. Samples
+        // older than the current bucket of a resolution are ignored by it.
+        void record(float value, int64_t time);
+
+        // Add a sample taken now
+        void record(float value);
+
+        // Time of the newest sample, -1 if nothing was recorded yet
+        int64_t latest(void) const;
+
+        // Return the buckets of the resolution, given in seconds, that start
+        // between from and to, in chronological order. Empty buckets are
+        // skipped. Throws out_of_range for an unknown resolution.
+        std::vector<Point> query(int resolution, int64_t from, int64_t to) const;
+
+    private:
+        struct Bucket {
+            std::atomic<uint32_t> sequence = ATOMIC_VAR_INIT(0);
+            std::atomic<uint32_t> count = ATOMIC_VAR_INIT(0);
+            std::atomic<int64_t> time = ATOMIC_VAR_INIT(-1);
+            std::atomic<double> sum = ATOMIC_VAR_INIT(0.0);
+            std::atomic<float> min = ATOMIC_VAR_INIT(0.0f);
+            std::atomic<float> max = ATOMIC_VAR_INIT(0.0f);
+        };
+
+        struct Ring {
+            int seconds = 0;
+            size_t num_buckets = 0;
+            std::unique_ptr<Bucket[]> buckets;
+        };
+
+        std::vector<Ring> rings;
+        std::atomic<int64_t> latest_time = ATOMIC_VAR_INIT(-1);
+};
+
+class MeasurementHistory {
+    public:
+        // A series takes about 136kB, with the default limit the history
+        // uses at most about 35MB.
+        explicit MeasurementHistory(size_t max_series = 256);
+        MeasurementHistory(const MeasurementHistory&) = delete;
+        MeasurementHistory& operator=(const MeasurementHistory&) = delete;
+
+        // Return the series with that name, creating it if needed. Names
+        // start with the channel, e.g. "5C/snr". When the limit is reached,
+        // the least recently recorded series of another channel is dropped
+        // to make room. Returns nullptr if the limit is reached and all
+        // series belong to the channel of name.
+        std::shared_ptr<TimeSeries> series(const std::string& name);
+
+        // Return the series with that name, or nullptr if it does not exist
+        std::shared_ptr<const TimeSeries> find(const std::string& name) const;
+
+        std::vector<std::string> names(void) const;
+
+    private:
+        const size_t max_series;
+        mutable std::mutex history_mutex;
+        // A dropped series stays valid for those still holding it
+        std::map<std::string, std::shared_ptr<TimeSeries> > all_series;
+};
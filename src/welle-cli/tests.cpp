@@ -32,14 +32,18 @@
 
 #include "tests.h"
 #include "backend/radio-receiver.h"
+#include "backend/dabplus_decoder.h"
+#include "null_device.h"
 #include "raw_file.h"
 #include "various/profiling.h"
 #include <algorithm>
+#include <chrono>
 #include <numeric>
 #include <random>
 #include <condition_variable>
 #include <deque>
 #include <iostream>
+#include <map>
 #include <utility>
 #include <cstdio>
 
@@ -162,7 +166,14 @@ class TestRadioInterface : public RadioControllerInterface {
         }
 
         virtual void onDateTimeUpdate(const dab_date_time_t& dateTime) override { (void)dateTime; }
-        virtual void onFIBDecodeSuccess(bool crcCheckOk, const uint8_t* fib) override { (void)crcCheckOk; (void)fib; }
+        virtual void onFIBDecodeSuccess(bool crcCheckOk, const uint8_t* fib) override
+        {
+            (void)fib;
+            num_fibs++;
+            if (not crcCheckOk) {
+                num_fib_crc_errors++;
+            }
+        }
         virtual void onNewImpulseResponse(std::vector<float>&& data) override
         {
             if (data.size() != 2048) {
@@ -196,6 +207,8 @@ class TestRadioInterface : public RadioControllerInterface {
         virtual void onTIIMeasurement(tii_measurement_t&& m) override { (void)m; }
         size_t num_syncs = 0;
         size_t num_desyncs = 0;
+        size_t num_fibs = 0;
+        size_t num_fib_crc_errors = 0;
         chrono::steady_clock::time_point first_sync_time;
 };
 
@@ -212,14 +225,13 @@ class TestProgrammeHandler: public ProgrammeHandlerInterface {
             frameErrorStats.push_back(frameErrors);
         }
 
-        virtual void onNewAudio(std::vector<int16_t>&& audioData, int sampleRate, const string& mode) override {
-            (void)audioData;
+        virtual void onNewAudio(const audio_frame_ptr& frame, const string& mode) override {
             (void)mode;
 
-            if (rate != sampleRate) {
-                cout << "rate " << sampleRate << endl;
+            if (rate != frame->sample_rate) {
+                cout << "rate " << frame->sample_rate << endl;
             }
-            rate = sampleRate;
+            rate = frame->sample_rate;
         }
 
         virtual void onRsErrors(bool uncorrectedErrors, int numCorrectedErrors) override {
@@ -369,6 +381,194 @@ void Tests::test_multipath(int test_id)
     fclose(fd);
 }
 
+// Compare the DAB+ Reed-Solomon decoder against the generic libfec
+// decoder, on clean superframes and on superframes with byte errors.
+// Does not use the input.
+void Tests::test_reed_solomon()
+{
+    cerr << "Setup test_reed_solomon" << endl;
+
+    // 96 kbit/s subchannel, 12 RS packets per superframe
+    constexpr size_t subch_index = 12;
+    constexpr size_t sf_len = 120 * subch_index;
+    constexpr int num_superframes = 2000;
+
+    void *rs_handle = init_rs_char(8, 0x11D, 0, 1, 10, 135);
+    if (not rs_handle) {
+        cerr << "init_rs_char failed" << endl;
+        return;
+    }
+
+    uniform_int_distribution<int> byte_distr(0, 255);
+    uniform_int_distribution<size_t> pos_distr(0, sf_len - 1);
+
+    vector<vector<uint8_t> > clean(num_superframes);
+    for (auto& sf : clean) {
+        sf.resize(sf_len);
+        uint8_t packet[120];
+        for (size_t i = 0; i < subch_index; i++) {
+            for (size_t pos = 0; pos < 110; pos++) {
+                packet[pos] = byte_distr(random_generator);
+            }
+            encode_rs_char(rs_handle, packet, packet + 110);
+
+            for (size_t pos = 0; pos < 120; pos++) {
+                sf[pos * subch_index + i] = packet[pos];
+            }
+        }
+    }
+    free_rs_char(rs_handle);
+
+    // Between 1 and 20 byte errors per superframe. With up to five errors
+    // per packet, all are correctable.
+    vector<vector<uint8_t> > noisy(clean);
+    uniform_int_distribution<int> num_errors_distr(1, 20);
+    for (auto& sf : noisy) {
+        const int num_errors = num_errors_distr(random_generator);
+        for (int e = 0; e < num_errors; e++) {
+            sf[pos_distr(random_generator)] ^= 1 + byte_distr(random_generator) % 255;
+        }
+    }
+
+    RSDecoder rs_dec;
+
+    using decode_f = void (RSDecoder::*)(uint8_t*, size_t, int&, bool&);
+    auto run = [&](const vector<vector<uint8_t> >& input, decode_f decode,
+            vector<vector<uint8_t> >& output, int& total_corr, int& num_uncorr) {
+        output = input;
+        total_corr = 0;
+        num_uncorr = 0;
+
+        const auto start = chrono::steady_clock::now();
+        for (auto& sf : output) {
+            int corr_count = 0;
+            bool uncorr_errors = false;
+            (rs_dec.*decode)(sf.data(), sf.size(), corr_count, uncorr_errors);
+            total_corr += corr_count;
+            num_uncorr += uncorr_errors ? 1 : 0;
+        }
+        const chrono::duration<double, micro> d = chrono::steady_clock::now() - start;
+        return d.count() / input.size();
+    };
+
+    for (const bool with_errors : {false, true}) {
+        const auto& input = with_errors ? noisy : clean;
+
+        vector<vector<uint8_t> > out_fast, out_generic;
+        int corr_fast = 0, corr_generic = 0;
+        int uncorr_fast = 0, uncorr_generic = 0;
+
+        const double us_generic = run(input, &RSDecoder::DecodeSuperframeGeneric,
+                out_generic, corr_generic, uncorr_generic);
+        const double us_fast = run(input, &RSDecoder::DecodeSuperframe,
+                out_fast, corr_fast, uncorr_fast);
+
+        cerr << endl;
+        cerr << (with_errors ? "Superframes with errors" : "Clean superframes") << endl;
+        cerr << "  generic: " << us_generic << " us/superframe, " <<
+            corr_generic << " corrected, " << uncorr_generic << " uncorrectable" << endl;
+        cerr << "  fast:    " << us_fast << " us/superframe, " <<
+            corr_fast << " corrected, " << uncorr_fast << " uncorrectable" << endl;
+
+        const bool same = out_fast == out_generic and
+            corr_fast == corr_generic and uncorr_fast == uncorr_generic;
+        const bool restored = out_fast == clean or uncorr_fast > 0;
+        cerr << "  " << (same and restored ? "PASS" : "FAIL") << endl;
+    }
+    cerr << endl;
+}
+
+// Write the ensemble of the IQ file to an ETI file, and replay that file
+// as fast as possible, first without and then with decoding all audio
+// programmes. This measures the channel decoding without the demodulator.
+void Tests::test_eti()
+{
+    const string eti_filename = "test.eti";
+    cerr << "Setup test_eti, writing " << eti_filename << endl;
+
+    {
+        TestRadioInterface ri;
+        RadioReceiver rx(ri, *input_interface.get(), rro);
+        // The input is not throttled, the demodulator has to wait for the writer
+        if (not rx.startEtiOutput(eti_filename, true)) {
+            return;
+        }
+        rx.restart(false);
+
+        auto& intf = dynamic_cast<CRAWFile&>(*input_interface);
+        while (not intf.endWasReached()) {
+            this_thread::sleep_for(chrono::milliseconds(120));
+        }
+        rx.stop();
+    }
+
+    FILE *fd = fopen(eti_filename.c_str(), "r");
+    if (fd == nullptr) {
+        perror("fopen");
+        return;
+    }
+    fseek(fd, 0, SEEK_END);
+    const long num_frames = ftell(fd) / 6144;
+    fclose(fd);
+    cerr << "Wrote " << num_frames << " ETI frames" << endl;
+
+    // The replay must decode every FIB and every audio superframe of a clean
+    // recording, the ETI frames carry exactly what the demodulator received.
+    bool ok = num_frames > 0;
+    for (const bool decode_audio : {false, true}) {
+        TestRadioInterface ri;
+        map<uint32_t, TestProgrammeHandler> phs;
+        CNullDevice null_device;
+        RadioReceiver rx(ri, null_device, rro);
+        if (not rx.setEtiInput(eti_filename, false, false)) {
+            return;
+        }
+
+        const auto start_time = chrono::steady_clock::now();
+        rx.restart(false);
+
+        while (not rx.etiEndReached()) {
+            if (decode_audio) {
+                for (const auto& s : rx.getServiceList()) {
+                    if (phs.count(s.serviceId) == 0 and rx.serviceHasAudioComponent(s) and
+                            not rx.addServiceToDecode(phs[s.serviceId], "", s)) {
+                        phs.erase(s.serviceId);
+                    }
+                }
+            }
+            this_thread::sleep_for(chrono::milliseconds(10));
+        }
+
+        const chrono::duration<double> d = chrono::steady_clock::now() - start_time;
+        rx.stop();
+
+        int frame_errors = 0, aac_errors = 0, rs_errors = 0;
+        for (const auto& ph : phs) {
+            const auto& tph = ph.second;
+            frame_errors += std::accumulate(tph.frameErrorStats.begin(), tph.frameErrorStats.end(), 0);
+            aac_errors += std::accumulate(tph.aacErrorStats.begin(), tph.aacErrorStats.end(), 0);
+            rs_errors += std::accumulate(tph.rsErrorStats.begin(), tph.rsErrorStats.end(), 0);
+        }
+
+        cerr << endl;
+        cerr << "Replay " << (decode_audio ? "with " : "without ") <<
+            "audio decoding: " << num_frames << " CIFs in " << d.count() << " s, " <<
+            num_frames * 0.024 / d.count() << " times real time" << endl;
+        cerr << "Programmes decoded: " << phs.size() << endl;
+        cerr << "FIBs/FIB CRC errors: " << ri.num_fibs << "/" << ri.num_fib_crc_errors << endl;
+        cerr << "frameErrors/aacErrors/rsErrors: " << frame_errors << "/" <<
+            aac_errors << "/" << rs_errors << endl;
+
+        const bool pass = ri.num_fibs > 0 and ri.num_fib_crc_errors == 0 and
+            aac_errors == 0 and rs_errors == 0 and
+            (not decode_audio or not phs.empty());
+        cerr << "  " << (pass ? "PASS" : "FAIL") << endl;
+        ok = ok and pass;
+    }
+    cerr << endl;
+    cerr << "test_eti " << (ok ? "PASS" : "FAIL") << endl;
+}
+
 void Tests::run_test(int test_id)
 {
     rro.fftPlacementMethod = DEFAULT_FFT_PLACEMENT;
@@ -376,5 +576,7 @@ void Tests::run_test(int test_id)
     if (test_id == 0) test_with_noise();
     else if (test_id == 1 or test_id == 2) test_multipath(test_id);
     else if (test_id == 3) test_with_noise_iteration(0);
+    else if (test_id == 4) test_reed_solomon();
+    else if (test_id == 5) test_eti();
     else cerr << "Test " << test_id << " does not exist!" << endl;
 }
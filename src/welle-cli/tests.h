@@ -45,6 +45,8 @@ class Tests {
         void test_with_noise();
         void test_with_noise_iteration(double stddev);
         void test_multipath(int test_id);
+        void test_reed_solomon();
+        void test_eti();
 
         std::unique_ptr<CVirtualInput>& input_interface;
         RadioReceiverOptions rro;
@@ -0,0 +1,42 @@
+/*
+ *    Copyright (C) 2020
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/* The files of the web interface, embedded into the binary at build time by
+ * cmake/EmbedWebAssets.cmake. The gzip variant is only available if gzip was
+ * found when building, otherwise gzip_data is nullptr. */
+struct WebAsset {
+    const char *name;
+    const uint8_t *data;
+    size_t size;
+    const uint8_t *gzip_data;
+    size_t gzip_size;
+};
+
+// Terminated by an entry whose name is nullptr
+extern const WebAsset web_assets[];
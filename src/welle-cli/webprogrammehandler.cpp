@@ -24,6 +24,8 @@
  */
 #include "webprogrammehandler.h"
 #include <iostream>
+#include <iomanip>
+#include <sstream>
 #include <algorithm>
 
 using namespace std;
@@ -49,7 +51,7 @@ ProgrammeSender& ProgrammeSender::operator=(ProgrammeSender&& other)
     return *this;
 }
 
-bool ProgrammeSender::send_mp3(const std::vector<uint8_t>& mp3Data)
+bool ProgrammeSender::send_data(const uint8_t *data, size_t len)
 {
     if (not s.valid()) {
         return false;
@@ -57,7 +59,7 @@ bool ProgrammeSender::send_mp3(const std::vector<uint8_t>& mp3Data)
 
     const int flags = MSG_NOSIGNAL;
 
-    ssize_t ret = s.send(mp3Data.data(), mp3Data.size(), flags);
+    ssize_t ret = s.send(data, len, flags);
     if (ret == -1) {
         s.close();
         std::unique_lock<std::mutex> lock(mutex);
@@ -84,8 +86,10 @@ void ProgrammeSender::cancel()
     running = false;
 }
 
-WebProgrammeHandler::WebProgrammeHandler(uint32_t serviceId) :
-    serviceId(serviceId)
+WebProgrammeHandler::WebProgrammeHandler(uint32_t serviceId,
+        const audio_postprocessing_t& pp) :
+    serviceId(serviceId),
+    audio_postprocessing(pp)
 {
     const auto now = chrono::system_clock::now();
     time_label = now;
@@ -96,9 +100,12 @@ WebProgrammeHandler::WebProgrammeHandler(uint32_t serviceId) :
 
 WebProgrammeHandler::WebProgrammeHandler(WebProgrammeHandler&& other) :
     serviceId(other.serviceId),
-    senders(move(other.senders))
+    audio_postprocessing(other.audio_postprocessing),
+    encoder_groups(move(other.encoder_groups)),
+    untouched_senders(move(other.untouched_senders))
 {
-    other.senders.clear();
+    other.encoder_groups.clear();
+    other.untouched_senders.clear();
     other.serviceId = 0;
 
     const auto now = chrono::system_clock::now();
@@ -108,28 +115,81 @@ WebProgrammeHandler::WebProgrammeHandler(WebProgrammeHandler&& other) :
     time_mot_change = now;
 }
 
-void WebProgrammeHandler::registerSender(ProgrammeSender *sender)
+void WebProgrammeHandler::registerSender(ProgrammeSender *sender,
+        const encoder_key_t& key)
 {
     std::unique_lock<std::mutex> lock(senders_mutex);
-    senders.push_back(sender);
+    encoder_groups[key].new_senders.push_back(sender);
 }
 
-void WebProgrammeHandler::removeSender(ProgrammeSender *sender)
+void WebProgrammeHandler::removeSender(ProgrammeSender *sender,
+        const encoder_key_t& key)
 {
     std::unique_lock<std::mutex> lock(senders_mutex);
-    senders.remove(sender);
+    auto group = encoder_groups.find(key);
+    if (group != encoder_groups.end()) {
+        group->second.senders.remove(sender);
+        group->second.new_senders.remove(sender);
+
+        if (group->second.senders.empty() and
+                group->second.new_senders.empty()) {
+            encoder_groups.erase(group);
+        }
+    }
+}
+
+void WebProgrammeHandler::registerUntouchedSender(ProgrammeSender *sender)
+{
+    std::unique_lock<std::mutex> lock(senders_mutex);
+    untouched_senders.push_back(sender);
+}
+
+void WebProgrammeHandler::removeUntouchedSender(ProgrammeSender *sender)
+{
+    std::unique_lock<std::mutex> lock(senders_mutex);
+    untouched_senders.remove(sender);
 }
 
 bool WebProgrammeHandler::needsToBeDecoded() const
 {
     std::unique_lock<std::mutex> lock(senders_mutex);
-    return not senders.empty();
+    return not encoder_groups.empty() or not untouched_senders.empty();
+}
+
+bool WebProgrammeHandler::wantsDecodedAudio() const
+{
+    // The audio decoder and the encoders only run for listeners of
+    // decoded audio.
+    // Services that are decoded for their DLS, slides and error counters
+    // only (e.g. with -D or in the carousel), or whose listeners all get
+    // the untouched stream, are not decoded.
+    std::unique_lock<std::mutex> lock(senders_mutex);
+    return not encoder_groups.empty();
+}
+
+bool WebProgrammeHandler::wantsEncodedAudio() const
+{
+    std::unique_lock<std::mutex> lock(senders_mutex);
+    return not untouched_senders.empty();
+}
+
+audio_postprocessing_t WebProgrammeHandler::audioPostProcessing() const
+{
+    return audio_postprocessing;
 }
 
 void WebProgrammeHandler::cancelAll()
 {
     std::unique_lock<std::mutex> lock(senders_mutex);
-    for (auto& s : senders) {
+    for (auto& group : encoder_groups) {
+        for (auto& s : group.second.senders) {
+            s->cancel();
+        }
+        for (auto& s : group.second.new_senders) {
+            s->cancel();
+        }
+    }
+    for (auto& s : untouched_senders) {
         s->cancel();
     }
 }
@@ -153,15 +213,39 @@ WebProgrammeHandler::mot_t WebProgrammeHandler::getMOT() const
     mot_t mot;
 
     std::unique_lock<std::mutex> lock(stats_mutex);
-    if (last_mot_valid) {
-        mot.data = last_mot;
+    if (not slide_history.empty()) {
+        mot.slide = slide_history.back();
         mot.time = time_mot;
         mot.last_changed = time_mot_change;
-        mot.subtype = last_subtype;
     }
     return mot;
 }
 
+vector<WebProgrammeHandler::slide_t> WebProgrammeHandler::getSlideHistory() const
+{
+    std::unique_lock<std::mutex> lock(stats_mutex);
+    return vector<slide_t>(slide_history.begin(), slide_history.end());
+}
+
+bool WebProgrammeHandler::getSlide(uint64_t hash, slide_t& slide) const
+{
+    std::unique_lock<std::mutex> lock(stats_mutex);
+    for (const auto& sl : slide_history) {
+        if (sl.hash == hash) {
+            slide = sl;
+            return true;
+        }
+    }
+    return false;
+}
+
+string WebProgrammeHandler::hashToString(uint64_t hash)
+{
+    stringstream ss;
+    ss << hex << setfill('0') << setw(16) << hash;
+    return ss.str();
+}
+
 WebProgrammeHandler::xpad_error_t WebProgrammeHandler::getXPADErrors() const
 {
     std::unique_lock<std::mutex> lock(stats_mutex);
@@ -190,67 +274,77 @@ void WebProgrammeHandler::onFrameErrors(int frameErrors)
     errorcounters.time = chrono::system_clock::now();
 }
 
-void WebProgrammeHandler::onNewAudio(std::vector<int16_t>&& audioData,
-                int sampleRate, const string& m)
+void WebProgrammeHandler::onNewAudio(const audio_frame_ptr& frame,
+                const string& m)
 {
-    rate = sampleRate;
+    rate = frame->sample_rate;
     mode = m;
 
-    if (audioData.empty()) {
+    if (frame->samples.empty()) {
         return;
     }
 
-    // The audio decoders always upconvert to stereo
-    const int channels = 2;
-
-    int last_audioLevel_L = 0;
-    int last_audioLevel_R = 0;
-    {
-        int16_t max_L = 0;
-        int16_t max_R = 0;
-        for (size_t i = 0; i < audioData.size()-1; i+=2) {
-            max_L = std::max(max_L, audioData[i]);
-            max_R = std::max(max_R, audioData[i+1]);
-        }
-        last_audioLevel_L = max_L;
-        last_audioLevel_R = max_R;
-    }
-
     {
         std::unique_lock<std::mutex> lock(stats_mutex);
         audiolevels.time = chrono::system_clock::now();
-        audiolevels.last_audioLevel_L = last_audioLevel_L;
-        audiolevels.last_audioLevel_R = last_audioLevel_R;
+        audiolevels.last_audioLevel_L = frame->peak_L;
+        audiolevels.last_audioLevel_R = frame->peak_R;
+        audiolevels.loudness_momentary = frame->loudness_momentary;
+        audiolevels.loudness_short_term = frame->loudness_short_term;
+        audiolevels.gain_dB = frame->gain_dB;
     }
 
-    if (not lame_initialised) {
-        lame_set_in_samplerate(lame.lame, rate);
-        lame_set_num_channels(lame.lame, channels);
-        lame_set_VBR(lame.lame, vbr_default);
-        lame_set_VBR_q(lame.lame, 2);
-        lame_init_params(lame.lame);
-        lame_initialised = true;
-    }
+    std::unique_lock<std::mutex> lock(senders_mutex);
 
-    vector<uint8_t> mp3buf(16384);
+    for (auto& g : encoder_groups) {
+        const auto& key = g.first;
+        auto& group = g.second;
+
+        encoded.clear();
+        try {
+            if (not group.encoder or group.sample_rate != rate) {
+                group.encoder = make_audio_encoder(key, rate);
+                group.sample_rate = rate;
+
+                // A second header in the middle of a WAV or Ogg stream
+                // makes it invalid, so these listeners have to reconnect.
+                // MP3 listeners continue with the new sample rate.
+                if (not group.encoder->streamHeader().empty()) {
+                    for (auto& s : group.senders) {
+                        s->cancel();
+                    }
+                    group.senders.clear();
+                }
+            }
 
-    int written = lame_encode_buffer_interleaved(lame.lame,
-            audioData.data(), audioData.size()/channels,
-            mp3buf.data(), mp3buf.size());
+            group.encoder->encode(*frame, encoded);
+        }
+        catch (const runtime_error& e) {
+            cerr << "Cannot encode audio for " << serviceId << ": " <<
+                e.what() << endl;
+            for (auto& s : group.senders) {
+                s->cancel();
+            }
+            for (auto& s : group.new_senders) {
+                s->cancel();
+            }
+            continue;
+        }
 
-    if (written < 0) {
-        cerr << "Failed to encode mp3: " << written << endl;
-    }
-    else if (written > (ssize_t)mp3buf.size()) {
-        cerr << "mp3 encoder wrote more than buffer size!" << endl;
-    }
-    else if (written > 0) {
-        mp3buf.resize(written);
+        const auto& header = group.encoder->streamHeader();
+        for (auto& s : group.new_senders) {
+            if (not header.empty() and not s->send_data(header.data(), header.size())) {
+                cerr << "Failed to send audio for " << serviceId << endl;
+            }
+        }
+        group.senders.splice(group.senders.end(), group.new_senders);
 
-        std::unique_lock<std::mutex> lock(senders_mutex);
+        if (encoded.empty()) {
+            continue;
+        }
 
-        for (auto& s : senders) {
-            bool success = s->send_mp3(mp3buf);
+        for (auto& s : group.senders) {
+            bool success = s->send_data(encoded.data(), encoded.size());
             if (not success) {
                 cerr << "Failed to send audio for " << serviceId << endl;
             }
@@ -258,6 +352,19 @@ void WebProgrammeHandler::onNewAudio(std::vector<int16_t>&& audioData,
     }
 }
 
+void WebProgrammeHandler::onNewEncodedAudio(const uint8_t *data, size_t len, size_t duration_ms)
+{
+    (void)duration_ms;
+
+    std::unique_lock<std::mutex> lock(senders_mutex);
+    for (auto& s : untouched_senders) {
+        bool success = s->send_data(data, len);
+        if (not success) {
+            cerr << "Failed to send untouched audio for " << serviceId << endl;
+        }
+    }
+}
+
 void WebProgrammeHandler::onRsErrors(bool uncorrectedErrors, int numCorrectedErrors)
 {
     (void)numCorrectedErrors; // TODO calculate BER before Reed-Solomon
@@ -273,6 +380,13 @@ void WebProgrammeHandler::onAacErrors(int aacErrors)
     errorcounters.time = chrono::system_clock::now();
 }
 
+void WebProgrammeHandler::onBitErrors(size_t bitErrors, size_t numBits)
+{
+    std::unique_lock<std::mutex> lock(stats_mutex);
+    errorcounters.num_viterbiBits += numBits;
+    errorcounters.num_viterbiBitErrors += bitErrors;
+}
+
 void WebProgrammeHandler::onNewDynamicLabel(const string& label)
 {
     std::unique_lock<std::mutex> lock(stats_mutex);
@@ -285,24 +399,66 @@ void WebProgrammeHandler::onNewDynamicLabel(const string& label)
     last_label = label;
 }
 
-void WebProgrammeHandler::onMOT(const mot_file_t& mot_file)
+static uint64_t fnv1a(const vector<uint8_t>& data)
 {
-    std::unique_lock<std::mutex> lock(stats_mutex);
-    last_mot_valid = true;
-    const auto now = chrono::system_clock::now();
-    time_mot = now;
-    if (last_mot != mot_file.data) {
-        time_mot_change = now;
+    uint64_t h = 14695981039346656037ull;
+    for (const uint8_t b : data) {
+        h ^= b;
+        h *= 1099511628211ull;
     }
-    last_mot = mot_file.data;
+    return h;
+}
+
+void WebProgrammeHandler::onMOT(const mot_file_t& mot_file)
+{
+    // Most slides are repetitions of one we already have. Hashing outside
+    // the lock is enough to recognise them, and avoids keeping a copy of the
+    // previous slide only to compare against it.
+    const uint64_t hash = fnv1a(*mot_file.data);
+
+    MOTType subtype = MOTType::Unknown;
     if (mot_file.content_sub_type == 0x01) {
-        last_subtype = MOTType::JPEG;
+        subtype = MOTType::JPEG;
     }
     else if (mot_file.content_sub_type == 0x03) {
-        last_subtype = MOTType::PNG;
+        subtype = MOTType::PNG;
+    }
+
+    const auto now = chrono::system_clock::now();
+
+    std::unique_lock<std::mutex> lock(stats_mutex);
+    time_mot = now;
+
+    if (not slide_history.empty() and slide_history.back().hash == hash and
+            slide_history.back().data->size() == mot_file.data->size()) {
+        slide_history.back().last_received = now;
+        return;
+    }
+
+    time_mot_change = now;
+
+    slide_t slide;
+    auto it = find_if(slide_history.begin(), slide_history.end(),
+            [&](const slide_t& sl) {
+                return sl.hash == hash and sl.data->size() == mot_file.data->size();
+            });
+
+    if (it != slide_history.end()) {
+        slide = *it;
+        slide_history.erase(it);
     }
     else {
-        last_subtype = MOTType::Unknown;
+        slide.data = mot_file.data;
+        slide.hash = hash;
+        slide.first_received = now;
+    }
+
+    slide.subtype = subtype;
+    slide.last_received = now;
+    slide_history.push_back(move(slide));
+
+    while (slide_history.size() > SLIDE_HISTORY_LENGTH) {
+        slide_history.pop_front();
     }
 }
 
@@ -26,12 +26,17 @@
 
 #include "various/Socket.h"
 #include "backend/radio-receiver.h"
-#include <lame/lame.h>
+#include "audio-encoder.h"
 #include <cstdint>
 #include <memory>
 #include <mutex>
 #include <chrono>
+#include <deque>
+#include <limits>
+#include <list>
+#include <map>
 #include <string>
+#include <vector>
 #include <atomic>
 
 class ProgrammeSender {
@@ -46,31 +51,17 @@ class ProgrammeSender {
         ProgrammeSender(Socket&& s);
         ProgrammeSender(ProgrammeSender&& other);
         ProgrammeSender& operator=(ProgrammeSender&& other);
-        bool send_mp3(const std::vector<uint8_t>& mp3data);
+        bool send_data(const uint8_t *data, size_t len);
         void wait_for_termination() const;
         void cancel();
 };
 
 
-struct Lame {
-    lame_t lame;
-
-    Lame() {
-        lame = lame_init();
-    }
-
-    Lame(const Lame& other) = delete;
-    Lame& operator=(const Lame& other) = delete;
-    Lame(Lame&& other) = default;
-    Lame& operator=(Lame&& other) = default;
-
-    ~Lame() {
-        lame_close(lame);
-    }
-};
-
 enum class MOTType { JPEG, PNG, Unknown };
 
+// Number of distinct slides kept for every service
+constexpr size_t SLIDE_HISTORY_LENGTH = 10;
+
 
 class WebProgrammeHandler : public ProgrammeHandlerInterface {
     public:
@@ -85,6 +76,10 @@ class WebProgrammeHandler : public ProgrammeHandlerInterface {
             std::chrono::time_point<std::chrono::system_clock> time;
             int last_audioLevel_L = -1;
             int last_audioLevel_R = -1;
+            // Only measured if enabled in the audio_postprocessing_t
+            float loudness_momentary = -std::numeric_limits<float>::infinity();
+            float loudness_short_term = -std::numeric_limits<float>::infinity();
+            float gain_dB = 0.0f;
         };
 
         struct errorcounters_t {
@@ -92,15 +87,49 @@ class WebProgrammeHandler : public ProgrammeHandlerInterface {
             size_t num_frameErrors = 0;
             size_t num_rsErrors = 0;
             size_t num_aacErrors = 0;
+            size_t num_viterbiBits = 0;
+            size_t num_viterbiBitErrors = 0;
+        };
+
+        // A slide as received through MOT. The data is never modified once
+        // received, readers share it without copying.
+        struct slide_t {
+            std::shared_ptr<const std::vector<uint8_t> > data;
+            MOTType subtype = MOTType::Unknown;
+
+            // FNV-1a hash of the data, identifies the slide
+            uint64_t hash = 0;
+
+            std::chrono::time_point<std::chrono::system_clock> first_received;
+            std::chrono::time_point<std::chrono::system_clock> last_received;
         };
+
+        // The hash as 16 hexadecimal digits, as used in URLs and ETags
+        static std::string hashToString(uint64_t hash);
     private:
         uint32_t serviceId;
-
-        bool lame_initialised = false;
-        Lame lame;
+        const audio_postprocessing_t audio_postprocessing;
+
+        // The listeners of one format and bitrate share one encoder. It is
+        // created with the first audio frame after the first listener arrived
+        // and destroyed when the last listener leaves.
+        struct encoder_group_t {
+            std::unique_ptr<AudioEncoder> encoder;
+            int sample_rate = 0;
+            std::list<ProgrammeSender*> senders;
+            // Senders that have not yet received the stream header
+            std::list<ProgrammeSender*> new_senders;
+        };
 
         mutable std::mutex senders_mutex;
-        std::list<ProgrammeSender*> senders;
+        std::map<encoder_key_t, encoder_group_t> encoder_groups;
+
+        // Encoder output, reused for every audio frame
+        std::vector<uint8_t> encoded;
+
+        // Senders that get the audio as broadcast, without decoding.
+        // Also protected by senders_mutex.
+        std::list<ProgrammeSender*> untouched_senders;
 
         mutable std::mutex stats_mutex;
 
@@ -111,11 +140,12 @@ class WebProgrammeHandler : public ProgrammeHandlerInterface {
         std::chrono::time_point<std::chrono::system_clock> time_label_change;
         std::string last_label;
 
-        bool last_mot_valid = false;
         std::chrono::time_point<std::chrono::system_clock> time_mot;
         std::chrono::time_point<std::chrono::system_clock> time_mot_change;
-        std::vector<uint8_t> last_mot;
-        MOTType last_subtype = MOTType::Unknown;
+
+        // The most recently received distinct slides, the current one last.
+        // A slide that is received again moves to the back.
+        std::deque<slide_t> slide_history;
 
         xpad_error_t xpad_error;
 
@@ -125,11 +155,14 @@ class WebProgrammeHandler : public ProgrammeHandlerInterface {
         int rate = 0;
         std::string mode;
 
-        WebProgrammeHandler(uint32_t serviceId);
+        WebProgrammeHandler(uint32_t serviceId,
+                const audio_postprocessing_t& pp = audio_postprocessing_t());
         WebProgrammeHandler(WebProgrammeHandler&& other);
 
-        void registerSender(ProgrammeSender *sender);
-        void removeSender(ProgrammeSender *sender);
+        void registerSender(ProgrammeSender *sender, const encoder_key_t& key);
+        void removeSender(ProgrammeSender *sender, const encoder_key_t& key);
+        void registerUntouchedSender(ProgrammeSender *sender);
+        void removeUntouchedSender(ProgrammeSender *sender);
         bool needsToBeDecoded() const;
         void cancelAll();
 
@@ -140,23 +173,34 @@ class WebProgrammeHandler : public ProgrammeHandlerInterface {
         dls_t getDLS() const;
 
         struct mot_t {
-            std::vector<uint8_t> data;
-            MOTType subtype = MOTType::Unknown;
+            slide_t slide; // slide.data is nullptr if no slide was received
             std::chrono::time_point<std::chrono::system_clock> time;
             std::chrono::time_point<std::chrono::system_clock> last_changed; };
         mot_t getMOT() const;
 
+        // Oldest first, at most SLIDE_HISTORY_LENGTH entries
+        std::vector<slide_t> getSlideHistory() const;
+
+        // Look up a slide in the history. Returns false if it is not
+        // (or no longer) available.
+        bool getSlide(uint64_t hash, slide_t& slide) const;
+
         xpad_error_t getXPADErrors() const;
         audiolevels_t getAudioLevels() const;
         errorcounters_t getErrorCounters() const;
 
         virtual void onFrameErrors(int frameErrors) override;
-        virtual void onNewAudio(std::vector<int16_t>&& audioData,
-                int sampleRate, const std::string& mode) override;
+        virtual void onNewAudio(const audio_frame_ptr& frame,
+                const std::string& mode) override;
         virtual void onRsErrors(bool uncorrectedErrors, int numCorrectedErrors) override;
         virtual void onAacErrors(int aacErrors) override;
+        virtual void onBitErrors(size_t bitErrors, size_t numBits) override;
         virtual void onNewDynamicLabel(const std::string& label) override;
         virtual void onMOT(const mot_file_t& mot_file) override;
         virtual void onPADLengthError(size_t announced_xpad_len, size_t xpad_len) override;
+        virtual bool wantsDecodedAudio() const override;
+        virtual bool wantsEncodedAudio() const override;
+        virtual audio_postprocessing_t audioPostProcessing() const override;
+        virtual void onNewEncodedAudio(const uint8_t *data, size_t len, size_t duration_ms) override;
 };
 
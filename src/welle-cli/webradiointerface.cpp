@@ -25,6 +25,7 @@
 
 #include "welle-cli/webradiointerface.h"
 #include <algorithm>
+#include <cctype>
 #include <cmath>
 #include <complex>
 #include <cstdio>
@@ -50,10 +51,13 @@
 #include <utility>
 #include "Socket.h"
 #include "channels.h"
+#include "metrics.h"
 #include "ofdm-decoder.h"
+#include "profiling.h"
 #include "radio-receiver.h"
 #include "virtual_input.h"
 #include "welle-cli/jsonconvert.h"
+#include "welle-cli/webassets.h"
 #include "welle-cli/webprogrammehandler.h"
 
 #ifdef __unix__
@@ -79,16 +83,19 @@
 #define ASSERT_RX if (not rx) throw logic_error("rx does not exist")
 
 constexpr size_t MAX_PENDING_MESSAGES = 512;
+constexpr size_t NUM_CIR_PEAKS = 6;
 
 using namespace std;
 
 static const char* http_ok = "HTTP/1.0 200 OK\r\n";
+static const char* http_304 = "HTTP/1.0 304 Not Modified\r\n";
 static const char* http_400 = "HTTP/1.0 400 Bad Request\r\n";
 static const char* http_404 = "HTTP/1.0 404 Not Found\r\n";
 static const char* http_405 = "HTTP/1.0 405 Method Not Allowed\r\n";
 static const char* http_500 = "HTTP/1.0 500 Internal Server Error\r\n";
 static const char* http_503 = "HTTP/1.0 503 Service Unavailable\r\n";
 static const char* http_contenttype_mp3 = "Content-Type: audio/mpeg\r\n";
+static const char* http_contenttype_aac = "Content-Type: audio/aacp\r\n";
 static const char* http_contenttype_text = "Content-Type: text/plain\r\n";
 static const char* http_contenttype_data =
         "Content-Type: application/octet-stream\r\n";
@@ -102,6 +109,9 @@ static const char* http_contenttype_js =
 static const char* http_contenttype_html =
         "Content-Type: text/html; charset=utf-8\r\n";
 
+static const char* http_contenttype_metrics =
+        "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n";
+
 static const char* http_nocache = "Cache-Control: no-cache\r\n";
 
 static string to_hex(uint32_t value, int width)
@@ -113,6 +123,28 @@ static string to_hex(uint32_t value, int width)
     return sidstream.str();
 }
 
+// Send the whole buffer, even if the kernel accepts only part of it at once
+static bool send_all(Socket& s, const char *data, size_t size)
+{
+    while (size > 0) {
+        const ssize_t ret = s.send(data, size, MSG_NOSIGNAL);
+        if (ret <= 0) {
+            return false;
+        }
+        data += ret;
+        size -= ret;
+    }
+    return true;
+}
+
+// True if the If-None-Match header value lists the given ETag
+static bool etag_matches(const string& if_none_match, const string& etag)
+{
+    return if_none_match == "*" or
+        (not if_none_match.empty() and
+         if_none_match.find(etag) != string::npos);
+}
+
 static bool send_http_response(Socket& s, const string& statuscode,
         const string& data, const string& content_type = http_contenttype_text) {
     string headers = statuscode;
@@ -133,10 +165,17 @@ WebRadioInterface::WebRadioInterface(CVirtualInput& in,
         RadioReceiverOptions rro) :
     dabparams(1),
     input(in),
-    spectrum_fft_handler(dabparams.T_u),
+    spectrum_service(dabparams.T_u, 3),
+    null_spectrum_service(dabparams.T_u, 4),
     rro(rro),
     decode_settings(ds)
 {
+    build_static_responses();
+
+    if (not decode_settings.ensemble_cache.empty()) {
+        ensemble_cache = make_shared<EnsembleCache>(decode_settings.ensemble_cache);
+    }
+
     {
         // Ensure that rx always exists when rx_mut is free!
         lock_guard<mutex> lock(rx_mut);
@@ -147,22 +186,31 @@ WebRadioInterface::WebRadioInterface(CVirtualInput& in,
         }
 
         if (success) {
+            setup_history();
             rx = make_unique<RadioReceiver>(*this, in, rro);
         }
 
         if (not rx) {
             throw runtime_error("Could not initialise WebRadioInterface");
         }
+        rx->setEnsembleCache(ensemble_cache);
+        setup_eti();
 
         time_rx_created = chrono::system_clock::now();
         rx->restart(false);
     }
 
+    spectrum_service.start([&](int size) {
+                return input.getSpectrumSamples(size);
+            }, chrono::milliseconds(100));
+
     programme_handler_thread = thread(&WebRadioInterface::handle_phs, this);
 }
 
 WebRadioInterface::~WebRadioInterface()
 {
+    spectrum_service.stop();
+
     running = false;
     if (programme_handler_thread.joinable()) {
         programme_handler_thread.join();
@@ -239,6 +287,19 @@ void WebRadioInterface::check_decoders_required()
     phs_changed.notify_all();
 }
 
+void WebRadioInterface::setup_eti()
+{
+    if (not decode_settings.eti_input.empty() and
+            not rx->setEtiInput(decode_settings.eti_input, true, true)) {
+        throw runtime_error("Could not open ETI input " + decode_settings.eti_input);
+    }
+
+    if (not decode_settings.eti_output.empty() and
+            not rx->startEtiOutput(decode_settings.eti_output)) {
+        throw runtime_error("Could not open ETI output " + decode_settings.eti_output);
+    }
+}
+
 void WebRadioInterface::retune(const std::string& channel)
 {
     // Ensure two closely occurring retune() calls don't get stuck
@@ -271,8 +332,10 @@ void WebRadioInterface::retune(const std::string& channel)
             lock_guard<mutex> data_lock(data_mut);
             last_dateTime = {};
             last_snr = 0;
+            last_mer = 0;
             last_fine_correction = 0;
             last_coarse_correction = 0;
+            last_sample_clock_offset = 0;
         }
 
         synced = false;
@@ -280,18 +343,23 @@ void WebRadioInterface::retune(const std::string& channel)
         {
             lock_guard<mutex> fib_lock(fib_mut);
             num_fic_crc_errors = 0;
+            num_fic_viterbi_bits = 0;
+            num_fic_viterbi_bit_errors = 0;
         }
         tiis.clear();
 
         cerr << "RETUNE Set frequency" << endl;
         input.setFrequency(freq);
         input.reset(); // Clear buffer
+        setup_history();
 
         cerr << "RETUNE Restart RX" << endl;
         rx = make_unique<RadioReceiver>(*this, input, rro);
         if (not rx) {
             throw runtime_error("Could not initialise RadioReceiver");
         }
+        rx->setEnsembleCache(ensemble_cache);
+        setup_eti();
 
         time_rx_created = chrono::system_clock::now();
         rx->restart(false);
@@ -354,6 +422,17 @@ static vector<char> recv_exactly(Socket& s, size_t num_bytes)
     return buf;
 }
 
+static string trim(const string& str)
+{
+    const auto whitespace = " \t\r\n";
+    const auto first = str.find_first_not_of(whitespace);
+    if (first == string::npos) {
+        return "";
+    }
+    const auto last = str.find_last_not_of(whitespace);
+    return str.substr(first, last - first + 1);
+}
+
 static vector<string> split(const string& str, char c = ' ')
 {
     const char *s = str.data();
@@ -407,15 +486,18 @@ static http_request_t parse_http_headers(Socket& s) {
             break;
         }
 
-        const auto header = split(header_line, ':');
-
-        if (header.size() == 2) {
-            r.headers.emplace(header[0], header[1]);
+        // Header names are case-insensitive, store them in lowercase.
+        // Values may themselves contain colons.
+        const auto colon = header_line.find(':');
+        if (colon != string::npos) {
+            string name = header_line.substr(0, colon);
+            transform(name.begin(), name.end(), name.begin(), ::tolower);
+            r.headers.emplace(name, trim(header_line.substr(colon + 1)));
         }
     }
 
     if (r.is_post) {
-        constexpr auto CL = "Content-Length";
+        constexpr auto CL = "content-length";
         if (r.headers.count(CL) == 1) {
             try {
                 const int content_length = std::stoi(r.headers[CL]);
@@ -442,6 +524,14 @@ static http_request_t parse_http_headers(Socket& s) {
     return r;
 }
 
+// Returns the value of the header, or an empty string if it is absent.
+// name must be in lowercase.
+static string get_header(const http_request_t& r, const string& name)
+{
+    const auto it = r.headers.find(name);
+    return it == r.headers.end() ? "" : it->second;
+}
+
 bool WebRadioInterface::dispatch_client(Socket&& client)
 {
     Socket s(move(client));
@@ -460,11 +550,13 @@ bool WebRadioInterface::dispatch_client(Socket&& client)
     }
     else {
         if (req.is_get) {
-            if (req.url == "/") {
-                success = send_file(s, "index.html", http_contenttype_html);
-            }
-            else if (req.url == "/index.js") {
-                success = send_file(s, "index.js", http_contenttype_js);
+            const auto static_response = static_responses.find(req.url);
+            if (static_response != static_responses.end()) {
+                const bool accept_gzip =
+                    get_header(req, "accept-encoding").find("gzip") != string::npos;
+
+                success = send_static(s, static_response->second,
+                        get_header(req, "if-none-match"), accept_gzip);
             }
             else if (req.url == "/mux.json") {
                 success = send_mux_json(s);
@@ -487,22 +579,71 @@ bool WebRadioInterface::dispatch_client(Socket&& client)
             else if (req.url == "/channel") {
                 success = send_channel(s);
             }
+            else if (req.url == "/metrics") {
+                success = send_metrics(s);
+            }
+            else if (req.url == "/history") {
+                success = send_history(s, "", "");
+            }
+#if defined(WITH_PROFILING)
+            else if (req.url == "/profiling") {
+                success = send_http_response(s, http_ok,
+                        get_profiler().stats_json(), http_contenttype_json);
+            }
+            else if (req.url == "/profiling/trace.json") {
+                success = send_http_response(s, http_ok,
+                        get_profiler().chrome_trace_json(), http_contenttype_json);
+            }
+#endif
             else if (req.url == "/fftwindowplacement" or req.url == "/enablecoarsecorrector") {
                 send_http_response(s, http_405,
                         "405 Method Not Allowed\r\n" + req.url + " is POST-only");
                 return false;
             }
             else {
-                const regex regex_slide(R"(^[/]slide[/]([^ ]+))");
+                const regex regex_spectrum(R"(^[/](null)?spectrum[/]([0-9]{1,5})$)");
+                std::smatch match_spectrum;
+
+                const regex regex_slide(R"(^[/]slide[/]([^/?]+)(?:[/]([^/?]+))?(?:[?].*)?$)");
                 std::smatch match_slide;
 
-                const regex regex_mp3(R"(^[/]mp3[/]([^ ]+))");
-                std::smatch match_mp3;
-                if (regex_search(req.url, match_mp3, regex_mp3)) {
-                    success = send_mp3(s, match_mp3[1]);
+                const regex regex_audio(R"(^[/](mp3|opus|wav)[/]([^/?]+)(?:[?]bitrate=([0-9]{1,3}))?$)");
+                std::smatch match_audio;
+
+                const regex regex_untouched(R"(^[/](aac|mp2)[/]([^ ]+))");
+                std::smatch match_untouched;
+
+                const regex regex_history(R"(^[/]history[/]([^?]+)(?:[?](.*))?$)");
+                std::smatch match_history;
+                encoder_key_t key;
+                if (regex_search(req.url, match_audio, regex_audio) and
+                        parse_audio_encoding(match_audio[1], key.encoding)) {
+                    if (match_audio[3].matched) {
+                        key.bitrate_kbps = std::stoi(match_audio[3]);
+                    }
+                    success = send_audio(s, match_audio[2], key);
+                }
+                else if (regex_search(req.url, match_untouched, regex_untouched)) {
+                    success = send_untouched(s, match_untouched[2],
+                            match_untouched[1] == "aac" ?
+                            AudioServiceComponentType::DABPlus :
+                            AudioServiceComponentType::DAB);
+                }
+                else if (regex_search(req.url, match_spectrum, regex_spectrum)) {
+                    const size_t num_bins = std::stoul(match_spectrum[2]);
+                    if (match_spectrum[1].matched) {
+                        success = send_null_spectrum(s, num_bins);
+                    }
+                    else {
+                        success = send_spectrum(s, num_bins);
+                    }
                 }
                 else if (regex_search(req.url, match_slide, regex_slide)) {
-                    success = send_slide(s, match_slide[1]);
+                    success = send_slide(s, match_slide[1], match_slide[2],
+                            get_header(req, "if-none-match"));
+                }
+                else if (regex_search(req.url, match_history, regex_history)) {
+                    success = send_history(s, match_history[1], match_history[2]);
                 }
                 else {
                     cerr << "Could not understand GET request " << req.url << endl;
@@ -535,44 +676,82 @@ bool WebRadioInterface::dispatch_client(Socket&& client)
     }
 }
 
-bool WebRadioInterface::send_file(Socket& s,
-        const std::string& filename,
-        const std::string& content_type)
+// FNV-1a, only used to derive the ETags of the embedded assets
+static uint32_t fnv1a(const uint8_t *data, size_t size)
 {
-    FILE *fd = fopen(filename.c_str(), "r");
-    if (fd) {
-        if (not send_http_response(s, http_ok, "", content_type)) {
-            cerr << "Failed to send file headers" << endl;
-            fclose(fd);
-            return false;
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < size; i++) {
+        h ^= data[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+void WebRadioInterface::build_static_responses()
+{
+    for (const WebAsset *asset = web_assets; asset->name; asset++) {
+        const string name = asset->name;
+        const bool is_js = name.size() > 3 and
+            name.compare(name.size() - 3, 3, ".js") == 0;
+
+        StaticResponse r;
+
+        stringstream etag;
+        etag << "\"" << hex << setfill('0') << setw(8) <<
+            fnv1a(asset->data, asset->size) << "\"";
+        r.etag = etag.str();
+
+        // The ETag changes whenever welle-cli is rebuilt with different
+        // assets, browsers have to revalidate but usually get a 304.
+        const string common_headers =
+            string(is_js ? http_contenttype_js : http_contenttype_html) +
+            http_nocache +
+            "ETag: " + r.etag + "\r\n" +
+            "Vary: Accept-Encoding\r\n";
+
+        r.identity = http_ok + common_headers +
+            "Content-Length: " + to_string(asset->size) + "\r\n\r\n" +
+            string((const char*)asset->data, asset->size);
+
+        if (asset->gzip_data) {
+            r.gzip = http_ok + common_headers +
+                "Content-Encoding: gzip\r\n" +
+                "Content-Length: " + to_string(asset->gzip_size) + "\r\n\r\n" +
+                string((const char*)asset->gzip_data, asset->gzip_size);
         }
 
-        vector<char> data(1024);
-        ssize_t ret = 0;
-        do {
-            ret = fread(data.data(), 1, data.size(), fd);
-            ret = s.send(data.data(), ret, MSG_NOSIGNAL);
-            if (ret == -1) {
-                cerr << "Failed to send file data" << endl;
-                fclose(fd);
-                return false;
-            }
+        r.not_modified = string(http_304) + http_nocache +
+            "ETag: " + r.etag + "\r\n" +
+            "Vary: Accept-Encoding\r\n\r\n";
+
+        static_responses["/" + name] = r;
+        if (name == "index.html") {
+            static_responses["/"] = move(r);
+        }
+    }
+}
 
-        } while (ret > 0);
+bool WebRadioInterface::send_static(Socket& s, const StaticResponse& response,
+        const string& if_none_match, bool accept_gzip)
+{
+    const string *data = &response.identity;
 
-        fclose(fd);
-        return true;
+    if (etag_matches(if_none_match, response.etag)) {
+        data = &response.not_modified;
     }
-    else {
-        return send_http_response(s, http_500, "file '" + filename + "' is missing!");
+    else if (accept_gzip and not response.gzip.empty()) {
+        data = &response.gzip;
     }
-    return false;
+
+    if (not send_all(s, data->data(), data->size())) {
+        cerr << "Failed to send static asset" << endl;
+        return false;
+    }
+    return true;
 }
 
 static vector<PeakJson> calculate_cir_peaks(const vector<float>& cir_linear)
 {
-    constexpr size_t num_peaks = 6;
-
     vector<PeakJson> peaks;
 
     if (not cir_linear.empty()) {
@@ -580,7 +759,7 @@ static vector<PeakJson> calculate_cir_peaks(const vector<float>& cir_linear)
 
         // Every time we find a peak, we attenuate it, including
         // its surrounding values, and we go search the next peak.
-        for (size_t peak = 0; peak < num_peaks; peak++) {
+        for (size_t peak = 0; peak < NUM_CIR_PEAKS; peak++) {
             PeakJson p;
             for (size_t i = 1; i < cir_lin.size(); i++) {
                 if (cir_lin[i] > p.value) {
@@ -620,18 +799,21 @@ bool WebRadioInterface::send_mux_json(Socket& s)
     {
         lock_guard<mutex> lock(fib_mut);
         mux_json.demodulator_fic_numcrcerrors = num_fic_crc_errors;
+        mux_json.demodulator_fic_viterbibits = num_fic_viterbi_bits;
+        mux_json.demodulator_fic_viterbibiterrors = num_fic_viterbi_bit_errors;
     }
 
     {
         lock_guard<mutex> lock(rx_mut);
         ASSERT_RX;
 
-        mux_json.ensemble.label = rx->getEnsembleLabel();
+        const auto ensemble = rx->getEnsemble();
+        mux_json.ensemble.label = ensemble->label;
 
-        mux_json.ensemble.id = to_hex(rx->getEnsembleId(), 4);
-        mux_json.ensemble.ecc = to_hex(rx->getEnsembleEcc(), 2);
+        mux_json.ensemble.id = to_hex(ensemble->id, 4);
+        mux_json.ensemble.ecc = to_hex(ensemble->ecc, 2);
 
-        for (const auto& s : rx->getServiceList()) {
+        for (const auto& s : ensemble->services) {
             ServiceJson service;
             service.sid = to_hex(s.serviceId, 4);
             service.programType = s.programType;
@@ -641,14 +823,15 @@ bool WebRadioInterface::send_mux_json(Socket& s)
             service.label = s.serviceLabel;
             service.url_mp3 = "";
 
-            for (const auto& sc : rx->getComponents(s)) {
+            for (const auto comp : ensemble->findComponents(s.serviceId)) {
+                const auto& sc = *comp;
                 ComponentJson component;
                 component.componentnr = sc.componentNr;
                 component.primary = (sc.PS_flag ? true : false);
                 component.caflag = (sc.CAflag ? true : false);
                 component.label = sc.componentLabel;
 
-                const auto sub = rx->getSubchannel(sc);
+                const auto& sub = ensemble->subchannels.at(sc.subchannelId);
 
                 switch (sc.transportMode()) {
                     case TransportMode::Audio:
@@ -690,6 +873,9 @@ bool WebRadioInterface::send_mux_json(Socket& s)
                 service.audiolevel_time = chrono::system_clock::to_time_t(al.time);
                 service.audiolevel_left = al.last_audioLevel_L;
                 service.audiolevel_right = al.last_audioLevel_R;
+                service.audiolevel_momentary = al.loudness_momentary;
+                service.audiolevel_shortterm = al.loudness_short_term;
+                service.audiolevel_gain = al.gain_dB;
 
                 service.channels = 2;
                 service.samplerate = wph.rate;
@@ -698,6 +884,9 @@ bool WebRadioInterface::send_mux_json(Socket& s)
                 auto mot = wph.getMOT();
                 service.mot_time = chrono::system_clock::to_time_t(mot.time);
                 service.mot_lastchange = chrono::system_clock::to_time_t(mot.last_changed);
+                if (mot.slide.data) {
+                    service.mot_hash = WebProgrammeHandler::hashToString(mot.slide.hash);
+                }
 
                 auto dls = wph.getDLS();
                 service.dls_label = dls.label;
@@ -708,6 +897,8 @@ bool WebRadioInterface::send_mux_json(Socket& s)
                 service.errorcounters_frameerrors = errorcounters.num_frameErrors;
                 service.errorcounters_rserrors = errorcounters.num_rsErrors;
                 service.errorcounters_aacerrors = errorcounters.num_aacErrors;
+                service.errorcounters_viterbibits = errorcounters.num_viterbiBits;
+                service.errorcounters_viterbibiterrors = errorcounters.num_viterbiBitErrors;
                 service.errorcounters_time = chrono::system_clock::to_time_t(dls.time);
 
                 auto xpad_err = wph.getXPADErrors();
@@ -769,7 +960,9 @@ bool WebRadioInterface::send_mux_json(Socket& s)
         pending_messages.clear();
 
         mux_json.demodulator_snr = last_snr;
+        mux_json.demodulator_mer = last_mer;
         mux_json.demodulator_frequencycorrection = last_fine_correction + last_coarse_correction;
+        mux_json.demodulator_sampleclockoffset = last_sample_clock_offset;
 
         mux_json.tii = getTiiStats();
     }
@@ -779,6 +972,14 @@ bool WebRadioInterface::send_mux_json(Socket& s)
         mux_json.cir_peaks = calculate_cir_peaks(last_CIR);
     }
 
+    if (auto spectrum = spectrum_service.getSpectrum()) {
+        mux_json.demodulator_spectrum_level = spectrum->level_dB;
+    }
+
+    if (auto spectrum = null_spectrum_service.getSpectrum()) {
+        mux_json.demodulator_null_spectrum_level = spectrum->level_dB;
+    }
+
     if (not send_http_response(s, http_ok, "", http_contenttype_json)) {
         return false;
     }
@@ -793,40 +994,63 @@ bool WebRadioInterface::send_mux_json(Socket& s)
     return true;
 }
 
-bool WebRadioInterface::send_mp3(Socket& s, const std::string& stream)
+// Parse a service id given either in hex with 0x prefix or in decimal
+static bool parse_service_id(const string& stream, uint32_t& sid)
+{
+    try {
+        if (stream.compare(0, 2, "0x") == 0) {
+            sid = std::stoul(stream.substr(2), nullptr, 16);
+        }
+        else {
+            sid = std::stoul(stream);
+        }
+        return true;
+    }
+    catch (const logic_error&) {
+        return false;
+    }
+}
+
+bool WebRadioInterface::send_audio(Socket& s, const std::string& stream,
+        const encoder_key_t& key)
 {
+    uint32_t sid = 0;
+    if (not parse_service_id(stream, sid)) {
+        return false;
+    }
+
     unique_lock<mutex> lock(rx_mut);
     ASSERT_RX;
 
     for (const auto& srv : rx->getServiceList()) {
-        if (rx->serviceHasAudioComponent(srv) and
-                (to_hex(srv.serviceId, 4) == stream or
-                (uint32_t)std::stoul(stream) == srv.serviceId)) {
+        if (srv.serviceId == sid and rx->serviceHasAudioComponent(srv)) {
             try {
                 auto& ph = phs.at(srv.serviceId);
 
                 lock.unlock();
 
-                if (not send_http_response(s, http_ok, "", http_contenttype_mp3)) {
-                    cerr << "Failed to send mp3 headers" << endl;
+                const string content_type = string("Content-Type: ") +
+                    audio_content_type(key.encoding) + "\r\n";
+                if (not send_http_response(s, http_ok, "", content_type)) {
+                    cerr << "Failed to send audio headers" << endl;
                     return false;
                 }
 
                 ProgrammeSender sender(move(s));
 
-                cerr << "Registering mp3 sender" << endl;
-                ph.registerSender(&sender);
+                cerr << "Registering audio sender" << endl;
+                ph.registerSender(&sender, key);
                 check_decoders_required();
                 sender.wait_for_termination();
 
-                cerr << "Removing mp3 sender" << endl;
-                ph.removeSender(&sender);
+                cerr << "Removing audio sender" << endl;
+                ph.removeSender(&sender, key);
                 check_decoders_required();
 
                 return true;
             }
             catch (const out_of_range& e) {
-                cerr << "Could not setup mp3 sender for " <<
+                cerr << "Could not setup audio sender for " <<
                     srv.serviceId << ": " << e.what() << endl;
 
                 send_http_response(s, http_503, e.what());
@@ -837,59 +1061,195 @@ bool WebRadioInterface::send_mp3(Socket& s, const std::string& stream)
     return false;
 }
 
-bool WebRadioInterface::send_slide(Socket& s, const std::string& stream)
+bool WebRadioInterface::send_untouched(Socket& s, const std::string& stream,
+        AudioServiceComponentType type)
 {
-    for (const auto& wph : phs) {
-        if (to_hex(wph.first, 4) == stream or
-                (uint32_t)std::stoul(stream) == wph.first) {
-            const auto mot = wph.second.getMOT();
+    uint32_t sid = 0;
+    if (not parse_service_id(stream, sid)) {
+        return false;
+    }
 
-            if (mot.data.empty()) {
-                send_http_response(s, http_404, "404 Not Found\r\nSlide not available.\r\n");
-                return true;
-            }
+    unique_lock<mutex> lock(rx_mut);
+    ASSERT_RX;
 
-            stringstream headers;
-            headers << http_ok;
+    const auto ensemble = rx->getEnsemble();
+    for (const auto& srv : ensemble->services) {
+        if (srv.serviceId != sid) {
+            continue;
+        }
 
-            headers << "Content-Type: ";
-            switch (mot.subtype) {
-                case MOTType::Unknown:
-                    headers << "application/octet-stream";
-                    break;
-                case MOTType::JPEG:
-                    headers << "image/jpeg";
-                    break;
-                case MOTType::PNG:
-                    headers << "image/png";
-                    break;
+        bool type_matches = false;
+        for (const auto sc : ensemble->findComponents(srv.serviceId)) {
+            if (sc->transportMode() == TransportMode::Audio and
+                    sc->audioType() == type) {
+                type_matches = true;
             }
-            headers << "\r\n";
+        }
+
+        if (not type_matches) {
+            lock.unlock();
+            send_http_response(s, http_404, "404 Not Found\r\n"
+                    "Service is not encoded in this format.\r\n");
+            return true;
+        }
 
-            headers << http_nocache;
+        try {
+            auto& ph = phs.at(srv.serviceId);
 
-            headers << "Last-Modified: ";
-            std::time_t t = chrono::system_clock::to_time_t(mot.time);
-            headers << put_time(std::gmtime(&t), "%a, %d %b %Y %T GMT");
-            headers << "\r\n";
+            lock.unlock();
 
-            headers << "\r\n";
-            const auto headers_str = headers.str();
-            int ret = s.send(headers_str.data(), headers_str.size(), MSG_NOSIGNAL);
-            if (ret == (ssize_t)headers_str.size()) {
-                ret = s.send(mot.data.data(), mot.data.size(), MSG_NOSIGNAL);
+            const auto content_type = (type == AudioServiceComponentType::DABPlus) ?
+                http_contenttype_aac : http_contenttype_mp3;
+            if (not send_http_response(s, http_ok, "", content_type)) {
+                cerr << "Failed to send untouched stream headers" << endl;
+                return false;
             }
 
-            if (ret == -1) {
-                cerr << "Failed to send slide" << endl;
-            }
+            ProgrammeSender sender(move(s));
+
+            cerr << "Registering untouched stream sender" << endl;
+            ph.registerUntouchedSender(&sender);
+            check_decoders_required();
+            sender.wait_for_termination();
+
+            cerr << "Removing untouched stream sender" << endl;
+            ph.removeUntouchedSender(&sender);
+            check_decoders_required();
 
             return true;
         }
+        catch (const out_of_range& e) {
+            cerr << "Could not setup untouched stream sender for " <<
+                srv.serviceId << ": " << e.what() << endl;
+
+            send_http_response(s, http_503, e.what());
+            return false;
+        }
     }
     return false;
 }
 
+static const char *mot_content_type(MOTType subtype)
+{
+    switch (subtype) {
+        case MOTType::JPEG: return "image/jpeg";
+        case MOTType::PNG: return "image/png";
+        case MOTType::Unknown: break;
+    }
+    return "application/octet-stream";
+}
+
+bool WebRadioInterface::send_slide(Socket& s, const std::string& stream,
+        const std::string& which, const std::string& if_none_match)
+{
+    uint32_t sid = 0;
+    if (not parse_service_id(stream, sid)) {
+        return false;
+    }
+
+    const bool want_history = (which == "history");
+    const bool want_current = which.empty();
+    uint64_t hash = 0;
+    if (not want_history and not want_current) {
+        if (which.size() != 16) {
+            return false;
+        }
+        try {
+            hash = std::stoull(which, nullptr, 16);
+        }
+        catch (const logic_error&) {
+            return false;
+        }
+    }
+
+    // phs is protected by rx_mut. Only keep it while copying out the
+    // shared pointers, not while sending.
+    WebProgrammeHandler::slide_t slide;
+    vector<WebProgrammeHandler::slide_t> history;
+    chrono::time_point<chrono::system_clock> mot_time;
+    bool found = false;
+    {
+        lock_guard<mutex> lock(rx_mut);
+        const auto wph = phs.find(sid);
+        if (wph == phs.end()) {
+            return false;
+        }
+
+        if (want_history) {
+            history = wph->second.getSlideHistory();
+        }
+        else if (want_current) {
+            const auto mot = wph->second.getMOT();
+            slide = mot.slide;
+            mot_time = mot.time;
+            found = (bool)slide.data;
+        }
+        else {
+            found = wph->second.getSlide(hash, slide);
+            mot_time = slide.last_received;
+        }
+    }
+
+    if (want_history) {
+        vector<SlideJson> slides;
+        for (const auto& sl : history) {
+            SlideJson sj;
+            sj.hash = WebProgrammeHandler::hashToString(sl.hash);
+            sj.contenttype = mot_content_type(sl.subtype);
+            sj.url = "/slide/" + stream + "/" + sj.hash;
+            sj.firstreceived = chrono::system_clock::to_time_t(sl.first_received);
+            sj.lastreceived = chrono::system_clock::to_time_t(sl.last_received);
+            slides.push_back(move(sj));
+        }
+        send_http_response(s, http_ok,
+                build_slide_history_json(slides), http_contenttype_json);
+        return true;
+    }
+
+    if (not found) {
+        send_http_response(s, http_404, "404 Not Found\r\nSlide not available.\r\n");
+        return true;
+    }
+
+    const string etag = "\"" + WebProgrammeHandler::hashToString(slide.hash) + "\"";
+
+    // The current slide of a service changes, clients have to revalidate.
+    // A slide addressed by its hash never changes.
+    const string cache_control = want_current ?
+        http_nocache : "Cache-Control: max-age=86400, immutable\r\n";
+
+    stringstream headers;
+    if (etag_matches(if_none_match, etag)) {
+        headers << http_304;
+    }
+    else {
+        headers << http_ok;
+        headers << "Content-Type: " << mot_content_type(slide.subtype) << "\r\n";
+        headers << "Content-Length: " << slide.data->size() << "\r\n";
+    }
+
+    headers << cache_control;
+    headers << "ETag: " << etag << "\r\n";
+
+    headers << "Last-Modified: ";
+    std::time_t t = chrono::system_clock::to_time_t(mot_time);
+    headers << put_time(std::gmtime(&t), "%a, %d %b %Y %T GMT");
+    headers << "\r\n";
+
+    headers << "\r\n";
+    const auto headers_str = headers.str();
+    bool success = send_all(s, headers_str.data(), headers_str.size());
+    if (success and not etag_matches(if_none_match, etag)) {
+        success = send_all(s, (const char*)slide.data->data(), slide.data->size());
+    }
+
+    if (not success) {
+        cerr << "Failed to send slide" << endl;
+    }
+
+    return true;
+}
+
 bool WebRadioInterface::send_fic(Socket& s)
 {
     if (not send_http_response(s, http_ok, "", http_contenttype_data)) {
@@ -936,26 +1296,23 @@ bool WebRadioInterface::send_impulseresponse(Socket& s)
     return true;
 }
 
-static bool send_fft_data(Socket& s, DSPCOMPLEX *spectrumBuffer, size_t T_u)
+static bool send_spectrum_data(Socket& s,
+        const shared_ptr<const SpectrumService::Spectrum>& spectrum,
+        size_t num_bins)
 {
-    vector<float> spectrum(T_u);
-
-    // Shift FFT samples
-    const size_t half_Tu = T_u / 2;
-    for (size_t i = 0; i < half_Tu; i++) {
-        spectrum[i] = abs(spectrumBuffer[i + half_Tu]);
-    }
-    for (size_t i = half_Tu; i < T_u; i++) {
-        spectrum[i] = abs(spectrumBuffer[i - half_Tu]);
+    if (not spectrum) {
+        return false;
     }
 
+    const auto bins = SpectrumService::decimate(spectrum->bins, num_bins);
+
     if (not send_http_response(s, http_ok, "", http_contenttype_data)) {
         cerr << "Failed to send spectrum headers" << endl;
         return false;
     }
 
-    size_t lengthBytes = spectrum.size() * sizeof(float);
-    ssize_t ret = s.send(spectrum.data(), lengthBytes, MSG_NOSIGNAL);
+    size_t lengthBytes = bins.size() * sizeof(float);
+    ssize_t ret = s.send(bins.data(), lengthBytes, MSG_NOSIGNAL);
     if (ret == -1) {
         cerr << "Failed to send spectrum data" << endl;
         return false;
@@ -964,44 +1321,14 @@ static bool send_fft_data(Socket& s, DSPCOMPLEX *spectrumBuffer, size_t T_u)
     return true;
 }
 
-bool WebRadioInterface::send_spectrum(Socket& s)
+bool WebRadioInterface::send_spectrum(Socket& s, size_t num_bins)
 {
-    // Get FFT buffer
-    DSPCOMPLEX* spectrumBuffer = spectrum_fft_handler.getVector();
-    auto samples = input.getSpectrumSamples(dabparams.T_u);
-
-    // Continue only if we got data
-    if (samples.size() != (size_t)dabparams.T_u)
-        return false;
-
-    std::copy(samples.begin(), samples.end(), spectrumBuffer);
-
-    // Do FFT to get the spectrum
-    spectrum_fft_handler.do_FFT();
-
-    return send_fft_data(s, spectrumBuffer, dabparams.T_u);
+    return send_spectrum_data(s, spectrum_service.getSpectrum(), num_bins);
 }
 
-bool WebRadioInterface::send_null_spectrum(Socket& s)
+bool WebRadioInterface::send_null_spectrum(Socket& s, size_t num_bins)
 {
-    // Get FFT buffer
-    DSPCOMPLEX* spectrumBuffer = spectrum_fft_handler.getVector();
-
-    lock_guard<mutex> lock(plotdata_mut);
-    if (last_NULL.empty()) {
-        return false;
-    }
-    else if (last_NULL.size() != (size_t)dabparams.T_null) {
-        cerr << "Invalid NULL size " << last_NULL.size() << endl;
-        return false;
-    }
-
-    copy(last_NULL.begin(), last_NULL.begin() + dabparams.T_u, spectrumBuffer);
-
-    // Do FFT to get the spectrum
-    spectrum_fft_handler.do_FFT();
-
-    return send_fft_data(s, spectrumBuffer, dabparams.T_u);
+    return send_spectrum_data(s, null_spectrum_service.getSpectrum(), num_bins);
 }
 
 bool WebRadioInterface::send_constellation(Socket& s)
@@ -1036,6 +1363,94 @@ bool WebRadioInterface::send_constellation(Socket& s)
     return false;
 }
 
+bool WebRadioInterface::send_metrics(Socket& s)
+{
+    {
+        lock_guard<mutex> lock(data_mut);
+        metrics::registry().gauge("welle_snr",
+                "Signal-to-noise ratio estimated by the OFDM decoder").set(last_snr);
+        metrics::registry().gauge("welle_mer",
+                "Modulation error ratio in dB of the differential QPSK points, "
+                "about 3dB below that of the carriers").set(last_mer);
+        metrics::registry().gauge("welle_frequency_correction_hz",
+                "Sum of the coarse and fine frequency corrections").set(
+                last_fine_correction + last_coarse_correction);
+        metrics::registry().gauge("welle_sample_clock_offset_ppm",
+                "Sample clock offset estimated by the OFDM decoder").set(
+                last_sample_clock_offset);
+    }
+
+    if (not send_http_response(s, http_ok, metrics::registry().render(),
+                http_contenttype_metrics)) {
+        cerr << "Failed to send metrics" << endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool WebRadioInterface::send_history(Socket& s, const std::string& name,
+        const std::string& query)
+{
+    if (name.empty()) {
+        return send_http_response(s, http_ok,
+                build_history_index_json(history.names()),
+                http_contenttype_json);
+    }
+
+    const auto series = history.find(name);
+    if (series == nullptr) {
+        return false;
+    }
+
+    HistoryJson hj;
+    hj.name = name;
+    hj.resolution = 60;
+
+    using namespace std::chrono;
+    // By default, everything that is still available
+    int64_t to = duration_cast<seconds>(
+            system_clock::now().time_since_epoch()).count();
+    int64_t from = 0;
+
+    try {
+        // The query is a list of key=value pairs separated by &
+        stringstream ss(query);
+        string param;
+        while (getline(ss, param, '&')) {
+            const auto eq = param.find('=');
+            if (eq == string::npos) {
+                continue;
+            }
+            const string key = param.substr(0, eq);
+            const string value = param.substr(eq + 1);
+            if (key == "from") {
+                from = std::stoll(value);
+            }
+            else if (key == "to") {
+                to = std::stoll(value);
+            }
+            else if (key == "resolution") {
+                hj.resolution = std::stoi(value);
+            }
+        }
+
+        hj.points = series->query(hj.resolution, from, to);
+    }
+    catch (const logic_error& e) {
+        return send_http_response(s, http_400,
+                string("Invalid history query: ") + e.what() + "\r\n");
+    }
+
+    if (not send_http_response(s, http_ok, build_history_json(hj),
+                http_contenttype_json)) {
+        cerr << "Failed to send history" << endl;
+        return false;
+    }
+
+    return true;
+}
+
 bool WebRadioInterface::send_channel(Socket& s)
 {
     const auto freq = input.getFrequency();
@@ -1186,23 +1601,21 @@ void WebRadioInterface::handle_phs()
         unique_lock<mutex> lock(rx_mut);
         ASSERT_RX;
 
-        auto serviceList = rx->getServiceList();
-        for (auto& s : serviceList) {
-            auto scs = rx->getComponents(s);
-
+        const auto ensemble = rx->getEnsemble();
+        for (const auto& s : ensemble->services) {
             if (std::find(
                         carousel_services_available.cbegin(),
                         carousel_services_available.cend(),
                         s.serviceId) == carousel_services_available.cend()) {
-                for (auto& sc : scs) {
-                    if (sc.transportMode() == TransportMode::Audio) {
+                for (const auto sc : ensemble->findComponents(s.serviceId)) {
+                    if (sc->transportMode() == TransportMode::Audio) {
                         carousel_services_available.push_back(s.serviceId);
                     }
                 }
             }
 
             if (phs.count(s.serviceId) == 0) {
-                WebProgrammeHandler ph(s.serviceId);
+                WebProgrammeHandler ph(s.serviceId, decode_settings.audio_postprocessing);
                 phs.emplace(std::make_pair(s.serviceId, move(ph)));
             }
         }
@@ -1234,7 +1647,7 @@ void WebRadioInterface::handle_phs()
         }
         else if (decode_settings.strategy == DecodeStrategy::CarouselPAD) {
             while (carousel_services_active.size() < max_services_in_carousel) {
-                if (not serviceList.empty()) {
+                if (not ensemble->services.empty()) {
                     carousel_services_active.emplace_back(
                             carousel_services_available.front());
                     carousel_services_available.pop_front();
@@ -1389,12 +1802,54 @@ void WebRadioInterface::serve()
     carousel_services_active.clear();
 }
 
+void WebRadioInterface::setup_history()
+{
+    const auto freq = input.getFrequency();
+    try {
+        history_channel = channels.getChannelForFrequency(freq);
+    }
+    catch (const out_of_range&) {
+        history_channel = to_string(freq);
+    }
+
+    history_snr = history.series(history_channel + "/snr");
+    history_mer = history.series(history_channel + "/mer");
+    history_fic_errors = history.series(history_channel + "/fic_crc_errors");
+    history_fic_ber = history.series(history_channel + "/fic_ber");
+
+    history_cir_delay.clear();
+    history_cir_level.clear();
+    for (size_t i = 0; i < NUM_CIR_PEAKS; i++) {
+        const string prefix = history_channel + "/cir/" + to_string(i);
+        history_cir_delay.push_back(history.series(prefix + "/delay"));
+        history_cir_level.push_back(history.series(prefix + "/level"));
+    }
+    time_last_cir_recorded = 0;
+
+    // Resolved on the first measurement of each comb and pattern
+    history_tii.clear();
+}
+
 void WebRadioInterface::onSNR(int snr)
 {
+    if (history_snr) {
+        history_snr->record(snr);
+    }
+
     lock_guard<mutex> lock(data_mut);
     last_snr = snr;
 }
 
+void WebRadioInterface::onMER(float mer)
+{
+    if (history_mer) {
+        history_mer->record(mer);
+    }
+
+    lock_guard<mutex> lock(data_mut);
+    last_mer = mer;
+}
+
 void WebRadioInterface::onFrequencyCorrectorChange(int fine, int coarse)
 {
     lock_guard<mutex> lock(data_mut);
@@ -1402,6 +1857,12 @@ void WebRadioInterface::onFrequencyCorrectorChange(int fine, int coarse)
     last_coarse_correction = coarse;
 }
 
+void WebRadioInterface::onSampleClockOffset(float ppm)
+{
+    lock_guard<mutex> lock(data_mut);
+    last_sample_clock_offset = ppm;
+}
+
 void WebRadioInterface::onSyncChange(char isSync)
 {
     synced = isSync;
@@ -1420,23 +1881,18 @@ void WebRadioInterface::onDateTimeUpdate(const dab_date_time_t& dateTime)
 
 void WebRadioInterface::onFIBDecodeSuccess(bool crcCheckOk, const uint8_t* fib)
 {
+    // The mean of a bucket is the FIB error rate
+    if (history_fic_errors) {
+        history_fic_errors->record(crcCheckOk ? 0.0f : 1.0f);
+    }
+
     if (not crcCheckOk) {
         lock_guard<mutex> lock(fib_mut);
         num_fic_crc_errors++;
         return;
     }
 
-    // Convert the fib bitvector to bytes
-    vector<uint8_t> buf(32);
-    for (size_t i = 0; i < buf.size(); i++) {
-        uint8_t v = 0;
-        for (int j = 0; j < 8; j++) {
-            if (fib[8*i+j]) {
-                v |= 1 << (7-j);
-            }
-        }
-        buf[i] = v;
-    }
+    vector<uint8_t> buf(fib, fib + 32);
 
     {
         lock_guard<mutex> lock(fib_mut);
@@ -1450,16 +1906,47 @@ void WebRadioInterface::onFIBDecodeSuccess(bool crcCheckOk, const uint8_t* fib)
     new_fib_block_available.notify_one();
 }
 
+void WebRadioInterface::onFICBitErrors(size_t bitErrors, size_t numBits)
+{
+    if (numBits == 0) {
+        return;
+    }
+
+    if (history_fic_ber) {
+        history_fic_ber->record((float)bitErrors / numBits);
+    }
+
+    lock_guard<mutex> lock(fib_mut);
+    num_fic_viterbi_bits += numBits;
+    num_fic_viterbi_bit_errors += bitErrors;
+}
+
 void WebRadioInterface::onNewImpulseResponse(std::vector<float>&& data)
 {
+    // Searching the peaks takes some time, only do it once per second,
+    // which is the finest resolution of the history.
+    using namespace std::chrono;
+    const int64_t now = duration_cast<seconds>(
+            system_clock::now().time_since_epoch()).count();
+    if (now != time_last_cir_recorded) {
+        time_last_cir_recorded = now;
+
+        const auto peaks = calculate_cir_peaks(data);
+        for (size_t i = 0; i < peaks.size() and i < history_cir_delay.size(); i++) {
+            if (peaks[i].value > 0 and history_cir_delay[i] and history_cir_level[i]) {
+                history_cir_delay[i]->record(peaks[i].index, now);
+                history_cir_level[i]->record(10.0f * log10(peaks[i].value), now);
+            }
+        }
+    }
+
     lock_guard<mutex> lock(plotdata_mut);
     last_CIR = move(data);
 }
 
 void WebRadioInterface::onNewNullSymbol(std::vector<DSPCOMPLEX>&& data)
 {
-    lock_guard<mutex> lock(plotdata_mut);
-    last_NULL = move(data);
+    null_spectrum_service.feed(data);
 }
 
 void WebRadioInterface::onConstellationPoints(std::vector<DSPCOMPLEX>&& data)
@@ -1488,8 +1975,26 @@ void WebRadioInterface::onMessage(message_level_t level, const std::string& text
 
 void WebRadioInterface::onTIIMeasurement(tii_measurement_t&& m)
 {
+    const comb_pattern_t cp(m.comb, m.pattern);
+    auto tii_series = history_tii.find(cp);
+    if (tii_series == history_tii.end()) {
+        const string prefix = history_channel + "/tii/" +
+            to_string(m.comb) + "/" + to_string(m.pattern);
+        tii_series_t s;
+        s.delay = history.series(prefix + "/delay");
+        s.error = history.series(prefix + "/error");
+        tii_series = history_tii.emplace(cp, s).first;
+    }
+
+    if (tii_series->second.delay) {
+        tii_series->second.delay->record(m.delay_samples);
+    }
+    if (tii_series->second.error) {
+        tii_series->second.error->record(m.error);
+    }
+
     lock_guard<mutex> lock(data_mut);
-    auto& l = tiis[make_pair(m.comb, m.pattern)];
+    auto& l = tiis[cp];
     l.push_back(move(m));
 
     if (l.size() > 20) {
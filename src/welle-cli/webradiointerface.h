@@ -39,10 +39,12 @@
 #include <cstdint>
 #include <cstddef>
 #include "backend/dab-constants.h"
+#include "backend/ensemble-cache.h"
 #include "backend/radio-controller.h"
-#include "various/fft.h"
+#include "backend/spectrum-service.h"
 #include "various/Socket.h"
 #include "various/channels.h"
+#include "measurement-history.h"
 #include "webprogrammehandler.h"
 #include "radio-receiver-options.h"
 
@@ -69,6 +71,18 @@ class WebRadioInterface : public RadioControllerInterface {
         struct DecodeSettings {
             DecodeStrategy strategy = DecodeStrategy::OnDemand;
             int num_decoders_in_carousel = 0;
+
+            // Applied to the decoded audio of all programmes
+            audio_postprocessing_t audio_postprocessing;
+
+            // Replay this ETI-NI file instead of the input, if not empty
+            std::string eti_input;
+
+            // Write the ensemble to this ETI-NI file, if not empty
+            std::string eti_output;
+
+            // Keep the ensembles in this directory, if not empty
+            std::string ensemble_cache;
         };
 
         WebRadioInterface(
@@ -83,7 +97,9 @@ class WebRadioInterface : public RadioControllerInterface {
         void serve();
 
         virtual void onSNR(int snr) override;
+        virtual void onMER(float mer) override;
         virtual void onFrequencyCorrectorChange(int fine, int coarse) override;
+        virtual void onSampleClockOffset(float ppm) override;
         virtual void onSyncChange(char isSync) override;
         virtual void onSignalPresence(bool isSignal) override;
         virtual void onServiceDetected(uint32_t sId) override;
@@ -91,6 +107,7 @@ class WebRadioInterface : public RadioControllerInterface {
         virtual void onSetEnsembleLabel(DabLabel& label) override;
         virtual void onDateTimeUpdate(const dab_date_time_t& dateTime) override;
         virtual void onFIBDecodeSuccess(bool crcCheckOk, const uint8_t* fib) override;
+        virtual void onFICBitErrors(size_t bitErrors, size_t numBits) override;
         virtual void onNewImpulseResponse(std::vector<float>&& data) override;
         virtual void onNewNullSymbol(std::vector<DSPCOMPLEX>&& data) override;
         virtual void onConstellationPoints(std::vector<DSPCOMPLEX>&& data) override;
@@ -102,24 +119,53 @@ class WebRadioInterface : public RadioControllerInterface {
         std::mutex retune_mut;
         void retune(const std::string& channel);
 
+        // Set up the ETI input and output of a new rx
+        void setup_eti(void);
+
         bool dispatch_client(Socket&& client);
-        // Send a file
-        bool send_file(Socket& s,
-                const std::string& filename,
-                const std::string& content_type);
+
+        // Complete HTTP responses, headers included, for one of the web
+        // assets embedded in the binary.
+        struct StaticResponse {
+            std::string etag;
+            std::string identity;
+            std::string gzip; // empty if no gzip variant was embedded
+            std::string not_modified;
+        };
+
+        // Keyed by URL, built once in the constructor and never modified
+        // afterwards, so that it can be read without locking.
+        std::map<std::string, StaticResponse> static_responses;
+        void build_static_responses(void);
+
+        // Send an embedded web asset in a single write, as 304 Not Modified
+        // if the client already has it, or gzip compressed if the client
+        // accepts it.
+        bool send_static(Socket& s, const StaticResponse& response,
+                const std::string& if_none_match, bool accept_gzip);
 
         // Generate and send the mux.json
         bool send_mux_json(Socket& s);
 
-        // Send an mp3 stream containing the selected programme.
-        // stream is a service id, either in hex with 0x prefix or
-        // in decimal
-        bool send_mp3(Socket& s, const std::string& stream);
+        // Send a stream containing the selected programme, in the format
+        // and at the bitrate given by key. stream is a service id, either
+        // in hex with 0x prefix or in decimal
+        bool send_audio(Socket& s, const std::string& stream,
+                const encoder_key_t& key);
+
+        // Send the audio of the selected programme as broadcast, without
+        // decoding and re-encoding: AAC in LATM/LOAS for DAB+ (type DABPlus),
+        // MPEG Layer II for DAB. Fails if the programme is in the other
+        // format. stream is a service id, as for send_audio.
+        bool send_untouched(Socket& s, const std::string& stream,
+                AudioServiceComponentType type);
 
         // Send the slide for the selected programme.
         // stream is a service id, either in hex with 0x prefix or
-        // in decimal
-        bool send_slide(Socket& s, const std::string& stream);
+        // in decimal. which is empty for the current slide, "history"
+        // for the list of recent slides, or the hash of a recent slide.
+        bool send_slide(Socket& s, const std::string& stream,
+                const std::string& which, const std::string& if_none_match);
 
         // Send the Fast Information Channel as a stream.
         // Every FIB is 32 bytes long, there three FIBs per 24ms interval,
@@ -129,9 +175,10 @@ class WebRadioInterface : public RadioControllerInterface {
         // Send the impulse response, in dB, as a sequence of float values.
         bool send_impulseresponse(Socket& s);
 
-        // Send the signal spectrum, in dB, as a sequence of float values.
-        bool send_spectrum(Socket& s);
-        bool send_null_spectrum(Socket& s);
+        // Send the averaged signal spectrum as a sequence of float values.
+        // If num_bins is not zero, the spectrum is decimated to that many bins.
+        bool send_spectrum(Socket& s, size_t num_bins = 0);
+        bool send_null_spectrum(Socket& s, size_t num_bins = 0);
 
         // Send the constellation points, a sequence of phases between -180 and 180 .
         bool send_constellation(Socket& s);
@@ -139,6 +186,17 @@ class WebRadioInterface : public RadioControllerInterface {
         // Send the currently tuned channel
         bool send_channel(Socket& s);
 
+        // Send the counters and histograms of the receiver pipeline in
+        // the Prometheus text format
+        bool send_metrics(Socket& s);
+
+        // Send the list of series in the measurement history if name is
+        // empty, otherwise the buckets of the series. query may contain
+        // from and to, in seconds since the epoch, and the resolution
+        // in seconds.
+        bool send_history(Socket& s, const std::string& name,
+                const std::string& query);
+
         // Handle a POSTs
         bool handle_fft_window_placement_post(Socket& s, const std::string& request);
         bool handle_coarse_corrector_post(Socket& s, const std::string& request);
@@ -150,22 +208,30 @@ class WebRadioInterface : public RadioControllerInterface {
         void check_decoders_required();
         std::list<tii_measurement_t> getTiiStats();
 
+        // Select the series of the measurement history for the channel the
+        // input is tuned to. Must only be called while no rx exists.
+        void setup_history(void);
+
         std::thread programme_handler_thread;
         std::atomic<bool> running = ATOMIC_VAR_INIT(true);
 
         Channels channels;
         DABParams dabparams;
         CVirtualInput& input;
-        fft::Forward spectrum_fft_handler;
+        SpectrumService spectrum_service;
+        SpectrumService null_spectrum_service;
 
         RadioReceiverOptions rro;
         DecodeSettings decode_settings;
+        std::shared_ptr<EnsembleCache> ensemble_cache;
 
         mutable std::mutex data_mut;
         bool synced = 0;
         int last_snr = 0;
+        float last_mer = 0;
         int last_fine_correction = 0;
         int last_coarse_correction = 0;
+        float last_sample_clock_offset = 0;
         dab_date_time_t last_dateTime;
 
         struct pending_message_t {
@@ -178,11 +244,12 @@ class WebRadioInterface : public RadioControllerInterface {
 
         mutable std::mutex plotdata_mut;
         std::vector<float> last_CIR;
-        std::vector<DSPCOMPLEX> last_NULL;
         std::vector<DSPCOMPLEX> last_constellation;
 
         mutable std::mutex fib_mut;
         size_t num_fic_crc_errors = 0;
+        size_t num_fic_viterbi_bits = 0;
+        size_t num_fic_viterbi_bit_errors = 0;
         std::condition_variable new_fib_block_available;
         std::deque<std::vector<uint8_t> > fib_blocks;
 
@@ -191,6 +258,28 @@ class WebRadioInterface : public RadioControllerInterface {
         std::chrono::time_point<std::chrono::steady_clock> time_last_tiis_clean;
         std::map<comb_pattern_t, std::list<tii_measurement_t> > tiis;
 
+        // Long term history of the SNR, MER, FIC errors, CIR peaks and TII
+        // measurements, with one set of series per channel. The series of
+        // the current channel are only changed while no rx exists, so the
+        // receiver callbacks use them without locking.
+        MeasurementHistory history;
+        std::string history_channel;
+        std::shared_ptr<TimeSeries> history_snr;
+        std::shared_ptr<TimeSeries> history_mer;
+        std::shared_ptr<TimeSeries> history_fic_errors;
+        std::shared_ptr<TimeSeries> history_fic_ber;
+        std::vector<std::shared_ptr<TimeSeries> > history_cir_delay;
+        std::vector<std::shared_ptr<TimeSeries> > history_cir_level;
+        int64_t time_last_cir_recorded = 0;
+
+        // The delay and error series of every comb and pattern seen on the
+        // current channel, only used by the TII decoder thread
+        struct tii_series_t {
+            std::shared_ptr<TimeSeries> delay;
+            std::shared_ptr<TimeSeries> error;
+        };
+        std::map<comb_pattern_t, tii_series_t> history_tii;
+
         Socket serverSocket;
 
         mutable std::mutex rx_mut;
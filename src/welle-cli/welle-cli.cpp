@@ -40,6 +40,7 @@
 #include <set>
 #include <utility>
 #include <cstdio>
+#include <getopt.h>
 #include <unistd.h>
 #ifdef HAVE_SOAPYSDR
 #  include "soapy_sdr.h"
@@ -50,8 +51,12 @@
 #endif
 #include "welle-cli/webradiointerface.h"
 #include "welle-cli/tests.h"
+#include "backend/audio-postprocessor.h"
+#include "backend/band-scanner.h"
+#include "backend/mot_manager.h"
 #include "backend/radio-receiver.h"
 #include "input/input_factory.h"
+#include "input/null_device.h"
 #include "input/raw_file.h"
 #include "various/channels.h"
 #include "libs/json.hpp"
@@ -72,21 +77,28 @@ using namespace nlohmann;
 #if defined(HAVE_ALSA)
 class AlsaProgrammeHandler: public ProgrammeHandlerInterface {
     public:
+        AlsaProgrammeHandler(const audio_postprocessing_t& pp) :
+            audio_postprocessing(pp) {}
+
+        virtual audio_postprocessing_t audioPostProcessing() const override {
+            return audio_postprocessing;
+        }
+
         virtual void onFrameErrors(int frameErrors) override { (void)frameErrors; }
-        virtual void onNewAudio(std::vector<int16_t>&& audioData, int sampleRate, const std::string& mode) override
+        virtual void onNewAudio(const audio_frame_ptr& frame, const std::string& mode) override
         {
             (void)mode;
             lock_guard<mutex> lock(aomutex);
 
-            bool reset_ao = sampleRate != (int)rate;
-            rate = sampleRate;
+            bool reset_ao = frame->sample_rate != (int)rate;
+            rate = frame->sample_rate;
 
             if (!ao or reset_ao) {
                 cerr << "Create audio output rate " << rate << endl;
                 ao = make_unique<AlsaOutput>(2, rate);
             }
 
-            ao->playPCM(move(audioData));
+            ao->playPCM(frame->samples);
         }
 
         virtual void onRsErrors(bool uncorrectedErrors, int numCorrectedErrors) override {
@@ -104,6 +116,7 @@ class AlsaProgrammeHandler: public ProgrammeHandlerInterface {
         }
 
     private:
+        audio_postprocessing_t audio_postprocessing;
         mutex aomutex;
         unique_ptr<AlsaOutput> ao;
         bool stereo = true;
@@ -113,9 +126,11 @@ class AlsaProgrammeHandler: public ProgrammeHandlerInterface {
 
 class WavProgrammeHandler: public ProgrammeHandlerInterface {
     public:
-        WavProgrammeHandler(uint32_t SId, const std::string& fileprefix) :
+        WavProgrammeHandler(uint32_t SId, const std::string& fileprefix,
+                const audio_postprocessing_t& pp) :
             SId(SId),
-            filePrefix(fileprefix) {}
+            filePrefix(fileprefix),
+            audio_postprocessing(pp) {}
         ~WavProgrammeHandler() {
             if (fd) {
                 wavfile_close(fd);
@@ -126,9 +141,14 @@ class WavProgrammeHandler: public ProgrammeHandlerInterface {
         WavProgrammeHandler(WavProgrammeHandler&& other) = default;
         WavProgrammeHandler& operator=(WavProgrammeHandler&& other) = default;
 
+        virtual audio_postprocessing_t audioPostProcessing() const override {
+            return audio_postprocessing;
+        }
+
         virtual void onFrameErrors(int frameErrors) override { (void)frameErrors; }
-        virtual void onNewAudio(std::vector<int16_t>&& audioData, int sampleRate, const string& mode) override
+        virtual void onNewAudio(const audio_frame_ptr& frame, const string& mode) override
         {
+            const int sampleRate = frame->sample_rate;
             if (rate != sampleRate ) {
                 cout << "[0x" << std::hex << SId << std::dec << "] " <<
                     "rate " << sampleRate <<  " mode " << mode << endl;
@@ -146,7 +166,7 @@ class WavProgrammeHandler: public ProgrammeHandlerInterface {
             rate = sampleRate;
 
             if (fd) {
-                wavfile_write(fd, audioData.data(), audioData.size());
+                wavfile_write(fd, frame->samples.data(), frame->samples.size());
             }
         }
 
@@ -168,6 +188,7 @@ class WavProgrammeHandler: public ProgrammeHandlerInterface {
     private:
         uint32_t SId;
         string filePrefix;
+        audio_postprocessing_t audio_postprocessing;
         FILE* fd = nullptr;
         int rate = 0;
 };
@@ -218,19 +239,7 @@ class RadioInterface : public RadioControllerInterface {
                     return;
                 }
 
-                // convert bitvector to byte vector
-                vector<uint8_t> buf(32);
-                for (size_t i = 0; i < buf.size(); i++) {
-                    uint8_t v = 0;
-                    for (int j = 0; j < 8; j++) {
-                        if (fib[8*i+j]) {
-                            v |= 1 << (7-j);
-                        }
-                    }
-                    buf[i] = v;
-                }
-
-                fwrite(buf.data(), buf.size(), sizeof(buf[0]), fic_fd);
+                fwrite(fib, 32, 1, fic_fd);
             }
         }
         virtual void onNewImpulseResponse(std::vector<float>&& data) override { (void)data; }
@@ -278,6 +287,7 @@ struct options_t {
     int gain = -1;
     string channel = "10B";
     string iqsource = "";
+    string eti_output = "";
     string programme = "GRRIF";
     string frontend = "auto";
     string frontend_args = "";
@@ -286,6 +296,10 @@ struct options_t {
     int num_decoders_in_carousel = 0;
     bool carousel_pad = false;
     int web_port = -1; // positive value means enable
+    bool scan = false;
+    string ensemble_cache = "";
+    int mot_memory_mb = 0;
+    audio_postprocessing_t audio_postprocessing;
     list<int> tests;
 
     RadioReceiverOptions rro;
@@ -303,6 +317,9 @@ static void usage()
         " welle-cli -f file -p programme" << endl <<
         endl <<
 #endif // defined(HAVE_ALSA)
+        "Read an ETI-NI file instead of IQ samples, if the file name ends with .eti:" << endl <<
+        " welle-cli -f file.eti -p programme" << endl <<
+        endl <<
         "Use -D to dump FIC and all programmes to files." << endl <<
         " welle-cli -c channel -D " << endl <<
         endl <<
@@ -322,6 +339,11 @@ static void usage()
         " welle-cli -c channel -C 1 -w port" << endl <<
         " welle-cli -c channel -PC 1 -w port" << endl <<
         endl <<
+        "Use --scan to search Band III for ensembles, and print one JSON line per channel." << endl <<
+        "Empty channels are rejected after a short probe, the others are decoded until" << endl <<
+        "their ensemble is complete." << endl <<
+        " welle-cli --scan" << endl <<
+        endl <<
         "Backend and input options" << endl <<
         " -u      disable coarse corrector, for receivers who have a low frequency offset." << endl <<
         " -g GAIN set input gain to GAIN or -1 for auto gain." << endl <<
@@ -344,6 +366,17 @@ static void usage()
         " -s ARGS SoapySDR Driver arguments." << endl <<
         " -A ANT  set input antenna to ANT (for SoapySDR input only)." << endl <<
         " -T      disable TII decoding to reduce CPU usage." << endl <<
+        " -E FILE write the whole ensemble to FILE in the ETI-NI format." << endl <<
+        " --ensemble-cache DIR" << endl <<
+        "         keep the ensembles in DIR, so that decoding can start before the FIC" << endl <<
+        "         is received when tuning to a channel seen before." << endl <<
+        " --mot-memory MB" << endl <<
+        "         limit the memory used by all programmes together for slideshow objects" << endl <<
+        "         being received to MB megabytes. Default: " << MOTBudget::DEFAULT_LIMIT / (1024 * 1024) << "." << endl <<
+        endl <<
+        "Audio options" << endl <<
+        " -r RATE resample the audio of all programmes to RATE Hz, e.g. 44100 or 48000." << endl <<
+        " -L LUFS slowly adapt the audio gain so that the loudness approaches LUFS, e.g. -23." << endl <<
         endl <<
         "Use -t test_number to run a test." << endl <<
         "To understand what the tests do, please see source code." << endl <<
@@ -359,8 +392,17 @@ options_t parse_cmdline(int argc, char **argv)
     string fe_opt = "";
     options.rro.decodeTII = true;
 
+    enum { OPT_SCAN = 256, OPT_ENSEMBLE_CACHE, OPT_MOT_MEMORY };
+    const struct option long_options[] = {
+        {"scan", no_argument, nullptr, OPT_SCAN},
+        {"ensemble-cache", required_argument, nullptr, OPT_ENSEMBLE_CACHE},
+        {"mot-memory", required_argument, nullptr, OPT_MOT_MEMORY},
+        {nullptr, 0, nullptr, 0}
+    };
+
     int opt;
-    while ((opt = getopt(argc, argv, "A:c:C:dDf:F:g:hp:PTs:t:w:u")) != -1) {
+    while ((opt = getopt_long(argc, argv, "A:c:C:dDE:f:F:g:hL:p:Pr:Ts:t:w:u",
+                    long_options, nullptr)) != -1) {
         switch (opt) {
             case 'A':
                 options.antenna = optarg;
@@ -377,6 +419,9 @@ options_t parse_cmdline(int argc, char **argv)
             case 'D':
                 options.decode_all_programmes = true;
                 break;
+            case 'E':
+                options.eti_output = optarg;
+                break;
             case 'f':
                 options.iqsource = optarg;
                 break;
@@ -386,6 +431,10 @@ options_t parse_cmdline(int argc, char **argv)
             case 'g':
                 options.gain = std::atoi(optarg);
                 break;
+            case 'L':
+                options.audio_postprocessing.normalise = true;
+                options.audio_postprocessing.target_lufs = std::atof(optarg);
+                break;
             case 'p':
                 options.programme = optarg;
                 break;
@@ -395,6 +444,9 @@ options_t parse_cmdline(int argc, char **argv)
             case 'h':
                 usage();
                 exit(1);
+            case 'r':
+                options.audio_postprocessing.output_rate = std::atoi(optarg);
+                break;
             case 's':
                 options.soapySDRDriverArgs = optarg;
                 break;
@@ -410,6 +462,19 @@ options_t parse_cmdline(int argc, char **argv)
             case 'u':
                 options.rro.disableCoarseCorrector = true;
                 break;
+            case OPT_SCAN:
+                options.scan = true;
+                break;
+            case OPT_ENSEMBLE_CACHE:
+                options.ensemble_cache = optarg;
+                break;
+            case OPT_MOT_MEMORY:
+                options.mot_memory_mb = std::atoi(optarg);
+                if (options.mot_memory_mb <= 0 or options.mot_memory_mb > 4096) {
+                    cerr << "Invalid memory limit for --mot-memory" << endl;
+                    exit(1);
+                }
+                break;
             default:
                 cerr << "Unknown option. Use -h for help" << endl;
                 exit(1);
@@ -430,21 +495,104 @@ options_t parse_cmdline(int argc, char **argv)
         exit(1);
     }
 
+    if (options.audio_postprocessing.output_rate < 0 or
+            options.audio_postprocessing.output_rate > 192000) {
+        cerr << "Invalid audio rate for -r" << endl;
+        exit(1);
+    }
+    else if (options.audio_postprocessing.output_rate != 0 and
+            not Resampler::supportsOutputRate(options.audio_postprocessing.output_rate)) {
+        cerr << "Unsupported audio rate for -r, use a usual rate like 44100 or 48000" << endl;
+        exit(1);
+    }
+
     return options;
 }
 
+static json scan_result_to_json(const BandScanner::Result& r)
+{
+    json j;
+    j["channel"] = r.channel;
+    j["frequency"] = r.frequency;
+    j["probe"] = {
+        {"nulldip_dB", r.probe.null_dip_dB},
+        {"occupancy_dB", r.probe.occupancy_dB}
+    };
+    j["candidate"] = r.candidate;
+    j["synced"] = r.synced;
+    j["complete"] = r.complete;
+    j["time_ms"] = {
+        {"probe", r.probe_time.count()},
+        {"sync", r.sync_time.count()},
+        {"fic", r.fic_time.count()},
+        {"total", r.total_time.count()}
+    };
+
+    if (r.ensemble) {
+        json services = json::array();
+        for (const auto& s : r.ensemble->services) {
+            services.push_back({
+                    {"sid", s.serviceId},
+                    {"label", s.serviceLabel.utf8_label()}});
+        }
+
+        j["ensemble"] = {
+            {"id", r.ensemble->id},
+            {"label", r.ensemble->label.utf8_label()},
+            {"services", services}
+        };
+    }
+    return j;
+}
+
+static void run_scan(CVirtualInput& in, const RadioReceiverOptions& rro)
+{
+    BandScanner scanner(in, rro);
+
+    const auto start = chrono::steady_clock::now();
+    const auto results = scanner.scan(BandScanner::bandIIIChannels(),
+            [](const BandScanner::Result& r) {
+                cout << scan_result_to_json(r) << endl;
+            });
+    in.stop();
+
+    const auto duration = chrono::duration_cast<chrono::milliseconds>(
+            chrono::steady_clock::now() - start);
+    const size_t num_found = count_if(results.begin(), results.end(),
+            [](const BandScanner::Result& r) { return r.synced; });
+    cerr << "Scanned " << results.size() << " channels in " <<
+        duration.count() << " ms, found " << num_found << " ensembles" << endl;
+}
+
+static bool is_eti_file(const string& filename)
+{
+    const string ext = ".eti";
+    return filename.size() > ext.size() and
+        filename.compare(filename.size() - ext.size(), ext.size(), ext) == 0;
+}
+
 int main(int argc, char **argv)
 {
     cerr << "Hello this is welle-cli " << VERSION << endl;
     auto options = parse_cmdline(argc, argv);
 
+    if (options.mot_memory_mb) {
+        MOTBudget::Instance().SetLimit((size_t)options.mot_memory_mb * 1024 * 1024);
+    }
+
     RadioInterface ri;
 
     Channels channels;
 
     unique_ptr<CVirtualInput> in = nullptr;
 
-    if (options.iqsource.empty()) {
+    // An ETI file bypasses the demodulator, the input stays idle
+    const bool eti_input = is_eti_file(options.iqsource);
+
+    if (eti_input) {
+        in = make_unique<CNullDevice>();
+    }
+    else if (options.iqsource.empty()) {
         in.reset(CInputFactory::GetDevice(ri, options.frontend));
 
         if (not in) {
@@ -506,7 +654,14 @@ int main(int argc, char **argv)
     in->setFrequency(freq);
     string service_to_tune = options.programme;
 
-    if (not options.tests.empty()) {
+    if (options.scan) {
+        if (eti_input) {
+            cerr << "Cannot scan an ETI file" << endl;
+            return 1;
+        }
+        run_scan(*in, options.rro);
+    }
+    else if (not options.tests.empty()) {
         Tests tests(in, options.rro);
         for (int test : options.tests) {
             tests.run_test(test);
@@ -527,11 +682,34 @@ int main(int argc, char **argv)
             }
             ds.num_decoders_in_carousel = options.num_decoders_in_carousel;
         }
+        // The loudness is shown in the web interface
+        ds.audio_postprocessing = options.audio_postprocessing;
+        ds.audio_postprocessing.measure_loudness = true;
+        if (eti_input) {
+            ds.eti_input = options.iqsource;
+        }
+        ds.eti_output = options.eti_output;
+        ds.ensemble_cache = options.ensemble_cache;
         WebRadioInterface wri(*in, options.web_port, ds, options.rro);
         wri.serve();
     }
     else {
         RadioReceiver rx(ri, *in, options.rro);
+        if (not options.ensemble_cache.empty()) {
+            rx.setEnsembleCache(make_shared<EnsembleCache>(options.ensemble_cache));
+        }
+
+        if (eti_input and not rx.setEtiInput(options.iqsource, true, true)) {
+            cerr << "Could not open ETI file " << options.iqsource << endl;
+            return 1;
+        }
+
+        if (not options.eti_output.empty() and
+                not rx.startEtiOutput(options.eti_output)) {
+            cerr << "Could not open ETI output " << options.eti_output << endl;
+            return 1;
+        }
+
         if (options.decode_all_programmes) {
             FILE* fic_fd = fopen("dump.fic", "w");
 
@@ -578,7 +756,8 @@ int main(int argc, char **argv)
                 dumpFilePrefix.erase(std::find_if(dumpFilePrefix.rbegin(), dumpFilePrefix.rend(),
                             [](int ch) { return !std::isspace(ch); }).base(), dumpFilePrefix.end());
 
-                WavProgrammeHandler ph(s.serviceId, dumpFilePrefix);
+                WavProgrammeHandler ph(s.serviceId, dumpFilePrefix,
+                        options.audio_postprocessing);
                 phs.emplace(std::make_pair(s.serviceId, move(ph)));
 
                 auto dumpFileName = dumpFilePrefix + ".msc";
@@ -598,7 +777,7 @@ int main(int argc, char **argv)
         }
         else {
 #if defined(HAVE_ALSA)
-            AlsaProgrammeHandler ph;
+            AlsaProgrammeHandler ph(options.audio_postprocessing);
             while (not service_to_tune.empty()) {
                 cerr << "Service list" << endl;
                 for (const auto& s : rx.getServiceList()) {
@@ -6,18 +6,40 @@ CONFIG += console
 
 HEADERS += \
     alsa-output.h  \
+    audio-encoder.h \
+    measurement-history.h \
     webprogrammehandler.h \
+    webassets.h \
     webradiointerface.h \
     jsonconvert.h
 
 SOURCES += \
     alsa-output.cpp \
+    audio-encoder.cpp \
+    measurement-history.cpp \
     tests.cpp \
     webprogrammehandler.cpp \
     webradiointerface.cpp \
     jsonconvert.cpp \
     welle-cli.cpp
 
+# Optional, for the /opus streams
+unix:packagesExist(opus) {
+    DEFINES += HAVE_OPUS
+    LIBS += -lopus
+}
+
+# Embed the web interface into the binary, see cmake/EmbedWebAssets.cmake
+WEB_ASSETS = index.html index.js
+webassets.target = webassets.cpp
+webassets.commands = cmake -DINPUT_DIR=$$PWD \"-DFILES=$$WEB_ASSETS\" \
+    -DOUTPUT=$$OUT_PWD/webassets.cpp -P $$PWD/../../cmake/EmbedWebAssets.cmake
+for(asset, WEB_ASSETS): webassets.depends += $$PWD/$$asset
+QMAKE_EXTRA_TARGETS += webassets
+PRE_TARGETDEPS += webassets.cpp
+GENERATED_SOURCES += webassets.cpp
+QMAKE_CLEAN += webassets.cpp
+
 # Include git hash into build
 unix: {
     GITHASHSTRING = $$system(git rev-parse --short HEAD)
@@ -51,7 +51,9 @@ CGUIHelper::CGUIHelper(CRadioController *RadioController, QObject *parent)
     : QObject(parent)
     , radioController(RadioController)
     , spectrumSeries(nullptr)
+    , spectrumService(RadioController->getParams().T_u, 3)
     , impulseResponseSeries(nullptr)
+    , nullSymbolSpectrumService(RadioController->getParams().T_u, 1)
 {
     // Add image provider for the MOT slide show
     motImageProvider = new CMOTImageProvider;
@@ -211,7 +213,7 @@ void CGUIHelper::motUpdate(mot_file_t mot_file)
             "/" + QString::number(mot_file.slide_id) +
             "/" + QString::fromStdString(mot_file.content_name);
 
-    QByteArray qdata(reinterpret_cast<const char*>(mot_file.data.data()), static_cast<int>(mot_file.data.size()));
+    QByteArray qdata(reinterpret_cast<const char*>(mot_file.data->data()), static_cast<int>(mot_file.data->size()));
     QImage motImage;
     motImage.loadFromData(qdata, mot_file.content_sub_type == 0 ? "GIF" : mot_file.content_sub_type == 1 ? "JPEG" : mot_file.content_sub_type == 2 ? "BMP" : "PNG");
     motImageProvider->setPixmap(QPixmap::fromImage(motImage), pictureName);
@@ -315,7 +317,6 @@ void CGUIHelper::tryHideWindow()
 // This function is called by the QML GUI
 void CGUIHelper::updateSpectrum()
 {
-    std::vector<DSPCOMPLEX> signalProbeBuffer;
     int T_u = radioController->getParams().T_u;
 
     qreal y = 0;
@@ -329,31 +330,17 @@ void CGUIHelper::updateSpectrum()
     qreal sampleFrequency_MHz = INPUT_RATE / 1e6;
     qreal dip_MHz = sampleFrequency_MHz / T_u;
 
-    signalProbeBuffer = radioController->getSignalProbe();
+    spectrumService.feed(radioController->getSignalProbe(spectrumService.blockSize()));
+    const auto spectrum = spectrumService.getSpectrum();
 
-    if (signalProbeBuffer.size() == (size_t)T_u) {
+    if (spectrum and spectrum->bins.size() == (size_t)T_u) {
         spectrumSeriesData.resize(T_u);
 
-        fft::Forward FFT(T_u);
-        DSPCOMPLEX* spectrumBuffer = FFT.getVector();
-
-        std::copy(signalProbeBuffer.begin(), signalProbeBuffer.begin() + T_u,
-                spectrumBuffer);
-
-        // Do FFT to get the spectrum
-        FFT.do_FFT();
-
         tunedFrequency_MHz = CurrentFrequency / 1e6;
 
         // Process samples one by one
         for (int i = 0; i < T_u; i++) {
-            int half_Tu = T_u / 2;
-
-            // Shift FFT samples
-            if (i < half_Tu)
-                y = abs(spectrumBuffer[i + half_Tu]);
-            else
-                y = abs(spectrumBuffer[i - half_Tu]);
+            y = spectrum->bins[i];
 
             // Apply a cumulative moving average filter
             int avg = 4; // Number of y values to average
@@ -435,26 +422,14 @@ void CGUIHelper::updateNullSymbol()
     if (nullSymbolBuffer.size() == (size_t)T_null) {
         nullSymbolSeriesData.resize(T_u);
 
-        fft::Forward FFT(T_u);
-        DSPCOMPLEX* spectrumBuffer = FFT.getVector();
-
-        std::copy(nullSymbolBuffer.begin(), nullSymbolBuffer.begin() + T_u,
-                spectrumBuffer);
-
-        // Do FFT to get the spectrum
-        FFT.do_FFT();
+        nullSymbolSpectrumService.feed(nullSymbolBuffer.data(), T_u);
+        const auto spectrum = nullSymbolSpectrumService.getSpectrum();
 
         tunedFrequency_MHz = CurrentFrequency / 1e6;
 
         // Process samples one by one
         for (int i = 0; i < T_u; i++) {
-            int half_Tu = T_u / 2;
-
-            // Shift FFT samples
-            if (i < half_Tu)
-                y = abs(spectrumBuffer[i + half_Tu]);
-            else
-                y = abs(spectrumBuffer[i - half_Tu]);
+            y = spectrum->bins[i];
 
             // Apply a cumulative moving average filter
             int avg = 4; // Number of y values to average
@@ -51,6 +51,7 @@
 #include "mot_image_provider.h"
 #include "dab-constants.h"
 #include "radio_controller.h"
+#include "spectrum-service.h"
 
 #ifdef __ANDROID__
     class FileActivityResultReceiver;
@@ -181,12 +182,14 @@ private:
 
     QXYSeries* spectrumSeries;
     QVector<QPointF> spectrumSeriesData;
+    SpectrumService spectrumService;
 
     QXYSeries* impulseResponseSeries;
     QVector<QPointF> impulseResponseSeriesData;
 
     QXYSeries* nullSymbolSeries;
     QVector<QPointF> nullSymbolSeriesData;
+    SpectrumService nullSymbolSpectrumService;
 
     QXYSeries* constellationSeries;
     QVector<QPointF> constellationSeriesData;
@@ -539,15 +539,13 @@ std::vector<float> CRadioController::getImpulseResponse()
     return buf;
 }
 
-std::vector<DSPCOMPLEX> CRadioController::getSignalProbe()
+std::vector<DSPCOMPLEX> CRadioController::getSignalProbe(size_t num_samples)
 {
-    int16_t T_u = getParams().T_u;
-
     if (device) {
-        return device->getSpectrumSamples(T_u);
+        return device->getSpectrumSamples(num_samples);
     }
     else {
-        std::vector<DSPCOMPLEX> dummyBuf(static_cast<std::vector<DSPCOMPLEX>::size_type>(T_u));
+        std::vector<DSPCOMPLEX> dummyBuf(num_samples);
         return dummyBuf;
     }
 }
@@ -996,9 +994,10 @@ void CRadioController::onSignalPresence(bool isSignal)
         emit switchToNextChannel(isSignal);
 }
 
-void CRadioController::onNewAudio(std::vector<int16_t>&& audioData, int sampleRate, const std::string& mode)
+void CRadioController::onNewAudio(const audio_frame_ptr& frame, const std::string& mode)
 {
-    audioBuffer.putDataIntoBuffer(audioData.data(), static_cast<int32_t>(audioData.size()));
+    const int sampleRate = frame->sample_rate;
+    audioBuffer.putDataIntoBuffer(frame->samples.data(), static_cast<int32_t>(frame->samples.size()));
 
     if (audioSampleRate != sampleRate) {
         qDebug() << "RadioController: Audio sample rate" <<  sampleRate << "Hz, mode=" <<
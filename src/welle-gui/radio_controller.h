@@ -126,13 +126,13 @@ public:
 
     // Buffer getter
     std::vector<float> getImpulseResponse(void);
-    std::vector<DSPCOMPLEX> getSignalProbe(void);
+    std::vector<DSPCOMPLEX> getSignalProbe(size_t num_samples);
     std::vector<DSPCOMPLEX> getNullSymbol(void);
     std::vector<DSPCOMPLEX> getConstellationPoint(void);
 
     //called from the backend
     virtual void onFrameErrors(int frameErrors) override;
-    virtual void onNewAudio(std::vector<int16_t>&& audioData, int sampleRate, const std::string& mode) override;
+    virtual void onNewAudio(const audio_frame_ptr& frame, const std::string& mode) override;
     virtual void onRsErrors(bool uncorrectedErrors, int numCorrectedErrors) override;
     virtual void onAacErrors(int aacErrors) override;
     virtual void onNewDynamicLabel(const std::string& label) override;
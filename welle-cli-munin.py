@@ -54,6 +54,15 @@ graph_category welleio
 graph_info This graph shows the receiver SNR
 snr.label SNR
 
+multigraph spectrum
+graph_title Spectrum level
+graph_args --base 1000
+graph_vlabel Mean power in dB
+graph_category welleio
+graph_info This graph shows the mean power of the averaged signal and NULL symbol spectra
+level.label Signal
+nulllevel.label NULL symbol
+
 multigraph fic
 graph_title FIC CRC error counter
 graph_args --base 1000
@@ -150,6 +159,13 @@ try:
 except:
     print("snr.value U")
 
+print("multigraph spectrum")
+for field in ("level", "nulllevel"):
+    try:
+        print("{}.value {}".format(field, muxdata["demodulator"]["spectrum"][field]))
+    except:
+        print("{}.value U".format(field))
+
 try:
     print("multigraph fic")
     print("crcerr.value {}".format(muxdata["ensemble"]["fic"]["numcrcerrors"]))